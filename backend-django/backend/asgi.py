@@ -11,11 +11,17 @@ import os
 
 from channels.routing import ProtocolTypeRouter, URLRouter # type: ignore
 from django.core.asgi import get_asgi_application
-import backend.routing
 
 os.environ.setdefault('DJANGO_SETTINGS_MODULE', 'backend.settings')
 
+django_asgi_app = get_asgi_application()
+
+# These import models, so only once the app registry is ready
+import backend.routing  # noqa: E402
+from photo.media import MediaApp  # noqa: E402
+from photo.uploads import UploadApp  # noqa: E402
+
 application = ProtocolTypeRouter({
-    'http': get_asgi_application(),
+    'http': UploadApp(MediaApp(django_asgi_app)),
     'websocket': URLRouter(backend.routing.websocket_urlpatterns),
 })
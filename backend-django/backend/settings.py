@@ -58,11 +58,25 @@ WSGI_APPLICATION = 'backend.wsgi.application'
 
 ASGI_APPLICATION = 'backend.asgi.application'
 
-CHANNEL_LAYERS = {
-    'default': {
-        'BACKEND': 'channels.layers.InMemoryChannelLayer',
-    },
-}
+# The in-memory layer only reaches sockets of the same process. With
+# REDIS_URL set, groups fan out through Redis to every worker and host.
+if os.environ.get('REDIS_URL'):
+    CHANNEL_LAYERS = {
+        'default': {
+            'BACKEND': 'photo.layers.RedisFanoutChannelLayer',
+            'CONFIG': {
+                'url': os.environ['REDIS_URL'],
+                'capacity': 100,
+                'batch_window': 0.002,
+            },
+        },
+    }
+else:
+    CHANNEL_LAYERS = {
+        'default': {
+            'BACKEND': 'channels.layers.InMemoryChannelLayer',
+        },
+    }
 
 DATABASES = {
     'default': {
@@ -98,4 +112,29 @@ STATICFILES_STORAGE = 'whitenoise.storage.CompressedManifestStaticFilesStorage'
 MEDIA_URL = '/media/'
 MEDIA_ROOT = BASE_DIR / 'media'
 
+# Hand media to a front-end proxy instead of sending it from Python: None,
+# 'x-accel-redirect' (nginx, with MEDIA_SENDFILE_PREFIX an internal location
+# aliased to MEDIA_ROOT) or 'x-sendfile' (Apache mod_xsendfile, lighttpd)
+MEDIA_SENDFILE = os.environ.get('MEDIA_SENDFILE') or None
+MEDIA_SENDFILE_PREFIX = '/protected-media/'
+
+# Photos kept for devices that were offline, and how many one sync page holds
+PHOTO_HISTORY_LIMIT = 2000
+PHOTO_SYNC_PAGE_SIZE = 200
+# Albums one WebSocket may follow at once
+PHOTO_MAX_ALBUMS_PER_SOCKET = 1000
+# photo-batch.v1 sockets get the updates of this window in one frame, and
+# at most this many per frame
+PHOTO_BATCH_WINDOW_MS = 10
+PHOTO_BATCH_MAX_UPDATES = 64
+# Where variants and history pruning run once an upload has been answered:
+# 'local' on PHOTO_TASK_WORKERS threads of the web process, or 'redis' on
+# `manage.py photo_worker` processes fed through PHOTO_TASK_REDIS_URL
+PHOTO_TASK_QUEUE = os.environ.get('PHOTO_TASK_QUEUE', 'local')
+PHOTO_TASK_WORKERS = 2
+PHOTO_TASK_REDIS_URL = os.environ.get('REDIS_URL', 'redis://localhost:6379/0')
+# Largest body /api/photo/stream/ takes, and the size of its writes
+PHOTO_STREAM_MAX_BYTES = 200 * 1024 * 1024
+PHOTO_STREAM_CHUNK_SIZE = 256 * 1024
+
 DEFAULT_AUTO_FIELD = 'django.db.models.BigAutoField'
\ No newline at end of file
@@ -1,16 +1,111 @@
+import asyncio
 import json
+from urllib.parse import parse_qs
+
 from channels.generic.websocket import AsyncWebsocketConsumer # type: ignore
+from django.conf import settings
+
+from .models import ALBUM_NAME, album_group
+from .wire import PHOTO_BATCH_PROTOCOL, encode_photo_batch
+
 
 class PhotoConsumer(AsyncWebsocketConsumer):
+    """Sends photo_update for every album the socket subscribes to.
+
+    Without an `albums` query parameter a socket follows the default album,
+    as it always has. `?albums=a,b` (possibly empty) picks the albums at
+    connect instead, and {"type": "subscribe" | "unsubscribe", "albums": [...]}
+    changes them later, so one socket can follow many albums. Each change is
+    answered with the full list: {"type": "subscribed", "albums": [...]}.
+
+    A socket that negotiates the photo-batch.v1 subprotocol gets photo
+    updates as binary frames instead (see wire.py). Updates that arrive
+    within PHOTO_BATCH_WINDOW_MS of the first are sent together.
+    """
+
     async def connect(self):
-        await self.channel_layer.group_add('photo_updates', self.channel_name)
-        await self.accept()
+        self.albums = set()
+        self.batch = [] if PHOTO_BATCH_PROTOCOL in self.scope.get('subprotocols', []) else None
+        self.batch_flush = None
+        query = parse_qs(self.scope.get('query_string', b'').decode(), keep_blank_values=True)
+        await self.accept(subprotocol=PHOTO_BATCH_PROTOCOL if self.batch is not None else None)
+        if 'albums' not in query:
+            # Clients that predate albums expect nothing but photo_update
+            await self.channel_layer.group_add(album_group(''), self.channel_name)
+            self.albums.add('')
+            return
+        requested = [a for value in query['albums'] for a in value.split(',') if a]
+        if not await self._subscribe(requested):
+            await self.close(code=4400)
 
     async def disconnect(self, close_code):
-        await self.channel_layer.group_discard('photo_updates', self.channel_name)
+        if self.batch_flush is not None:
+            self.batch_flush.cancel()
+        for album in self.albums:
+            await self.channel_layer.group_discard(album_group(album), self.channel_name)
+
+    async def receive(self, text_data=None, bytes_data=None):
+        try:
+            message = json.loads(text_data or '')
+            kind = message['type']
+            albums = message['albums']
+            if kind not in ('subscribe', 'unsubscribe') or not isinstance(albums, list):
+                raise ValueError
+        except (ValueError, KeyError, TypeError):
+            await self._error('Expected {"type": "subscribe" | "unsubscribe", "albums": [...]}.')
+            return
+        if kind == 'subscribe':
+            await self._subscribe(albums)
+        else:
+            for album in set(albums) & self.albums:
+                self.albums.discard(album)
+                await self.channel_layer.group_discard(album_group(album), self.channel_name)
+            await self._send_subscribed()
+
+    async def _subscribe(self, albums):
+        if not all(isinstance(a, str) and ALBUM_NAME.match(a) for a in albums):
+            await self._error('Album names are up to 64 letters, digits, "-" or "_".')
+            return False
+        added = set(albums) - self.albums
+        if len(self.albums) + len(added) > settings.PHOTO_MAX_ALBUMS_PER_SOCKET:
+            await self._error(f'At most {settings.PHOTO_MAX_ALBUMS_PER_SOCKET} albums per socket.')
+            return False
+        for album in added:
+            await self.channel_layer.group_add(album_group(album), self.channel_name)
+            self.albums.add(album)
+        await self._send_subscribed()
+        return True
+
+    async def _send_subscribed(self):
+        await self.send(text_data=json.dumps({'type': 'subscribed', 'albums': sorted(self.albums)}))
+
+    async def _error(self, detail):
+        await self.send(text_data=json.dumps({'type': 'error', 'detail': detail}))
 
     async def photo_update(self, event):
+        if self.batch is not None:
+            self.batch.append(event)
+            if len(self.batch) >= settings.PHOTO_BATCH_MAX_UPDATES:
+                await self._flush_batch()
+            elif self.batch_flush is None:
+                self.batch_flush = asyncio.get_running_loop().create_task(self._flush_batch_later())
+            return
         await self.send(text_data=json.dumps({
             'type': 'photo_update',
+            'album': event.get('album', ''),
             'image': event['image'],
-        })) 
\ No newline at end of file
+            'trace': event.get('trace'),
+        }))
+
+    async def _flush_batch_later(self):
+        await asyncio.sleep(settings.PHOTO_BATCH_WINDOW_MS / 1000)
+        self.batch_flush = None
+        await self._flush_batch()
+
+    async def _flush_batch(self):
+        if self.batch_flush is not None:
+            self.batch_flush.cancel()
+            self.batch_flush = None
+        events, self.batch = self.batch, []
+        if events:
+            await self.send(bytes_data=encode_photo_batch(events))
@@ -0,0 +1,261 @@
+"""Channel layer that fans group messages out across worker processes
+through Redis pub/sub.
+
+Each process keeps one subscriber connection. While any of its channels
+belong to a group it subscribes to that group's topic, and it always
+subscribes to one topic of its own for messages sent to a single channel.
+A group_send is therefore one PUBLISH however many sockets listen, and
+every process fans it out to its own sockets.
+
+group_send calls for the same group within batch_window share one PUBLISH,
+and the callers wait for it, so a slow Redis holds producers back instead
+of queueing without bound. Every local channel has a bounded queue; when a
+slow consumer lets it fill, its oldest message is dropped so one stalled
+socket never holds up the rest of the group or grows memory.
+"""
+import asyncio
+import logging
+import os
+import re
+import secrets
+import weakref
+
+import msgpack
+import redis.asyncio as aioredis
+from channels.layers import BaseChannelLayer  # type: ignore
+
+logger = logging.getLogger(__name__)
+
+# The names channels itself accepts
+_VALID_NAME = re.compile(r'^[a-zA-Z\d\-_.]+(!([\d\w\-_.]*))?$')
+_MAX_NAME_LENGTH = 100
+
+
+def _require_valid_name(name, kind):
+    if not isinstance(name, str) or len(name) >= _MAX_NAME_LENGTH or not _VALID_NAME.match(name):
+        raise TypeError(f'{kind} name must be a valid unicode string of fewer than '
+                        f'{_MAX_NAME_LENGTH} characters: {name!r}')
+
+
+class _Batch:
+    def __init__(self, loop):
+        self.messages = []
+        self.full = asyncio.Event()
+        self.done = loop.create_future()
+        self.task = None  # Publishes the batch; held so it is not collected
+
+
+class RedisFanoutChannelLayer(BaseChannelLayer):
+    extensions = ['groups', 'flush']
+
+    def __init__(self, url='redis://localhost:6379/0', prefix='photo', capacity=100,
+                 batch_window=0.002, batch_size=64, expiry=60, channel_capacity=None):
+        super().__init__(expiry=expiry, capacity=capacity, channel_capacity=channel_capacity)
+        self.url = url
+        self.prefix = prefix
+        self.batch_window = batch_window
+        self.batch_size = batch_size
+        # Names this process's channels; other processes publish to it
+        self.client_id = f'{os.getpid()}-{secrets.token_hex(4)}'
+        self.dropped = 0
+
+        self._queues = {}  # Local channel name -> asyncio.Queue
+        self._groups = {}  # Group -> local channel names in it
+        self._batches = {}  # (loop, group) -> _Batch being collected
+        # async_to_sync outside ASGI runs each call on a fresh loop, and a
+        # connection cannot outlive its loop
+        self._publishers = weakref.WeakKeyDictionary()
+        self._subscriber = None
+        self._pubsub = None
+        self._reader = None
+        self._subscribe_lock = None
+
+    # Topics
+
+    def _group_topic(self, group):
+        return f'{self.prefix}:group:{group}'
+
+    def _client_topic(self, client_id):
+        return f'{self.prefix}:client:{client_id}'
+
+    def _owner(self, channel):
+        # new_channel names are '<prefix>.<client_id>!<suffix>'
+        if '!' not in channel:
+            return None
+        head = channel.split('!', 1)[0]
+        return head.rsplit('.', 1)[1] if '.' in head else None
+
+    # Connections
+
+    def _publisher(self):
+        loop = asyncio.get_running_loop()
+        client = self._publishers.get(loop)
+        if client is None:
+            client = aioredis.Redis.from_url(self.url)
+            self._publishers[loop] = client
+        return client
+
+    async def _ensure_subscriber(self):
+        if self._pubsub is not None:
+            return
+        if self._subscribe_lock is None:
+            self._subscribe_lock = asyncio.Lock()
+        async with self._subscribe_lock:
+            if self._pubsub is not None:
+                return
+            self._subscriber = aioredis.Redis.from_url(self.url)
+            pubsub = self._subscriber.pubsub(ignore_subscribe_messages=True)
+            await pubsub.subscribe(self._client_topic(self.client_id))
+            self._pubsub = pubsub
+            self._reader = asyncio.ensure_future(self._read())
+
+    async def _read(self):
+        group_prefix = self._group_topic('')
+        while True:
+            try:
+                item = await self._pubsub.get_message(timeout=None)
+            except asyncio.CancelledError:
+                raise
+            except Exception:
+                # redis-py resubscribes when it reconnects
+                logger.exception('Channel layer subscriber failed; retrying')
+                await asyncio.sleep(1)
+                continue
+            if item is None or item['type'] != 'message':
+                continue
+            topic = item['channel'].decode()
+            payload = msgpack.unpackb(item['data'])
+            if topic.startswith(group_prefix):
+                members = self._groups.get(topic[len(group_prefix):], ())
+                for channel in list(members):
+                    for message in payload:
+                        self._deliver(channel, message)
+            else:
+                channel, message = payload
+                self._deliver(channel, message)
+
+    def _queue(self, channel):
+        queue = self._queues.get(channel)
+        if queue is None:
+            queue = self._queues[channel] = asyncio.Queue(self.get_capacity(channel))
+        return queue
+
+    def _deliver(self, channel, message):
+        queue = self._queues.get(channel)
+        if queue is None:
+            return
+        if queue.full():
+            # A slow consumer loses its oldest message, not the others their
+            # newest
+            queue.get_nowait()
+            self.dropped += 1
+        queue.put_nowait(message)
+
+    # Channel layer API
+
+    async def new_channel(self, prefix='specific'):
+        await self._ensure_subscriber()
+        channel = f'{prefix}.{self.client_id}!{secrets.token_hex(6)}'
+        self._queue(channel)
+        return channel
+
+    async def send(self, channel, message):
+        _require_valid_name(channel, 'Channel')
+        owner = self._owner(channel)
+        if owner is None:
+            # Channels without an owner only exist in this process
+            self._queue(channel)
+        if owner is None or owner == self.client_id:
+            self._deliver(channel, message)
+            return
+        await self._publisher().publish(self._client_topic(owner), msgpack.packb([channel, message]))
+
+    async def receive(self, channel):
+        _require_valid_name(channel, 'Channel')
+        queue = self._queue(channel)
+        try:
+            return await queue.get()
+        except asyncio.CancelledError:
+            # Consumers stop receiving when their socket closes
+            self._forget(channel)
+            raise
+
+    def _forget(self, channel):
+        self._queues.pop(channel, None)
+        for group, members in list(self._groups.items()):
+            members.discard(channel)
+            if not members:
+                del self._groups[group]
+                asyncio.ensure_future(self._pubsub.unsubscribe(self._group_topic(group)))
+
+    async def group_add(self, group, channel):
+        _require_valid_name(group, 'Group')
+        _require_valid_name(channel, 'Channel')
+        await self._ensure_subscriber()
+        members = self._groups.get(group)
+        if members is None:
+            members = self._groups[group] = set()
+            await self._pubsub.subscribe(self._group_topic(group))
+        members.add(channel)
+        self._queue(channel)
+
+    async def group_discard(self, group, channel):
+        _require_valid_name(group, 'Group')
+        _require_valid_name(channel, 'Channel')
+        members = self._groups.get(group)
+        if members is None:
+            return
+        members.discard(channel)
+        if not members:
+            del self._groups[group]
+            await self._pubsub.unsubscribe(self._group_topic(group))
+
+    async def group_send(self, group, message):
+        _require_valid_name(group, 'Group')
+        loop = asyncio.get_running_loop()
+        key = (loop, group)
+        batch = self._batches.get(key)
+        if batch is None:
+            # First sender of a batch. The publish runs in a task of its own,
+            # so a sender that is cancelled cannot strand the others.
+            batch = self._batches[key] = _Batch(loop)
+            batch.task = loop.create_task(self._publish_batch(key, group, batch))
+        batch.messages.append(message)
+        if len(batch.messages) >= self.batch_size:
+            batch.full.set()
+        error = await asyncio.shield(batch.done)
+        if error is not None:
+            raise error
+
+    async def _publish_batch(self, key, group, batch):
+        try:
+            try:
+                await asyncio.wait_for(batch.full.wait(), self.batch_window)
+            except asyncio.TimeoutError:
+                pass
+            finally:
+                del self._batches[key]
+            await self._publisher().publish(self._group_topic(group), msgpack.packb(batch.messages))
+        except BaseException as error:
+            # Every sender of the batch hears about it, whatever went wrong
+            batch.done.set_result(error)
+            if not isinstance(error, Exception):
+                raise
+        else:
+            batch.done.set_result(None)
+
+    async def flush(self):
+        if self._reader is not None:
+            self._reader.cancel()
+            self._reader = None
+        if self._pubsub is not None:
+            await self._pubsub.aclose()
+            self._pubsub = None
+        if self._subscriber is not None:
+            await self._subscriber.aclose()
+            self._subscriber = None
+        self._queues.clear()
+        self._groups.clear()
+        publisher = self._publishers.pop(asyncio.get_running_loop(), None)
+        if publisher is not None:
+            await publisher.aclose()
@@ -0,0 +1,14 @@
+from django.conf import settings
+from django.core.management.base import BaseCommand, CommandError
+
+from photo.tasks import run_worker
+
+
+class Command(BaseCommand):
+    help = 'Runs queued photo tasks when PHOTO_TASK_QUEUE is "redis".'
+
+    def handle(self, *args, **options):
+        if settings.PHOTO_TASK_QUEUE != 'redis':
+            raise CommandError('PHOTO_TASK_QUEUE is not "redis"; tasks run inside the web process.')
+        self.stdout.write(f'Running photo tasks from {settings.PHOTO_TASK_REDIS_URL}')
+        run_worker()
@@ -0,0 +1,205 @@
+"""Serving of uploaded photos.
+
+Every response carries Content-Length, a strong ETag, Last-Modified and
+Cache-Control, and honours a single byte Range. Content-hashed names are
+immutable and cached for a year; anything else is revalidated.
+
+The bytes never pass through a Django worker thread:
+
+- with MEDIA_SENDFILE set, a front-end proxy sends the file after an
+  X-Accel-Redirect (nginx) or X-Sendfile (Apache, lighttpd) handoff;
+- under ASGI, MediaApp answers before Django does, through the server's
+  zero-copy send extension when it offers one, and otherwise by reading
+  chunks on the default executor while the event loop writes them out.
+
+serve_media_with_cors applies the same rules under WSGI and runserver.
+"""
+import asyncio
+import mimetypes
+import os
+
+from django.conf import settings
+from django.core.exceptions import SuspiciousFileOperation
+from django.utils._os import safe_join
+from django.utils.http import http_date, parse_http_date_safe
+
+from .models import CONTENT_HASHED_NAME
+
+CHUNK_SIZE = 256 * 1024
+IMMUTABLE = 'public, max-age=31536000, immutable'
+REVALIDATE = 'public, no-cache'
+
+
+class MediaPlan:
+    """How to answer one media request: |length| bytes of |path| from
+    |offset| follow the headers, or no body when |length| is 0."""
+
+    def __init__(self, status, headers=(), path=None, offset=0, length=0):
+        self.status = status
+        self.headers = list(headers)
+        self.path = path
+        self.offset = offset
+        self.length = length
+
+
+def media_name(url_path):
+    """The file under MEDIA_ROOT a request path asks for, or None when it
+    is not a media URL."""
+    for prefix in (settings.MEDIA_URL, '/api' + settings.MEDIA_URL):
+        if url_path.startswith(prefix):
+            return url_path[len(prefix):]
+    return None
+
+
+def _etag_matches(header, etag):
+    if header.strip() == '*':
+        return True
+    # If-None-Match compares weakly
+    return any(tag.strip().removeprefix('W/') == etag for tag in header.split(','))
+
+
+def _parse_range(header, size):
+    """(start, end) inclusive for a single satisfiable byte range, None to
+    send the whole file, or False when the range cannot be satisfied."""
+    unit, _, spec = header.partition('=')
+    if unit.strip().lower() != 'bytes' or ',' in spec:
+        # Multipart ranges are rare enough to answer with the whole file
+        return None
+    first, _, last = spec.strip().partition('-')
+    try:
+        if not first:
+            suffix = int(last)
+            if suffix <= 0:
+                return False
+            return max(0, size - suffix), size - 1
+        start = int(first)
+        end = int(last) if last else size - 1
+    except ValueError:
+        return None
+    if start >= size or end < start:
+        return False
+    return start, min(end, size - 1)
+
+
+def plan_media_response(method, name, headers):
+    """Decides the answer to a GET or HEAD of media file |name|; |headers|
+    are the request headers with lower-case names."""
+    try:
+        path = safe_join(settings.MEDIA_ROOT, name)
+        stat = os.stat(path)
+    except (SuspiciousFileOperation, OSError):
+        return MediaPlan(404)
+    if not os.path.isfile(path):
+        return MediaPlan(404)
+
+    size = stat.st_size
+    etag = f'"{size:x}-{stat.st_mtime_ns:x}"'
+    immutable = CONTENT_HASHED_NAME.match(os.path.basename(name)) is not None
+    validators = [
+        ('ETag', etag),
+        ('Last-Modified', http_date(stat.st_mtime)),
+        ('Cache-Control', IMMUTABLE if immutable else REVALIDATE),
+        ('Access-Control-Allow-Origin', '*'),
+    ]
+
+    if_none_match = headers.get('if-none-match')
+    if if_none_match is not None:
+        not_modified = _etag_matches(if_none_match, etag)
+    else:
+        since = parse_http_date_safe(headers.get('if-modified-since', ''))
+        not_modified = since is not None and int(stat.st_mtime) <= since
+    if not_modified:
+        return MediaPlan(304, validators)
+
+    content_type = mimetypes.guess_type(path)[0] or 'application/octet-stream'
+    sendfile = settings.MEDIA_SENDFILE
+    if sendfile == 'x-accel-redirect':
+        # nginx serves the internal location itself, Range included
+        return MediaPlan(200, validators + [
+            ('Content-Type', content_type),
+            ('X-Accel-Redirect', settings.MEDIA_SENDFILE_PREFIX + name),
+        ])
+    if sendfile == 'x-sendfile':
+        return MediaPlan(200, validators + [
+            ('Content-Type', content_type),
+            ('X-Sendfile', path),
+        ])
+
+    headers_out = validators + [
+        ('Content-Type', content_type),
+        ('Accept-Ranges', 'bytes'),
+    ]
+    start, end = 0, size - 1
+    status = 200
+    range_header = headers.get('range')
+    if_range = headers.get('if-range')
+    # A Range is only honoured while the client's copy is still current
+    if range_header and (if_range is None or if_range.strip() == etag):
+        byte_range = _parse_range(range_header, size)
+        if byte_range is False:
+            return MediaPlan(416, validators + [('Content-Range', f'bytes */{size}')])
+        if byte_range is not None:
+            start, end = byte_range
+            status = 206
+            headers_out.append(('Content-Range', f'bytes {start}-{end}/{size}'))
+    length = end - start + 1 if size else 0
+    headers_out.append(('Content-Length', str(length)))
+    if method == 'HEAD':
+        length = 0
+    return MediaPlan(status, headers_out, path, start, length)
+
+
+class MediaApp:
+    """ASGI wrapper that answers GET and HEAD of media URLs itself and hands
+    everything else to |app|."""
+
+    def __init__(self, app):
+        self.app = app
+
+    async def __call__(self, scope, receive, send):
+        name = None
+        if scope['type'] == 'http' and scope['method'] in ('GET', 'HEAD'):
+            name = media_name(scope['path'])
+        if name is None:
+            return await self.app(scope, receive, send)
+
+        headers = {
+            key.decode('latin-1').lower(): value.decode('latin-1')
+            for key, value in scope['headers']
+        }
+        plan = plan_media_response(scope['method'], name, headers)
+        await send({
+            'type': 'http.response.start',
+            'status': plan.status,
+            'headers': [
+                (key.lower().encode('latin-1'), value.encode('latin-1'))
+                for key, value in plan.headers
+            ],
+        })
+        if not plan.length:
+            await send({'type': 'http.response.body', 'body': b''})
+            return
+
+        with open(plan.path, 'rb') as file:
+            if 'http.response.zerocopysend' in scope.get('extensions', {}):
+                await send({
+                    'type': 'http.response.zerocopysend',
+                    'file': file,
+                    'offset': plan.offset,
+                    'count': plan.length,
+                })
+                return
+            loop = asyncio.get_running_loop()
+            offset = plan.offset
+            remaining = plan.length
+            while remaining:
+                chunk = await loop.run_in_executor(
+                    None, os.pread, file.fileno(), min(CHUNK_SIZE, remaining), offset)
+                if not chunk:
+                    # Truncated under us; the short body tells the client
+                    break
+                offset += len(chunk)
+                remaining -= len(chunk)
+                await send({'type': 'http.response.body', 'body': chunk, 'more_body': bool(remaining)})
+            if remaining:
+                await send({'type': 'http.response.body', 'body': b''})
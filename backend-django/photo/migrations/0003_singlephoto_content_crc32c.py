@@ -0,0 +1,23 @@
+# Generated by Django 5.2.3 on 2025-07-20 10:00
+
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('photo', '0002_singlephoto_original_file_name'),
+    ]
+
+    operations = [
+        migrations.AddField(
+            model_name='singlephoto',
+            name='content_crc32c',
+            field=models.CharField(blank=True, max_length=8),
+        ),
+        migrations.AddField(
+            model_name='singlephoto',
+            name='content_crc32c_blocks',
+            field=models.TextField(blank=True),
+        ),
+    ]
@@ -0,0 +1,24 @@
+# Generated by Django 5.2.3 on 2025-07-24 09:00
+
+import photo.models
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('photo', '0004_photovariant'),
+    ]
+
+    operations = [
+        migrations.AddField(
+            model_name='singlephoto',
+            name='content_sha256',
+            field=models.CharField(blank=True, max_length=64),
+        ),
+        migrations.AlterField(
+            model_name='singlephoto',
+            name='image',
+            field=models.ImageField(upload_to=photo.models.content_hashed_path),
+        ),
+    ]
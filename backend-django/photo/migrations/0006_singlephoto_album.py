@@ -0,0 +1,22 @@
+# Generated by Django 5.2.3 on 2025-07-24 09:00
+
+from django.db import migrations, models
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('photo', '0005_singlephoto_content_sha256'),
+    ]
+
+    operations = [
+        migrations.AddField(
+            model_name='singlephoto',
+            name='album',
+            field=models.CharField(blank=True, default='', max_length=64),
+        ),
+        migrations.AddIndex(
+            model_name='singlephoto',
+            index=models.Index(fields=['album', 'id'], name='photo_album_id'),
+        ),
+    ]
@@ -0,0 +1,36 @@
+# Generated by Django 5.2.3 on 2025-07-24 09:00
+
+from django.db import migrations, models
+
+
+def seed_pruned_history(apps, schema_editor):
+    # History used to be pruned across all albums, so every album may have
+    # lost the photos before the oldest one kept
+    SinglePhoto = apps.get_model('photo', 'SinglePhoto')
+    PrunedHistory = apps.get_model('photo', 'PrunedHistory')
+    oldest = SinglePhoto.objects.order_by('id').values_list('id', flat=True).first()
+    if oldest is None or oldest <= 1:
+        return
+    albums = SinglePhoto.objects.values_list('album', flat=True).distinct()
+    PrunedHistory.objects.bulk_create(
+        PrunedHistory(album=album, through_id=oldest - 1) for album in albums
+    )
+
+
+class Migration(migrations.Migration):
+
+    dependencies = [
+        ('photo', '0006_singlephoto_album'),
+    ]
+
+    operations = [
+        migrations.CreateModel(
+            name='PrunedHistory',
+            fields=[
+                ('id', models.BigAutoField(auto_created=True, primary_key=True, serialize=False, verbose_name='ID')),
+                ('album', models.CharField(blank=True, max_length=64, unique=True)),
+                ('through_id', models.BigIntegerField(default=0)),
+            ],
+        ),
+        migrations.RunPython(seed_pruned_history, migrations.RunPython.noop),
+    ]
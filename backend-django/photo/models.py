@@ -1,17 +1,188 @@
-from django.db import models
+from django.conf import settings
+from django.core.files.base import ContentFile
+from django.db import models, transaction
+from PIL import Image
+import crc32c
+import hashlib
+import io
+import os
+import re
 
 # Create your models here.
 
+# Clients re-fetch only the blocks whose checksum does not match.
+CRC32C_BLOCK_SIZE = 1024 * 1024
+
+# (longest side, JPEG quality) of the copies made at upload. Clients on a
+# slow link show one of these first and upgrade to the original later.
+VARIANT_SPECS = ((480, 60), (1600, 80))
+
+
+# Stored media named after its content never changes, so it can be cached
+# for good. Variants add their size and quality to the original's name.
+CONTENT_HASH_LENGTH = 32
+CONTENT_HASHED_NAME = re.compile(r'^[0-9a-f]{%d}(_\d+q\d+)?\.[a-z0-9]+$' % CONTENT_HASH_LENGTH)
+
+
+# Albums let one server feed several stations; '' is the default album that
+# clients without album support follow.
+ALBUM_NAME = re.compile(r'^[A-Za-z0-9_-]{0,64}$')
+
+
+def album_group(album):
+    """The channel layer group of an album's sockets."""
+    return f'photo_updates.{album}' if album else 'photo_updates'
+
+
+def content_hashed_path(instance, filename):
+    """upload_to that names the original after its SHA-256, keeping the
+    extension."""
+    extension = os.path.splitext(filename)[1].lower()
+    return f'photos/{instance.content_sha256[:CONTENT_HASH_LENGTH]}{extension}'
+
+
+class ContentDigester:
+    """SHA-256, CRC32C and per-block CRC32C of a byte stream fed to it a
+    chunk at a time, so an upload can be digested as it arrives."""
+
+    def __init__(self):
+        self.sha256 = hashlib.sha256()
+        self.total = 0
+        self.blocks = []
+        self._block = 0
+        self._block_fill = 0
+
+    def update(self, chunk):
+        self.sha256.update(chunk)
+        view = memoryview(chunk)
+        while view:
+            take = min(len(view), CRC32C_BLOCK_SIZE - self._block_fill)
+            piece = view[:take]
+            self.total = crc32c.crc32c(piece, self.total)
+            self._block = crc32c.crc32c(piece, self._block)
+            self._block_fill += take
+            view = view[take:]
+            if self._block_fill == CRC32C_BLOCK_SIZE:
+                self.blocks.append(self._block)
+                self._block = 0
+                self._block_fill = 0
+
+    def apply(self, photo):
+        """Stores the digests on |photo|; call once the stream has ended."""
+        blocks = self.blocks + ([self._block] if self._block_fill else [])
+        photo.content_sha256 = self.sha256.hexdigest()
+        photo.content_crc32c = f'{self.total:08x}'
+        photo.content_crc32c_blocks = ','.join(f'{b:08x}' for b in blocks)
+
+
 class SinglePhoto(models.Model):
-    image = models.ImageField(upload_to='photos/')
+    image = models.ImageField(upload_to=content_hashed_path)
     original_file_name = models.CharField(max_length=255, blank=True)
+    album = models.CharField(max_length=64, blank=True, default='')
     uploaded_at = models.DateTimeField(auto_now_add=True)
+    # Hex CRC32C of the stored bytes, and of each block (comma separated).
+    content_crc32c = models.CharField(max_length=8, blank=True)
+    content_crc32c_blocks = models.TextField(blank=True)
+    content_sha256 = models.CharField(max_length=64, blank=True)
+
+    class Meta:
+        # Per-album sync walks one album by id
+        indexes = [models.Index(fields=['album', 'id'], name='photo_album_id')]
 
     def save(self, *args, **kwargs):
-        # Delete previous image if exists
-        if SinglePhoto.objects.exists() and not self.pk:
-            SinglePhoto.objects.all().delete()
+        creating = self.pk is None
+        # Digest the upload once, before it is written to storage. Streamed
+        # uploads arrive digested already.
+        if self.image and not self.content_crc32c:
+            digester = ContentDigester()
+            for chunk in self.image.chunks():
+                digester.update(chunk)
+            digester.apply(self)
         super().save(*args, **kwargs)
+        if creating:
+            # Variants and pruning run after the upload has been answered
+            from .tasks import enqueue, process_new_photo
+            transaction.on_commit(lambda: enqueue(process_new_photo, self.pk))
 
     def __str__(self):
         return f"Photo uploaded at {self.uploaded_at}"
+
+
+class PhotoVariant(models.Model):
+    photo = models.ForeignKey(SinglePhoto, related_name='variants', on_delete=models.CASCADE)
+    image = models.ImageField(upload_to='photos/')
+    width = models.PositiveIntegerField()
+    height = models.PositiveIntegerField()
+    quality = models.PositiveSmallIntegerField()
+    file_size = models.PositiveIntegerField()
+
+    def __str__(self):
+        return f"{self.width}x{self.height} q{self.quality} of {self.photo_id}"
+
+
+class PrunedHistory(models.Model):
+    """The newest photo prune_history has dropped from an album. A sync
+    cursor before it has missed photos that are gone."""
+    album = models.CharField(max_length=64, blank=True, unique=True)
+    through_id = models.BigIntegerField(default=0)
+
+    def __str__(self):
+        return f"Album {self.album!r} pruned through {self.through_id}"
+
+
+def prune_history(album):
+    """Drops the oldest photos of |album| beyond PHOTO_HISTORY_LIMIT, so a
+    busy album cannot push a quiet one's history out. Ids only grow, so the
+    id of a photo doubles as the sync cursor of everything before it."""
+    limit = settings.PHOTO_HISTORY_LIMIT
+    photos = SinglePhoto.objects.filter(album=album)
+    cutoff = photos.order_by('-id').values_list('id', flat=True)[limit:limit + 1]
+    if not cutoff:
+        return
+    # Recorded first: a sync must not miss a gap because pruning was cut short
+    record, _ = PrunedHistory.objects.get_or_create(album=album)
+    PrunedHistory.objects.filter(pk=record.pk, through_id__lt=cutoff[0]).update(through_id=cutoff[0])
+    expired = photos.filter(id__lte=cutoff[0]).prefetch_related('variants')
+    for photo in expired:
+        for variant in photo.variants.all():
+            variant.image.delete(save=False)
+        photo.image.delete(save=False)
+    expired.delete()
+
+
+def make_variants(photo):
+    """Stores a downscaled progressive JPEG of the photo for every entry of
+    VARIANT_SPECS smaller than the original. EXIF is copied so orientation
+    still applies."""
+    photo.image.open('rb')
+    try:
+        with Image.open(photo.image) as source:
+            width, height = source.size
+            specs = sorted((s for s in VARIANT_SPECS if s[0] < max(width, height)), reverse=True)
+            if not specs:
+                return
+            exif = source.info.get('exif', b'')
+            # JPEGs decode straight at a reduced scale when a large copy is
+            # not needed
+            source.draft('RGB', (specs[0][0], specs[0][0]))
+            image = source.convert('RGB')
+    except OSError:
+        # Not something Pillow can decode; clients just get the original
+        return
+    finally:
+        photo.image.close()
+
+    stem = os.path.splitext(os.path.basename(photo.image.name))[0]
+    for longest, quality in specs:
+        copy = image.copy()
+        copy.thumbnail((longest, longest), Image.LANCZOS)
+        buffer = io.BytesIO()
+        copy.save(buffer, 'JPEG', quality=quality, progressive=True, optimize=True, exif=exif)
+        PhotoVariant.objects.create(
+            photo=photo,
+            image=ContentFile(buffer.getvalue(), name=f'{stem}_{longest}q{quality}.jpg'),
+            width=copy.width,
+            height=copy.height,
+            quality=quality,
+            file_size=buffer.tell(),
+        )
@@ -1,14 +1,16 @@
 from rest_framework import serializers
-from .models import SinglePhoto
+from .models import SinglePhoto, CRC32C_BLOCK_SIZE
 import os
 
 class SinglePhotoSerializer(serializers.ModelSerializer):
     image = serializers.SerializerMethodField()
     file_size = serializers.SerializerMethodField()
+    content_digest = serializers.SerializerMethodField()
+    variants = serializers.SerializerMethodField()
 
     class Meta:
         model = SinglePhoto
-        fields = ['id', 'image', 'original_file_name', 'file_size', 'uploaded_at']
+        fields = ['id', 'album', 'image', 'original_file_name', 'file_size', 'uploaded_at', 'content_digest', 'variants']
 
     def get_image(self, obj):
         if obj.image and hasattr(obj.image, 'name') and obj.image.name:
@@ -20,6 +22,32 @@ class SinglePhotoSerializer(serializers.ModelSerializer):
             return obj.image.size
         return None
 
+    def get_content_digest(self, obj):
+        # Photos uploaded before digests existed have none
+        if not obj.content_crc32c:
+            return None
+        blocks = obj.content_crc32c_blocks
+        return {
+            'algorithm': 'crc32c',
+            'value': obj.content_crc32c,
+            'block_size': CRC32C_BLOCK_SIZE,
+            'blocks': blocks.split(',') if blocks else [],
+        }
+
+    def get_variants(self, obj):
+        # Smallest first; the original itself is not listed. Sorted here so a
+        # prefetched list is not queried again.
+        return [
+            {
+                'image': os.path.basename(variant.image.name),
+                'width': variant.width,
+                'height': variant.height,
+                'quality': variant.quality,
+                'file_size': variant.file_size,
+            }
+            for variant in sorted(obj.variants.all(), key=lambda v: v.file_size)
+        ]
+
     def create(self, validated_data):
         # Handle image upload properly
         image = self.context['request'].FILES.get('image')
@@ -0,0 +1,102 @@
+"""Background work on new photos, kept off the upload request.
+
+An upload is answered and broadcast as soon as its file is durable. Work
+that only improves the photo afterwards, such as its variants and pruning
+old history, is queued here instead.
+
+PHOTO_TASK_QUEUE picks where queued tasks run:
+
+- 'local' (the default) is an in-process stand-in: a pool of
+  PHOTO_TASK_WORKERS threads in the web process. Tasks still queued when
+  the process exits are lost. A photo without variants is still served;
+  clients just get the original.
+- 'redis' pushes tasks onto a list at REDIS_URL, and
+  `manage.py photo_worker` processes pop and run them, so the web
+  processes never spend CPU on them.
+"""
+import logging
+import threading
+from concurrent.futures import ThreadPoolExecutor
+
+import msgpack
+from django.conf import settings
+from django.db import close_old_connections
+
+logger = logging.getLogger(__name__)
+
+QUEUE_KEY = 'photo:tasks'
+
+_tasks = {}  # Name -> function, for workers to look tasks up by
+_executor = None
+_redis = None
+_lock = threading.Lock()
+
+
+def task(function):
+    """Registers |function| so enqueue() can run it on another process. Its
+    arguments must be msgpack-able."""
+    _tasks[f'{function.__module__}.{function.__name__}'] = function
+    return function
+
+
+def _run(name, args):
+    close_old_connections()
+    try:
+        _tasks[name](*args)
+    except Exception:
+        logger.exception('Task %s%r failed', name, tuple(args))
+    finally:
+        close_old_connections()
+
+
+def _queue():
+    global _executor, _redis
+    with _lock:
+        if settings.PHOTO_TASK_QUEUE == 'redis':
+            if _redis is None:
+                import redis
+                _redis = redis.Redis.from_url(settings.PHOTO_TASK_REDIS_URL)
+            return _redis
+        if _executor is None:
+            _executor = ThreadPoolExecutor(
+                max_workers=settings.PHOTO_TASK_WORKERS, thread_name_prefix='photo-task')
+        return _executor
+
+
+def enqueue(function, *args):
+    """Runs |function|(*args) later, on whichever queue is configured."""
+    name = f'{function.__module__}.{function.__name__}'
+    if _tasks.get(name) is not function:
+        raise ValueError(f'{name} is not a task')
+    queue = _queue()
+    if isinstance(queue, ThreadPoolExecutor):
+        queue.submit(_run, name, args)
+    else:
+        queue.lpush(QUEUE_KEY, msgpack.packb([name, list(args)]))
+
+
+def run_worker(stop=None):
+    """Pops and runs tasks from the Redis queue until |stop| is set."""
+    import redis
+    client = redis.Redis.from_url(settings.PHOTO_TASK_REDIS_URL)
+    while stop is None or not stop.is_set():
+        item = client.brpop(QUEUE_KEY, timeout=1)
+        if item is None:
+            continue
+        name, args = msgpack.unpackb(item[1])
+        if name not in _tasks:
+            logger.error('Unknown task %s', name)
+            continue
+        _run(name, args)
+
+
+@task
+def process_new_photo(photo_id):
+    """Makes the variants of a freshly stored photo and prunes history."""
+    from .models import SinglePhoto, make_variants, prune_history
+    photo = SinglePhoto.objects.filter(id=photo_id).first()
+    if photo is None:
+        return
+    if photo.image and not photo.variants.exists():
+        make_variants(photo)
+    prune_history(photo.album)
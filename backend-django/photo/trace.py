@@ -0,0 +1,18 @@
+"""The server's side of a photo's trace: its id and when the upload was
+received, stored and broadcast, in microseconds since the epoch. Devices
+add their own marks against it."""
+import re
+import time
+import uuid
+
+# An uploader may name the trace itself to follow a photo end to end
+_TRACE_ID = re.compile(r'^[A-Za-z0-9_-]{1,64}$')
+
+
+def now_us():
+    return time.time_ns() // 1000
+
+
+def trace_id(header):
+    """The X-Trace-Id header value if it is a usable id, else a new one."""
+    return header if header and _TRACE_ID.match(header) else uuid.uuid4().hex
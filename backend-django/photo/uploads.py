@@ -0,0 +1,200 @@
+"""Streaming photo uploads: POST /api/photo/stream/?name=photo.jpg&album=a
+with the photo itself as the body, instead of a multipart form.
+
+The body goes to a temporary file under MEDIA_ROOT a chunk at a time and
+is digested on the way, so it is never held in memory or read twice. Once
+it has all arrived, the file is synced, linked under its content-hashed
+name and recorded, and the photo is broadcast and answered straight away.
+Its variants follow from photo.tasks.
+
+Under ASGI, UploadApp does this on the event loop before Django sees the
+request; file writes go to the default executor, so a slow uploader holds
+no thread. PhotoStreamView applies the same rules under WSGI and
+runserver.
+"""
+import asyncio
+import json
+import os
+import tempfile
+from urllib.parse import parse_qsl
+
+from asgiref.sync import sync_to_async
+from channels.layers import get_channel_layer  # type: ignore
+from django.conf import settings
+from django.core.files.storage import default_storage
+from django.core.serializers.json import DjangoJSONEncoder
+
+from .models import ALBUM_NAME, ContentDigester, SinglePhoto, album_group, content_hashed_path
+from .serializers import SinglePhotoSerializer
+from .trace import now_us, trace_id
+
+STREAM_PATH = '/api/photo/stream/'
+
+
+class UploadError(Exception):
+    def __init__(self, status, detail):
+        super().__init__(detail)
+        self.status = status
+        self.detail = detail
+
+
+def upload_params(query, content_length):
+    """(album, original file name) of a streamed upload, from its query
+    parameters and Content-Length header."""
+    album = query.get('album') or ''
+    if not ALBUM_NAME.match(album):
+        raise UploadError(400, 'album is up to 64 letters, digits, "-" or "_".')
+    name = os.path.basename((query.get('name') or '').strip())
+    if not name or len(name) > 255:
+        raise UploadError(400, 'name is the file name, up to 255 characters.')
+    if content_length and content_length.isdigit() and int(content_length) > settings.PHOTO_STREAM_MAX_BYTES:
+        raise UploadError(413, 'The photo is too large.')
+    return album, name
+
+
+def _fsync_directory(path):
+    fd = os.open(path, os.O_RDONLY)
+    try:
+        os.fsync(fd)
+    finally:
+        os.close(fd)
+
+
+class StreamedUpload:
+    """One upload body on its way to storage. write() and commit() block on
+    the disk; save() on the database."""
+
+    def __init__(self, name, album):
+        self.photo = SinglePhoto(original_file_name=name, album=album)
+        self.size = 0
+        self._digester = ContentDigester()
+        self._directory = os.path.join(settings.MEDIA_ROOT, 'photos')
+        os.makedirs(self._directory, exist_ok=True)
+        self._fd, self._temp = tempfile.mkstemp(prefix='.upload-', suffix='.part', dir=self._directory)
+
+    def write(self, chunk):
+        self.size += len(chunk)
+        if self.size > settings.PHOTO_STREAM_MAX_BYTES:
+            raise UploadError(413, 'The photo is too large.')
+        self._digester.update(chunk)
+        view = memoryview(chunk)
+        while view:
+            view = view[os.write(self._fd, view):]
+
+    def commit(self):
+        """Makes the file durable under its content-hashed name."""
+        if not self.size:
+            raise UploadError(400, 'No image in the body.')
+        os.fsync(self._fd)
+        os.close(self._fd)
+        self._fd = None
+        self._digester.apply(self.photo)
+        name = content_hashed_path(self.photo, self.photo.original_file_name)
+        # Another upload may take the name between the check and the link
+        while True:
+            name = default_storage.get_available_name(name)
+            try:
+                os.link(self._temp, default_storage.path(name))
+                break
+            except FileExistsError:
+                continue
+        os.unlink(self._temp)
+        self._temp = None
+        _fsync_directory(self._directory)
+        self.photo.image.name = name
+
+    def save(self):
+        """Records the committed photo and returns its serialized form."""
+        self.photo.save()
+        return SinglePhotoSerializer(self.photo).data
+
+    def discard(self):
+        """Removes whatever commit() has not claimed; safe to call always."""
+        if self._fd is not None:
+            os.close(self._fd)
+            self._fd = None
+        if self._temp is not None:
+            try:
+                os.unlink(self._temp)
+            except FileNotFoundError:
+                pass
+            self._temp = None
+
+
+def photo_update(data, album, trace):
+    """The channel layer event that tells an album's sockets of a photo."""
+    return {'type': 'photo_update', 'album': album, 'image': data, 'trace': trace}
+
+
+async def _send_json(send, status, payload, extra_headers=()):
+    body = json.dumps(payload, cls=DjangoJSONEncoder, separators=(',', ':')).encode()
+    await send({
+        'type': 'http.response.start',
+        'status': status,
+        'headers': [
+            (b'content-type', b'application/json'),
+            (b'content-length', str(len(body)).encode()),
+            *extra_headers,
+        ],
+    })
+    await send({'type': 'http.response.body', 'body': body})
+
+
+class UploadApp:
+    """ASGI wrapper that answers POSTs to STREAM_PATH itself and hands
+    everything else to |app|."""
+
+    def __init__(self, app):
+        self.app = app
+
+    async def __call__(self, scope, receive, send):
+        if scope['type'] != 'http' or scope['method'] != 'POST' or scope['path'] != STREAM_PATH:
+            return await self.app(scope, receive, send)
+
+        headers = {
+            key.decode('latin-1').lower(): value.decode('latin-1')
+            for key, value in scope['headers']
+        }
+        loop = asyncio.get_running_loop()
+        upload = None
+        try:
+            query = dict(parse_qsl(scope['query_string'].decode('latin-1')))
+            album, name = upload_params(query, headers.get('content-length'))
+            upload = await loop.run_in_executor(None, StreamedUpload, name, album)
+            # Messages are as small as the server's reads; write in larger
+            # chunks so each executor hop is worth it
+            pending = []
+            pending_size = 0
+            more = True
+            while more:
+                message = await receive()
+                if message['type'] == 'http.disconnect':
+                    return
+                body = message.get('body', b'')
+                more = message.get('more_body', False)
+                if body:
+                    pending.append(body)
+                    pending_size += len(body)
+                if pending and (pending_size >= settings.PHOTO_STREAM_CHUNK_SIZE or not more):
+                    await loop.run_in_executor(None, upload.write, b''.join(pending))
+                    pending.clear()
+                    pending_size = 0
+            received_us = now_us()
+            await loop.run_in_executor(None, upload.commit)
+            data = await sync_to_async(upload.save)()
+        except UploadError as error:
+            await _send_json(send, error.status, {'detail': error.detail})
+            return
+        finally:
+            if upload is not None:
+                await loop.run_in_executor(None, upload.discard)
+
+        trace = {
+            'id': trace_id(headers.get('x-trace-id')),
+            'received_us': received_us,
+            'stored_us': now_us(),
+            'broadcast_us': now_us(),
+        }
+        await get_channel_layer().group_send(album_group(album), photo_update(data, album, trace))
+        await _send_json(send, 201, {**data, 'trace': trace},
+                         [(b'x-trace-id', trace['id'].encode('latin-1'))])
@@ -1,7 +1,10 @@
 from django.urls import path
-from .views import SinglePhotoView, serve_media_with_cors
+from .views import SinglePhotoView, PhotoStreamView, PhotoSyncView, ServerTimeView, serve_media_with_cors
 
 urlpatterns = [
     path('photo/', SinglePhotoView.as_view(), name='single-photo'),
+    path('photo/stream/', PhotoStreamView.as_view(), name='photo-stream'),
+    path('photo/sync/', PhotoSyncView.as_view(), name='photo-sync'),
+    path('time/', ServerTimeView.as_view(), name='server-time'),
     path('media/<path:path>', serve_media_with_cors),
 ] 
\ No newline at end of file
@@ -3,60 +3,228 @@ from rest_framework.views import APIView
 from rest_framework.response import Response
 from rest_framework.parsers import MultiPartParser, FormParser
 from rest_framework import status
-from .models import SinglePhoto
+from .models import ALBUM_NAME, PrunedHistory, SinglePhoto, album_group
 from .serializers import SinglePhotoSerializer
+from .media import plan_media_response
+from .trace import now_us, trace_id
+from .uploads import StreamedUpload, UploadError, photo_update, upload_params
 
-from django.http import FileResponse, Http404
+from django.http import FileResponse, Http404, HttpResponse, StreamingHttpResponse
 from django.conf import settings
+from django.db.models import Count
+from django.utils.decorators import method_decorator
+from django.views.decorators.gzip import gzip_page
+from django.views.decorators.http import condition
 import os
 from channels.layers import get_channel_layer # type: ignore
 from asgiref.sync import async_to_sync
 
+# Bump when the serialized photo changes shape, so cached copies go stale
+PHOTO_REPRESENTATION_VERSION = 2
+
+def _requested_album(request):
+    """The `album` query parameter, '' (the default album) when absent, or
+    None when it is not a valid album name."""
+    album = request.GET.get('album', '')
+    return album if ALBUM_NAME.match(album) else None
+
+
+def _latest_photo_validators(request):
+    # Both validator functions run for one request; look the photo up once
+    if not hasattr(request, '_latest_photo_validators'):
+        album = _requested_album(request)
+        request._latest_photo_validators = None if album is None else (
+            SinglePhoto.objects.filter(album=album)
+            .order_by('-id')
+            .annotate(variant_count=Count('variants'))
+            .values('id', 'uploaded_at', 'content_crc32c', 'variant_count')
+            .first()
+        )
+    return request._latest_photo_validators
+
+
+def latest_photo_etag(request, *args, **kwargs):
+    # A photo never changes once its variants exist, so these identify the
+    # response byte for byte without serializing it
+    latest = _latest_photo_validators(request)
+    if latest is None:
+        return None
+    return '-'.join([
+        str(latest['id']),
+        latest['content_crc32c'] or '0',
+        str(latest['variant_count']),
+        f'v{PHOTO_REPRESENTATION_VERSION}',
+    ])
+
+
+def latest_photo_last_modified(request, *args, **kwargs):
+    latest = _latest_photo_validators(request)
+    return latest['uploaded_at'] if latest else None
+
+
 class SinglePhotoView(APIView):
     parser_classes = (MultiPartParser, FormParser)
 
+    # The latest photo of `album`, the default album when absent. Answers
+    # 304 from one indexed lookup when the client already has it
+    @method_decorator(condition(etag_func=latest_photo_etag, last_modified_func=latest_photo_last_modified))
     def get(self, request, format=None):
-        photo = SinglePhoto.objects.first()
+        album = _requested_album(request)
+        if album is None:
+            return Response({'detail': 'album is up to 64 letters, digits, "-" or "_".'},
+                            status=status.HTTP_400_BAD_REQUEST)
+        photo = SinglePhoto.objects.filter(album=album).order_by('-id').first()
         if not photo:
             return Response({'detail': 'No photo found.'}, status=status.HTTP_404_NOT_FOUND)
         serializer = SinglePhotoSerializer(photo, context={'request': request})
         return Response(serializer.data)
 
     def post(self, request, format=None):
+        # The body has been read by the time the view runs
+        received_us = now_us()
         if 'image' not in request.FILES or not request.FILES['image']:
             return Response({'detail': 'No image file provided.'}, status=status.HTTP_400_BAD_REQUEST)
-        
-        # Delete existing photos
-        SinglePhoto.objects.all().delete()
-        
-        # Create new photo with image
+
+        album = request.data.get('album', '')
+        if not ALBUM_NAME.match(album):
+            return Response({'detail': 'album is up to 64 letters, digits, "-" or "_".'},
+                            status=status.HTTP_400_BAD_REQUEST)
+
+        # Create new photo with image. Its variants are made in the
+        # background; the photo is broadcast without them.
         image_file = request.FILES['image']
         photo = SinglePhoto.objects.create(
             image=image_file,
-            original_file_name=image_file.name
+            original_file_name=image_file.name,
+            album=album,
         )
-        
-        # Serialize and return response
-        serializer = SinglePhotoSerializer(photo, context={'request': request})
-        
-        # Notify WebSocket clients
-        channel_layer = get_channel_layer()
-        async_to_sync(channel_layer.group_send)(
-            'photo_updates',
-            {
-                'type': 'photo_update',
-                'image': serializer.data,
-            }
+        return _publish(request, photo, album, received_us)
+
+
+class PhotoStreamView(APIView):
+    """Takes the photo as the raw request body, written to storage as it
+    is read; see photo.uploads. Under ASGI, UploadApp answers these before
+    Django does."""
+
+    def post(self, request, format=None):
+        upload = None
+        try:
+            album, name = upload_params(request.query_params, request.headers.get('Content-Length'))
+            upload = StreamedUpload(name, album)
+            stream = request.stream
+            while stream is not None:
+                chunk = stream.read(settings.PHOTO_STREAM_CHUNK_SIZE)
+                if not chunk:
+                    break
+                upload.write(chunk)
+            received_us = now_us()
+            upload.commit()
+            upload.save()
+        except UploadError as error:
+            return Response({'detail': error.detail}, status=error.status)
+        finally:
+            if upload is not None:
+                upload.discard()
+        return _publish(request, upload.photo, album, received_us)
+
+
+def _publish(request, photo, album, received_us):
+    """Broadcasts a newly stored photo and answers its upload."""
+    stored_us = now_us()
+    serializer = SinglePhotoSerializer(photo, context={'request': request})
+    data = serializer.data
+
+    # Server side of the photo's timeline, in microseconds since the
+    # epoch; devices add their own marks against it
+    trace = {
+        'id': trace_id(request.headers.get('X-Trace-Id')),
+        'received_us': received_us,
+        'stored_us': stored_us,
+        'broadcast_us': now_us(),
+    }
+
+    # Notify WebSocket clients
+    channel_layer = get_channel_layer()
+    async_to_sync(channel_layer.group_send)(album_group(album), photo_update(data, album, trace))
+
+    response = Response({**data, 'trace': trace}, status=status.HTTP_201_CREATED)
+    response['X-Trace-Id'] = trace['id']
+    return response
+
+
+@method_decorator(gzip_page, name='dispatch')
+class PhotoSyncView(APIView):
+    """Every photo of `album` (the default album when absent) uploaded after
+    the `since` cursor, oldest first, one page at a time, so a device that
+    was offline catches up without polling."""
+
+    def get(self, request, format=None):
+        try:
+            since = int(request.query_params.get('since', 0))
+            limit = int(request.query_params.get('limit', settings.PHOTO_SYNC_PAGE_SIZE))
+        except ValueError:
+            return Response({'detail': 'since and limit must be integers.'}, status=status.HTTP_400_BAD_REQUEST)
+        limit = max(1, min(limit, settings.PHOTO_SYNC_PAGE_SIZE))
+        album = request.query_params.get('album', '')
+        if not ALBUM_NAME.match(album):
+            return Response({'detail': 'album is up to 64 letters, digits, "-" or "_".'},
+                            status=status.HTTP_400_BAD_REQUEST)
+
+        # One extra row tells whether another page follows
+        photos = list(
+            SinglePhoto.objects.filter(album=album, id__gt=since)
+            .order_by('id')
+            .prefetch_related('variants')[:limit + 1]
         )
-        
-        return Response(serializer.data, status=status.HTTP_201_CREATED)
+        has_more = len(photos) > limit
+        photos = photos[:limit]
+        # Photos of the album at or before this id were pruned
+        pruned_through = (
+            PrunedHistory.objects.filter(album=album).values_list('through_id', flat=True).first() or 0
+        )
+        serializer = SinglePhotoSerializer(photos, many=True, context={'request': request})
+        return Response({
+            'photos': serializer.data,
+            'cursor': photos[-1].id if photos else since,
+            'has_more': has_more,
+            'history_truncated': 0 < since < pruned_through,
+        })
 
 
-def serve_media_with_cors(request, path):
-    file_path = os.path.join(settings.MEDIA_ROOT, path)
-    if os.path.exists(file_path):
-        response = FileResponse(open(file_path, 'rb'))
-        response['Access-Control-Allow-Origin'] = '*'
+class ServerTimeView(APIView):
+    """The server's clock, which devices sample to estimate their skew
+    against the timestamps in photo traces."""
+
+    def get(self, request, format=None):
+        response = Response({'server_time_us': now_us()})
+        response['Cache-Control'] = 'no-store'
         return response
+
+
+def _read_range(path, offset, length):
+    with open(path, 'rb') as file:
+        file.seek(offset)
+        while length:
+            chunk = file.read(min(64 * 1024, length))
+            if not chunk:
+                return
+            length -= len(chunk)
+            yield chunk
+
+
+def serve_media_with_cors(request, path):
+    # Under ASGI, photo.media.MediaApp answers these before Django does
+    headers = {name.lower(): value for name, value in request.headers.items()}
+    plan = plan_media_response(request.method, path, headers)
+    if plan.status == 404:
+        raise Http404("File not found")
+    if not plan.length:
+        response = HttpResponse(status=plan.status)
+    elif plan.status == 200:
+        # Lets a WSGI server with wsgi.file_wrapper use sendfile
+        response = FileResponse(open(plan.path, 'rb'))
     else:
-        raise Http404("File not found")
\ No newline at end of file
+        response = StreamingHttpResponse(_read_range(plan.path, plan.offset, plan.length), status=plan.status)
+    for name, value in plan.headers:
+        response[name] = value
+    return response
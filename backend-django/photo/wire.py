@@ -0,0 +1,103 @@
+"""The photo-batch.v1 WebSocket subprotocol: photo_update messages packed
+several to a binary frame, in a fixed schema instead of JSON.
+
+A client asks for it with `Sec-WebSocket-Protocol: photo-batch.v1`. Control
+messages (subscribed, error, subscribe, unsubscribe) stay JSON text frames
+either way; only photo updates change.
+
+Everything is little-endian. str8 and str16 are UTF-8 behind a u8 or u16
+byte length.
+
+    frame    u8 version (1), u8 flags (0), u16 count, then count updates
+    update   i64 id, i64 file_size (-1 when unknown),
+             i64 uploaded_at (microseconds since the epoch, -1 when unknown),
+             str8 album, str8 image, str16 original_file_name,
+             u8 has_digest; when 1: u32 crc32c, u32 block_size,
+                 u16 block_count, block_count u32 block crc32cs,
+             u8 variant_count; each: str8 image, u16 width, u16 height,
+                 u8 quality, u32 file_size,
+             str8 trace_id; unless empty: i64 received_us, i64 stored_us,
+                 i64 broadcast_us
+
+The runner's photo_batch.h decodes the same layout.
+"""
+import struct
+
+from django.utils.dateparse import parse_datetime
+
+PHOTO_BATCH_PROTOCOL = 'photo-batch.v1'
+PHOTO_BATCH_VERSION = 1
+# A u16 count; the consumer flushes long before this
+MAX_UPDATES_PER_FRAME = 0xffff
+
+_HEADER = struct.Struct('<BBH')
+_NUMBERS = struct.Struct('<qqq')
+_DIGEST = struct.Struct('<IIH')
+_VARIANT = struct.Struct('<HHBI')
+_TRACE = struct.Struct('<qqq')
+
+
+def _str8(value):
+    data = (value or '').encode()
+    if len(data) > 0xff:
+        raise ValueError(f'{value!r} is longer than 255 bytes')
+    return bytes((len(data),)) + data
+
+
+def _str16(value):
+    data = (value or '').encode()[:0xffff]
+    return struct.pack('<H', len(data)) + data
+
+
+def _epoch_us(timestamp):
+    moment = parse_datetime(timestamp) if timestamp else None
+    if moment is None:
+        return -1
+    return int(moment.timestamp()) * 1000000 + moment.microsecond
+
+
+def _encode_update(event):
+    photo = event['image']
+    file_size = photo.get('file_size')
+    parts = [
+        _NUMBERS.pack(photo['id'], -1 if file_size is None else file_size,
+                      _epoch_us(photo.get('uploaded_at'))),
+        _str8(event.get('album', '')),
+        _str8(photo['image']),
+        _str16(photo.get('original_file_name')),
+    ]
+
+    digest = photo.get('content_digest')
+    if digest and digest.get('algorithm') == 'crc32c':
+        blocks = digest.get('blocks') or []
+        parts.append(b'\x01')
+        parts.append(_DIGEST.pack(int(digest['value'], 16), digest.get('block_size') or 0,
+                                  len(blocks)))
+        parts.append(struct.pack(f'<{len(blocks)}I', *(int(b, 16) for b in blocks)))
+    else:
+        parts.append(b'\x00')
+
+    variants = photo.get('variants') or []
+    parts.append(bytes((len(variants),)))
+    for variant in variants:
+        parts.append(_str8(variant['image']))
+        parts.append(_VARIANT.pack(variant['width'], variant['height'], variant['quality'],
+                                   variant['file_size']))
+
+    trace = event.get('trace')
+    if trace:
+        parts.append(_str8(trace['id']))
+        parts.append(_TRACE.pack(trace.get('received_us', 0), trace.get('stored_us', 0),
+                                 trace.get('broadcast_us', 0)))
+    else:
+        parts.append(b'\x00')
+    return b''.join(parts)
+
+
+def encode_photo_batch(events):
+    """One photo-batch.v1 frame carrying the photo_update channel layer
+    events |events|."""
+    if len(events) > MAX_UPDATES_PER_FRAME:
+        raise ValueError(f'At most {MAX_UPDATES_PER_FRAME} updates per frame.')
+    return _HEADER.pack(PHOTO_BATCH_VERSION, 0, len(events)) + b''.join(
+        _encode_update(event) for event in events)
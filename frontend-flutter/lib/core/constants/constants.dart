@@ -1,10 +1,20 @@
 class Constants {
   Constants._();
 
-  static final String baseUrl =
+  static const String defaultBaseUrl =
       "https://autophotosaver-production.up.railway.app";
-  static final String mediaUrl = "$baseUrl/media/photos/";
-  static final String wsUrl =
-      "wss://autophotosaver-production.up.railway.app/ws/photo/";
+  static String _baseUrl = defaultBaseUrl;
+
+  static String get baseUrl => _baseUrl;
+  static String get mediaUrl => "$baseUrl/media/photos/";
+  // http -> ws, https -> wss.
+  static String get wsUrl => "${baseUrl.replaceFirst('http', 'ws')}/ws/photo/";
   static final String serverErrorMessage = "something_went_wrong";
+
+  /// Points the app at another backend, e.g. `http://127.0.0.1:8010` for
+  /// the stand-in server native performance tests run against
+  /// (linux/backend_standin). Call before anything connects.
+  static void useBackend(String url) {
+    _baseUrl = url.endsWith('/') ? url.substring(0, url.length - 1) : url;
+  }
 }
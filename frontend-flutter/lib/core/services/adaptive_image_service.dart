@@ -0,0 +1,101 @@
+import 'dart:io';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+
+/// One downloadable copy of a photo: a downscaled variant from the server,
+/// or the original itself.
+class ImageVariant {
+  final String url;
+  final int width;
+  final int height;
+  final int fileSize;
+
+  const ImageVariant({
+    required this.url,
+    required this.fileSize,
+    this.width = 0,
+    this.height = 0,
+  });
+}
+
+class FetchedVariant {
+  final String path;
+
+  /// Position in the candidate list passed to [AdaptiveImageService.fetch].
+  final int index;
+  final int bytes;
+  final bool cacheHit;
+
+  const FetchedVariant({
+    required this.path,
+    required this.index,
+    required this.bytes,
+    required this.cacheHit,
+  });
+}
+
+/// Chooses which copy of a photo to download for display from a live
+/// estimate of the link, measured natively by the Linux runner.
+class AdaptiveImageService {
+  static const MethodChannel _channel = MethodChannel(
+    'com.rabee.omran.variants',
+  );
+
+  /// How long a photo may take to first appear.
+  static const firstBudget = Duration(milliseconds: 300);
+
+  /// How long an upgrade to a sharper copy may take.
+  static const upgradeBudget = Duration(seconds: 8);
+
+  static bool get isSupported => !kIsWeb && Platform.isLinux;
+
+  /// Downloads the largest of [candidates] (smallest first, original last)
+  /// expected to arrive within [budget], and at least the one at
+  /// [minIndex]. With nothing known about the link yet, that is the
+  /// smallest allowed.
+  static Future<FetchedVariant?> fetch(
+    List<ImageVariant> candidates, {
+    Duration budget = firstBudget,
+    int minIndex = 0,
+  }) async {
+    if (!isSupported || candidates.isEmpty) return null;
+    final result = await _channel.invokeMapMethod<String, dynamic>('fetch', {
+      'candidates': _encode(candidates),
+      'budgetMillis': budget.inMilliseconds,
+      'minIndex': minIndex,
+    });
+    if (result == null) return null;
+    return FetchedVariant(
+      path: result['path'],
+      index: result['index'],
+      bytes: result['bytes'],
+      cacheHit: result['cacheHit'],
+    );
+  }
+
+  /// Current throughput estimate and the signals behind it, with the size
+  /// of the on-disk variant cache.
+  static Future<Map<String, dynamic>?> estimate() async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('estimate');
+  }
+
+  /// Measures time-to-visible-photo at each of [rates] (bytes per second),
+  /// throttled on the client, for the original alone against smallest-first
+  /// with an upgrade.
+  static Future<Map<String, dynamic>?> benchmark(
+    List<ImageVariant> candidates, {
+    List<int> rates = const [64000, 256000, 1000000, 8000000],
+  }) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('benchmark', {
+      'candidates': _encode(candidates),
+      'rates': rates,
+    });
+  }
+
+  static List<Map<String, Object>> _encode(List<ImageVariant> candidates) => [
+    for (final candidate in candidates)
+      {'url': candidate.url, 'size': candidate.fileSize},
+  ];
+}
@@ -20,13 +20,14 @@ void callbackDispatcher() {
         SharedPrefsService.setInstance(prefs);
 
         final dio = Dio();
-        final remoteDataSource = PhotoRemoteDataSourceImpl(dio);
+        final remoteDataSource = PhotoRemoteDataSourceImpl(dio, prefs);
 
         final lastId = prefs.lastPhotoId;
 
+        // Null when the server answered 304: the saved photo is current
         final model = await remoteDataSource.getLatestPhoto();
 
-        if (lastId != model.id) {
+        if (model != null && lastId != model.id) {
           // Schedule native Android worker for background image download
           if (Platform.isAndroid) {
             await Workmanager().registerOneOffTask(
@@ -57,14 +58,14 @@ void callbackDispatcher() {
           }
 
           // Update preferences with new photo info
-          await prefs.setLastDownloadDate(DateTime.now());
-          await prefs.setLastPhotoId(model.id);
-          await prefs.setLastPhotoPath(model.image);
-          await prefs.setLastPhotoFileName(model.originalFileName);
-          await prefs.setLastPhotoUploadedAt(
-            model.uploadedAt.toIso8601String(),
+          await prefs.setLastPhoto(
+            id: model.id,
+            path: model.image,
+            fileName: model.originalFileName,
+            uploadedAt: model.uploadedAt.toIso8601String(),
+            fileSize: model.fileSize,
+            downloadDate: DateTime.now(),
           );
-          await prefs.setLastPhotoFileSize(model.fileSize);
         }
       } catch (e) {
         debugPrint('BackgroundService: Error: $e');
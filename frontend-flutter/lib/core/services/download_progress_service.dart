@@ -0,0 +1,121 @@
+import 'dart:async';
+import 'dart:io';
+import 'dart:ui';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/scheduler.dart';
+import 'package:flutter/services.dart';
+
+/// Where one photo download stands.
+class DownloadProgress {
+  final int id;
+  final int received;
+
+  /// 0 while the size is unknown.
+  final int total;
+  final bool done;
+  final bool ok;
+
+  const DownloadProgress({
+    required this.id,
+    required this.received,
+    required this.total,
+    required this.done,
+    required this.ok,
+  });
+
+  double? get fraction => total > 0 ? received / total : null;
+
+  factory DownloadProgress.fromMap(Map<dynamic, dynamic> map) {
+    return DownloadProgress(
+      id: map['id'] as int,
+      received: map['received'] as int,
+      total: map['total'] as int,
+      done: map['done'] as bool,
+      ok: map['ok'] as bool,
+    );
+  }
+}
+
+/// Download progress from the Linux runner's pipeline. The runner batches
+/// it: at most one event per frame while the window is visible, and every
+/// quarter second while it is not, each covering every transfer that moved.
+class DownloadProgressService {
+  static const MethodChannel _channel =
+      MethodChannel('com.rabee.omran.downloads');
+  static const EventChannel _events =
+      EventChannel('com.rabee.omran.downloads/progress');
+
+  static bool get isSupported => !kIsWeb && Platform.isLinux;
+
+  static Stream<List<DownloadProgress>>? _progress;
+
+  /// One list per batch. Transfers that finished appear once more with
+  /// `done` set.
+  static Stream<List<DownloadProgress>> get progress {
+    if (!isSupported) return const Stream.empty();
+    return _progress ??= _events.receiveBroadcastStream().map((event) {
+      final transfers = (event as Map)['transfers'] as List;
+      return transfers
+          .map((t) => DownloadProgress.fromMap(t as Map))
+          .toList(growable: false);
+    }).asBroadcastStream();
+  }
+
+  /// Events sent, frame and background samples, and the measured frame
+  /// interval.
+  static Future<Map<String, dynamic>?> stats() async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('stats');
+  }
+
+  /// Downloads [url] [transfers] times at once, first with batched progress
+  /// and then with one event per received chunk, while listening to the
+  /// progress and recording frame timings. Adds events received and
+  /// build/raster p50/p99 to each run's native figures.
+  static Future<Map<String, dynamic>?> benchmark({
+    required String url,
+    int transfers = 20,
+  }) async {
+    if (!isSupported) return null;
+    final results = <String, dynamic>{};
+    for (final naive in [false, true]) {
+      final timings = <FrameTiming>[];
+      void onTimings(List<FrameTiming> batch) => timings.addAll(batch);
+      var events = 0;
+      final subscription = progress.listen((_) => events++);
+      SchedulerBinding.instance.addTimingsCallback(onTimings);
+      try {
+        final run = await _channel.invokeMapMethod<String, dynamic>(
+          'benchmark',
+          {'url': url, 'transfers': transfers, 'naive': naive},
+        );
+        // Let the last frames report in.
+        await Future<void>.delayed(const Duration(milliseconds: 200));
+        results[naive ? 'naive' : 'batched'] = {
+          ...?run,
+          'eventsReceived': events,
+          'frames': timings.length,
+          'buildP50Micros': _percentile(
+              timings.map((t) => t.buildDuration.inMicroseconds), 0.5),
+          'buildP99Micros': _percentile(
+              timings.map((t) => t.buildDuration.inMicroseconds), 0.99),
+          'rasterP50Micros': _percentile(
+              timings.map((t) => t.rasterDuration.inMicroseconds), 0.5),
+          'rasterP99Micros': _percentile(
+              timings.map((t) => t.rasterDuration.inMicroseconds), 0.99),
+        };
+      } finally {
+        SchedulerBinding.instance.removeTimingsCallback(onTimings);
+        await subscription.cancel();
+      }
+    }
+    return results;
+  }
+
+  static int _percentile(Iterable<int> values, double fraction) {
+    final sorted = values.toList()..sort();
+    if (sorted.isEmpty) return 0;
+    final index = (fraction * sorted.length).floor();
+    return sorted[index < sorted.length ? index : sorted.length - 1];
+  }
+}
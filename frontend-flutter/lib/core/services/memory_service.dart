@@ -0,0 +1,28 @@
+import 'dart:io';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+
+/// The Linux runner's memory governor. It sheds native caches on its own
+/// when the kernel reports memory pressure; this exposes what it did and
+/// lets the app ask for the same ahead of a known spike.
+class MemoryService {
+  static const MethodChannel _channel = MethodChannel('com.rabee.omran.memory');
+
+  static bool get isSupported => !kIsWeb && Platform.isLinux;
+
+  /// Pressure source and triggers, reclaim counts per tier, bytes released
+  /// per cache and the most recent reclaim.
+  static Future<Map<String, dynamic>?> stats() async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('stats');
+  }
+
+  /// Sheds caches now. A [critical] reclaim also drops what is costly to
+  /// rebuild, such as pooled download connections.
+  static Future<Map<String, dynamic>?> reclaim({bool critical = false}) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('reclaim', {
+      'level': critical ? 'critical' : 'moderate',
+    });
+  }
+}
@@ -0,0 +1,54 @@
+import 'dart:io';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+
+/// The Linux runner's photo mirror. It keeps a second copy of every saved
+/// photo in another directory, copying each new one as it is recorded
+/// rather than rescanning, and picks up where it left off after a restart.
+class MirrorService {
+  static const MethodChannel _channel =
+      MethodChannel('com.rabee.omran.mirror');
+
+  static bool get isSupported => !kIsWeb && Platform.isLinux;
+
+  /// Mirrors into [target], an absolute path, or stops mirroring when it is
+  /// empty. At most [concurrency] files, 1 to 8, are copied at once. A new
+  /// target starts again from the oldest photo, skipping files already
+  /// there. Returns what [stats] would.
+  static Future<Map<String, dynamic>?> configure({
+    required String target,
+    int? concurrency,
+  }) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('configure', {
+      'target': target,
+      if (concurrency != null) 'concurrency': concurrency,
+    });
+  }
+
+  /// The target, how far the mirror has got, files and bytes copied by
+  /// method (cloned, copyFileRange, buffered), skips, failures, throughput
+  /// and the last error.
+  static Future<Map<String, dynamic>?> stats() async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('stats');
+  }
+
+  /// Mirrors [files] generated photos of [fileBytes] each under [directory],
+  /// then times a full rescan of both sides against an incremental pass
+  /// over a few new ones.
+  static Future<Map<String, dynamic>?> benchmark({
+    int? files,
+    int? fileBytes,
+    int? concurrency,
+    String? directory,
+  }) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('benchmark', {
+      if (files != null) 'files': files,
+      if (fileBytes != null) 'fileBytes': fileBytes,
+      if (concurrency != null) 'concurrency': concurrency,
+      if (directory != null) 'directory': directory,
+    });
+  }
+}
@@ -0,0 +1,62 @@
+import 'dart:io';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+
+class NativePreview {
+  final String path;
+  final int width;
+  final int height;
+  final bool cacheHit;
+
+  const NativePreview({
+    required this.path,
+    required this.width,
+    required this.height,
+    required this.cacheHit,
+  });
+}
+
+/// Downscaled previews produced off the UI thread by the Linux runner.
+class NativePreviewService {
+  static const MethodChannel _channel = MethodChannel(
+    'com.rabee.omran.preview',
+  );
+
+  static bool get isSupported => !kIsWeb && Platform.isLinux;
+
+  /// Returns a cached preview of [sourcePath] whose longest side covers
+  /// [size] logical pixels, or null when the native pipeline is unavailable.
+  static Future<NativePreview?> getPreview(String sourcePath, int size) async {
+    if (!isSupported) return null;
+    try {
+      final result = await _channel.invokeMapMethod<String, dynamic>(
+        'getPreview',
+        {'path': sourcePath, 'size': size},
+      );
+      if (result == null) return null;
+      return NativePreview(
+        path: result['path'],
+        width: result['width'],
+        height: result['height'],
+        cacheHit: result['cacheHit'],
+      );
+    } on PlatformException catch (e) {
+      debugPrint('NativePreviewService: ${e.message}');
+      return null;
+    }
+  }
+
+  /// Decodes [sourcePath] at full size and at [size] and returns the time,
+  /// peak pixel-buffer bytes and output bytes of each, for comparing
+  /// against a full decode.
+  static Future<Map<String, dynamic>?> benchmarkDecode(
+    String sourcePath,
+    int size,
+  ) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('benchmarkDecode', {
+      'path': sourcePath,
+      'size': size,
+    });
+  }
+}
@@ -0,0 +1,47 @@
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+import 'native_preview_service.dart';
+
+/// Native pixel-buffer textures owned by the Linux runner. Pixels stay in
+/// native memory; only texture ids and sizes cross the channel.
+class NativeTextureService {
+  static const MethodChannel _channel = MethodChannel(
+    'com.rabee.omran.texture',
+  );
+
+  static bool get isSupported => NativePreviewService.isSupported;
+
+  /// Registers a new texture and returns its id, or null on failure.
+  static Future<int?> create() async {
+    if (!isSupported) return null;
+    final id = await _channel.invokeMethod<int>('create');
+    return id == null || id < 0 ? null : id;
+  }
+
+  /// Decodes [path] natively into [textureId] at no more than [size] pixels
+  /// on the longest side and returns the displayed size.
+  static Future<Size?> setImage(int textureId, String path, int size) async {
+    try {
+      final result = await _channel.invokeMapMethod<String, dynamic>(
+        'setImage',
+        {'textureId': textureId, 'path': path, 'size': size},
+      );
+      if (result == null) return null;
+      return Size(
+        (result['width'] as int).toDouble(),
+        (result['height'] as int).toDouble(),
+      );
+    } on PlatformException catch (e) {
+      debugPrint('NativeTextureService: ${e.message}');
+      return null;
+    }
+  }
+
+  /// Unregisters [textureId] and returns its buffers to the native pool.
+  static Future<void> release(int textureId) =>
+      _channel.invokeMethod('release', {'textureId': textureId});
+
+  /// Frame and buffer-pool counters, for measuring update throughput.
+  static Future<Map<String, dynamic>?> stats() =>
+      _channel.invokeMapMethod<String, dynamic>('stats');
+}
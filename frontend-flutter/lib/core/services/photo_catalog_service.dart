@@ -0,0 +1,170 @@
+import 'dart:io';
+import 'dart:typed_data';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+
+/// One row of a catalog page. Hash and timings are left out of pages; use
+/// [PhotoCatalogService.get] for the full record.
+class CatalogEntry {
+  final int id;
+
+  /// Subscription that saved it; empty otherwise. Photos are keyed by
+  /// source and [id].
+  final String source;
+  final String path;
+  final String fileName;
+  final int fileSize;
+  final int width;
+  final int height;
+  final DateTime? capturedAt;
+  final DateTime savedAt;
+
+  const CatalogEntry({
+    required this.id,
+    required this.source,
+    required this.path,
+    required this.fileName,
+    required this.fileSize,
+    required this.width,
+    required this.height,
+    required this.capturedAt,
+    required this.savedAt,
+  });
+}
+
+class CatalogPage {
+  final List<CatalogEntry> entries;
+  final bool hasMore;
+  final int nextSavedAt;
+  final int nextId;
+  final String nextSource;
+
+  const CatalogPage({
+    required this.entries,
+    required this.hasMore,
+    required this.nextSavedAt,
+    required this.nextId,
+    required this.nextSource,
+  });
+}
+
+/// History of every photo saved on this device, kept by the Linux runner in
+/// SQLite.
+class PhotoCatalogService {
+  static const MethodChannel _channel = MethodChannel(
+    'com.rabee.omran.catalog',
+  );
+
+  static bool get isSupported => !kIsWeb && Platform.isLinux;
+
+  /// Records a photo saved at [path]. Hash, dimensions and EXIF capture time
+  /// are read natively from the file.
+  static Future<void> record({
+    required int id,
+    required String path,
+    required String fileName,
+    required String uploadedAt,
+    required int downloadMicros,
+    required int writeMicros,
+    String source = '',
+  }) async {
+    if (!isSupported) return;
+    try {
+      await _channel.invokeMethod('record', {
+        'id': id,
+        'path': path,
+        'fileName': fileName,
+        'uploadedAt': uploadedAt,
+        'downloadMicros': downloadMicros,
+        'writeMicros': writeMicros,
+        'source': source,
+      });
+    } on PlatformException catch (e) {
+      debugPrint('PhotoCatalogService: ${e.message}');
+    }
+  }
+
+  /// Returns up to [limit] photos, newest first. Pass the previous page's
+  /// [CatalogPage.nextSavedAt], [CatalogPage.nextId] and
+  /// [CatalogPage.nextSource] to continue.
+  static Future<CatalogPage?> list({
+    int limit = 100,
+    int? cursorSavedAt,
+    int? cursorId,
+    String? cursorSource,
+    String? search,
+  }) async {
+    if (!isSupported) return null;
+    final result = await _channel.invokeMapMethod<String, dynamic>('list', {
+      'limit': limit,
+      if (cursorSavedAt != null) 'cursorSavedAt': cursorSavedAt,
+      if (cursorId != null) 'cursorId': cursorId,
+      if (cursorSource != null) 'cursorSource': cursorSource,
+      if (search != null && search.isNotEmpty) 'search': search,
+    });
+    if (result == null) return null;
+
+    final Int64List ids = result['ids'];
+    final Int64List sizes = result['fileSizes'];
+    final Int64List widths = result['widths'];
+    final Int64List heights = result['heights'];
+    final Int64List savedAt = result['savedAt'];
+    final List capturedAt = result['capturedAt'];
+    final List paths = result['paths'];
+    final List names = result['fileNames'];
+    final List sources = result['sources'];
+    return CatalogPage(
+      entries: List.generate(
+        ids.length,
+        (i) => CatalogEntry(
+          id: ids[i],
+          source: sources[i],
+          path: paths[i],
+          fileName: names[i],
+          fileSize: sizes[i],
+          width: widths[i],
+          height: heights[i],
+          capturedAt: capturedAt[i] != null
+              ? DateTime.tryParse(capturedAt[i])
+              : null,
+          savedAt: DateTime.fromMillisecondsSinceEpoch(savedAt[i]),
+        ),
+      ),
+      hasMore: result['hasMore'],
+      nextSavedAt: result['nextSavedAt'],
+      nextId: result['nextId'],
+      nextSource: result['nextSource'],
+    );
+  }
+
+  /// Full record for [id] as saved by [source], including content hash and
+  /// timings. Counts as viewing the photo for least-recently-used retention.
+  static Future<Map<String, dynamic>?> get(int id, {String source = ''}) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('get', {
+      'id': id,
+      'source': source,
+    });
+  }
+
+  /// Marks [id] as saved by [source] as just viewed, for least-recently-used
+  /// retention.
+  static Future<void> touch(int id, {String source = ''}) async {
+    if (!isSupported) return;
+    await _channel.invokeMethod('touch', {'id': id, 'source': source});
+  }
+
+  static Future<int> count() async {
+    if (!isSupported) return 0;
+    return await _channel.invokeMethod<int>('count') ?? 0;
+  }
+
+  /// Fills a scratch catalog with [rows] photos and times inserts, paging and
+  /// search against it.
+  static Future<Map<String, dynamic>?> benchmark({int rows = 100000}) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('benchmark', {
+      'rows': rows,
+    });
+  }
+}
@@ -0,0 +1,258 @@
+import 'dart:io';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+
+/// CRC-32C the server advertises for a photo: [value] covers the whole file
+/// and [blocks] each [blockSize] slice of it, all as hex strings.
+class ContentDigest {
+  final String value;
+  final int blockSize;
+  final List<String> blocks;
+
+  const ContentDigest({
+    required this.value,
+    required this.blockSize,
+    required this.blocks,
+  });
+
+  /// Parses the serializer's `content_digest`; null when absent or not
+  /// CRC-32C.
+  static ContentDigest? fromJson(Map<String, dynamic>? json) {
+    if (json == null || json['algorithm'] != 'crc32c') return null;
+    return ContentDigest(
+      value: json['value'],
+      blockSize: json['block_size'] ?? 0,
+      blocks: List<String>.from(json['blocks'] ?? const []),
+    );
+  }
+}
+
+/// The server's side of a photo's trace, as sent in `photo_update`: its id
+/// and when the upload arrived, was stored and was broadcast, in
+/// microseconds since the epoch on the server's clock.
+class ServerTrace {
+  final String id;
+  final int receivedMicros;
+  final int storedMicros;
+  final int broadcastMicros;
+
+  const ServerTrace({
+    required this.id,
+    required this.receivedMicros,
+    required this.storedMicros,
+    required this.broadcastMicros,
+  });
+
+  static ServerTrace? fromJson(Map<String, dynamic>? json) {
+    if (json == null || json['id'] == null) return null;
+    return ServerTrace(
+      id: json['id'],
+      receivedMicros: json['received_us'] ?? 0,
+      storedMicros: json['stored_us'] ?? 0,
+      broadcastMicros: json['broadcast_us'] ?? 0,
+    );
+  }
+}
+
+/// One photo to save, as passed to [PhotoPipelineService.catchUp].
+class PipelinePhoto {
+  final int id;
+  final String url;
+  final String fileName;
+  final String? uploadedAt;
+  final int? expectedSize;
+  final ContentDigest? digest;
+  final ServerTrace? trace;
+
+  const PipelinePhoto({
+    required this.id,
+    required this.url,
+    required this.fileName,
+    this.uploadedAt,
+    this.expectedSize,
+    this.digest,
+    this.trace,
+  });
+
+  Map<String, Object> get _args => {
+    'id': id,
+    'url': url,
+    'fileName': fileName,
+    'uploadedAt': uploadedAt ?? '',
+    'expectedSize': expectedSize ?? 0,
+    if (digest != null) ...{
+      'crc32c': digest!.value,
+      'crc32cBlockSize': digest!.blockSize,
+      'crc32cBlocks': digest!.blocks,
+    },
+    if (trace != null) ...{
+      'traceId': trace!.id,
+      'serverReceivedMicros': trace!.receivedMicros,
+      'serverStoredMicros': trace!.storedMicros,
+      'serverBroadcastMicros': trace!.broadcastMicros,
+    },
+  };
+}
+
+class PipelineResult {
+  final String path;
+  final int bytes;
+  final int downloadMicros;
+  final int verifyMicros;
+  final int processMicros;
+  final int transcodeMicros;
+  final int writeMicros;
+  final int totalMicros;
+
+  const PipelineResult({
+    required this.path,
+    required this.bytes,
+    required this.downloadMicros,
+    required this.verifyMicros,
+    required this.processMicros,
+    required this.transcodeMicros,
+    required this.writeMicros,
+    required this.totalMicros,
+  });
+}
+
+/// Staged download -> verify -> process -> transcode -> write pipeline in
+/// the Linux runner. Several photos move through it at once, each stage bounded so a
+/// slow disk or link pushes back instead of buffering without limit.
+class PhotoPipelineService {
+  static const MethodChannel _channel = MethodChannel(
+    'com.rabee.omran.pipeline',
+  );
+
+  static const _queueFullRetries = 20;
+  static const _queueFullDelay = Duration(milliseconds: 250);
+
+  static bool get isSupported => !kIsWeb && Platform.isLinux;
+
+  /// Downloads [url] and saves it as [fileName], recording it in the photo
+  /// catalog. Resolves once the file is durable. If the download queue is
+  /// full, waits and retries before giving up.
+  ///
+  /// With a [digest], the download is checked as it streams and only the
+  /// blocks that do not match are fetched again. A [trace] lets the runner
+  /// line its own timestamps up with the server's; see [TraceService].
+  static Future<PipelineResult> enqueue({
+    required int id,
+    required String url,
+    required String fileName,
+    String? uploadedAt,
+    int? expectedSize,
+    ContentDigest? digest,
+    ServerTrace? trace,
+  }) async {
+    for (var attempt = 0; ; attempt++) {
+      try {
+        final result = await _channel.invokeMapMethod<String, dynamic>(
+          'enqueue',
+          PipelinePhoto(
+            id: id,
+            url: url,
+            fileName: fileName,
+            uploadedAt: uploadedAt,
+            expectedSize: expectedSize,
+            digest: digest,
+            trace: trace,
+          )._args,
+        );
+        return PipelineResult(
+          path: result!['path'],
+          bytes: result['bytes'],
+          downloadMicros: result['downloadMicros'],
+          verifyMicros: result['verifyMicros'],
+          processMicros: result['processMicros'],
+          transcodeMicros: result['transcodeMicros'],
+          writeMicros: result['writeMicros'],
+          totalMicros: result['totalMicros'],
+        );
+      } on PlatformException catch (e) {
+        if (e.code != 'QUEUE_FULL' || attempt >= _queueFullRetries) rethrow;
+        await Future.delayed(_queueFullDelay);
+      }
+    }
+  }
+
+  /// Saves every photo of [photos] with at most [parallelism] of them in
+  /// the pipeline at once, leaving room for photos that arrive live. Returns
+  /// the ids that were saved.
+  static Future<Set<int>> catchUp(
+    List<PipelinePhoto> photos, {
+    int parallelism = 3,
+  }) async {
+    if (photos.isEmpty) return const {};
+    final result = await _channel.invokeMapMethod<String, dynamic>('catchUp', {
+      'photos': [for (final photo in photos) photo._args],
+      'parallelism': parallelism,
+    });
+    final saved = <int>{};
+    for (final item in result?['results'] ?? const []) {
+      if (item['ok'] == true) {
+        saved.add(item['id']);
+      } else {
+        debugPrint('Catch-up of photo ${item['id']} failed: ${item['error']}');
+      }
+    }
+    debugPrint(
+      'Caught up on ${saved.length}/${photos.length} photos in '
+      '${(result?['elapsedMicros'] ?? 0) ~/ 1000} ms',
+    );
+    return saved;
+  }
+
+  /// Also renders a preview of each saved photo at [size] so it is cached
+  /// before the UI asks for it; 0 turns this off.
+  static Future<void> setWarmPreviewSize(int size) async {
+    if (!isSupported) return;
+    await _channel.invokeMethod('configure', {'warmPreviewSize': size});
+  }
+
+  /// Re-encodes photos as [format] (`webp` or `avif`, `off` to keep the
+  /// originals) at [quality] 0-100 before they are written. EXIF is kept; a
+  /// copy that comes out larger than its original is discarded. A format
+  /// the runner was built without fails with a [PlatformException].
+  static Future<void> setTranscode(String format, {int quality = 80}) async {
+    if (!isSupported) return;
+    await _channel.invokeMethod('configure', {
+      'transcodeFormat': format,
+      'transcodeQuality': quality,
+    });
+  }
+
+  /// Per-stage concurrency, queue depth and latency percentiles.
+  static Future<Map<String, dynamic>?> stats() async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('stats');
+  }
+
+  /// Pushes [count] downloads of [url] through the pipeline as fast as it
+  /// accepts them and reports throughput with the stage metrics.
+  static Future<Map<String, dynamic>?> benchmark(
+    String url, {
+    int count = 50,
+  }) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('benchmark', {
+      'url': url,
+      'count': count,
+    });
+  }
+
+  /// Transcodes every JPEG and PNG in [corpus] across the worker pool and
+  /// reports bytes saved, CPU time per megapixel and throughput per core.
+  static Future<Map<String, dynamic>?> transcodeBenchmark(
+    String corpus, {
+    String format = 'webp',
+    int quality = 80,
+  }) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('transcodeBenchmark', {
+      'corpus': corpus,
+      'format': format,
+      'quality': quality,
+    });
+  }
+}
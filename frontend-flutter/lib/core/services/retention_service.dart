@@ -0,0 +1,66 @@
+import 'dart:io';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+
+/// Which saved photos the Linux runner removes first to stay within quota.
+enum RetentionPolicy { oldestFirst, leastRecentlyUsed, keepEveryNth }
+
+/// The Linux runner's retention engine. It keeps running totals of the
+/// space saved photos take, per source and per day, deletes the ones the
+/// policy picks once a quota or age limit is passed, and holds writes back
+/// before the disk fills up.
+class RetentionService {
+  static const MethodChannel _channel =
+      MethodChannel('com.rabee.omran.retention');
+
+  static bool get isSupported => !kIsWeb && Platform.isLinux;
+
+  /// Changes what is kept; anything left out stays as it was. A quota of 0
+  /// removes it, and [sourceQuotas], keyed by subscription id, replaces the
+  /// previous set. [keepEvery] applies to [RetentionPolicy.keepEveryNth].
+  /// Below [lowSpaceBytes] free, photos are evicted until there is that
+  /// much again; 0 never evicts for space. Returns what [usage] would.
+  static Future<Map<String, dynamic>?> configure({
+    RetentionPolicy? policy,
+    int? quotaBytes,
+    Map<String, int>? sourceQuotas,
+    int? maxAgeDays,
+    int? keepEvery,
+    int? lowSpaceBytes,
+    int? criticalSpaceBytes,
+  }) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('configure', {
+      if (policy != null) 'policy': policy.name,
+      if (quotaBytes != null) 'quotaBytes': quotaBytes,
+      if (sourceQuotas != null) 'sourceQuotas': sourceQuotas,
+      if (maxAgeDays != null) 'maxAgeDays': maxAgeDays,
+      if (keepEvery != null) 'keepEvery': keepEvery,
+      if (lowSpaceBytes != null) 'lowSpaceBytes': lowSpaceBytes,
+      if (criticalSpaceBytes != null) 'criticalSpaceBytes': criticalSpaceBytes,
+    });
+  }
+
+  /// Bytes and files saved, overall, per source and per UTC day (days since
+  /// the epoch, column by column), free space on the watched volumes, the
+  /// config and eviction counts.
+  static Future<Map<String, dynamic>?> usage() async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('usage');
+  }
+
+  /// Evicts whatever is over its limit now instead of on the next pass.
+  static Future<Map<String, dynamic>?> enforce() async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('enforce');
+  }
+
+  /// Times a walk of [directory], by default a watched save directory,
+  /// against a lookup of the running totals.
+  static Future<Map<String, dynamic>?> benchmark({String? directory}) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('benchmark', {
+      if (directory != null) 'directory': directory,
+    });
+  }
+}
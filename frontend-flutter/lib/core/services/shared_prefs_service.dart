@@ -1,15 +1,34 @@
+import 'dart:io';
+
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
 import 'package:shared_preferences/shared_preferences.dart';
 
 class SharedPrefsService {
   static SharedPrefsService? _instance;
   static SharedPrefsService get instance => _instance!;
 
+  static const MethodChannel _stateChannel = MethodChannel(
+    'com.rabee.omran.state',
+  );
+
   SharedPreferences? _prefs;
+  Map<String, Object?>? _nativeState;
 
   SharedPrefsService();
 
   Future<void> init() async {
     _prefs = await SharedPreferences.getInstance();
+    if (!kIsWeb && Platform.isLinux) {
+      try {
+        final values = await _stateChannel.invokeMapMethod<String, Object?>(
+          'getAll',
+        );
+        _nativeState = values ?? <String, Object?>{};
+      } catch (e) {
+        debugPrint('SharedPrefsService: native state store unavailable: $e');
+      }
+    }
   }
 
   // Language
@@ -43,32 +62,90 @@ class SharedPrefsService {
       (_prefs?.getInt('settings_background_fetch') ?? 1) == 1;
 
   // Photo data
-  Future<void> setLastPhotoId(int id) async =>
-      await _prefs?.setInt('last_photo_id', id);
-  int? get lastPhotoId => _prefs?.getInt('last_photo_id');
+  //
+  // On Linux the last photo record lives in the runner's native state store,
+  // which commits all six fields as one record with a single fsync.
+  // shared_preferences_linux rewrites its whole JSON file for every field,
+  // so a crash between two of those writes left a half-updated record.
+  Future<void> setLastPhoto({
+    required int id,
+    required String path,
+    required String fileName,
+    required String uploadedAt,
+    required int fileSize,
+    required DateTime downloadDate,
+  }) async {
+    final entries = <String, Object>{
+      'last_photo_id': id,
+      'last_photo_path': path,
+      'last_photo_file_name': fileName,
+      'last_photo_uploaded_at': uploadedAt,
+      'last_photo_file_size': fileSize,
+      'last_download_date': downloadDate.toIso8601String(),
+    };
+    if (_nativeState != null) {
+      try {
+        await _stateChannel.invokeMethod('commit', {'entries': entries});
+        _nativeState!.addAll(entries);
+        return;
+      } catch (e) {
+        debugPrint('SharedPrefsService: native commit failed: $e');
+      }
+    }
+    await _prefs?.setInt('last_photo_id', id);
+    await _prefs?.setString('last_photo_path', path);
+    await _prefs?.setString('last_photo_file_name', fileName);
+    await _prefs?.setString('last_photo_uploaded_at', uploadedAt);
+    await _prefs?.setInt('last_photo_file_size', fileSize);
+    await _prefs?.setString(
+      'last_download_date',
+      downloadDate.toIso8601String(),
+    );
+  }
+
+  int? get lastPhotoId => _getInt('last_photo_id');
+  String? get lastPhotoPath => _getString('last_photo_path');
+  String? get lastPhotoFileName => _getString('last_photo_file_name');
+  String? get lastPhotoUploadedAt => _getString('last_photo_uploaded_at');
+  int? get lastPhotoFileSize => _getInt('last_photo_file_size');
+  DateTime? get lastDownloadDate {
+    final str = _getString('last_download_date');
+    return str != null ? DateTime.tryParse(str) : null;
+  }
 
-  Future<void> setLastPhotoPath(String path) async =>
-      await _prefs?.setString('last_photo_path', path);
-  String? get lastPhotoPath => _prefs?.getString('last_photo_path');
+  // Validators of the last /api/photo/ response and the id of the photo it
+  // described. They are only sent back while that photo is the one saved, so
+  // a fetch whose photo never got saved is not answered with 304.
+  Future<void> setPhotoValidators({
+    required int id,
+    String? etag,
+    String? lastModified,
+  }) async {
+    await _prefs?.setInt('photo_validators_id', id);
+    await _prefs?.setString('photo_etag', etag ?? '');
+    await _prefs?.setString('photo_last_modified', lastModified ?? '');
+  }
 
-  Future<void> setLastPhotoFileName(String fileName) async =>
-      await _prefs?.setString('last_photo_file_name', fileName);
-  String? get lastPhotoFileName => _prefs?.getString('last_photo_file_name');
+  String? get photoEtag => _validator('photo_etag');
+  String? get photoLastModified => _validator('photo_last_modified');
 
-  Future<void> setLastPhotoUploadedAt(String uploadedAt) async =>
-      await _prefs?.setString('last_photo_uploaded_at', uploadedAt);
-  String? get lastPhotoUploadedAt =>
-      _prefs?.getString('last_photo_uploaded_at');
+  String? _validator(String key) {
+    final id = _prefs?.getInt('photo_validators_id');
+    if (id == null || id != lastPhotoId) return null;
+    final value = _prefs?.getString(key);
+    return value == null || value.isEmpty ? null : value;
+  }
 
-  Future<void> setLastPhotoFileSize(int fileSize) async =>
-      await _prefs?.setInt('last_photo_file_size', fileSize);
-  int? get lastPhotoFileSize => _prefs?.getInt('last_photo_file_size');
+  // Values written before the native store existed are still read from
+  // shared_preferences until the next photo replaces them.
+  int? _getInt(String key) {
+    final value = _nativeState?[key];
+    return value is int ? value : _prefs?.getInt(key);
+  }
 
-  Future<void> setLastDownloadDate(DateTime date) async =>
-      await _prefs?.setString('last_download_date', date.toIso8601String());
-  DateTime? get lastDownloadDate {
-    final str = _prefs?.getString('last_download_date');
-    return str != null ? DateTime.tryParse(str) : null;
+  String? _getString(String key) {
+    final value = _nativeState?[key];
+    return value is String ? value : _prefs?.getString(key);
   }
 
   static void setInstance(SharedPrefsService service) {
@@ -0,0 +1,127 @@
+import 'dart:async';
+import 'dart:io';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+import '../constants/constants.dart';
+
+/// A photo the runner's subscription hub finished with, saved or given up
+/// on.
+class SubscriptionPhoto {
+  final String sourceId;
+  final String album;
+  final int id;
+  final bool ok;
+  final String path;
+  final int bytes;
+  final String error;
+
+  /// The source's cursor after this photo.
+  final int cursor;
+
+  const SubscriptionPhoto({
+    required this.sourceId,
+    required this.album,
+    required this.id,
+    required this.ok,
+    required this.path,
+    required this.bytes,
+    required this.error,
+    required this.cursor,
+  });
+
+  factory SubscriptionPhoto.fromMap(Map<dynamic, dynamic> map) {
+    return SubscriptionPhoto(
+      sourceId: map['sourceId'] as String,
+      album: map['album'] as String,
+      id: map['id'] as int,
+      ok: map['ok'] as bool,
+      path: map['path'] as String,
+      bytes: map['bytes'] as int,
+      error: map['error'] as String,
+      cursor: map['cursor'] as int,
+    );
+  }
+}
+
+/// The Linux runner's subscription hub: follows many albums, on one or
+/// more servers, from a single native event loop, and saves what they
+/// publish through the photo pipeline without a round trip through Dart.
+///
+/// Albums on the same server share one WebSocket. Each source resumes from
+/// a cursor the runner keeps in its state store, catching up on what it
+/// missed before taking live photos; when photos queue up, sources with a
+/// higher priority are saved first.
+class SubscriptionService {
+  static const MethodChannel _channel =
+      MethodChannel('com.rabee.omran.subscriptions');
+  static final _saved = StreamController<SubscriptionPhoto>.broadcast();
+  static bool _listening = false;
+
+  static bool get isSupported => !kIsWeb && Platform.isLinux;
+
+  /// Every photo a source finished with.
+  static Stream<SubscriptionPhoto> get photoSaved {
+    if (isSupported && !_listening) {
+      _listening = true;
+      _channel.setMethodCallHandler((call) async {
+        if (call.method == 'photoSaved') {
+          _saved.add(SubscriptionPhoto.fromMap(call.arguments as Map));
+        }
+      });
+    }
+    return _saved.stream;
+  }
+
+  /// Follows [album] ('' for the default one) on [server], e.g.
+  /// `https://example.com`, as source [id]; calling it again with the same
+  /// [id] updates its [priority] and [directory]. The source resumes from
+  /// its stored cursor unless [cursor] is given.
+  static Future<void> addSource({
+    required String id,
+    required String server,
+    String album = '',
+    int priority = 0,
+    String? directory,
+    int? cursor,
+  }) async {
+    if (!isSupported) return;
+    await _channel.invokeMethod('addSource', {
+      'id': id,
+      'server': server,
+      'album': album,
+      'priority': priority,
+      if (directory != null) 'directory': directory,
+      if (cursor != null) 'cursor': cursor,
+    });
+  }
+
+  static Future<void> removeSource(String id) async {
+    if (!isSupported) return;
+    await _channel.invokeMethod('removeSource', {'id': id});
+  }
+
+  /// Per source: cursor, whether it is subscribed and caught up, and photo
+  /// counts; per server: connection state and traffic; and the event
+  /// loop's CPU time.
+  static Future<Map<String, dynamic>?> stats() async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('stats');
+  }
+
+  /// Follows 1, 10, ... empty albums on [server] (the app's backend by
+  /// default) with a hub of its own and reports, for each count, the time
+  /// until all are caught up, heap and RSS per source, and event loop CPU
+  /// per source and per idle second.
+  static Future<List<dynamic>?> benchmark({
+    String? server,
+    List<int> counts = const [1, 10, 100, 500],
+    int idleMillis = 2000,
+  }) async {
+    if (!isSupported) return null;
+    return _channel.invokeListMethod<dynamic>('benchmark', {
+      'server': server ?? Constants.baseUrl,
+      'counts': counts,
+      'idleMillis': idleMillis,
+    });
+  }
+}
@@ -0,0 +1,42 @@
+import 'dart:io';
+import 'package:flutter/foundation.dart';
+import 'package:flutter/services.dart';
+import '../constants/constants.dart';
+
+/// Upload-to-disk traces recorded by the Linux runner. Each photo announced
+/// live carries the server's timestamps; the runner adds its own for
+/// receive, first byte, last byte, verify and write, corrected for the
+/// estimated offset between the two clocks.
+///
+/// Spans are `store`, `broadcast`, `notify`, `request`, `download`,
+/// `verify`, `write` and `total`, in microseconds.
+class TraceService {
+  static const MethodChannel _channel = MethodChannel('com.rabee.omran.trace');
+
+  static bool get isSupported => !kIsWeb && Platform.isLinux;
+
+  /// p50/p90/p99/max of each span over recent photos, and the clock
+  /// estimate they were corrected with.
+  static Future<Map<String, dynamic>?> stats() async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('stats');
+  }
+
+  /// The [limit] most recent photos, newest first, with their raw
+  /// timestamps and spans.
+  static Future<Map<String, dynamic>?> traces({int limit = 50}) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('traces', {
+      'limit': limit,
+    });
+  }
+
+  /// Samples the server clock now instead of waiting for the next traced
+  /// photo to do it.
+  static Future<Map<String, dynamic>?> syncClock({String? url}) async {
+    if (!isSupported) return null;
+    return _channel.invokeMapMethod<String, dynamic>('syncClock', {
+      'url': url ?? '${Constants.baseUrl}/api/time/',
+    });
+  }
+}
@@ -4,13 +4,52 @@ import 'package:flutter/foundation.dart';
 import 'package:file_saver/file_saver.dart';
 import 'dart:io';
 import 'package:http/http.dart' as http;
+import '../services/photo_catalog_service.dart';
+import '../services/photo_pipeline_service.dart';
 
 class GallerySaverUtils {
   static const MethodChannel _channel = MethodChannel(
     'com.rabee.omran.gallery',
   );
+  static const MethodChannel _writerChannel = MethodChannel(
+    'com.rabee.omran.writer',
+  );
 
-  static Future<bool> saveImageToGallery(String url, String fileName) async {
+  /// Downloads [url] and saves it as [fileName]. On Linux, passing
+  /// [photoId] also records the saved file in the native photo catalog.
+  static Future<bool> saveImageToGallery(
+    String url,
+    String fileName, {
+    int? photoId,
+    String? uploadedAt,
+    int? expectedSize,
+    ContentDigest? digest,
+    ServerTrace? trace,
+  }) async {
+    if (photoId != null && PhotoPipelineService.isSupported) {
+      try {
+        final result = await PhotoPipelineService.enqueue(
+          id: photoId,
+          url: url,
+          fileName: fileName,
+          uploadedAt: uploadedAt,
+          expectedSize: expectedSize,
+          digest: digest,
+          trace: trace,
+        );
+        debugPrint(
+          'Saved ${result.bytes} bytes in ${result.totalMicros ~/ 1000} ms '
+          '(download ${result.downloadMicros ~/ 1000} ms, '
+          'write ${result.writeMicros ~/ 1000} ms)',
+        );
+        return true;
+      } on MissingPluginException {
+        // Runner built without the pipeline; use the Dart path below.
+      } on PlatformException catch (e) {
+        debugPrint('Pipeline failed: ${e.message}');
+        return false;
+      }
+    }
     if (!kIsWeb && (Platform.isAndroid || Platform.isIOS)) {
       final result = await _channel.invokeMethod('saveImageToGallery', {
         'url': url,
@@ -19,10 +58,30 @@ class GallerySaverUtils {
       return result == true;
     } else {
       try {
+        final stopwatch = Stopwatch()..start();
         final response = await http.get(Uri.parse(url));
+        final downloadMicros = stopwatch.elapsedMicroseconds;
         if (response.statusCode == 200) {
           final data = response.bodyBytes;
-          await FileSaver.instance.saveFile(name: fileName, bytes: data);
+          if (!kIsWeb && Platform.isLinux) {
+            // Native writer: atomic publish with a configurable fsync policy
+            final path = await _writerChannel.invokeMethod<String>(
+              'saveFile',
+              {'name': fileName, 'bytes': data},
+            );
+            if (path != null && photoId != null) {
+              await PhotoCatalogService.record(
+                id: photoId,
+                path: path,
+                fileName: fileName,
+                uploadedAt: uploadedAt ?? '',
+                downloadMicros: downloadMicros,
+                writeMicros: stopwatch.elapsedMicroseconds - downloadMicros,
+              );
+            }
+          } else {
+            await FileSaver.instance.saveFile(name: fileName, bytes: data);
+          }
           return true;
         } else {
           debugPrint('Failed to download file: ${response.statusCode}');
@@ -34,4 +93,40 @@ class GallerySaverUtils {
       }
     }
   }
+
+  /// Saves every photo of [photos] and returns the ids that were saved. On
+  /// Linux the runner downloads several at once; elsewhere they are saved
+  /// one after another.
+  static Future<Set<int>> saveAllToGallery(List<PipelinePhoto> photos) async {
+    if (PhotoPipelineService.isSupported) {
+      try {
+        return await PhotoPipelineService.catchUp(photos);
+      } on MissingPluginException {
+        // Runner built without the pipeline; save one at a time below.
+      } on PlatformException catch (e) {
+        debugPrint('Catch-up failed: ${e.message}');
+        return const {};
+      }
+    }
+    final saved = <int>{};
+    for (final photo in photos) {
+      final ok = await saveImageToGallery(
+        photo.url,
+        photo.fileName,
+        photoId: photo.id,
+        uploadedAt: photo.uploadedAt,
+        expectedSize: photo.expectedSize,
+        digest: photo.digest,
+      );
+      if (ok) saved.add(photo.id);
+    }
+    return saved;
+  }
+
+  /// Sets how the Linux writer syncs saved photos: 'perFile', 'group'
+  /// (batched group commit, the default) or 'none'.
+  static Future<void> setFsyncPolicy(String policy) async {
+    if (kIsWeb || !Platform.isLinux) return;
+    await _writerChannel.invokeMethod('setFsyncPolicy', {'policy': policy});
+  }
 }
@@ -0,0 +1,206 @@
+// ignore_for_file: depend_on_referenced_packages
+import 'package:flutter/material.dart';
+import 'package:flutter/services.dart';
+import 'package:flutter_cache_manager/flutter_cache_manager.dart';
+import '../services/adaptive_image_service.dart';
+import '../services/native_preview_service.dart';
+import '../services/native_texture_service.dart';
+import 'custom_cached_image.dart';
+import 'loading_widget.dart';
+
+/// Shows [imageUrl] through the native preview cache on Linux so only a
+/// display-sized image is ever decoded, and renders it from a native texture
+/// so the pixels never round-trip through the engine's image codecs. Other
+/// platforms use [CustomCachedImage] unchanged.
+///
+/// When the server lists [variants], the copy that suits the current link is
+/// shown first and replaced by a sharper one, up to the original, once the
+/// link allows.
+class NativePreviewImage extends StatefulWidget {
+  final String imageUrl;
+  final List<ImageVariant> variants;
+  final int? originalSize;
+  final double height;
+  final double? width;
+  final BoxFit fit;
+  final double borderRadius;
+
+  const NativePreviewImage({
+    super.key,
+    required this.imageUrl,
+    this.variants = const [],
+    this.originalSize,
+    required this.height,
+    this.width,
+    this.fit = BoxFit.cover,
+    this.borderRadius = 0,
+  });
+
+  @override
+  State<NativePreviewImage> createState() => _NativePreviewImageState();
+}
+
+class _NativePreviewImageState extends State<NativePreviewImage> {
+  Future<int?>? _textureId;
+  int? _activeTextureId;
+  Future<Size?>? _frame;
+  String? _loadedUrl;
+  int? _loadedSize;
+  bool _failed = false;
+
+  @override
+  void initState() {
+    super.initState();
+    if (NativeTextureService.isSupported) {
+      _textureId = NativeTextureService.create();
+    }
+  }
+
+  @override
+  void dispose() {
+    _textureId?.then((id) {
+      if (id != null) NativeTextureService.release(id);
+    });
+    super.dispose();
+  }
+
+  Future<Size?> _load(String url, int size) async {
+    final textureId = await _textureId;
+    if (textureId == null) return null;
+    _activeTextureId = textureId;
+
+    final candidates = _candidates(url);
+    String? path;
+    if (candidates != null) {
+      try {
+        final first = await AdaptiveImageService.fetch(candidates);
+        if (first != null) {
+          path = first.path;
+          if (first.index < candidates.length - 1) {
+            _upgrade(textureId, candidates, first.index, url, size);
+          }
+        }
+      } on PlatformException catch (e) {
+        debugPrint('NativePreviewImage: ${e.message}');
+      }
+    }
+    path ??= (await DefaultCacheManager().getSingleFile(url)).path;
+    final preview = await NativePreviewService.getPreview(path, size);
+    if (preview == null) return null;
+    return NativeTextureService.setImage(textureId, preview.path, size);
+  }
+
+  // Server variants followed by the original, or null when there is no
+  // choice to make.
+  List<ImageVariant>? _candidates(String url) {
+    final originalSize = widget.originalSize;
+    if (!AdaptiveImageService.isSupported ||
+        widget.variants.isEmpty ||
+        originalSize == null) {
+      return null;
+    }
+    return [
+      ...widget.variants,
+      ImageVariant(url: url, fileSize: originalSize),
+    ];
+  }
+
+  Future<void> _upgrade(
+    int textureId,
+    List<ImageVariant> candidates,
+    int current,
+    String url,
+    int size,
+  ) async {
+    try {
+      final better = await AdaptiveImageService.fetch(
+        candidates,
+        budget: AdaptiveImageService.upgradeBudget,
+        minIndex: current + 1,
+      );
+      if (better == null || !_stillShowing(url, size)) return;
+      final preview = await NativePreviewService.getPreview(better.path, size);
+      if (preview == null || !_stillShowing(url, size)) return;
+      // Wait for the first frame so the sharper copy is never overwritten.
+      await _frame;
+      final frame = await NativeTextureService.setImage(
+        textureId,
+        preview.path,
+        size,
+      );
+      if (frame != null && _stillShowing(url, size)) {
+        setState(() => _frame = Future.value(frame));
+      }
+    } on PlatformException catch (e) {
+      debugPrint('NativePreviewImage: upgrade failed: ${e.message}');
+    }
+  }
+
+  bool _stillShowing(String url, int size) =>
+      mounted && _loadedUrl == url && _loadedSize == size;
+
+  @override
+  Widget build(BuildContext context) {
+    if (!NativePreviewService.isSupported || _failed) {
+      return CustomCachedImage(
+        imageUrl: widget.imageUrl,
+        height: widget.height,
+        width: widget.width,
+        fit: widget.fit,
+        borderRadius: widget.borderRadius,
+      );
+    }
+
+    final colorScheme = Theme.of(context).colorScheme;
+    return LayoutBuilder(
+      builder: (context, constraints) {
+        final logicalWidth = constraints.maxWidth.isFinite
+            ? constraints.maxWidth
+            : widget.height;
+        final longest = logicalWidth > widget.height
+            ? logicalWidth
+            : widget.height;
+        final size = (longest * MediaQuery.devicePixelRatioOf(context)).ceil();
+        if (_loadedUrl != widget.imageUrl || _loadedSize != size) {
+          _loadedUrl = widget.imageUrl;
+          _loadedSize = size;
+          _frame = _load(widget.imageUrl, size);
+        }
+        return ClipRRect(
+          borderRadius: BorderRadius.circular(widget.borderRadius),
+          child: FutureBuilder<Size?>(
+            future: _frame,
+            builder: (context, snapshot) {
+              if (snapshot.connectionState != ConnectionState.done) {
+                return Container(
+                  height: widget.height,
+                  width: widget.width,
+                  color: colorScheme.onSurface.withValues(alpha: 0.06),
+                  child: const Center(child: LoadingWidget()),
+                );
+              }
+              final frameSize = snapshot.data;
+              if (frameSize == null) {
+                WidgetsBinding.instance.addPostFrameCallback((_) {
+                  if (mounted) setState(() => _failed = true);
+                });
+                return SizedBox(height: widget.height, width: widget.width);
+              }
+              return SizedBox(
+                height: widget.height,
+                width: widget.width,
+                child: FittedBox(
+                  fit: widget.fit,
+                  child: SizedBox.fromSize(
+                    size: frameSize,
+                    child: Texture(textureId: _activeTextureId!),
+                  ),
+                ),
+              );
+            },
+          ),
+        );
+      },
+    );
+  }
+}
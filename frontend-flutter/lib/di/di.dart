@@ -5,6 +5,7 @@ import '../features/photo/data/datasources/photo_remote_data_source.dart';
 import '../features/photo/data/repositories/photo_repository_impl.dart';
 import '../features/photo/domain/repositories/photo_repository.dart';
 import '../features/photo/domain/usecases/get_latest_photo.dart';
+import '../features/photo/domain/usecases/get_photos_since.dart';
 import '../features/photo/presentation/bloc/photo_cubit/photo_cubit.dart';
 import '../core/network/network_info.dart';
 import '../core/network/network_cubit.dart';
@@ -23,17 +24,18 @@ Future<void> setupLocator() async {
 
   // Photo Feature
   sl.registerLazySingleton<PhotoRemoteDataSource>(
-    () => PhotoRemoteDataSourceImpl(sl()),
+    () => PhotoRemoteDataSourceImpl(sl(), sl()),
   );
   sl.registerLazySingleton<PhotoRepository>(() => PhotoRepositoryImpl(sl()));
   sl.registerLazySingleton<GetLatestPhoto>(() => GetLatestPhoto(sl()));
+  sl.registerLazySingleton<GetPhotosSince>(() => GetPhotosSince(sl()));
   sl.registerLazySingleton<PhotoWebSocketService>(
     () => PhotoWebSocketService(),
   );
   sl.registerLazySingleton<WebSocketCubit>(
     () => WebSocketCubit(sl<PhotoWebSocketService>()),
   );
-  sl.registerFactory<PhotoCubit>(() => PhotoCubit(sl(), sl(), sl()));
+  sl.registerFactory<PhotoCubit>(() => PhotoCubit(sl(), sl(), sl(), sl()));
 
   // Network Feature
   sl.registerLazySingleton<NetworkInfo>(() => NetworkInfo());
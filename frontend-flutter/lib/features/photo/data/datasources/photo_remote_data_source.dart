@@ -1,24 +1,63 @@
 import 'package:auto_photo_saver_app/core/constants/constants.dart';
+import 'package:auto_photo_saver_app/core/services/shared_prefs_service.dart';
 import 'package:dio/dio.dart';
 import '../models/photo_model.dart';
+import '../models/photo_sync_page_model.dart';
 
 abstract class PhotoRemoteDataSource {
-  Future<PhotoModel> getLatestPhoto();
+  /// The latest photo, or null when it is still the one last saved.
+  /// [conditional] false asks for it even if it is unchanged.
+  Future<PhotoModel?> getLatestPhoto({bool conditional = true});
+  Future<PhotoSyncPageModel> getPhotosSince(int cursor);
 }
 
 class PhotoRemoteDataSourceImpl implements PhotoRemoteDataSource {
   final Dio dio;
-  PhotoRemoteDataSourceImpl(this.dio);
+  final SharedPrefsService prefs;
+  PhotoRemoteDataSourceImpl(this.dio, this.prefs);
 
   @override
-  Future<PhotoModel> getLatestPhoto() async {
+  Future<PhotoModel?> getLatestPhoto({bool conditional = true}) async {
+    final etag = conditional ? prefs.photoEtag : null;
+    final lastModified = conditional ? prefs.photoLastModified : null;
     final response = await dio.get(
       '${Constants.baseUrl}/api/photo/',
+      options: Options(
+        headers: {
+          if (etag != null) 'If-None-Match': etag,
+          if (lastModified != null) 'If-Modified-Since': lastModified,
+        },
+        validateStatus: (status) => status == 200 || status == 304,
+      ),
     );
+    if (response.statusCode == 304) {
+      // Unchanged: nothing to parse
+      return null;
+    }
     if (response.statusCode == 200) {
-      return PhotoModel.fromJson(response.data);
+      final model = PhotoModel.fromJson(response.data);
+      await prefs.setPhotoValidators(
+        id: model.id,
+        etag: response.headers.value('etag'),
+        lastModified: response.headers.value('last-modified'),
+      );
+      return model;
     } else {
       throw Exception('Failed to load photo');
     }
   }
+
+  @override
+  Future<PhotoSyncPageModel> getPhotosSince(int cursor) async {
+    // The page comes back gzip-compressed; dart:io inflates it
+    final response = await dio.get(
+      '${Constants.baseUrl}/api/photo/sync/',
+      queryParameters: {'since': cursor},
+    );
+    if (response.statusCode == 200) {
+      return PhotoSyncPageModel.fromJson(response.data);
+    } else {
+      throw Exception('Failed to sync photos');
+    }
+  }
 }
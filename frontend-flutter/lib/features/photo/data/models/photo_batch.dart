@@ -0,0 +1,130 @@
+import 'dart:convert';
+import 'dart:typed_data';
+import 'package:auto_photo_saver_app/core/constants/constants.dart';
+import 'package:auto_photo_saver_app/core/services/adaptive_image_service.dart';
+import 'package:auto_photo_saver_app/core/services/photo_pipeline_service.dart';
+import 'photo_model.dart';
+
+/// WebSocket subprotocol under which the backend packs photo updates
+/// several to a binary frame; the layout is in the backend's photo/wire.py.
+const photoBatchProtocol = 'photo-batch.v1';
+
+/// Decodes one photo-batch.v1 frame into the photos it carries. Throws
+/// [FormatException] on a malformed frame.
+List<PhotoModel> decodePhotoBatch(Uint8List frame) {
+  final reader = _Reader(frame);
+  if (reader.u8() != 1) throw const FormatException('Unknown photo batch');
+  reader.u8(); // Flags.
+  final count = reader.u16();
+  return List.generate(count, (_) => _decodeUpdate(reader), growable: false);
+}
+
+PhotoModel _decodeUpdate(_Reader reader) {
+  final id = reader.i64();
+  final fileSize = reader.i64();
+  final uploadedAt = reader.i64();
+  reader.string(1); // Album; the socket already filters on it.
+  final image = reader.string(1);
+  final originalFileName = reader.string(2);
+
+  ContentDigest? digest;
+  if (reader.u8() == 1) {
+    final value = reader.u32();
+    final blockSize = reader.u32();
+    final blocks = List.generate(reader.u16(), (_) => _hex(reader.u32()));
+    digest = ContentDigest(
+      value: _hex(value),
+      blockSize: blockSize,
+      blocks: blocks,
+    );
+  }
+
+  final variants = List.generate(reader.u8(), (_) {
+    final url = Constants.mediaUrl + reader.string(1);
+    final width = reader.u16();
+    final height = reader.u16();
+    reader.u8(); // Quality.
+    return ImageVariant(
+      url: url,
+      width: width,
+      height: height,
+      fileSize: reader.u32(),
+    );
+  });
+
+  final traceId = reader.string(1);
+  final trace = traceId.isEmpty
+      ? null
+      : ServerTrace(
+          id: traceId,
+          receivedMicros: reader.i64(),
+          storedMicros: reader.i64(),
+          broadcastMicros: reader.i64(),
+        );
+
+  return PhotoModel(
+    id: id,
+    image: Constants.mediaUrl + image,
+    originalFileName: originalFileName,
+    fileSize: fileSize < 0 ? 0 : fileSize,
+    uploadedAt: uploadedAt < 0
+        ? DateTime.now()
+        : DateTime.fromMicrosecondsSinceEpoch(uploadedAt, isUtc: true)
+            .toLocal(),
+    contentDigest: digest,
+    trace: trace,
+    variants: variants,
+  );
+}
+
+String _hex(int value) => value.toRadixString(16).padLeft(8, '0');
+
+class _Reader {
+  final Uint8List _bytes;
+  final ByteData _data;
+  int _offset = 0;
+
+  _Reader(this._bytes) : _data = ByteData.sublistView(_bytes);
+
+  void _need(int count) {
+    if (_offset + count > _bytes.length) {
+      throw const FormatException('Truncated photo batch');
+    }
+  }
+
+  int u8() {
+    _need(1);
+    return _data.getUint8(_offset++);
+  }
+
+  int u16() {
+    _need(2);
+    final value = _data.getUint16(_offset, Endian.little);
+    _offset += 2;
+    return value;
+  }
+
+  int u32() {
+    _need(4);
+    final value = _data.getUint32(_offset, Endian.little);
+    _offset += 4;
+    return value;
+  }
+
+  int i64() {
+    _need(8);
+    final value = _data.getInt64(_offset, Endian.little);
+    _offset += 8;
+    return value;
+  }
+
+  String string(int lengthBytes) {
+    final length = lengthBytes == 1 ? u8() : u16();
+    _need(length);
+    final value = utf8.decode(
+      Uint8List.sublistView(_bytes, _offset, _offset + length),
+    );
+    _offset += length;
+    return value;
+  }
+}
@@ -1,4 +1,6 @@
 import 'package:auto_photo_saver_app/core/constants/constants.dart';
+import 'package:auto_photo_saver_app/core/services/adaptive_image_service.dart';
+import 'package:auto_photo_saver_app/core/services/photo_pipeline_service.dart';
 
 import '../../domain/entities/photo.dart';
 
@@ -8,6 +10,9 @@ class PhotoModel {
   final String originalFileName;
   final int fileSize;
   final DateTime uploadedAt;
+  final ContentDigest? contentDigest;
+  final ServerTrace? trace;
+  final List<ImageVariant> variants;
 
   PhotoModel({
     required this.id,
@@ -15,15 +20,34 @@ class PhotoModel {
     required this.originalFileName,
     required this.fileSize,
     required this.uploadedAt,
+    this.contentDigest,
+    this.trace,
+    this.variants = const [],
   });
 
-  factory PhotoModel.fromJson(Map<String, dynamic> json) {
+  /// [trace] is the `trace` sent alongside the photo in `photo_update`; an
+  /// upload's own response carries it inside [json].
+  factory PhotoModel.fromJson(
+    Map<String, dynamic> json, {
+    Map<String, dynamic>? trace,
+  }) {
     return PhotoModel(
       id: json['id'],
       image: Constants.mediaUrl + json['image'],
       originalFileName: json['original_file_name'],
       fileSize: json['file_size'],
       uploadedAt: DateTime.parse(json['uploaded_at']).toLocal(),
+      contentDigest: ContentDigest.fromJson(json['content_digest']),
+      trace: ServerTrace.fromJson(trace ?? json['trace']),
+      variants: [
+        for (final variant in json['variants'] ?? const [])
+          ImageVariant(
+            url: Constants.mediaUrl + variant['image'],
+            width: variant['width'],
+            height: variant['height'],
+            fileSize: variant['file_size'],
+          ),
+      ],
     );
   }
 
@@ -33,5 +57,8 @@ class PhotoModel {
     originalFileName: originalFileName,
     fileSize: fileSize,
     uploadedAt: uploadedAt,
+    contentDigest: contentDigest,
+    trace: trace,
+    variants: variants,
   );
 }
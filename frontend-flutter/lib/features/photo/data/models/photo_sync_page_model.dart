@@ -0,0 +1,35 @@
+import '../../domain/entities/photo_sync_page.dart';
+import 'photo_model.dart';
+
+class PhotoSyncPageModel {
+  final List<PhotoModel> photos;
+  final int cursor;
+  final bool hasMore;
+  final bool historyTruncated;
+
+  PhotoSyncPageModel({
+    required this.photos,
+    required this.cursor,
+    required this.hasMore,
+    required this.historyTruncated,
+  });
+
+  factory PhotoSyncPageModel.fromJson(Map<String, dynamic> json) {
+    return PhotoSyncPageModel(
+      photos: [
+        for (final photo in json['photos'] ?? const [])
+          PhotoModel.fromJson(photo),
+      ],
+      cursor: json['cursor'],
+      hasMore: json['has_more'] ?? false,
+      historyTruncated: json['history_truncated'] ?? false,
+    );
+  }
+
+  PhotoSyncPage toEntity() => PhotoSyncPage(
+    photos: [for (final photo in photos) photo.toEntity()],
+    cursor: cursor,
+    hasMore: hasMore,
+    historyTruncated: historyTruncated,
+  );
+}
@@ -1,6 +1,7 @@
 import 'package:dartz/dartz.dart';
 import '../../../../core/constants/constants.dart';
 import '../../domain/entities/photo.dart';
+import '../../domain/entities/photo_sync_page.dart';
 import '../../domain/repositories/photo_repository.dart';
 import '../../../../core/error/failure.dart';
 import '../datasources/photo_remote_data_source.dart';
@@ -10,9 +11,23 @@ class PhotoRepositoryImpl implements PhotoRepository {
   PhotoRepositoryImpl(this.remoteDataSource);
 
   @override
-  Future<Either<Failure, Photo>> getLatestPhoto() async {
+  Future<Either<Failure, Photo?>> getLatestPhoto({
+    bool conditional = true,
+  }) async {
     try {
-      final model = await remoteDataSource.getLatestPhoto();
+      final model = await remoteDataSource.getLatestPhoto(
+        conditional: conditional,
+      );
+      return Right(model?.toEntity());
+    } catch (e) {
+      return Left(ServerFailure(Constants.serverErrorMessage));
+    }
+  }
+
+  @override
+  Future<Either<Failure, PhotoSyncPage>> getPhotosSince(int cursor) async {
+    try {
+      final model = await remoteDataSource.getPhotosSince(cursor);
       return Right(model.toEntity());
     } catch (e) {
       return Left(ServerFailure(Constants.serverErrorMessage));
@@ -1,14 +1,16 @@
 import 'dart:async';
 import 'dart:convert';
+import 'dart:typed_data';
 import 'package:web_socket_channel/web_socket_channel.dart';
 import 'package:rxdart/rxdart.dart';
 import '../../../../core/constants/constants.dart';
+import '../models/photo_batch.dart';
 import '../models/photo_model.dart';
 
 enum WebSocketStatus { connected, disconnected, connecting, error }
 
 class PhotoWebSocketService {
-  static final String _wsUrl = Constants.wsUrl;
+  static String get _wsUrl => Constants.wsUrl;
   WebSocketChannel? _channel;
   final _errorController = StreamController<String>.broadcast();
   final BehaviorSubject<WebSocketStatus> _statusController =
@@ -23,7 +25,12 @@ class PhotoWebSocketService {
     if (_disposed) return;
     _statusController.add(WebSocketStatus.connecting);
     try {
-      _channel = WebSocketChannel.connect(Uri.parse(_wsUrl));
+      // Offer the binary photo-batch protocol; a server that does not speak
+      // it keeps sending JSON, which is still understood below.
+      _channel = WebSocketChannel.connect(
+        Uri.parse(_wsUrl),
+        protocols: const [photoBatchProtocol],
+      );
       _statusController.add(WebSocketStatus.connected);
       _channelSubscription?.cancel();
       _channelSubscription = _channel!.stream.listen(
@@ -47,9 +54,18 @@ class PhotoWebSocketService {
 
   void _handleMessage(dynamic message) {
     try {
+      if (message is List<int>) {
+        final frame = message is Uint8List
+            ? message
+            : Uint8List.fromList(message);
+        decodePhotoBatch(frame).forEach(_photoUpdatesController.add);
+        return;
+      }
       final data = jsonDecode(message);
       if (data['type'] == 'photo_update' && data['image'] != null) {
-        _photoUpdatesController.add(PhotoModel.fromJson(data['image']));
+        _photoUpdatesController.add(
+          PhotoModel.fromJson(data['image'], trace: data['trace']),
+        );
       }
     } catch (e) {
       _errorController.add('WebSocket message error: ${e.toString()}');
@@ -1,3 +1,5 @@
+import 'package:auto_photo_saver_app/core/services/adaptive_image_service.dart';
+import 'package:auto_photo_saver_app/core/services/photo_pipeline_service.dart';
 import 'package:equatable/equatable.dart';
 
 class Photo extends Equatable {
@@ -7,6 +9,13 @@ class Photo extends Equatable {
   final int fileSize;
   final DateTime uploadedAt;
   final DateTime? lastDownloadDate;
+  final ContentDigest? contentDigest;
+
+  /// Set on photos announced live over the WebSocket.
+  final ServerTrace? trace;
+
+  /// Downscaled copies of [image], smallest first.
+  final List<ImageVariant> variants;
 
   const Photo({
     required this.id,
@@ -15,6 +24,9 @@ class Photo extends Equatable {
     required this.fileSize,
     required this.uploadedAt,
     this.lastDownloadDate,
+    this.contentDigest,
+    this.trace,
+    this.variants = const [],
   });
 
   Photo copyWith({
@@ -24,6 +36,9 @@ class Photo extends Equatable {
     int? fileSize,
     DateTime? uploadedAt,
     DateTime? lastDownloadDate,
+    ContentDigest? contentDigest,
+    ServerTrace? trace,
+    List<ImageVariant>? variants,
   }) {
     return Photo(
       id: id ?? this.id,
@@ -32,6 +47,9 @@ class Photo extends Equatable {
       fileSize: fileSize ?? this.fileSize,
       uploadedAt: uploadedAt ?? this.uploadedAt,
       lastDownloadDate: lastDownloadDate ?? this.lastDownloadDate,
+      contentDigest: contentDigest ?? this.contentDigest,
+      trace: trace ?? this.trace,
+      variants: variants ?? this.variants,
     );
   }
 
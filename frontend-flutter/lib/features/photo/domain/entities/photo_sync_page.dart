@@ -0,0 +1,21 @@
+import 'photo.dart';
+
+/// Photos uploaded after a sync cursor, oldest first.
+class PhotoSyncPage {
+  final List<Photo> photos;
+
+  /// Pass back as the cursor to get the next page.
+  final int cursor;
+  final bool hasMore;
+
+  /// Some photos after the requested cursor are gone from the server's
+  /// history and cannot be caught up on.
+  final bool historyTruncated;
+
+  const PhotoSyncPage({
+    required this.photos,
+    required this.cursor,
+    required this.hasMore,
+    this.historyTruncated = false,
+  });
+}
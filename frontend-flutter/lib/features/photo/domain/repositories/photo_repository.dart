@@ -1,7 +1,11 @@
 import 'package:dartz/dartz.dart';
 import '../../../../core/error/failure.dart';
 import '../entities/photo.dart';
+import '../entities/photo_sync_page.dart';
 
 abstract class PhotoRepository {
-  Future<Either<Failure, Photo>> getLatestPhoto();
+  /// Right(null) when the latest photo is still the one last saved; never
+  /// when [conditional] is false.
+  Future<Either<Failure, Photo?>> getLatestPhoto({bool conditional = true});
+  Future<Either<Failure, PhotoSyncPage>> getPhotosSince(int cursor);
 }
@@ -7,7 +7,7 @@ class GetLatestPhoto {
   final PhotoRepository repository;
   GetLatestPhoto(this.repository);
 
-  Future<Either<Failure, Photo>> call() {
-    return repository.getLatestPhoto();
+  Future<Either<Failure, Photo?>> call({bool conditional = true}) {
+    return repository.getLatestPhoto(conditional: conditional);
   }
 }
@@ -0,0 +1,13 @@
+import 'package:dartz/dartz.dart';
+import '../entities/photo_sync_page.dart';
+import '../repositories/photo_repository.dart';
+import '../../../../core/error/failure.dart';
+
+class GetPhotosSince {
+  final PhotoRepository repository;
+  GetPhotosSince(this.repository);
+
+  Future<Either<Failure, PhotoSyncPage>> call(int cursor) {
+    return repository.getPhotosSince(cursor);
+  }
+}
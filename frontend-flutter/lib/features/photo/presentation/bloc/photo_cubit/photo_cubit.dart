@@ -4,6 +4,7 @@ import 'package:auto_photo_saver_app/core/constants/constants.dart';
 import 'package:flutter/foundation.dart';
 import 'package:flutter_bloc/flutter_bloc.dart';
 import 'package:equatable/equatable.dart';
+import 'package:auto_photo_saver_app/core/services/photo_pipeline_service.dart';
 import 'package:auto_photo_saver_app/core/services/shared_prefs_service.dart';
 import '../../../../../core/error/failure.dart';
 import '../../../domain/entities/photo.dart';
@@ -13,6 +14,7 @@ import '../../../../../core/network/network_info.dart';
 import '../../../data/services/photo_websocket_service.dart';
 import '../../../data/models/photo_model.dart';
 import '../../../domain/usecases/get_latest_photo.dart';
+import '../../../domain/usecases/get_photos_since.dart';
 
 part 'photo_state.dart';
 
@@ -20,7 +22,9 @@ class PhotoCubit extends Cubit<PhotoState> {
   final SharedPrefsService sharedPrefsService;
   final PhotoWebSocketService webSocketService;
   final GetLatestPhoto getLatestPhoto;
+  final GetPhotosSince getPhotosSince;
   int? _lastPhotoId;
+  bool _catchingUp = false;
   Photo? _latestPhoto;
   StreamSubscription<PhotoModel>? _wsSubscription;
   StreamSubscription<String>? _wsErrorSubscription;
@@ -29,13 +33,14 @@ class PhotoCubit extends Cubit<PhotoState> {
     this.sharedPrefsService,
     this.webSocketService,
     this.getLatestPhoto,
+    this.getPhotosSince,
   ) : super(PhotoInitial());
 
   void updateNetworkType(NetworkType type) {
     debugPrint('Network type changed to: $type');
     if (type == NetworkType.wifi || type == NetworkType.ethernet) {
       _startWebSocket();
-      _fetchLatestPhoto(); // Fetch latest photo when network becomes available
+      _catchUp(); // Save what was uploaded while the network was away
     } else {
       _stopWebSocket();
     }
@@ -60,6 +65,11 @@ class PhotoCubit extends Cubit<PhotoState> {
         final localPath = await GallerySaverUtils.saveImageToGallery(
           photo.image,
           photo.originalFileName,
+          photoId: photo.id,
+          uploadedAt: photo.uploadedAt.toIso8601String(),
+          expectedSize: photo.fileSize,
+          digest: photo.contentDigest,
+          trace: photo.trace,
         );
         await _saveLastPhoto(photo, localPath ? photo.image : null);
         if (localPath) {
@@ -100,12 +110,34 @@ class PhotoCubit extends Cubit<PhotoState> {
     webSocketService.disconnect();
   }
 
-  Future<void> _fetchLatestPhoto({bool emitLoading = true}) async {
+  Future<void> _fetchLatestPhoto({
+    bool emitLoading = true,
+    bool conditional = true,
+  }) async {
     if (emitLoading) {
       emit(PhotoLoading());
     }
-    final result = await getLatestPhoto();
+    final result = await getLatestPhoto(conditional: conditional);
     result.fold((failure) => emit(_mapFailureToState(failure)), (photo) async {
+      if (photo == null) {
+        // 304: the saved photo is still the latest
+        final latest = _latestPhoto;
+        if (latest == null) {
+          // Nothing to show for it, so ask for the photo itself
+          if (conditional) {
+            await _fetchLatestPhoto(emitLoading: false, conditional: false);
+          }
+          return;
+        }
+        emit(
+          PhotoLoaded(
+            latest.copyWith(
+              lastDownloadDate: sharedPrefsService.lastDownloadDate,
+            ),
+          ),
+        );
+        return;
+      }
       if (_lastPhotoId == photo.id) {
         final lastDownloadDate = sharedPrefsService.lastDownloadDate;
         emit(PhotoLoaded(photo.copyWith(lastDownloadDate: lastDownloadDate)));
@@ -113,12 +145,18 @@ class PhotoCubit extends Cubit<PhotoState> {
       }
 
       _lastPhotoId = photo.id;
+      _latestPhoto = photo;
       final lastDownloadDate = DateTime.now();
 
       try {
         final localPath = await GallerySaverUtils.saveImageToGallery(
           photo.image,
           photo.originalFileName,
+          photoId: photo.id,
+          uploadedAt: photo.uploadedAt.toIso8601String(),
+          expectedSize: photo.fileSize,
+          digest: photo.contentDigest,
+          trace: photo.trace,
         );
 
         await _saveLastPhoto(photo, localPath ? photo.image : null);
@@ -133,6 +171,75 @@ class PhotoCubit extends Cubit<PhotoState> {
     });
   }
 
+  /// Saves every photo uploaded after the last saved one, a page at a time,
+  /// and shows the newest. Stops at the first photo that fails so the next
+  /// reconnect retries from there. Without a saved photo to resume from,
+  /// only the latest is fetched.
+  Future<void> _catchUp() async {
+    final cursor = _lastPhotoId;
+    if (cursor == null) return _fetchLatestPhoto();
+    if (_catchingUp) return;
+    _catchingUp = true;
+    try {
+      var since = cursor;
+      Photo? newest;
+      var failed = false;
+      while (!failed) {
+        final result = await getPhotosSince(since);
+        final page = result.fold((failure) {
+          emit(_mapFailureToState(failure));
+          return null;
+        }, (page) => page);
+        if (page == null) break;
+        if (page.historyTruncated) {
+          debugPrint('Some photos after #$since are no longer on the server');
+        }
+
+        final saved = await GallerySaverUtils.saveAllToGallery([
+          for (final photo in page.photos)
+            PipelinePhoto(
+              id: photo.id,
+              url: photo.image,
+              fileName: photo.originalFileName,
+              uploadedAt: photo.uploadedAt.toIso8601String(),
+              expectedSize: photo.fileSize,
+              digest: photo.contentDigest,
+            ),
+        ]);
+        for (final photo in page.photos) {
+          if (!saved.contains(photo.id)) {
+            failed = true;
+            break;
+          }
+          newest = photo;
+        }
+        if (newest != null && newest.id > (_lastPhotoId ?? 0)) {
+          // A photo saved live meanwhile may already be newer
+          _lastPhotoId = newest.id;
+          _latestPhoto = newest;
+          await _saveLastPhoto(newest, newest.image);
+        }
+        if (!page.hasMore) break;
+        since = page.cursor;
+      }
+
+      if (failed) {
+        emit(
+          PhotoErrorState(
+            message: Constants.serverErrorMessage,
+            photo: _latestPhoto,
+          ),
+        );
+      } else if (newest != null) {
+        final photo = newest.copyWith(lastDownloadDate: DateTime.now());
+        emit(PhotoImageSaved(photo: photo));
+        emit(PhotoLoaded(photo));
+      }
+    } finally {
+      _catchingUp = false;
+    }
+  }
+
   Future<void> loadLastPhotoFromStorage() async {
     final prefs = sharedPrefsService;
     final id = prefs.lastPhotoId;
@@ -160,13 +267,14 @@ class PhotoCubit extends Cubit<PhotoState> {
   }
 
   Future<void> _saveLastPhoto(Photo photo, String? localPath) async {
-    final prefs = sharedPrefsService;
-    await prefs.setLastPhotoId(photo.id);
-    await prefs.setLastPhotoPath(localPath ?? photo.image);
-    await prefs.setLastPhotoFileName(photo.originalFileName);
-    await prefs.setLastPhotoUploadedAt(photo.uploadedAt.toIso8601String());
-    await prefs.setLastPhotoFileSize(photo.fileSize);
-    await prefs.setLastDownloadDate(DateTime.now());
+    await sharedPrefsService.setLastPhoto(
+      id: photo.id,
+      path: localPath ?? photo.image,
+      fileName: photo.originalFileName,
+      uploadedAt: photo.uploadedAt.toIso8601String(),
+      fileSize: photo.fileSize,
+      downloadDate: DateTime.now(),
+    );
   }
 
   PhotoState _mapFailureToState(Failure failure) {
@@ -3,7 +3,7 @@ import '../../domain/entities/photo.dart';
 import '../../../../core/utils/date_time_utils.dart';
 import '../../../../core/utils/file_size_utils.dart';
 import '../../../../core/extensions/localization_extension.dart';
-import 'package:auto_photo_saver_app/core/widgets/custom_cached_image.dart';
+import 'package:auto_photo_saver_app/core/widgets/native_preview_image.dart';
 
 class PhotoCard extends StatelessWidget {
   final Photo photo;
@@ -30,8 +30,10 @@ class PhotoCard extends StatelessWidget {
               mainAxisSize: MainAxisSize.min,
               crossAxisAlignment: CrossAxisAlignment.center,
               children: [
-                CustomCachedImage(
+                NativePreviewImage(
                   imageUrl: photo.image,
+                  variants: photo.variants,
+                  originalSize: photo.fileSize,
                   height: 270,
                   width: double.infinity,
                   fit: BoxFit.contain,
@@ -1,10 +1,17 @@
 import 'package:flutter/material.dart';
 import 'app.dart';
+import 'core/constants/constants.dart';
 import 'di/di.dart';
 import 'core/services/background_service.dart';
 
-void main() async {
+void main(List<String> args) async {
   WidgetsFlutterBinding.ensureInitialized();
+  // --backend=URL talks to another server than the production one.
+  for (final arg in args) {
+    if (arg.startsWith('--backend=')) {
+      Constants.useBackend(arg.substring('--backend='.length));
+    }
+  }
   await setupLocator();
 
   // Initialize background service
@@ -0,0 +1,38 @@
+#include "fault_plan.h"
+
+FaultPlan::FaultPlan(const FaultOptions& options)
+    : options_(options), random_(options.seed) {}
+
+bool FaultPlan::Chance(double probability) {
+  if (probability <= 0) return false;
+  return std::uniform_real_distribution<double>(0, 1)(random_) < probability;
+}
+
+int64_t FaultPlan::Delay() {
+  int64_t delay = options_.latency_us;
+  if (options_.jitter_us > 0) {
+    delay += std::uniform_int_distribution<int64_t>(
+        0, options_.jitter_us - 1)(random_);
+  }
+  return delay;
+}
+
+bool FaultPlan::LoseUpdate() { return Chance(options_.loss); }
+
+int64_t FaultPlan::NextDisconnect() {
+  if (options_.disconnect_mean_us <= 0) return -1;
+  // Drops arrive as a Poisson process, so a connection's age says nothing
+  // about when it will go.
+  double mean = double(options_.disconnect_mean_us);
+  return int64_t(std::exponential_distribution<double>(1 / mean)(random_)) + 1;
+}
+
+int64_t FaultPlan::CutAt(int64_t size) {
+  if (size < 2 || !Chance(options_.cut_media)) return -1;
+  return std::uniform_int_distribution<int64_t>(1, size - 1)(random_);
+}
+
+int64_t FaultPlan::CorruptAt(int64_t size) {
+  if (size < 1 || !Chance(options_.corrupt_media)) return -1;
+  return std::uniform_int_distribution<int64_t>(0, size - 1)(random_);
+}
@@ -0,0 +1,58 @@
+#ifndef BACKEND_STANDIN_FAULT_PLAN_H_
+#define BACKEND_STANDIN_FAULT_PLAN_H_
+
+#include <cstdint>
+#include <random>
+
+// What the network between the stand-in and its clients should look like.
+// Zero everywhere is a perfect network.
+struct FaultOptions {
+  // Added before every response and WebSocket message; the jitter is drawn
+  // uniformly from [0, jitter_us) on top. Order on a connection is kept.
+  int64_t latency_us = 0;
+  int64_t jitter_us = 0;
+  // Per connection, in bytes per second; 0 is unlimited.
+  int64_t bandwidth = 0;
+  // Chance that a photo_update is never sent to a given socket.
+  double loss = 0;
+  // Mean time a WebSocket stays up before it is dropped without a close
+  // frame; 0 never drops one.
+  int64_t disconnect_mean_us = 0;
+  // Chance that a media body stops partway and the connection is closed.
+  double cut_media = 0;
+  // Chance that one byte of a media body is flipped on the way out.
+  double corrupt_media = 0;
+  uint32_t seed = 1;
+};
+
+/**
+ * Draws every fault from one seeded generator. The server is single
+ * threaded and asks in a fixed order for a fixed sequence of requests, so a
+ * run with the same seed, recording and client behaviour injects the same
+ * faults at the same places.
+ */
+class FaultPlan {
+ public:
+  explicit FaultPlan(const FaultOptions& options);
+
+  const FaultOptions& options() const { return options_; }
+
+  // How long to hold the next response or message back.
+  int64_t Delay();
+  // True when a photo_update should be dropped for one socket.
+  bool LoseUpdate();
+  // Microseconds until a socket opened now should be dropped; -1 for never.
+  int64_t NextDisconnect();
+  // Where to cut a media body of |size| bytes, or -1 to send all of it.
+  int64_t CutAt(int64_t size);
+  // Which byte of a media body of |size| bytes to flip, or -1 for none.
+  int64_t CorruptAt(int64_t size);
+
+ private:
+  bool Chance(double probability);
+
+  const FaultOptions options_;
+  std::mt19937 random_;
+};
+
+#endif  // BACKEND_STANDIN_FAULT_PLAN_H_
@@ -0,0 +1,190 @@
+#include <curl/curl.h>
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "recording.h"
+#include "standin_server.h"
+
+namespace {
+
+void Usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "       %s --record DIR --upstream URL [--album NAME]...\n"
+          "Stands in for the backend in native performance tests: serves the\n"
+          "photo API, media and WebSocket notifications, replaying a\n"
+          "recording through a network with the faults asked for. Point the\n"
+          "app at it with --backend=http://HOST:PORT.\n"
+          "\n"
+          "  --host HOST             address to listen on (127.0.0.1)\n"
+          "  --port PORT             port to listen on (8010)\n"
+          "  --recording DIR         photos to replay (none: only uploads)\n"
+          "  --speed X               replay X times faster (1)\n"
+          "  --loop                  start the replay over when it ends\n"
+          "  --preload               publish the whole recording at start,\n"
+          "                          as history to catch up on\n"
+          "  --start-on-connect      hold the replay until a WebSocket opens\n"
+          "  --batch-window-ms MS    photo-batch sockets get the updates of\n"
+          "                          this window in one frame (10)\n"
+          "  --batch-max N           and at most N per frame (64)\n"
+          "\n"
+          "Faults, drawn from one seeded generator:\n"
+          "  --latency-ms MS         added to every response and message (0)\n"
+          "  --jitter-ms MS          up to this much more, at random (0)\n"
+          "  --bandwidth BYTES       per connection and second (unlimited)\n"
+          "  --loss P                chance a photo_update is not sent (0)\n"
+          "  --disconnect-ms MS      mean WebSocket lifetime before it is\n"
+          "                          dropped without a close frame (never)\n"
+          "  --cut-media P           chance a media body stops partway (0)\n"
+          "  --corrupt-media P       chance a media body has a byte\n"
+          "                          flipped (0)\n"
+          "  --seed N                seed for all of the above (1)\n"
+          "\n"
+          "Recording:\n"
+          "  --record DIR            save the photos of --upstream to DIR and\n"
+          "                          exit\n"
+          "  --upstream URL          backend to record, e.g.\n"
+          "                          https://example.com\n"
+          "  --album NAME            album to record; repeat for more (the\n"
+          "                          default album)\n",
+          program, program);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  static const option kOptions[] = {
+      {"host", required_argument, nullptr, 'h'},
+      {"port", required_argument, nullptr, 'p'},
+      {"recording", required_argument, nullptr, 'r'},
+      {"speed", required_argument, nullptr, 's'},
+      {"loop", no_argument, nullptr, 'l'},
+      {"preload", no_argument, nullptr, 'P'},
+      {"start-on-connect", no_argument, nullptr, 'S'},
+      {"batch-window-ms", required_argument, nullptr, 'w'},
+      {"batch-max", required_argument, nullptr, 'm'},
+      {"latency-ms", required_argument, nullptr, 'L'},
+      {"jitter-ms", required_argument, nullptr, 'j'},
+      {"bandwidth", required_argument, nullptr, 'b'},
+      {"loss", required_argument, nullptr, 'x'},
+      {"disconnect-ms", required_argument, nullptr, 'd'},
+      {"cut-media", required_argument, nullptr, 'c'},
+      {"corrupt-media", required_argument, nullptr, 'C'},
+      {"seed", required_argument, nullptr, 'z'},
+      {"record", required_argument, nullptr, 'R'},
+      {"upstream", required_argument, nullptr, 'u'},
+      {"album", required_argument, nullptr, 'a'},
+      {"help", no_argument, nullptr, '?'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  StandinOptions options;
+  std::string recording_dir;
+  std::string record_dir;
+  std::string upstream;
+  std::vector<std::string> albums;
+  int option;
+  while ((option = getopt_long(argc, argv, "", kOptions, nullptr)) != -1) {
+    switch (option) {
+      case 'h':
+        options.host = optarg;
+        break;
+      case 'p':
+        options.port = atoi(optarg);
+        break;
+      case 'r':
+        recording_dir = optarg;
+        break;
+      case 's':
+        options.speed = atof(optarg);
+        break;
+      case 'l':
+        options.loop = true;
+        break;
+      case 'P':
+        options.preload = true;
+        break;
+      case 'S':
+        options.start_on_connect = true;
+        break;
+      case 'w':
+        options.batch_window_us = int64_t(atoll(optarg)) * 1000;
+        break;
+      case 'm':
+        options.batch_max = atoi(optarg);
+        break;
+      case 'L':
+        options.faults.latency_us = int64_t(atoll(optarg)) * 1000;
+        break;
+      case 'j':
+        options.faults.jitter_us = int64_t(atoll(optarg)) * 1000;
+        break;
+      case 'b':
+        options.faults.bandwidth = atoll(optarg);
+        break;
+      case 'x':
+        options.faults.loss = atof(optarg);
+        break;
+      case 'd':
+        options.faults.disconnect_mean_us = int64_t(atoll(optarg)) * 1000;
+        break;
+      case 'c':
+        options.faults.cut_media = atof(optarg);
+        break;
+      case 'C':
+        options.faults.corrupt_media = atof(optarg);
+        break;
+      case 'z':
+        options.faults.seed = uint32_t(strtoul(optarg, nullptr, 10));
+        break;
+      case 'R':
+        record_dir = optarg;
+        break;
+      case 'u':
+        upstream = optarg;
+        break;
+      case 'a':
+        albums.push_back(optarg);
+        break;
+      default:
+        Usage(argv[0]);
+        return 2;
+    }
+  }
+  if (optind != argc || options.port <= 0 || options.speed <= 0 ||
+      options.batch_window_us < 0 || options.batch_max <= 0 ||
+      options.faults.latency_us < 0 || options.faults.jitter_us < 0 ||
+      options.faults.bandwidth < 0 ||
+      (record_dir.empty() != upstream.empty())) {
+    Usage(argv[0]);
+    return 2;
+  }
+
+  Recording recording;
+  std::string error;
+  if (!record_dir.empty()) {
+    if (albums.empty()) albums.push_back("");
+    while (!upstream.empty() && upstream.back() == '/') upstream.pop_back();
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    bool ok = recording.Fetch(upstream, albums, &error) &&
+              recording.Save(record_dir, &error);
+    curl_global_cleanup();
+    if (!ok) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 1;
+    }
+    printf("Recorded %zu photos to %s\n", recording.photos.size(),
+           record_dir.c_str());
+    return 0;
+  }
+
+  if (!recording_dir.empty() && !recording.Load(recording_dir, &error)) {
+    fprintf(stderr, "%s\n", error.c_str());
+    return 1;
+  }
+  return StandinServer(options, std::move(recording)).Run();
+}
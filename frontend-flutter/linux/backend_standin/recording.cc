@@ -0,0 +1,317 @@
+#include "recording.h"
+
+#include <curl/curl.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "crc32c.h"
+
+namespace {
+
+const int kSyncPageSize = 200;
+
+size_t AppendToString(char* data, size_t size, size_t count, void* user_data) {
+  static_cast<std::string*>(user_data)->append(data, size * count);
+  return size * count;
+}
+
+bool HttpGet(CURL* curl, const std::string& url, std::string* body,
+             std::string* error) {
+  body->clear();
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, AppendToString);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, body);
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, 120L);
+  CURLcode code = curl_easy_perform(curl);
+  long status = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+  if (code != CURLE_OK || status != 200) {
+    *error = url + ": " +
+             (code != CURLE_OK ? curl_easy_strerror(code)
+                               : "HTTP " + std::to_string(status));
+    return false;
+  }
+  return true;
+}
+
+bool ParseJson(const std::string& text, Json::Value* value,
+               std::string* error) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  return reader->parse(text.data(), text.data() + text.size(), value, error);
+}
+
+std::string Escape(CURL* curl, const std::string& text) {
+  char* escaped = curl_easy_escape(curl, text.data(), int(text.size()));
+  std::string result = escaped != nullptr ? escaped : "";
+  curl_free(escaped);
+  return result;
+}
+
+// Media names come from the recording or the server; neither may point
+// outside the media directory.
+bool SafeName(const std::string& name) {
+  return !name.empty() && name.find('/') == std::string::npos &&
+         name != "." && name != "..";
+}
+
+std::string Hex(uint32_t value) {
+  char text[9];
+  snprintf(text, sizeof(text), "%08x", value);
+  return text;
+}
+
+}  // namespace
+
+std::string FormatTimestamp(int64_t time_us) {
+  time_t seconds = time_t(time_us / 1000000);
+  tm utc;
+  gmtime_r(&seconds, &utc);
+  char text[40];
+  size_t length = strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &utc);
+  snprintf(text + length, sizeof(text) - length, ".%06" PRId64 "Z",
+           time_us % 1000000);
+  return text;
+}
+
+int64_t ParseTimestamp(const std::string& text) {
+  tm parts = {};
+  int consumed = 0;
+  if (sscanf(text.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d%n", &parts.tm_year,
+             &parts.tm_mon, &parts.tm_mday, &parts.tm_hour, &parts.tm_min,
+             &parts.tm_sec, &consumed) != 6) {
+    return -1;
+  }
+  parts.tm_year -= 1900;
+  parts.tm_mon -= 1;
+  int64_t result = int64_t(timegm(&parts)) * 1000000;
+
+  const char* rest = text.c_str() + consumed;
+  if (*rest == '.') {
+    int64_t scale = 100000;
+    for (rest++; *rest >= '0' && *rest <= '9'; rest++) {
+      result += (*rest - '0') * scale;
+      scale /= 10;
+    }
+  }
+  int hours = 0;
+  int minutes = 0;
+  if ((*rest == '+' || *rest == '-') &&
+      sscanf(rest + 1, "%2d:%2d", &hours, &minutes) == 2) {
+    int64_t offset = (hours * 60 + minutes) * 60 * 1000000LL;
+    result += *rest == '+' ? -offset : offset;
+  }
+  return result;
+}
+
+void Recording::Digest(RecordedPhoto* photo) {
+  const std::string& body = *photo->body;
+  photo->block_crc32cs.clear();
+  for (size_t begin = 0; begin < body.size(); begin += kBlockSize) {
+    size_t length = std::min(kBlockSize, body.size() - begin);
+    photo->block_crc32cs.push_back(Crc32c(0, body.data() + begin, length));
+  }
+  photo->crc32c = Crc32c(0, body.data(), body.size());
+}
+
+Json::Value Recording::ToJson(const RecordedPhoto& photo, int64_t id,
+                              const std::string& uploaded_at) {
+  Json::Value blocks(Json::arrayValue);
+  for (uint32_t block : photo.block_crc32cs) blocks.append(Hex(block));
+  Json::Value digest;
+  digest["algorithm"] = "crc32c";
+  digest["value"] = Hex(photo.crc32c);
+  digest["block_size"] = Json::Int64(kBlockSize);
+  digest["blocks"] = blocks;
+
+  Json::Value value;
+  value["id"] = Json::Int64(id);
+  value["album"] = photo.album;
+  value["image"] = photo.image;
+  value["original_file_name"] = photo.original_file_name;
+  value["file_size"] = Json::Int64(photo.body->size());
+  value["uploaded_at"] = uploaded_at;
+  value["content_digest"] = digest;
+  value["variants"] = Json::Value(Json::arrayValue);
+  return value;
+}
+
+bool Recording::Load(const std::string& directory, std::string* error) {
+  std::ifstream index(directory + "/photos.jsonl");
+  if (!index) {
+    *error = "Cannot read " + directory + "/photos.jsonl";
+    return false;
+  }
+  photos.clear();
+  // Photos published more than once share their bytes.
+  std::map<std::string, std::shared_ptr<const std::string>> bodies;
+  std::string line;
+  for (int number = 1; std::getline(index, line); number++) {
+    if (line.empty()) continue;
+    Json::Value value;
+    std::string reason;
+    RecordedPhoto photo;
+    if (ParseJson(line, &value, &reason) && value.isObject()) {
+      photo.album = value.get("album", "").asString();
+      photo.image = value.get("image", "").asString();
+      photo.original_file_name =
+          value.get("original_file_name", photo.image).asString();
+      photo.offset_us = value.get("offset_us", 0).asInt64();
+    }
+    if (!SafeName(photo.image)) {
+      *error = directory + "/photos.jsonl:" + std::to_string(number) +
+               ": not a photo " + reason;
+      return false;
+    }
+
+    std::shared_ptr<const std::string>& body = bodies[photo.image];
+    if (body == nullptr) {
+      std::string path = directory + "/media/" + photo.image;
+      std::ifstream file(path, std::ios::binary);
+      if (!file) {
+        *error = "Cannot read " + path;
+        return false;
+      }
+      std::ostringstream bytes;
+      bytes << file.rdbuf();
+      body = std::make_shared<const std::string>(bytes.str());
+    }
+    photo.body = body;
+    Digest(&photo);
+    photos.push_back(std::move(photo));
+  }
+  std::stable_sort(photos.begin(), photos.end(),
+                   [](const RecordedPhoto& a, const RecordedPhoto& b) {
+                     return a.offset_us < b.offset_us;
+                   });
+  return true;
+}
+
+bool Recording::Save(const std::string& directory, std::string* error) const {
+  std::string media = directory + "/media";
+  for (const std::string& path : {directory, media}) {
+    if (mkdir(path.c_str(), 0755) != 0 && errno != EEXIST) {
+      *error = "Cannot create " + path + ": " + strerror(errno);
+      return false;
+    }
+  }
+
+  Json::StreamWriterBuilder builder;
+  builder["indentation"] = "";
+  std::ofstream index(directory + "/photos.jsonl", std::ios::trunc);
+  for (const RecordedPhoto& photo : photos) {
+    Json::Value value;
+    value["offset_us"] = Json::Int64(photo.offset_us);
+    value["album"] = photo.album;
+    value["image"] = photo.image;
+    value["original_file_name"] = photo.original_file_name;
+    index << Json::writeString(builder, value) << '\n';
+
+    std::ofstream file(media + "/" + photo.image,
+                       std::ios::binary | std::ios::trunc);
+    file.write(photo.body->data(), std::streamsize(photo.body->size()));
+    if (!file) {
+      *error = "Cannot write " + media + "/" + photo.image;
+      return false;
+    }
+  }
+  if (!index.flush()) {
+    *error = "Cannot write " + directory + "/photos.jsonl";
+    return false;
+  }
+  return true;
+}
+
+bool Recording::Fetch(const std::string& server,
+                      const std::vector<std::string>& albums,
+                      std::string* error) {
+  CURL* curl = curl_easy_init();
+  if (curl == nullptr) {
+    *error = "curl_easy_init failed";
+    return false;
+  }
+
+  // Ids are shared by every album, so they give the order photos were
+  // published in across all of them.
+  std::map<int64_t, std::pair<RecordedPhoto, int64_t>> found;
+  bool ok = true;
+  for (const std::string& album : albums) {
+    int64_t since = 0;
+    for (bool more = true; ok && more;) {
+      std::string url = server + "/api/photo/sync/?since=" +
+                        std::to_string(since) + "&limit=" +
+                        std::to_string(kSyncPageSize) +
+                        "&album=" + Escape(curl, album);
+      std::string body;
+      Json::Value page;
+      std::string reason;
+      if (!HttpGet(curl, url, &body, error)) {
+        ok = false;
+      } else if (!ParseJson(body, &page, &reason) || !page.isObject() ||
+                 !page["photos"].isArray()) {
+        *error = url + ": unexpected answer " + reason;
+        ok = false;
+      }
+      if (!ok) break;
+
+      for (const Json::Value& value : page["photos"]) {
+        RecordedPhoto photo;
+        photo.album = album;
+        photo.image = value.get("image", "").asString();
+        photo.original_file_name =
+            value.get("original_file_name", photo.image).asString();
+        if (!SafeName(photo.image)) continue;
+        int64_t uploaded_us =
+            ParseTimestamp(value.get("uploaded_at", "").asString());
+        found[value.get("id", 0).asInt64()] =
+            std::make_pair(std::move(photo), uploaded_us);
+      }
+      int64_t cursor = page.get("cursor", since).asInt64();
+      more = page.get("has_more", false).asBool() && cursor > since;
+      since = cursor;
+    }
+  }
+
+  photos.clear();
+  std::map<std::string, std::shared_ptr<const std::string>> bodies;
+  int64_t first_us = -1;
+  int64_t last_offset = 0;
+  for (auto& entry : found) {
+    if (!ok) break;
+    RecordedPhoto& photo = entry.second.first;
+    int64_t uploaded_us = entry.second.second;
+    std::shared_ptr<const std::string>& body = bodies[photo.image];
+    if (body == nullptr) {
+      auto bytes = std::make_shared<std::string>();
+      if (!HttpGet(curl, server + "/media/photos/" + Escape(curl, photo.image),
+                   bytes.get(), error)) {
+        ok = false;
+        break;
+      }
+      body = bytes;
+    }
+    photo.body = body;
+    Digest(&photo);
+    if (first_us < 0 && uploaded_us >= 0) first_us = uploaded_us;
+    // Clocks and missing timestamps must not reorder the replay.
+    if (uploaded_us >= 0) {
+      last_offset = std::max(last_offset, uploaded_us - first_us);
+    }
+    photo.offset_us = last_offset;
+    photos.push_back(std::move(photo));
+  }
+  curl_easy_cleanup(curl);
+  return ok;
+}
@@ -0,0 +1,60 @@
+#ifndef BACKEND_STANDIN_RECORDING_H_
+#define BACKEND_STANDIN_RECORDING_H_
+
+#include <json/json.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// One photo as the backend published it.
+struct RecordedPhoto {
+  std::string album;  // "" for the default album.
+  std::string image;  // Media file name, e.g. "3f2a....jpg".
+  std::string original_file_name;
+  // When it was published, after the first photo of the recording.
+  int64_t offset_us = 0;
+  std::shared_ptr<const std::string> body;
+  // content_digest, as the backend computes it from |body|.
+  uint32_t crc32c = 0;
+  std::vector<uint32_t> block_crc32cs;
+};
+
+/**
+ * Photos captured from a running backend, to be published again by the
+ * stand-in in the same order and with the same spacing.
+ *
+ * On disk a recording is a directory: photos.jsonl holds one photo per line
+ * ({"offset_us", "album", "image", "original_file_name"}) and media/ holds
+ * the files under their media names. Digests are recomputed on load.
+ */
+class Recording {
+ public:
+  // The backend hashes in blocks of this size.
+  static const size_t kBlockSize = 1 << 20;
+
+  bool Load(const std::string& directory, std::string* error);
+  bool Save(const std::string& directory, std::string* error) const;
+
+  // Pages through /api/photo/sync/ of the backend at |server| for each of
+  // |albums| and downloads every photo. Offsets come from uploaded_at.
+  bool Fetch(const std::string& server, const std::vector<std::string>& albums,
+             std::string* error);
+
+  // Fills in the digest of |photo| from its body.
+  static void Digest(RecordedPhoto* photo);
+  // |photo| as the backend serializes it, under |id|.
+  static Json::Value ToJson(const RecordedPhoto& photo, int64_t id,
+                            const std::string& uploaded_at);
+
+  std::vector<RecordedPhoto> photos;
+};
+
+// |time_us| (since the epoch) the way the backend writes timestamps.
+std::string FormatTimestamp(int64_t time_us);
+// The inverse of FormatTimestamp, accepting any ISO 8601 offset; -1 when
+// |text| is not a timestamp.
+int64_t ParseTimestamp(const std::string& text);
+
+#endif  // BACKEND_STANDIN_RECORDING_H_
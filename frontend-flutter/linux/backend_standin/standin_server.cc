@@ -0,0 +1,1283 @@
+#include "standin_server.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cinttypes>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <utility>
+
+namespace {
+
+const uint64_t kListenId = 0;
+const uint64_t kSignalId = UINT64_MAX;
+
+const size_t kMaxHeaderBytes = 64 * 1024;
+const size_t kMaxBodyBytes = 64 * 1024 * 1024;
+const size_t kMaxFrameBytes = 1024 * 1024;
+const int kSyncPageSize = 200;
+const size_t kMaxAlbumsPerSocket = 1000;
+const int kCloseInvalidAlbums = 4400;
+// Smallest write worth waking up for while bandwidth is limited.
+const size_t kMinBurst = 1460;
+
+const char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+int64_t NowMicros() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return int64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+int64_t WallMicros() {
+  timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return int64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+std::string WriteJson(const Json::Value& value) {
+  static Json::StreamWriterBuilder* builder = [] {
+    Json::StreamWriterBuilder* builder = new Json::StreamWriterBuilder();
+    (*builder)["indentation"] = "";
+    return builder;
+  }();
+  return Json::writeString(*builder, value);
+}
+
+std::string Lower(std::string text) {
+  for (char& c : text) c = char(tolower(static_cast<unsigned char>(c)));
+  return text;
+}
+
+std::string Trim(const std::string& text) {
+  size_t begin = text.find_first_not_of(" \t");
+  if (begin == std::string::npos) return "";
+  size_t end = text.find_last_not_of(" \t");
+  return text.substr(begin, end - begin + 1);
+}
+
+std::string PercentDecode(const std::string& text, bool plus_is_space) {
+  std::string result;
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '%' && i + 2 < text.size() && isxdigit(text[i + 1]) &&
+        isxdigit(text[i + 2])) {
+      result += char(std::stoi(text.substr(i + 1, 2), nullptr, 16));
+      i += 2;
+    } else if (text[i] == '+' && plus_is_space) {
+      result += ' ';
+    } else {
+      result += text[i];
+    }
+  }
+  return result;
+}
+
+std::vector<std::string> Split(const std::string& text, char separator) {
+  std::vector<std::string> parts;
+  size_t begin = 0;
+  while (begin <= text.size()) {
+    size_t end = text.find(separator, begin);
+    if (end == std::string::npos) end = text.size();
+    parts.push_back(text.substr(begin, end - begin));
+    begin = end + 1;
+  }
+  return parts;
+}
+
+// The backend's ALBUM_NAME.
+bool ValidAlbum(const std::string& album) {
+  if (album.size() > 64) return false;
+  for (char c : album) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The backend's _TRACE_ID.
+bool ValidTraceId(const std::string& id) {
+  return !id.empty() && ValidAlbum(id);
+}
+
+std::string RandomHex(size_t bytes) {
+  std::vector<unsigned char> random(bytes);
+  RAND_bytes(random.data(), int(bytes));
+  std::string hex;
+  char digits[3];
+  for (unsigned char byte : random) {
+    snprintf(digits, sizeof(digits), "%02x", byte);
+    hex += digits;
+  }
+  return hex;
+}
+
+std::string Sha256Hex(const std::string& data) {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char*>(data.data()), data.size(),
+         digest);
+  std::string hex;
+  char digits[3];
+  for (unsigned char byte : digest) {
+    snprintf(digits, sizeof(digits), "%02x", byte);
+    hex += digits;
+  }
+  return hex;
+}
+
+std::string AcceptKey(const std::string& key) {
+  std::string input = key + kWebSocketGuid;
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  SHA1(reinterpret_cast<const unsigned char*>(input.data()), input.size(),
+       digest);
+  char encoded[32];
+  EVP_EncodeBlock(reinterpret_cast<unsigned char*>(encoded), digest,
+                  SHA_DIGEST_LENGTH);
+  return encoded;
+}
+
+// A server frame: final, unmasked.
+std::string Frame(uint8_t opcode, const char* data, size_t size) {
+  std::string frame;
+  frame.reserve(size + 10);
+  frame += char(0x80 | opcode);
+  if (size < 126) {
+    frame += char(size);
+  } else if (size <= 0xFFFF) {
+    frame += char(126);
+    frame += char(size >> 8);
+    frame += char(size);
+  } else {
+    frame += char(127);
+    for (int shift = 56; shift >= 0; shift -= 8) frame += char(size >> shift);
+  }
+  frame.append(data, size);
+  return frame;
+}
+
+const char* Reason(int status) {
+  switch (status) {
+    case 101: return "Switching Protocols";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 416: return "Range Not Satisfiable";
+    case 426: return "Upgrade Required";
+    default: return "Unknown";
+  }
+}
+
+const char* ContentType(const std::string& name) {
+  std::string extension = Lower(name.substr(name.rfind('.') + 1));
+  if (extension == "jpg" || extension == "jpeg") return "image/jpeg";
+  if (extension == "png") return "image/png";
+  if (extension == "webp") return "image/webp";
+  if (extension == "avif") return "image/avif";
+  if (extension == "gif") return "image/gif";
+  if (extension == "heic") return "image/heic";
+  return "application/octet-stream";
+}
+
+Json::Value Detail(const std::string& detail) {
+  Json::Value value;
+  value["detail"] = detail;
+  return value;
+}
+
+// One field of a multipart/form-data body.
+struct FormPart {
+  std::string name;
+  std::string file_name;
+  std::string data;
+};
+
+std::string DispositionParameter(const std::string& header,
+                                 const std::string& name) {
+  std::string key = name + "=\"";
+  size_t begin = 0;
+  while ((begin = header.find(key, begin)) != std::string::npos) {
+    // Not the tail of a longer parameter, e.g. name= inside filename=.
+    if (begin == 0 || header[begin - 1] == ' ' || header[begin - 1] == ';') {
+      begin += key.size();
+      size_t end = header.find('"', begin);
+      if (end == std::string::npos) return "";
+      return header.substr(begin, end - begin);
+    }
+    begin += key.size();
+  }
+  return "";
+}
+
+bool ParseMultipart(const std::string& content_type, const std::string& body,
+                    std::vector<FormPart>* parts) {
+  size_t at = content_type.find("boundary=");
+  if (at == std::string::npos) return false;
+  std::string boundary = content_type.substr(at + 9);
+  boundary = boundary.substr(0, boundary.find(';'));
+  if (boundary.size() >= 2 && boundary.front() == '"') {
+    boundary = boundary.substr(1, boundary.size() - 2);
+  }
+  std::string delimiter = "--" + boundary;
+
+  size_t position = body.find(delimiter);
+  while (position != std::string::npos) {
+    position += delimiter.size();
+    if (body.compare(position, 2, "--") == 0) return true;
+    size_t headers = position + 2;  // Past the CRLF.
+    size_t headers_end = body.find("\r\n\r\n", headers);
+    if (headers_end == std::string::npos) return false;
+    size_t data = headers_end + 4;
+    size_t next = body.find("\r\n" + delimiter, data);
+    if (next == std::string::npos) return false;
+
+    FormPart part;
+    for (const std::string& line :
+         Split(body.substr(headers, headers_end - headers), '\n')) {
+      size_t colon = line.find(':');
+      if (colon == std::string::npos ||
+          Lower(line.substr(0, colon)) != "content-disposition") {
+        continue;
+      }
+      part.name = DispositionParameter(line, "name");
+      part.file_name = DispositionParameter(line, "filename");
+    }
+    part.data = body.substr(data, next - data);
+    parts->push_back(std::move(part));
+    position = next + 2;
+  }
+  return false;
+}
+
+}  // namespace
+
+StandinServer::StandinServer(const StandinOptions& options,
+                             Recording recording)
+    : options_(options),
+      recording_(std::move(recording)),
+      faults_(options.faults) {}
+
+StandinServer::~StandinServer() {
+  for (auto& entry : connections_) close(entry.second->fd);
+  if (signal_fd_ >= 0) close(signal_fd_);
+  if (listen_fd_ >= 0) close(listen_fd_);
+  if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+bool StandinServer::Listen(std::string* error) {
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+  addrinfo* addresses = nullptr;
+  std::string port = std::to_string(options_.port);
+  int status = getaddrinfo(options_.host.c_str(), port.c_str(), &hints,
+                           &addresses);
+  if (status != 0) {
+    *error = options_.host + ": " + gai_strerror(status);
+    return false;
+  }
+  for (addrinfo* address = addresses; address != nullptr;
+       address = address->ai_next) {
+    int fd = socket(address->ai_family,
+                    address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) continue;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, address->ai_addr, address->ai_addrlen) == 0 &&
+        listen(fd, SOMAXCONN) == 0) {
+      listen_fd_ = fd;
+      break;
+    }
+    *error = strerror(errno);
+    close(fd);
+  }
+  freeaddrinfo(addresses);
+  if (listen_fd_ < 0) {
+    *error = options_.host + ":" + port + ": " + *error;
+    return false;
+  }
+
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = kListenId;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, listen_fd_, &event);
+
+  // Signals arrive through the loop, so the report is printed from it.
+  sigset_t signals;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  sigprocmask(SIG_BLOCK, &signals, nullptr);
+  signal(SIGPIPE, SIG_IGN);
+  signal_fd_ = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+  event.data.u64 = kSignalId;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, signal_fd_, &event);
+  return true;
+}
+
+int StandinServer::Run() {
+  std::string error;
+  if (!Listen(&error)) {
+    fprintf(stderr, "Cannot listen on %s\n", error.c_str());
+    return 1;
+  }
+
+  int64_t now = NowMicros();
+  if (options_.preload) {
+    for (const RecordedPhoto& photo : recording_.photos) {
+      Json::Value trace;
+      trace["id"] = "preload-" + std::to_string(replayed_++);
+      Publish(photo, &trace, now);
+    }
+  } else if (!options_.start_on_connect) {
+    replay_start_us_ = now;
+  }
+  printf("Serving %zu recorded photos on http://%s:%d/\n",
+         recording_.photos.size(), options_.host.c_str(), options_.port);
+  fflush(stdout);
+
+  Loop();
+  Report();
+  return 0;
+}
+
+void StandinServer::Loop() {
+  epoll_event events[256];
+  while (true) {
+    int count = epoll_wait(epoll_fd_, events, 256,
+                           TimeoutMillis(NowMicros()));
+    if (count < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      return;
+    }
+    int64_t now = NowMicros();
+    for (int i = 0; i < count; i++) {
+      uint64_t id = events[i].data.u64;
+      if (id == kSignalId) return;
+      if (id == kListenId) {
+        Accept(now);
+        continue;
+      }
+      auto found = connections_.find(id);
+      if (found == connections_.end()) continue;
+      Connection* connection = found->second.get();
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        OnReadable(connection, now);
+      }
+      if (events[i].events & EPOLLOUT) Flush(connection, now);
+    }
+    RunTimers(now);
+    Replay(now);
+    Reap();
+  }
+}
+
+int StandinServer::TimeoutMillis(int64_t now_us) {
+  int64_t due = ReplayDue();
+  if (!timers_.empty()) due = std::min(due, timers_.begin()->first);
+  if (due == INT64_MAX) return -1;
+  if (due <= now_us) return 0;
+  return int(std::min<int64_t>((due - now_us + 999) / 1000, INT_MAX));
+}
+
+void StandinServer::RunTimers(int64_t now_us) {
+  while (!timers_.empty() && timers_.begin()->first <= now_us) {
+    int64_t due = timers_.begin()->first;
+    uint64_t id = timers_.begin()->second;
+    timers_.erase(timers_.begin());
+    auto found = connections_.find(id);
+    if (found == connections_.end()) continue;
+    Connection* connection = found->second.get();
+    if (connection->dead) continue;
+    if (connection->drop_us >= 0 && connection->drop_us <= now_us) {
+      // Gone without a close frame, as when the network drops.
+      disconnects_++;
+      Close(connection);
+      continue;
+    }
+    if (connection->batch_due_us >= 0 && connection->batch_due_us <= now_us) {
+      SendBatch(connection, now_us);
+    }
+    if (due == connection->timer_us) connection->timer_us = -1;
+    Flush(connection, now_us);
+  }
+}
+
+void StandinServer::Schedule(Connection* connection, int64_t due_us) {
+  // One pending wake-up per connection is enough; later ones fire early
+  // and reschedule.
+  if (connection->timer_us >= 0 && connection->timer_us <= due_us) return;
+  connection->timer_us = due_us;
+  timers_.emplace(due_us, connection->id);
+}
+
+void StandinServer::Accept(int64_t now_us) {
+  while (true) {
+    int fd = accept4(listen_fd_, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    std::unique_ptr<Connection> connection(new Connection());
+    connection->id = next_connection_++;
+    connection->fd = fd;
+    connection->tokens_us = now_us;
+    connection->tokens = double(
+        std::max<int64_t>(options_.faults.bandwidth / 20, kMinBurst));
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.u64 = connection->id;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+    connections_[connection->id] = std::move(connection);
+  }
+}
+
+void StandinServer::OnReadable(Connection* connection, int64_t now_us) {
+  char buffer[64 * 1024];
+  while (!connection->dead) {
+    ssize_t count = read(connection->fd, buffer, sizeof(buffer));
+    if (count > 0) {
+      // Whatever follows a request that ends the connection is ignored.
+      if (connection->keep_alive) connection->in.append(buffer, count);
+      continue;
+    }
+    if (count < 0 && (errno == EAGAIN || errno == EINTR)) break;
+    Close(connection);
+    return;
+  }
+
+  while (!connection->dead && connection->keep_alive &&
+         !connection->in.empty()) {
+    long consumed = connection->websocket ? ParseFrames(connection, now_us)
+                                          : ParseRequest(connection, now_us);
+    if (consumed < 0) {
+      Close(connection);
+      return;
+    }
+    if (consumed == 0) break;
+    connection->in.erase(0, size_t(consumed));
+  }
+}
+
+void StandinServer::Close(Connection* connection) {
+  if (connection->dead) return;
+  connection->dead = true;
+  doomed_.push_back(connection->id);
+}
+
+void StandinServer::Reap() {
+  for (uint64_t id : doomed_) {
+    auto found = connections_.find(id);
+    if (found == connections_.end()) continue;
+    Connection* connection = found->second.get();
+    for (const std::string& album : connection->albums) {
+      auto subscribers = subscribers_.find(album);
+      subscribers->second.erase(connection);
+      if (subscribers->second.empty()) subscribers_.erase(subscribers);
+    }
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, connection->fd, nullptr);
+    close(connection->fd);
+    connections_.erase(found);
+  }
+  doomed_.clear();
+}
+
+void StandinServer::Send(Connection* connection, Chunk chunk, int64_t now_us) {
+  if (connection->dead) return;
+  // Delays never reorder what one connection sends.
+  chunk.due_us = std::max(now_us + faults_.Delay(), connection->last_due_us);
+  connection->last_due_us = chunk.due_us;
+  connection->out.push_back(std::move(chunk));
+  Flush(connection, now_us);
+}
+
+void StandinServer::Flush(Connection* connection, int64_t now_us) {
+  if (connection->dead) return;
+  const int64_t bandwidth = options_.faults.bandwidth;
+  const double burst = double(std::max<int64_t>(bandwidth / 20, kMinBurst));
+  bool blocked = false;
+  while (!connection->out.empty()) {
+    Chunk& chunk = connection->out.front();
+    if (chunk.due_us > now_us) {
+      Schedule(connection, chunk.due_us);
+      break;
+    }
+    size_t total = chunk.head.size() + chunk.length;
+    if (chunk.sent < total) {
+      const char* data;
+      size_t size;
+      bool more = false;
+      if (chunk.sent < chunk.head.size()) {
+        data = chunk.head.data() + chunk.sent;
+        size = chunk.head.size() - chunk.sent;
+        more = chunk.length > 0;
+      } else {
+        size_t sent = chunk.sent - chunk.head.size();
+        data = chunk.body->data() + chunk.offset + sent;
+        size = chunk.length - sent;
+      }
+      if (bandwidth > 0) {
+        connection->tokens = std::min(
+            burst, connection->tokens + double(now_us - connection->tokens_us) *
+                                            double(bandwidth) / 1e6);
+        connection->tokens_us = now_us;
+        double wanted = std::min(burst, double(total - chunk.sent));
+        if (connection->tokens < wanted) {
+          Schedule(connection,
+                   now_us + int64_t((wanted - connection->tokens) * 1e6 /
+                                    double(bandwidth)) + 1);
+          break;
+        }
+        size = std::min(size, size_t(connection->tokens));
+      }
+      ssize_t written = send(connection->fd, data, size,
+                             MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+      if (written < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+          blocked = true;
+          break;
+        }
+        Close(connection);
+        return;
+      }
+      chunk.sent += size_t(written);
+      connection->tokens -= double(written);
+      bytes_out_ += written;
+      continue;
+    }
+    bool close_after = chunk.close_after;
+    connection->out.pop_front();
+    if (close_after) {
+      Close(connection);
+      return;
+    }
+  }
+
+  if (blocked != connection->want_write) {
+    connection->want_write = blocked;
+    epoll_event event = {};
+    event.events = EPOLLIN | (blocked ? EPOLLOUT : 0);
+    event.data.u64 = connection->id;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection->fd, &event);
+  }
+}
+
+long StandinServer::ParseRequest(Connection* connection, int64_t now_us) {
+  const std::string& in = connection->in;
+  size_t end = in.find("\r\n\r\n");
+  if (end == std::string::npos) {
+    return in.size() > kMaxHeaderBytes ? -1 : 0;
+  }
+
+  Request request;
+  std::vector<std::string> lines = Split(in.substr(0, end), '\n');
+  std::vector<std::string> start = Split(Trim(lines[0]), ' ');
+  if (start.size() != 3 || start[2].compare(0, 5, "HTTP/") != 0) return -1;
+  request.method = start[0];
+  for (size_t i = 1; i < lines.size(); i++) {
+    size_t colon = lines[i].find(':');
+    if (colon == std::string::npos) continue;
+    std::string value = lines[i].substr(colon + 1);
+    if (!value.empty() && value.back() == '\r') value.pop_back();
+    request.headers[Lower(Trim(lines[i].substr(0, colon)))] = Trim(value);
+  }
+
+  std::string connection_header = Lower(request.headers["connection"]);
+  connection->keep_alive =
+      start[2] == "HTTP/1.0"
+          ? connection_header.find("keep-alive") != std::string::npos
+          : connection_header.find("close") == std::string::npos;
+  if (request.headers.count("transfer-encoding") != 0) {
+    connection->keep_alive = false;
+    RespondJson(connection, 411, Detail("Chunked bodies are not supported."),
+                now_us);
+    return long(in.size());
+  }
+  size_t length = size_t(atoll(request.headers["content-length"].c_str()));
+  if (length > kMaxBodyBytes) {
+    connection->keep_alive = false;
+    RespondJson(connection, 413, Detail("Request body too large."), now_us);
+    return long(in.size());
+  }
+  if (in.size() < end + 4 + length) return 0;
+  request.body = in.substr(end + 4, length);
+
+  const std::string& target = start[1];
+  size_t question = target.find('?');
+  request.path = PercentDecode(target.substr(0, question), false);
+  if (question != std::string::npos) {
+    for (const std::string& pair : Split(target.substr(question + 1), '&')) {
+      if (pair.empty()) continue;
+      size_t equals = pair.find('=');
+      request.query[PercentDecode(pair.substr(0, equals), true)] =
+          equals == std::string::npos
+              ? ""
+              : PercentDecode(pair.substr(equals + 1), true);
+    }
+  }
+  Handle(connection, request, now_us);
+  return long(end + 4 + length);
+}
+
+void StandinServer::Handle(Connection* connection, const Request& request,
+                           int64_t now_us) {
+  requests_++;
+  const std::string& path = request.path;
+  const std::string& method = request.method;
+  for (const char* prefix : {"/media/photos/", "/api/media/photos/"}) {
+    size_t length = strlen(prefix);
+    if (path.compare(0, length, prefix) == 0) {
+      if (method != "GET" && method != "HEAD") {
+        RespondJson(connection, 405, Detail("Method not allowed."), now_us);
+      } else {
+        ServeMedia(connection, request, path.substr(length), now_us);
+      }
+      return;
+    }
+  }
+
+  if (path == "/ws/photo/") {
+    auto upgrade = request.headers.find("upgrade");
+    if (upgrade == request.headers.end() ||
+        Lower(upgrade->second) != "websocket") {
+      RespondJson(connection, 426, Detail("Expected a WebSocket upgrade."),
+                  now_us);
+    } else {
+      Upgrade(connection, request, now_us);
+    }
+  } else if (path == "/api/time/" && method == "GET") {
+    Json::Value value;
+    value["server_time_us"] = Json::Int64(WallMicros());
+    RespondJson(connection, 200, value, now_us);
+  } else if (path == "/api/photo/" && method == "GET") {
+    ServeLatest(connection, now_us);
+  } else if (path == "/api/photo/" && method == "POST") {
+    ServeUpload(connection, request, now_us);
+  } else if (path == "/api/photo/sync/" && method == "GET") {
+    ServeSync(connection, request, now_us);
+  } else if (path == "/api/time/" || path == "/api/photo/" ||
+             path == "/api/photo/sync/") {
+    RespondJson(connection, 405, Detail("Method not allowed."), now_us);
+  } else {
+    RespondJson(connection, 404, Detail("Not found."), now_us);
+  }
+}
+
+void StandinServer::Respond(Connection* connection, int status,
+                            const std::string& body, int64_t now_us,
+                            const std::string& headers) {
+  Chunk chunk;
+  chunk.head = "HTTP/1.1 " + std::to_string(status) + " " + Reason(status) +
+               "\r\nContent-Length: " + std::to_string(body.size()) +
+               "\r\n" + headers;
+  if (!connection->keep_alive) chunk.head += "Connection: close\r\n";
+  chunk.head += "\r\n" + body;
+  chunk.close_after = !connection->keep_alive;
+  Send(connection, std::move(chunk), now_us);
+}
+
+void StandinServer::RespondJson(Connection* connection, int status,
+                                const Json::Value& value, int64_t now_us,
+                                const std::string& headers) {
+  Respond(connection, status, WriteJson(value), now_us,
+          "Content-Type: application/json\r\n" + headers);
+}
+
+void StandinServer::ServeLatest(Connection* connection, int64_t now_us) {
+  if (published_.empty()) {
+    RespondJson(connection, 404, Detail("No photo found."), now_us);
+    return;
+  }
+  Respond(connection, 200, published_.back().json, now_us,
+          "Content-Type: application/json\r\n");
+}
+
+void StandinServer::ServeUpload(Connection* connection,
+                                const Request& request, int64_t now_us) {
+  int64_t received_us = WallMicros();
+  uploads_++;
+  std::vector<FormPart> parts;
+  auto content_type = request.headers.find("content-type");
+  if (content_type != request.headers.end()) {
+    ParseMultipart(content_type->second, request.body, &parts);
+  }
+  const FormPart* image = nullptr;
+  std::string album;
+  for (const FormPart& part : parts) {
+    if (part.name == "image" && image == nullptr) image = &part;
+    if (part.name == "album") album = part.data;
+  }
+  if (image == nullptr || image->data.empty()) {
+    RespondJson(connection, 400, Detail("No image file provided."), now_us);
+    return;
+  }
+  if (!ValidAlbum(album)) {
+    RespondJson(connection, 400,
+                Detail("album is up to 64 letters, digits, \"-\" or \"_\"."),
+                now_us);
+    return;
+  }
+
+  // Named like the backend names uploads: after their SHA-256, keeping the
+  // extension.
+  RecordedPhoto photo;
+  photo.album = album;
+  photo.original_file_name = image->file_name;
+  size_t dot = image->file_name.rfind('.');
+  std::string extension =
+      dot == std::string::npos ? "" : Lower(image->file_name.substr(dot));
+  photo.image = Sha256Hex(image->data).substr(0, 32) + extension;
+  auto existing = media_.find(photo.image);
+  photo.body = existing != media_.end()
+                   ? existing->second
+                   : std::make_shared<const std::string>(image->data);
+  Recording::Digest(&photo);
+
+  auto trace_header = request.headers.find("x-trace-id");
+  Json::Value trace;
+  trace["id"] = trace_header != request.headers.end() &&
+                        ValidTraceId(trace_header->second)
+                    ? trace_header->second
+                    : RandomHex(16);
+  trace["received_us"] = Json::Int64(received_us);
+  trace["stored_us"] = Json::Int64(WallMicros());
+  Json::Value data = Publish(photo, &trace, now_us);
+  data["trace"] = trace;
+  RespondJson(connection, 201, data, now_us,
+              "X-Trace-Id: " + trace["id"].asString() + "\r\n");
+}
+
+void StandinServer::ServeSync(Connection* connection, const Request& request,
+                              int64_t now_us) {
+  syncs_++;
+  int64_t since = 0;
+  int64_t limit = kSyncPageSize;
+  auto number = [&request](const char* name, int64_t* value) {
+    auto found = request.query.find(name);
+    if (found == request.query.end()) return true;
+    char* end = nullptr;
+    *value = strtoll(found->second.c_str(), &end, 10);
+    return !found->second.empty() && *end == '\0';
+  };
+  if (!number("since", &since) || !number("limit", &limit)) {
+    RespondJson(connection, 400,
+                Detail("since and limit must be integers."), now_us);
+    return;
+  }
+  limit = std::max<int64_t>(1, std::min<int64_t>(limit, kSyncPageSize));
+  auto album = request.query.find("album");
+  std::string name = album == request.query.end() ? "" : album->second;
+  if (!ValidAlbum(name)) {
+    RespondJson(connection, 400,
+                Detail("album is up to 64 letters, digits, \"-\" or \"_\"."),
+                now_us);
+    return;
+  }
+
+  // Published photos are already serialized; the page is spliced together.
+  std::string photos;
+  int64_t cursor = since;
+  bool has_more = false;
+  auto found = by_album_.find(name);
+  if (found != by_album_.end()) {
+    const std::vector<size_t>& indexes = found->second;
+    auto first = std::upper_bound(
+        indexes.begin(), indexes.end(), since,
+        [this](int64_t id, size_t index) { return id < published_[index].id; });
+    int64_t count = 0;
+    for (auto it = first; it != indexes.end(); ++it) {
+      if (count == limit) {
+        has_more = true;
+        break;
+      }
+      if (count++ > 0) photos += ',';
+      photos += published_[*it].json;
+      cursor = published_[*it].id;
+    }
+  }
+  // Nothing is ever pruned here, so history is never truncated.
+  std::string body = "{\"photos\":[" + photos +
+                     "],\"cursor\":" + std::to_string(cursor) +
+                     ",\"has_more\":" + (has_more ? "true" : "false") +
+                     ",\"history_truncated\":false}";
+  Respond(connection, 200, body, now_us, "Content-Type: application/json\r\n");
+}
+
+void StandinServer::ServeMedia(Connection* connection, const Request& request,
+                               const std::string& name, int64_t now_us) {
+  media_requests_++;
+  auto found = media_.find(name);
+  if (found == media_.end()) {
+    RespondJson(connection, 404, Detail("Not found."), now_us);
+    return;
+  }
+  const std::shared_ptr<const std::string>& body = found->second;
+  int64_t size = int64_t(body->size());
+  // Media names are content hashes, so they make a strong validator.
+  std::string etag = "\"" + name + "\"";
+  std::string validators = "ETag: " + etag +
+                           "\r\nCache-Control: public, max-age=31536000, "
+                           "immutable\r\n";
+
+  auto header = [&request](const char* key) -> const std::string* {
+    auto found = request.headers.find(key);
+    return found == request.headers.end() ? nullptr : &found->second;
+  };
+  const std::string* if_none_match = header("if-none-match");
+  if (if_none_match != nullptr &&
+      (*if_none_match == etag || *if_none_match == "*")) {
+    Respond(connection, 304, "", now_us, validators);
+    return;
+  }
+
+  int status = 200;
+  int64_t start = 0;
+  int64_t end = size - 1;
+  std::string headers = validators + "Content-Type: " + ContentType(name) +
+                        "\r\nAccept-Ranges: bytes\r\n";
+  const std::string* range = header("range");
+  const std::string* if_range = header("if-range");
+  if (range != nullptr && (if_range == nullptr || *if_range == etag) &&
+      range->compare(0, 6, "bytes=") == 0 &&
+      range->find(',') == std::string::npos) {
+    // The backend's _parse_range: one range, or the whole file.
+    std::string spec = range->substr(6);
+    size_t dash = spec.find('-');
+    std::string first = spec.substr(0, dash);
+    std::string last = dash == std::string::npos ? "" : spec.substr(dash + 1);
+    bool satisfiable = true;
+    bool valid = dash != std::string::npos;
+    if (valid && first.empty()) {
+      int64_t suffix = atoll(last.c_str());
+      satisfiable = suffix > 0;
+      start = std::max<int64_t>(0, size - suffix);
+    } else if (valid) {
+      start = atoll(first.c_str());
+      if (!last.empty()) end = std::min<int64_t>(atoll(last.c_str()), end);
+      satisfiable = start < size && end >= start;
+    }
+    if (!satisfiable) {
+      Respond(connection, 416, "", now_us,
+              validators + "Content-Range: bytes */" + std::to_string(size) +
+                  "\r\n");
+      return;
+    }
+    if (valid) {
+      status = 206;
+      partial_media_++;
+      headers += "Content-Range: bytes " + std::to_string(start) + "-" +
+                 std::to_string(end) + "/" + std::to_string(size) + "\r\n";
+    } else {
+      start = 0;
+      end = size - 1;
+    }
+  }
+
+  int64_t length = size > 0 ? end - start + 1 : 0;
+  Chunk chunk;
+  chunk.head = "HTTP/1.1 " + std::to_string(status) + " " + Reason(status) +
+               "\r\nContent-Length: " + std::to_string(length) + "\r\n" +
+               headers;
+  if (!connection->keep_alive) chunk.head += "Connection: close\r\n";
+  chunk.head += "\r\n";
+  chunk.close_after = !connection->keep_alive;
+  if (request.method == "GET") {
+    chunk.body = body;
+    chunk.offset = size_t(start);
+    chunk.length = size_t(length);
+    int64_t flip = faults_.CorruptAt(length);
+    if (flip >= 0) {
+      // Only this response sees the damage.
+      std::string copy = body->substr(size_t(start), size_t(length));
+      copy[size_t(flip)] ^= 0x55;
+      chunk.body = std::make_shared<const std::string>(std::move(copy));
+      chunk.offset = 0;
+      corruptions_++;
+    }
+    int64_t cut = faults_.CutAt(length);
+    if (cut >= 0) {
+      chunk.length = size_t(cut);
+      chunk.close_after = true;
+      cuts_++;
+    }
+  }
+  Send(connection, std::move(chunk), now_us);
+}
+
+void StandinServer::Upgrade(Connection* connection, const Request& request,
+                            int64_t now_us) {
+  auto key = request.headers.find("sec-websocket-key");
+  if (key == request.headers.end() || key->second.empty()) {
+    connection->keep_alive = false;
+    RespondJson(connection, 400, Detail("Missing Sec-WebSocket-Key."),
+                now_us);
+    return;
+  }
+  // Offered as a comma-separated list.
+  auto offered = request.headers.find("sec-websocket-protocol");
+  if (offered != request.headers.end()) {
+    std::string list = "," + offered->second + ",";
+    list.erase(std::remove(list.begin(), list.end(), ' '), list.end());
+    connection->batched = list.find(std::string(",") + kPhotoBatchProtocol +
+                                    ",") != std::string::npos;
+  }
+  Chunk chunk;
+  chunk.head =
+      "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+      "Connection: Upgrade\r\nSec-WebSocket-Accept: " +
+      AcceptKey(key->second) + "\r\n" +
+      (connection->batched
+           ? std::string("Sec-WebSocket-Protocol: ") + kPhotoBatchProtocol +
+                 "\r\n"
+           : std::string()) +
+      "\r\n";
+  Send(connection, std::move(chunk), now_us);
+  connection->websocket = true;
+  connection->keep_alive = true;
+  sockets_++;
+
+  int64_t drop_after = faults_.NextDisconnect();
+  if (drop_after >= 0) {
+    connection->drop_us = now_us + drop_after;
+    timers_.emplace(connection->drop_us, connection->id);
+  }
+  if (replay_start_us_ < 0 && !options_.preload) replay_start_us_ = now_us;
+
+  auto albums = request.query.find("albums");
+  if (albums == request.query.end()) {
+    // As the backend: the default album, and no "subscribed".
+    connection->albums.insert("");
+    subscribers_[""].insert(connection);
+    return;
+  }
+  std::vector<std::string> requested;
+  for (const std::string& album : Split(albums->second, ',')) {
+    if (!album.empty()) requested.push_back(album);
+  }
+  if (!Subscribe(connection, requested, now_us)) {
+    SendClose(connection, kCloseInvalidAlbums, now_us);
+  }
+}
+
+long StandinServer::ParseFrames(Connection* connection, int64_t now_us) {
+  const std::string& in = connection->in;
+  size_t position = 0;
+  while (!connection->dead && connection->keep_alive) {
+    const unsigned char* data =
+        reinterpret_cast<const unsigned char*>(in.data()) + position;
+    size_t available = in.size() - position;
+    if (available < 2) break;
+    bool final = data[0] & 0x80;
+    uint8_t opcode = data[0] & 0x0F;
+    // Clients must mask every frame.
+    if (!(data[1] & 0x80)) return -1;
+    uint64_t length = data[1] & 0x7F;
+    size_t header = 2;
+    if (length == 126) {
+      if (available < 4) break;
+      length = (uint64_t(data[2]) << 8) | data[3];
+      header = 4;
+    } else if (length == 127) {
+      if (available < 10) break;
+      length = 0;
+      for (int i = 0; i < 8; i++) length = (length << 8) | data[2 + i];
+      header = 10;
+    }
+    if (length > kMaxFrameBytes) return -1;
+    const unsigned char* mask = data + header;
+    header += 4;
+    if (available < header + length) break;
+
+    std::string payload(reinterpret_cast<const char*>(data + header),
+                        size_t(length));
+    for (size_t i = 0; i < payload.size(); i++) payload[i] ^= mask[i % 4];
+    position += header + size_t(length);
+
+    if (opcode == 0x8) {
+      uint16_t code = payload.size() >= 2
+                          ? uint16_t((uint8_t(payload[0]) << 8) |
+                                     uint8_t(payload[1]))
+                          : 1000;
+      SendClose(connection, code, now_us);
+    } else if (opcode == 0x9) {
+      Chunk pong;
+      pong.head = Frame(0xA, payload.data(), payload.size());
+      Send(connection, std::move(pong), now_us);
+    } else if (opcode == 0xA) {
+      // Nothing to do.
+    } else {
+      if (opcode != 0) {
+        connection->message_opcode = opcode;
+        connection->message.clear();
+      }
+      connection->message += payload;
+      if (connection->message.size() > kMaxFrameBytes) return -1;
+      if (final) {
+        if (connection->message_opcode == 0x1) OnMessage(connection, now_us);
+        connection->message.clear();
+      }
+    }
+  }
+  return long(position);
+}
+
+void StandinServer::OnMessage(Connection* connection, int64_t now_us) {
+  Json::CharReaderBuilder builder;
+  std::unique_ptr<Json::CharReader> reader(builder.newCharReader());
+  const std::string& text = connection->message;
+  Json::Value message;
+  bool ok = reader->parse(text.data(), text.data() + text.size(), &message,
+                          nullptr) &&
+            message.isObject() && message["type"].isString() &&
+            message["albums"].isArray();
+  std::string type = ok ? message["type"].asString() : "";
+  if (type != "subscribe" && type != "unsubscribe") {
+    SendError(connection,
+              "Expected {\"type\": \"subscribe\" | \"unsubscribe\", "
+              "\"albums\": [...]}.",
+              now_us);
+    return;
+  }
+
+  std::vector<std::string> albums;
+  bool strings = true;
+  for (const Json::Value& album : message["albums"]) {
+    if (album.isString()) {
+      albums.push_back(album.asString());
+    } else {
+      strings = false;
+    }
+  }
+  if (type == "unsubscribe") {
+    Unsubscribe(connection, albums, now_us);
+  } else if (!strings) {
+    SendError(connection,
+              "Album names are up to 64 letters, digits, \"-\" or \"_\".",
+              now_us);
+  } else {
+    Subscribe(connection, albums, now_us);
+  }
+}
+
+bool StandinServer::Subscribe(Connection* connection,
+                              const std::vector<std::string>& albums,
+                              int64_t now_us) {
+  std::set<std::string> added;
+  for (const std::string& album : albums) {
+    if (!ValidAlbum(album)) {
+      SendError(connection,
+                "Album names are up to 64 letters, digits, \"-\" or \"_\".",
+                now_us);
+      return false;
+    }
+    if (connection->albums.count(album) == 0) added.insert(album);
+  }
+  if (connection->albums.size() + added.size() > kMaxAlbumsPerSocket) {
+    SendError(connection,
+              "At most " + std::to_string(kMaxAlbumsPerSocket) +
+                  " albums per socket.",
+              now_us);
+    return false;
+  }
+  for (const std::string& album : added) {
+    connection->albums.insert(album);
+    subscribers_[album].insert(connection);
+  }
+  SendSubscribed(connection, now_us);
+  return true;
+}
+
+void StandinServer::Unsubscribe(Connection* connection,
+                                const std::vector<std::string>& albums,
+                                int64_t now_us) {
+  for (const std::string& album : albums) {
+    if (connection->albums.erase(album) == 0) continue;
+    auto subscribers = subscribers_.find(album);
+    subscribers->second.erase(connection);
+    if (subscribers->second.empty()) subscribers_.erase(subscribers);
+  }
+  SendSubscribed(connection, now_us);
+}
+
+void StandinServer::SendSubscribed(Connection* connection, int64_t now_us) {
+  Json::Value message;
+  message["type"] = "subscribed";
+  message["albums"] = Json::Value(Json::arrayValue);
+  for (const std::string& album : connection->albums) {
+    message["albums"].append(album);
+  }
+  SendText(connection, WriteJson(message), now_us);
+}
+
+void StandinServer::SendText(Connection* connection, const std::string& text,
+                             int64_t now_us) {
+  Chunk chunk;
+  chunk.head = Frame(0x1, text.data(), text.size());
+  Send(connection, std::move(chunk), now_us);
+}
+
+void StandinServer::SendError(Connection* connection,
+                              const std::string& detail, int64_t now_us) {
+  Json::Value message;
+  message["type"] = "error";
+  message["detail"] = detail;
+  SendText(connection, WriteJson(message), now_us);
+}
+
+void StandinServer::SendClose(Connection* connection, uint16_t code,
+                              int64_t now_us) {
+  char payload[2] = {char(code >> 8), char(code)};
+  Chunk chunk;
+  chunk.head = Frame(0x8, payload, sizeof(payload));
+  chunk.close_after = true;
+  Send(connection, std::move(chunk), now_us);
+  // Nothing the client sends after this is read.
+  connection->keep_alive = false;
+}
+
+void StandinServer::SendBatch(Connection* connection, int64_t now_us) {
+  connection->batch_due_us = -1;
+  if (connection->batch == nullptr) return;
+  const std::string& frame = connection->batch->frame();
+  Chunk chunk;
+  chunk.head = Frame(0x2, frame.data(), frame.size());
+  connection->batch.reset();
+  Send(connection, std::move(chunk), now_us);
+  batches_sent_++;
+}
+
+Json::Value StandinServer::Publish(const RecordedPhoto& photo,
+                                   Json::Value* trace, int64_t now_us) {
+  Published published;
+  published.id = int64_t(published_.size()) + 1;
+  published.album = photo.album;
+  int64_t uploaded_us = WallMicros();
+  Json::Value value =
+      Recording::ToJson(photo, published.id, FormatTimestamp(uploaded_us));
+  published.json = WriteJson(value);
+  by_album_[photo.album].push_back(published_.size());
+  published_.push_back(published);
+  media_.emplace(photo.image, photo.body);
+
+  // Recorded photos arrive and are stored the moment they are published.
+  if (!trace->isMember("received_us")) {
+    (*trace)["received_us"] = Json::Int64(WallMicros());
+    (*trace)["stored_us"] = (*trace)["received_us"];
+  }
+  (*trace)["broadcast_us"] = Json::Int64(WallMicros());
+  auto subscribers = subscribers_.find(photo.album);
+  if (subscribers == subscribers_.end()) return value;
+
+  // One frame, shared by every subscriber's queue.
+  Json::Value album(photo.album);
+  std::string text = "{\"type\":\"photo_update\",\"album\":" +
+                     WriteJson(album) + ",\"image\":" + published.json +
+                     ",\"trace\":" + WriteJson(*trace) + "}";
+  auto frame = std::make_shared<const std::string>(
+      Frame(0x1, text.data(), text.size()));
+  PhotoUpdate update;
+  update.id = published.id;
+  update.file_size = int64_t(photo.body->size());
+  update.uploaded_at_us = uploaded_us;
+  update.album = photo.album;
+  update.image = photo.image;
+  update.original_file_name = photo.original_file_name;
+  update.has_crc32c = true;
+  update.crc32c = photo.crc32c;
+  update.block_size = uint32_t(Recording::kBlockSize);
+  update.blocks = photo.block_crc32cs;
+  update.trace_id = (*trace)["id"].asString();
+  update.received_us = (*trace)["received_us"].asInt64();
+  update.stored_us = (*trace)["stored_us"].asInt64();
+  update.broadcast_us = (*trace)["broadcast_us"].asInt64();
+  for (Connection* connection : subscribers->second) {
+    if (connection->dead) continue;
+    if (faults_.LoseUpdate()) {
+      updates_lost_++;
+      continue;
+    }
+    updates_sent_++;
+    if (connection->batched) {
+      if (connection->batch == nullptr) {
+        connection->batch.reset(new PhotoBatchWriter());
+      }
+      connection->batch->Add(update);
+      if (int(connection->batch->count()) >= options_.batch_max) {
+        SendBatch(connection, now_us);
+      } else if (connection->batch_due_us < 0) {
+        connection->batch_due_us = now_us + options_.batch_window_us;
+        timers_.emplace(connection->batch_due_us, connection->id);
+      }
+      continue;
+    }
+    Chunk chunk;
+    chunk.body = frame;
+    chunk.length = frame->size();
+    Send(connection, std::move(chunk), now_us);
+  }
+  return value;
+}
+
+int64_t StandinServer::ReplayDue() const {
+  const std::vector<RecordedPhoto>& photos = recording_.photos;
+  if (replay_start_us_ < 0 || replay_next_ >= photos.size()) return INT64_MAX;
+  // A pass lasts until a second after its last photo.
+  int64_t pass = photos.back().offset_us + 1000000;
+  int64_t offset = int64_t(replay_pass_) * pass + photos[replay_next_].offset_us;
+  return replay_start_us_ + int64_t(double(offset) / options_.speed);
+}
+
+void StandinServer::Replay(int64_t now_us) {
+  const std::vector<RecordedPhoto>& photos = recording_.photos;
+  while (ReplayDue() <= now_us) {
+    Json::Value trace;
+    trace["id"] = "replay-" + std::to_string(replayed_++);
+    Publish(photos[replay_next_], &trace, now_us);
+    if (++replay_next_ == photos.size() && options_.loop) {
+      replay_next_ = 0;
+      replay_pass_++;
+    }
+  }
+}
+
+void StandinServer::Report() {
+  printf("\nrequests    %" PRId64 " (%" PRId64 " uploads, %" PRId64
+         " sync pages, %" PRId64 " media, %" PRId64 " partial)\n",
+         requests_, uploads_, syncs_, media_requests_, partial_media_);
+  printf("published   %zu photos (%" PRId64 " from the recording)\n",
+         published_.size(), replayed_);
+  printf("websockets  %" PRId64 " opened, %" PRId64 " dropped\n", sockets_,
+         disconnects_);
+  printf("updates     %" PRId64 " sent, %" PRId64 " lost; %" PRId64
+         " photo-batch frames\n",
+         updates_sent_, updates_lost_, batches_sent_);
+  printf("media       %" PRId64 " cut short, %" PRId64 " corrupted\n", cuts_,
+         corruptions_);
+  printf("sent        %" PRId64 " bytes\n", bytes_out_);
+  fflush(stdout);
+}
@@ -0,0 +1,212 @@
+#ifndef BACKEND_STANDIN_STANDIN_SERVER_H_
+#define BACKEND_STANDIN_STANDIN_SERVER_H_
+
+#include <json/json.h>
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "fault_plan.h"
+#include "photo_batch.h"
+#include "recording.h"
+
+struct StandinOptions {
+  std::string host = "127.0.0.1";
+  int port = 8010;
+  // Replays the recording this many times faster than it was captured.
+  double speed = 1;
+  // Starts the replay over, a second (scaled) after the last photo.
+  bool loop = false;
+  // Publishes the whole recording before the first client connects, as
+  // history to catch up on, instead of replaying it.
+  bool preload = false;
+  // Holds the replay back until the first WebSocket subscribes.
+  bool start_on_connect = false;
+  // As the backend's PHOTO_BATCH_WINDOW_MS and PHOTO_BATCH_MAX_UPDATES, for
+  // sockets that speak photo-batch.
+  int64_t batch_window_us = 10000;
+  int batch_max = 64;
+  FaultOptions faults;
+};
+
+/**
+ * Stands in for the Django backend in native performance tests: serves
+ * /api/photo/ (GET and POST), /api/photo/sync/, /api/time/, the media
+ * files and the /ws/photo/ albums protocol from one epoll thread, publishing
+ * a recording on its original schedule as if it were being uploaded now.
+ *
+ * Everything is held in memory and nothing depends on the wall clock except
+ * the timestamps in answers, so with a fixed seed a run injects the same
+ * faults every time. Photos uploaded to it are published like recorded ones.
+ */
+class StandinServer {
+ public:
+  StandinServer(const StandinOptions& options, Recording recording);
+  ~StandinServer();
+
+  StandinServer(const StandinServer&) = delete;
+  StandinServer& operator=(const StandinServer&) = delete;
+
+  // Serves until SIGINT or SIGTERM, then prints what happened. Returns the
+  // exit status.
+  int Run();
+
+ private:
+  // Bytes due on a connection no earlier than |due_us|: |head| followed by
+  // |length| bytes of |body| from |offset|. Bodies are shared, not copied.
+  struct Chunk {
+    int64_t due_us = 0;
+    std::string head;
+    std::shared_ptr<const std::string> body;
+    size_t offset = 0;
+    size_t length = 0;
+    size_t sent = 0;
+    bool close_after = false;
+  };
+
+  struct Connection {
+    uint64_t id = 0;
+    int fd = -1;
+    std::string in;
+    std::deque<Chunk> out;
+    int64_t last_due_us = 0;
+    int64_t timer_us = -1;  // When Flush is next due, if it is waiting.
+    bool want_write = false;
+    bool keep_alive = true;
+    bool dead = false;  // Closed; reaped at the end of the loop iteration.
+    // Bandwidth still to spend, refilled as time passes.
+    double tokens = 0;
+    int64_t tokens_us = 0;
+
+    bool websocket = false;
+    std::set<std::string> albums;
+    int64_t drop_us = -1;
+    // photo-batch sockets: updates waiting for the window to close.
+    bool batched = false;
+    std::unique_ptr<PhotoBatchWriter> batch;
+    int64_t batch_due_us = -1;
+    uint8_t message_opcode = 0;
+    std::string message;  // Fragments of a message not yet finished.
+  };
+
+  struct ById {
+    bool operator()(const Connection* a, const Connection* b) const {
+      return a->id < b->id;
+    }
+  };
+
+  struct Request {
+    std::string method;
+    std::string path;
+    std::map<std::string, std::string> query;
+    std::map<std::string, std::string> headers;  // Lower-case names.
+    std::string body;
+  };
+
+  struct Published {
+    int64_t id = 0;
+    std::string album;
+    std::string json;  // As the API serializes the photo.
+  };
+
+  bool Listen(std::string* error);
+  void Loop();
+  int TimeoutMillis(int64_t now_us);
+  void RunTimers(int64_t now_us);
+  void Schedule(Connection* connection, int64_t due_us);
+
+  void Accept(int64_t now_us);
+  void OnReadable(Connection* connection, int64_t now_us);
+  // Takes |connection| out of service; Reap frees it.
+  void Close(Connection* connection);
+  void Reap();
+  void Send(Connection* connection, Chunk chunk, int64_t now_us);
+  void Flush(Connection* connection, int64_t now_us);
+
+  // Returns the bytes consumed, 0 for an incomplete request or -1 to close.
+  long ParseRequest(Connection* connection, int64_t now_us);
+  void Handle(Connection* connection, const Request& request, int64_t now_us);
+  void Respond(Connection* connection, int status, const std::string& body,
+               int64_t now_us, const std::string& headers = "");
+  void RespondJson(Connection* connection, int status,
+                   const Json::Value& value, int64_t now_us,
+                   const std::string& headers = "");
+  void ServeLatest(Connection* connection, int64_t now_us);
+  void ServeUpload(Connection* connection, const Request& request,
+                   int64_t now_us);
+  void ServeSync(Connection* connection, const Request& request,
+                 int64_t now_us);
+  void ServeMedia(Connection* connection, const Request& request,
+                  const std::string& name, int64_t now_us);
+
+  void Upgrade(Connection* connection, const Request& request,
+               int64_t now_us);
+  // Returns the bytes consumed, or -1 to close.
+  long ParseFrames(Connection* connection, int64_t now_us);
+  void OnMessage(Connection* connection, int64_t now_us);
+  bool Subscribe(Connection* connection, const std::vector<std::string>& albums,
+                 int64_t now_us);
+  void Unsubscribe(Connection* connection,
+                   const std::vector<std::string>& albums, int64_t now_us);
+  void SendSubscribed(Connection* connection, int64_t now_us);
+  void SendText(Connection* connection, const std::string& text,
+                int64_t now_us);
+  void SendError(Connection* connection, const std::string& detail,
+                 int64_t now_us);
+  void SendClose(Connection* connection, uint16_t code, int64_t now_us);
+  void SendBatch(Connection* connection, int64_t now_us);
+
+  // Makes |photo| visible to the API and announces it to subscribers;
+  // returns it as the API serializes it. Completes |trace|.
+  Json::Value Publish(const RecordedPhoto& photo, Json::Value* trace,
+                      int64_t now_us);
+  void Replay(int64_t now_us);
+  int64_t ReplayDue() const;
+  void Report();
+
+  const StandinOptions options_;
+  Recording recording_;
+  FaultPlan faults_;
+  int listen_fd_ = -1;
+  int epoll_fd_ = -1;
+  int signal_fd_ = -1;
+
+  std::map<uint64_t, std::unique_ptr<Connection>> connections_;
+  uint64_t next_connection_ = 1;  // 0 is the listening socket.
+  std::multimap<int64_t, uint64_t> timers_;  // Due time, connection.
+  std::vector<uint64_t> doomed_;
+  // Ordered by id, so faults land on the same sockets every run.
+  std::map<std::string, std::set<Connection*, ById>> subscribers_;
+
+  std::vector<Published> published_;
+  std::map<std::string, std::vector<size_t>> by_album_;  // Into published_.
+  std::map<std::string, std::shared_ptr<const std::string>> media_;
+
+  // Replay position: the next photo, on which pass through the recording,
+  // timed from |replay_start_us_| (-1 while it waits for a subscriber).
+  size_t replay_next_ = 0;
+  int replay_pass_ = 0;
+  int64_t replay_start_us_ = -1;
+
+  int64_t requests_ = 0;
+  int64_t uploads_ = 0;
+  int64_t syncs_ = 0;
+  int64_t media_requests_ = 0;
+  int64_t partial_media_ = 0;
+  int64_t sockets_ = 0;
+  int64_t updates_sent_ = 0;
+  int64_t updates_lost_ = 0;
+  int64_t batches_sent_ = 0;
+  int64_t disconnects_ = 0;
+  int64_t cuts_ = 0;
+  int64_t corruptions_ = 0;
+  int64_t bytes_out_ = 0;
+  int64_t replayed_ = 0;
+};
+
+#endif  // BACKEND_STANDIN_STANDIN_SERVER_H_
@@ -0,0 +1,215 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <glib.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "memory_governor.h"
+
+namespace {
+
+const size_t kChunkBytes = 1 << 20;
+const int kCheckIntervalMs = 100;
+
+// Exit codes, as automake's test driver reads them.
+const int kPass = 0;
+const int kFail = 1;
+const int kSkip = 77;
+
+void Usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "Checks that the runner's memory governor gives memory back under\n"
+          "pressure. Holds a ballast that a registered shrinker frees, arms\n"
+          "the governor's PSI triggers, then churns a scratch file through\n"
+          "the page cache until the kernel reports stalls. Passes when the\n"
+          "resident set drops by --min-drop-mb within --timeout-ms.\n"
+          "\n"
+          "Run it inside a memory-limited cgroup, where the churn stalls;\n"
+          "run_pressure_test.sh sets one up.\n"
+          "\n"
+          "  --ballast-mb N     memory the shrinker holds (256)\n"
+          "  --pressure-mb N    size of the scratch file (512)\n"
+          "  --min-drop-mb N    RSS drop that passes (128)\n"
+          "  --timeout-ms MS    how long pressure may take to relieve (30000)\n"
+          "  --scratch DIR      where the scratch file goes; not tmpfs,\n"
+          "                     whose pages cannot be reclaimed (/var/tmp)\n"
+          "\n"
+          "Exits 0 on pass, 1 on fail and 77 when the kernel offers no\n"
+          "pressure triggers.\n",
+          program);
+}
+
+struct Options {
+  int64_t ballast_mb = 256;
+  int64_t pressure_mb = 512;
+  int64_t min_drop_mb = 128;
+  int64_t timeout_ms = 30000;
+  std::string scratch = "/var/tmp";
+};
+
+// Writes |bytes| to |path| and then reads it back over and over until
+// |stop| is set. Past the cgroup's limit every pass has to reclaim the
+// page cache the previous one filled, which the kernel counts as stalls.
+void Churn(const std::string& path, int64_t bytes, std::atomic<bool>* stop) {
+  std::unique_ptr<char[]> buffer(new char[kChunkBytes]);
+  memset(buffer.get(), 0x5A, kChunkBytes);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "Cannot create %s: %s\n", path.c_str(), strerror(errno));
+    return;
+  }
+  unlink(path.c_str());
+  for (int64_t written = 0; written < bytes && !stop->load();
+       written += int64_t(kChunkBytes)) {
+    if (write(fd, buffer.get(), kChunkBytes) < 0) break;
+  }
+  fdatasync(fd);
+  while (!stop->load()) {
+    if (lseek(fd, 0, SEEK_SET) != 0) break;
+    while (!stop->load() && read(fd, buffer.get(), kChunkBytes) > 0) {
+    }
+  }
+  close(fd);
+}
+
+struct Run {
+  Options options;
+  MemoryGovernor governor;
+  std::vector<std::unique_ptr<char[]>> ballast;
+  int64_t baseline_rss = 0;
+  int64_t started_us = 0;
+  int64_t shrunk_us = 0;  // First time the shrinker ran.
+  int result = kFail;
+  GMainLoop* loop = nullptr;
+};
+
+// Frees half of the ballast at the moderate tier and the rest at the
+// critical one, the way the runner's caches shed in tiers.
+size_t ShrinkBallast(Run* run, MemoryGovernor::Level level) {
+  if (run->shrunk_us == 0) run->shrunk_us = g_get_monotonic_time();
+  size_t keep = level == MemoryGovernor::kModerate ? run->ballast.size() / 2
+                                                   : 0;
+  size_t released = (run->ballast.size() - keep) * kChunkBytes;
+  run->ballast.resize(keep);
+  return released;
+}
+
+void Report(Run* run) {
+  MemoryGovernor::Event event;
+  int64_t rss = MemoryGovernor::ResidentBytes();
+  printf("baseline RSS %" G_GINT64_FORMAT " MiB, now %" G_GINT64_FORMAT
+         " MiB\n",
+         run->baseline_rss >> 20, rss >> 20);
+  if (run->shrunk_us != 0) {
+    printf("first shrink after %" G_GINT64_FORMAT " ms of pressure\n",
+           (run->shrunk_us - run->started_us) / 1000);
+  }
+  if (run->governor.last_event(&event)) {
+    printf("last reclaim: %s, %s, released %" G_GINT64_FORMAT
+           " MiB, RSS %" G_GINT64_FORMAT " -> %" G_GINT64_FORMAT " MiB\n",
+           event.level == MemoryGovernor::kCritical ? "critical" : "moderate",
+           event.from_pressure ? "from pressure" : "asked for",
+           event.released >> 20, event.rss_before >> 20,
+           event.rss_after >> 20);
+  } else {
+    printf("no reclaim ran\n");
+  }
+}
+
+gboolean Check(gpointer user_data) {
+  Run* run = static_cast<Run*>(user_data);
+  MemoryGovernor::Event event;
+  int64_t dropped = run->baseline_rss - MemoryGovernor::ResidentBytes();
+  if (run->governor.last_event(&event) && event.from_pressure &&
+      dropped >= (run->options.min_drop_mb << 20)) {
+    run->result = kPass;
+  } else if (g_get_monotonic_time() - run->started_us <
+             run->options.timeout_ms * 1000) {
+    return G_SOURCE_CONTINUE;
+  }
+  g_main_loop_quit(run->loop);
+  return G_SOURCE_REMOVE;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  static const option kOptions[] = {
+      {"ballast-mb", required_argument, nullptr, 'b'},
+      {"pressure-mb", required_argument, nullptr, 'p'},
+      {"min-drop-mb", required_argument, nullptr, 'm'},
+      {"timeout-ms", required_argument, nullptr, 't'},
+      {"scratch", required_argument, nullptr, 's'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0},
+  };
+  Run run;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", kOptions, nullptr)) != -1) {
+    switch (opt) {
+      case 'b':
+        run.options.ballast_mb = atoll(optarg);
+        break;
+      case 'p':
+        run.options.pressure_mb = atoll(optarg);
+        break;
+      case 'm':
+        run.options.min_drop_mb = atoll(optarg);
+        break;
+      case 't':
+        run.options.timeout_ms = atoll(optarg);
+        break;
+      case 's':
+        run.options.scratch = optarg;
+        break;
+      case 'h':
+        Usage(argv[0]);
+        return kPass;
+      default:
+        Usage(argv[0]);
+        return kFail;
+    }
+  }
+
+  for (int64_t i = 0; i < run.options.ballast_mb; i++) {
+    // Touched, so every page is resident before the pressure starts.
+    run.ballast.emplace_back(new char[kChunkBytes]);
+    memset(run.ballast.back().get(), int(i), kChunkBytes);
+  }
+  run.governor.Register("ballast", [&run](MemoryGovernor::Level level) {
+    return ShrinkBallast(&run, level);
+  });
+  std::string error;
+  if (!run.governor.Start(&error)) {
+    printf("SKIP: no memory pressure triggers (%s)\n", error.c_str());
+    return kSkip;
+  }
+
+  run.baseline_rss = MemoryGovernor::ResidentBytes();
+  run.started_us = g_get_monotonic_time();
+  std::atomic<bool> stop(false);
+  std::string scratch = run.options.scratch + "/memory_pressure." +
+                        std::to_string(getpid());
+  std::thread churn(Churn, scratch, run.options.pressure_mb << 20, &stop);
+
+  run.loop = g_main_loop_new(nullptr, FALSE);
+  g_timeout_add(kCheckIntervalMs, Check, &run);
+  g_main_loop_run(run.loop);
+  g_main_loop_unref(run.loop);
+  stop = true;
+  churn.join();
+
+  Report(&run);
+  printf("%s\n", run.result == kPass ? "PASS" : "FAIL");
+  return run.result;
+}
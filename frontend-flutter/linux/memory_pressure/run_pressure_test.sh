@@ -0,0 +1,101 @@
+#!/bin/sh
+# Runs the memory_pressure check inside a memory-limited cgroup, the way a
+# 2 GB kiosk squeezes the runner, and exits with its status: 0 pass, 1 fail,
+# 77 skip.
+#
+#   run_pressure_test.sh [path/to/memory_pressure] [-- check options]
+#
+# The cgroup gets MemoryMax of the ballast, given as --ballast-mb=N, plus
+# LIMIT_HEADROOM_MB (96) and no swap. It comes from systemd-run when a
+# systemd manager is reachable, otherwise, as root, from a cgroup made by
+# hand under cgroup v2 or the v1 memory hierarchy.
+
+set -u
+
+binary=${1:-./memory_pressure}
+[ $# -gt 0 ] && shift
+[ "${1:-}" = "--" ] && shift
+
+ballast_mb=256
+for arg in "$@"; do
+  case $arg in
+    --ballast-mb=*) ballast_mb=${arg#*=} ;;
+  esac
+done
+limit_mb=$((ballast_mb + ${LIMIT_HEADROOM_MB:-96}))
+set -- --ballast-mb="$ballast_mb" "$@"
+
+if [ ! -x "$binary" ]; then
+  echo "No memory_pressure binary at $binary; build it with" \
+       "\`cmake --build <build dir> --target memory_pressure\`." >&2
+  exit 1
+fi
+
+# systemd, as a unit of the user's manager or, for root, the system's.
+scope=""
+if [ "$(id -u)" -ne 0 ]; then
+  scope="--user"
+fi
+if command -v systemd-run >/dev/null 2>&1 &&
+   systemd-run $scope --scope --quiet true >/dev/null 2>&1; then
+  exec systemd-run $scope --scope --quiet \
+    -p MemoryMax="${limit_mb}M" -p MemorySwapMax=0 \
+    -- "$binary" "$@"
+fi
+
+if [ "$(id -u)" -ne 0 ]; then
+  echo "SKIP: no systemd manager to make a cgroup, and not root" >&2
+  exit 77
+fi
+
+# By hand. Every limit must take, or the check would run unconstrained and
+# pass for the wrong reason.
+cgroup=""
+skip() {
+  echo "SKIP: $1" >&2
+  [ -n "$cgroup" ] && rmdir "$cgroup" 2>/dev/null
+  exit 77
+}
+# Writes $2 to $cgroup/$1, skipping the test when it does not take. With
+# "optional", a control file the kernel does not provide is left alone.
+set_limit() {
+  if [ "${3:-}" = optional ] && [ ! -e "$cgroup/$1" ]; then
+    return
+  fi
+  echo "$2" 2>/dev/null > "$cgroup/$1" || skip "cannot set $1 to $2"
+}
+
+# cgroup v2 when the root hands the memory controller down to its
+# children, else v1.
+if [ -f /sys/fs/cgroup/cgroup.subtree_control ]; then
+  grep -qw memory /sys/fs/cgroup/cgroup.subtree_control ||
+    skip "the memory controller is not enabled for cgroup v2 children"
+  cgroup=/sys/fs/cgroup/memory_pressure.$$
+  mkdir "$cgroup" 2>/dev/null || {
+    cgroup=""
+    skip "cannot make a cgroup"
+  }
+  set_limit memory.max "${limit_mb}M"
+  # Absent without swap accounting, when there is no swap to limit anyway.
+  set_limit memory.swap.max 0 optional
+else
+  parent=$(sed -n 's/^[0-9]*:memory:\(.*\)$/\1/p' /proc/self/cgroup)
+  [ -n "$parent" ] || skip "no cgroup v1 memory hierarchy"
+  cgroup=/sys/fs/cgroup/memory${parent%/}/memory_pressure.$$
+  mkdir "$cgroup" 2>/dev/null || {
+    cgroup=""
+    skip "cannot make a memory cgroup"
+  }
+  set_limit memory.limit_in_bytes "$((limit_mb << 20))"
+  # Present only with swap accounting.
+  set_limit memory.memsw.limit_in_bytes "$((limit_mb << 20))" optional
+fi
+
+# The child joins the cgroup itself, so nothing runs before the limit
+# applies. 125 is its own: the check never exits with it.
+sh -c 'echo $$ 2>/dev/null > "$0/cgroup.procs" || exit 125; exec "$@"' \
+  "$cgroup" "$binary" "$@"
+status=$?
+[ $status -eq 125 ] && skip "cannot join $cgroup"
+rmdir "$cgroup"
+exit $status
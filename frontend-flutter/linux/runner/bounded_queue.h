@@ -0,0 +1,85 @@
+#ifndef RUNNER_BOUNDED_QUEUE_H_
+#define RUNNER_BOUNDED_QUEUE_H_
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/**
+ * Blocking FIFO with a fixed capacity. Push waits while the queue is full,
+ * which is how a slow consumer pushes back on its producer.
+ */
+template <typename T>
+class BoundedQueue {
+ public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+
+  // Blocks until there is room. Returns false, leaving |item| untouched, if
+  // the queue was closed.
+  bool Push(T& item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_full_.wait(lock,
+                   [this] { return closed_ || items_.size() < capacity_; });
+    if (closed_) return false;
+    items_.push_back(std::move(item));
+    max_depth_ = std::max(max_depth_, items_.size());
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // Returns false instead of blocking when the queue is full or closed.
+  bool TryPush(T& item) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (closed_ || items_.size() >= capacity_) return false;
+    items_.push_back(std::move(item));
+    max_depth_ = std::max(max_depth_, items_.size());
+    not_empty_.notify_one();
+    return true;
+  }
+
+  // Blocks until an item is available. Returns false once the queue is
+  // closed and drained.
+  bool Pop(T* item) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+    if (items_.empty()) return false;
+    *item = std::move(items_.front());
+    items_.pop_front();
+    not_full_.notify_one();
+    return true;
+  }
+
+  // Wakes every waiter; queued items can still be popped.
+  void Close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    not_full_.notify_all();
+    not_empty_.notify_all();
+  }
+
+  size_t depth() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return items_.size();
+  }
+
+  size_t max_depth() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_depth_;
+  }
+
+  size_t capacity() const { return capacity_; }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable not_full_;
+  std::condition_variable not_empty_;
+  std::deque<T> items_;
+  size_t capacity_;
+  size_t max_depth_ = 0;
+  bool closed_ = false;
+};
+
+#endif  // RUNNER_BOUNDED_QUEUE_H_
@@ -0,0 +1,49 @@
+#include "channel_utils.h"
+
+#include "worker_pool.h"
+
+namespace {
+
+FlValue* Lookup(FlValue* args, const char* key, FlValueType type) {
+  if (args == nullptr || fl_value_get_type(args) != FL_VALUE_TYPE_MAP) {
+    return nullptr;
+  }
+  FlValue* value = fl_value_lookup_string(args, key);
+  if (value == nullptr || fl_value_get_type(value) != type) return nullptr;
+  return value;
+}
+
+}  // namespace
+
+std::string ArgString(FlValue* args, const char* key,
+                      const std::string& fallback) {
+  FlValue* value = Lookup(args, key, FL_VALUE_TYPE_STRING);
+  return value != nullptr ? fl_value_get_string(value) : fallback;
+}
+
+int64_t ArgInt(FlValue* args, const char* key, int64_t fallback) {
+  FlValue* value = Lookup(args, key, FL_VALUE_TYPE_INT);
+  return value != nullptr ? fl_value_get_int(value) : fallback;
+}
+
+bool ArgBool(FlValue* args, const char* key, bool fallback) {
+  FlValue* value = Lookup(args, key, FL_VALUE_TYPE_BOOL);
+  return value != nullptr ? fl_value_get_bool(value) : fallback;
+}
+
+void RespondSuccessLater(FlMethodCall* method_call, FlValue* value) {
+  RunOnMainThread([method_call, value]() {
+    fl_method_call_respond_success(method_call, value, nullptr);
+    if (value != nullptr) fl_value_unref(value);
+    g_object_unref(method_call);
+  });
+}
+
+void RespondErrorLater(FlMethodCall* method_call, const std::string& code,
+                       const std::string& message) {
+  RunOnMainThread([method_call, code, message]() {
+    fl_method_call_respond_error(method_call, code.c_str(), message.c_str(),
+                                 nullptr, nullptr);
+    g_object_unref(method_call);
+  });
+}
@@ -0,0 +1,26 @@
+#ifndef RUNNER_CHANNEL_UTILS_H_
+#define RUNNER_CHANNEL_UTILS_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <cstdint>
+#include <string>
+
+/**
+ * Helpers shared by the runner's native method channels.
+ */
+
+// Reads |key| from a map argument, returning |fallback| when the argument is
+// missing or has the wrong type.
+std::string ArgString(FlValue* args, const char* key,
+                      const std::string& fallback = "");
+int64_t ArgInt(FlValue* args, const char* key, int64_t fallback = 0);
+bool ArgBool(FlValue* args, const char* key, bool fallback = false);
+
+// Completes |method_call| on the main thread and drops the reference taken
+// when the call was handed to a worker. Takes ownership of |value|.
+void RespondSuccessLater(FlMethodCall* method_call, FlValue* value);
+void RespondErrorLater(FlMethodCall* method_call, const std::string& code,
+                       const std::string& message);
+
+#endif  // RUNNER_CHANNEL_UTILS_H_
@@ -0,0 +1,125 @@
+#include "crc32c.h"
+
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <sys/auxv.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+#endif
+
+namespace {
+
+const uint32_t kPolynomial = 0x82F63B78;  // Reversed Castagnoli.
+
+struct Tables {
+  uint32_t entries[8][256];
+
+  Tables() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc >> 1) ^ (kPolynomial & (0u - (crc & 1)));
+      }
+      entries[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; i++) {
+      for (int t = 1; t < 8; t++) {
+        entries[t][i] =
+            (entries[t - 1][i] >> 8) ^ entries[0][entries[t - 1][i] & 0xFF];
+      }
+    }
+  }
+};
+
+uint32_t Crc32cSoftware(uint32_t crc, const uint8_t* p, size_t length) {
+  static const Tables tables;
+  const auto& t = tables.entries;
+  while (length >= 8) {
+    uint32_t low;
+    uint32_t high;
+    memcpy(&low, p, 4);
+    memcpy(&high, p + 4, 4);
+    low ^= crc;
+    crc = t[7][low & 0xFF] ^ t[6][(low >> 8) & 0xFF] ^
+          t[5][(low >> 16) & 0xFF] ^ t[4][low >> 24] ^ t[3][high & 0xFF] ^
+          t[2][(high >> 8) & 0xFF] ^ t[1][(high >> 16) & 0xFF] ^
+          t[0][high >> 24];
+    p += 8;
+    length -= 8;
+  }
+  while (length-- > 0) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+  return crc;
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("sse4.2"))) uint32_t Crc32cHardware(uint32_t crc,
+                                                          const uint8_t* p,
+                                                          size_t length) {
+  uint64_t crc64 = crc;
+  while (length >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+    p += 8;
+    length -= 8;
+  }
+  uint32_t crc32 = uint32_t(crc64);
+  while (length-- > 0) crc32 = _mm_crc32_u8(crc32, *p++);
+  return crc32;
+}
+
+bool DetectHardware() {
+  unsigned eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2) != 0;
+}
+
+#elif defined(__aarch64__)
+
+__attribute__((target("+crc"))) uint32_t Crc32cHardware(uint32_t crc,
+                                                        const uint8_t* p,
+                                                        size_t length) {
+  while (length >= 8) {
+    uint64_t word;
+    memcpy(&word, p, 8);
+    crc = __builtin_aarch64_crc32cx(crc, word);
+    p += 8;
+    length -= 8;
+  }
+  while (length-- > 0) crc = __builtin_aarch64_crc32cb(crc, *p++);
+  return crc;
+}
+
+bool DetectHardware() {
+  return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+}
+
+#else
+
+uint32_t Crc32cHardware(uint32_t crc, const uint8_t* p, size_t length) {
+  return Crc32cSoftware(crc, p, length);
+}
+
+bool DetectHardware() { return false; }
+
+#endif
+
+}  // namespace
+
+bool Crc32cIsHardwareAccelerated() {
+  static const bool hardware = DetectHardware();
+  return hardware;
+}
+
+uint32_t Crc32c(uint32_t crc, const void* data, size_t length) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  crc = ~crc;
+  crc = Crc32cIsHardwareAccelerated() ? Crc32cHardware(crc, p, length)
+                                      : Crc32cSoftware(crc, p, length);
+  return ~crc;
+}
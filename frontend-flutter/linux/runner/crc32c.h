@@ -0,0 +1,19 @@
+#ifndef RUNNER_CRC32C_H_
+#define RUNNER_CRC32C_H_
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * CRC-32C (Castagnoli). Uses the SSE4.2 / ARMv8 CRC instructions when the
+ * CPU has them and a slicing-by-8 table otherwise.
+ *
+ * Pass the previous return value as |crc| to checksum a stream in pieces;
+ * start with 0.
+ */
+uint32_t Crc32c(uint32_t crc, const void* data, size_t length);
+
+// True when Crc32c is running on the hardware instructions.
+bool Crc32cIsHardwareAccelerated();
+
+#endif  // RUNNER_CRC32C_H_
@@ -0,0 +1,449 @@
+#include "download_progress.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "channel_utils.h"
+
+namespace {
+
+// Main loop delay is probed this often during a benchmark.
+const int64_t kProbeIntervalUs = 10000;
+
+int64_t Percentile(std::vector<int64_t> samples, double fraction) {
+  if (samples.empty()) return 0;
+  size_t index = std::min(samples.size() - 1,
+                          size_t(fraction * double(samples.size())));
+  std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+  return samples[index];
+}
+
+FlValue* TransferToFlValue(int64_t id, int64_t received, int64_t total,
+                           bool done, bool ok) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "id", fl_value_new_int(id));
+  fl_value_set_string_take(value, "received", fl_value_new_int(received));
+  fl_value_set_string_take(value, "total", fl_value_new_int(total));
+  fl_value_set_string_take(value, "done", fl_value_new_bool(done));
+  fl_value_set_string_take(value, "ok", fl_value_new_bool(ok));
+  return value;
+}
+
+}  // namespace
+
+DownloadProgress::DownloadProgress() {}
+
+DownloadProgress::~DownloadProgress() {
+  Unschedule();
+  if (view_ != nullptr && window_state_handler_ != 0) {
+    g_signal_handler_disconnect(gtk_widget_get_toplevel(view_),
+                                window_state_handler_);
+  }
+  if (channel_ != nullptr) g_object_unref(channel_);
+  if (control_channel_ != nullptr) g_object_unref(control_channel_);
+}
+
+DownloadProgress::Transfer* DownloadProgress::Begin(int64_t id,
+                                                    int64_t total) {
+  for (Transfer& transfer : transfers_) {
+    int expected = Transfer::kFree;
+    if (!transfer.state_.compare_exchange_strong(expected,
+                                                 Transfer::kClaimed)) {
+      continue;
+    }
+    transfer.id_.store(id, std::memory_order_relaxed);
+    transfer.received_.store(0, std::memory_order_relaxed);
+    transfer.total_.store(total, std::memory_order_relaxed);
+    transfer.ok_.store(false, std::memory_order_relaxed);
+    transfer.state_.store(Transfer::kActive, std::memory_order_release);
+    active_.fetch_add(1);
+    Wake();
+    return &transfer;
+  }
+  return nullptr;
+}
+
+void DownloadProgress::End(Transfer* transfer, bool ok) {
+  transfer->ok_.store(ok, std::memory_order_relaxed);
+  transfer->state_.store(Transfer::kDone, std::memory_order_release);
+  active_.fetch_sub(1);
+  // The main thread may have just seen the transfer active and nothing
+  // else, and stopped; it has to come back for the final report.
+  Wake();
+}
+
+void DownloadProgress::Wake() {
+  if (wake_pending_.exchange(true)) return;
+  RunOnMainThread([this]() {
+    wake_pending_ = false;
+    Schedule(true);
+  });
+}
+
+void DownloadProgress::Schedule(bool start) {
+  bool running = tick_id_ != 0 || timer_id_ != 0;
+  if (!running && !start) return;
+  // Frames only matter to someone looking at them.
+  if (listening_ && visible_ && view_ != nullptr) {
+    if (timer_id_ != 0) g_source_remove(timer_id_);
+    timer_id_ = 0;
+    if (tick_id_ == 0) {
+      last_frame_us_ = 0;
+      tick_id_ = gtk_widget_add_tick_callback(view_, OnTick, this, nullptr);
+    }
+  } else {
+    if (tick_id_ != 0) gtk_widget_remove_tick_callback(view_, tick_id_);
+    tick_id_ = 0;
+    if (timer_id_ == 0) {
+      timer_id_ = g_timeout_add(kBackgroundIntervalMs, OnTimer, this);
+    }
+  }
+}
+
+void DownloadProgress::Unschedule() {
+  if (tick_id_ != 0 && view_ != nullptr) {
+    gtk_widget_remove_tick_callback(view_, tick_id_);
+  }
+  if (timer_id_ != 0) g_source_remove(timer_id_);
+  tick_id_ = 0;
+  timer_id_ = 0;
+}
+
+gboolean DownloadProgress::OnTick(GtkWidget*, GdkFrameClock* clock,
+                                  gpointer user_data) {
+  DownloadProgress* self = static_cast<DownloadProgress*>(user_data);
+  int64_t frame_us = gdk_frame_clock_get_frame_time(clock);
+  if (self->last_frame_us_ > 0) {
+    int64_t interval = frame_us - self->last_frame_us_;
+    self->frame_interval_us_ =
+        self->frame_interval_us_ == 0
+            ? interval
+            : (self->frame_interval_us_ * 7 + interval) / 8;
+  }
+  self->last_frame_us_ = frame_us;
+  self->frame_samples_++;
+  if (self->Sample()) return G_SOURCE_CONTINUE;
+  self->tick_id_ = 0;
+  return G_SOURCE_REMOVE;
+}
+
+gboolean DownloadProgress::OnTimer(gpointer user_data) {
+  DownloadProgress* self = static_cast<DownloadProgress*>(user_data);
+  self->background_samples_++;
+  if (self->Sample()) return G_SOURCE_CONTINUE;
+  self->timer_id_ = 0;
+  return G_SOURCE_REMOVE;
+}
+
+gboolean DownloadProgress::OnWindowState(GtkWidget*,
+                                         GdkEventWindowState* event,
+                                         gpointer user_data) {
+  DownloadProgress* self = static_cast<DownloadProgress*>(user_data);
+  bool visible = (event->new_window_state & (GDK_WINDOW_STATE_ICONIFIED |
+                                             GDK_WINDOW_STATE_WITHDRAWN)) == 0;
+  if (visible != self->visible_) {
+    self->visible_ = visible;
+    self->Schedule(false);
+  }
+  return FALSE;
+}
+
+bool DownloadProgress::Sample() {
+  samples_++;
+  FlValue* list = nullptr;
+  for (Transfer& transfer : transfers_) {
+    int state = transfer.state_.load(std::memory_order_acquire);
+    if (state != Transfer::kActive && state != Transfer::kDone) continue;
+    bool done = state == Transfer::kDone;
+    int64_t received = transfer.received_.load(std::memory_order_relaxed);
+    if (listening_ && (done || received != transfer.reported_received_)) {
+      if (list == nullptr) list = fl_value_new_list();
+      fl_value_append_take(
+          list, TransferToFlValue(
+                    transfer.id_.load(std::memory_order_relaxed), received,
+                    transfer.total_.load(std::memory_order_relaxed), done,
+                    transfer.ok_.load(std::memory_order_relaxed)));
+    }
+    transfer.reported_received_ = received;
+    if (done) {
+      transfer.reported_received_ = -1;
+      transfer.state_.store(Transfer::kFree, std::memory_order_release);
+    }
+  }
+
+  if (list != nullptr) {
+    g_autoptr(FlValue) message = fl_value_new_map();
+    fl_value_set_string_take(message, "transfers", list);
+    fl_event_channel_send(channel_, message, nullptr, nullptr);
+    messages_++;
+  } else {
+    idle_samples_++;
+  }
+  return active_.load() > 0;
+}
+
+void DownloadProgress::SendOne(int64_t id, int64_t received, int64_t total) {
+  if (!listening_) return;
+  g_autoptr(FlValue) message = fl_value_new_map();
+  FlValue* list = fl_value_new_list();
+  fl_value_append_take(list,
+                       TransferToFlValue(id, received, total, false, false));
+  fl_value_set_string_take(message, "transfers", list);
+  fl_event_channel_send(channel_, message, nullptr, nullptr);
+  messages_++;
+}
+
+FlValue* DownloadProgress::Stats() {
+  const char* mode = tick_id_ != 0    ? "frame"
+                     : timer_id_ != 0 ? "background"
+                                      : "idle";
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "mode", fl_value_new_string(mode));
+  fl_value_set_string_take(value, "listening", fl_value_new_bool(listening_));
+  fl_value_set_string_take(value, "visible", fl_value_new_bool(visible_));
+  fl_value_set_string_take(value, "active", fl_value_new_int(active_.load()));
+  fl_value_set_string_take(value, "messages", fl_value_new_int(messages_));
+  fl_value_set_string_take(value, "frameSamples",
+                           fl_value_new_int(frame_samples_));
+  fl_value_set_string_take(value, "backgroundSamples",
+                           fl_value_new_int(background_samples_));
+  fl_value_set_string_take(value, "idleSamples",
+                           fl_value_new_int(idle_samples_));
+  fl_value_set_string_take(value, "frameIntervalMicros",
+                           fl_value_new_int(frame_interval_us_));
+  return value;
+}
+
+FlValue* DownloadProgress::Benchmark(const std::string& url, int transfers,
+                                     bool naive) {
+  struct Download {
+    DownloadProgress* self = nullptr;
+    CURL* curl = nullptr;
+    Transfer* transfer = nullptr;
+    int64_t id = 0;
+    int64_t received = 0;
+    int64_t total = 0;
+    bool naive = false;
+    bool started = false;
+  };
+  static const curl_write_callback kReceive = [](char*, size_t size,
+                                                 size_t count,
+                                                 void* user_data) {
+    Download* download = static_cast<Download*>(user_data);
+    if (!download->started) {
+      download->started = true;
+      curl_off_t length = -1;
+      curl_easy_getinfo(download->curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                        &length);
+      download->total = length > 0 ? int64_t(length) : 0;
+      if (download->transfer != nullptr) {
+        download->transfer->SetTotal(download->total);
+      }
+    }
+    download->received += int64_t(size * count);
+    if (download->naive) {
+      // What a per-chunk event sink would do.
+      DownloadProgress* self = download->self;
+      int64_t id = download->id;
+      int64_t received = download->received;
+      int64_t total = download->total;
+      RunOnMainThread([self, id, received, total]() {
+        self->SendOne(id, received, total);
+      });
+    } else if (download->transfer != nullptr) {
+      download->transfer->Update(download->received);
+    }
+    return size * count;
+  };
+
+  // How long the main loop takes to get to a task posted to it; floods of
+  // channel messages show up here before they show up as dropped frames.
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::vector<int64_t> delays;
+  int probes_in_flight = 0;
+  auto probe = [&]() {
+    int64_t posted = g_get_monotonic_time();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      probes_in_flight++;
+    }
+    RunOnMainThread([&, posted]() {
+      std::lock_guard<std::mutex> lock(mutex);
+      delays.push_back(g_get_monotonic_time() - posted);
+      probes_in_flight--;
+      cv.notify_all();
+    });
+  };
+
+  int64_t messages_before = messages_.load();
+  int64_t samples_before = samples_.load();
+  CURLM* multi = curl_multi_init();
+  std::vector<Download> downloads(size_t(std::max(1, transfers)));
+  for (size_t i = 0; i < downloads.size(); i++) {
+    Download& download = downloads[i];
+    download.self = this;
+    download.id = -1 - int64_t(i);  // Apart from real photo ids.
+    download.naive = naive;
+    download.curl = curl_easy_init();
+    if (!naive) download.transfer = Begin(download.id, 0);
+    curl_easy_setopt(download.curl, CURLOPT_URL, url.c_str());
+    curl_easy_setopt(download.curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(download.curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(download.curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(download.curl, CURLOPT_WRITEFUNCTION, kReceive);
+    curl_easy_setopt(download.curl, CURLOPT_WRITEDATA, &download);
+    curl_easy_setopt(download.curl, CURLOPT_PRIVATE, &download);
+    curl_multi_add_handle(multi, download.curl);
+  }
+
+  int64_t start = g_get_monotonic_time();
+  int64_t next_probe = start;
+  int running = int(downloads.size());
+  int failures = 0;
+  while (running > 0) {
+    curl_multi_perform(multi, &running);
+    CURLMsg* message;
+    int queued;
+    while ((message = curl_multi_info_read(multi, &queued)) != nullptr) {
+      if (message->msg != CURLMSG_DONE) continue;
+      Download* download = nullptr;
+      curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &download);
+      bool ok = message->data.result == CURLE_OK;
+      if (!ok) failures++;
+      if (download->transfer != nullptr) End(download->transfer, ok);
+      download->transfer = nullptr;
+    }
+    int64_t now = g_get_monotonic_time();
+    if (now >= next_probe) {
+      probe();
+      next_probe = now + kProbeIntervalUs;
+    }
+    if (running > 0) curl_multi_poll(multi, nullptr, 0, 10, nullptr);
+  }
+  int64_t elapsed_us = std::max<int64_t>(1, g_get_monotonic_time() - start);
+
+  // The last probe queues behind every naive send, so once it is back all
+  // of them have gone out.
+  probe();
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return probes_in_flight == 0; });
+  }
+  int64_t drain_us = g_get_monotonic_time() - start - elapsed_us;
+
+  int64_t bytes = 0;
+  for (Download& download : downloads) {
+    bytes += download.received;
+    curl_multi_remove_handle(multi, download.curl);
+    curl_easy_cleanup(download.curl);
+  }
+  curl_multi_cleanup(multi);
+
+  int64_t messages = messages_.load() - messages_before;
+  FlValue* result = fl_value_new_map();
+  fl_value_set_string_take(result, "naive", fl_value_new_bool(naive));
+  fl_value_set_string_take(result, "transfers",
+                           fl_value_new_int(int64_t(downloads.size())));
+  fl_value_set_string_take(result, "failures", fl_value_new_int(failures));
+  fl_value_set_string_take(result, "bytes", fl_value_new_int(bytes));
+  fl_value_set_string_take(result, "elapsedMicros",
+                           fl_value_new_int(elapsed_us));
+  fl_value_set_string_take(result, "drainMicros", fl_value_new_int(drain_us));
+  fl_value_set_string_take(result, "messages", fl_value_new_int(messages));
+  fl_value_set_string_take(
+      result, "messagesPerSecond",
+      fl_value_new_float(double(messages) * 1e6 / double(elapsed_us)));
+  fl_value_set_string_take(
+      result, "samples", fl_value_new_int(samples_.load() - samples_before));
+  fl_value_set_string_take(result, "mainLoopDelayP50Micros",
+                           fl_value_new_int(Percentile(delays, 0.5)));
+  fl_value_set_string_take(result, "mainLoopDelayP99Micros",
+                           fl_value_new_int(Percentile(delays, 0.99)));
+  fl_value_set_string_take(
+      result, "mainLoopDelayMaxMicros",
+      fl_value_new_int(delays.empty()
+                           ? 0
+                           : *std::max_element(delays.begin(), delays.end())));
+  return result;
+}
+
+void DownloadProgress::RegisterChannel(FlBinaryMessenger* messenger,
+                                       GtkWidget* view, WorkerPool* pool) {
+  pool_ = pool;
+  view_ = view;
+  // Ticks and handlers die with the view; so must the pointer to it.
+  g_signal_connect(view_, "destroy", G_CALLBACK(+[](GtkWidget*,
+                                                   gpointer user_data) {
+                     DownloadProgress* self =
+                         static_cast<DownloadProgress*>(user_data);
+                     self->view_ = nullptr;
+                     self->tick_id_ = 0;
+                     self->window_state_handler_ = 0;
+                     self->Schedule(false);
+                   }),
+                   this);
+  window_state_handler_ =
+      g_signal_connect(gtk_widget_get_toplevel(view_), "window-state-event",
+                       G_CALLBACK(OnWindowState), this);
+
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_event_channel_new(messenger,
+                                  "com.rabee.omran.downloads/progress",
+                                  FL_METHOD_CODEC(codec));
+  fl_event_channel_set_stream_handlers(
+      channel_,
+      [](FlEventChannel*, FlValue*, gpointer user_data)
+          -> FlMethodErrorResponse* {
+        DownloadProgress* self = static_cast<DownloadProgress*>(user_data);
+        self->listening_ = true;
+        self->Schedule(false);
+        return nullptr;
+      },
+      [](FlEventChannel*, FlValue*, gpointer user_data)
+          -> FlMethodErrorResponse* {
+        DownloadProgress* self = static_cast<DownloadProgress*>(user_data);
+        self->listening_ = false;
+        self->Schedule(false);
+        return nullptr;
+      },
+      this, nullptr);
+
+  control_channel_ = fl_method_channel_new(
+      messenger, "com.rabee.omran.downloads", FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      control_channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        DownloadProgress* self = static_cast<DownloadProgress*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+
+        if (strcmp(method, "stats") == 0) {
+          g_autoptr(FlValue) stats = self->Stats();
+          fl_method_call_respond_success(method_call, stats, nullptr);
+        } else if (strcmp(method, "benchmark") == 0) {
+          std::string url = ArgString(args, "url");
+          if (url.empty()) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         "url is required", nullptr, nullptr);
+            return;
+          }
+          int transfers = int(ArgInt(args, "transfers", 20));
+          bool naive = ArgBool(args, "naive", false);
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, url, transfers, naive]() {
+            RespondSuccessLater(method_call,
+                                self->Benchmark(url, transfers, naive));
+          });
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
@@ -0,0 +1,116 @@
+#ifndef RUNNER_DOWNLOAD_PROGRESS_H_
+#define RUNNER_DOWNLOAD_PROGRESS_H_
+
+#include <flutter_linux/flutter_linux.h>
+#include <gtk/gtk.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "worker_pool.h"
+
+/**
+ * Download progress for the UI, on the "com.rabee.omran.downloads/progress"
+ * event channel.
+ *
+ * Download threads only store byte counts into a transfer's atomics; they
+ * never wake the main loop per chunk. The main thread samples every active
+ * transfer once per frame of the Flutter view's frame clock and sends one
+ * message covering all that moved. While the window is hidden, or nothing
+ * listens, it samples every kBackgroundIntervalMs instead, and while no
+ * transfer is active it does not run at all.
+ */
+class DownloadProgress {
+ public:
+  static const int kMaxTransfers = 64;
+  static const int kBackgroundIntervalMs = 250;
+
+  // One transfer's counters. Written by its download thread, read by the
+  // main thread.
+  class Transfer {
+   public:
+    void Update(int64_t received) {
+      received_.store(received, std::memory_order_relaxed);
+    }
+    // For when the size is only known once the response starts.
+    void SetTotal(int64_t total) {
+      total_.store(total, std::memory_order_relaxed);
+    }
+
+   private:
+    friend class DownloadProgress;
+    enum State { kFree, kClaimed, kActive, kDone };
+
+    std::atomic<int> state_{kFree};
+    std::atomic<int64_t> id_{0};
+    std::atomic<int64_t> received_{0};
+    std::atomic<int64_t> total_{0};  // 0 when unknown.
+    std::atomic<bool> ok_{false};
+    // Main thread only: what the last message said.
+    int64_t reported_received_ = -1;
+  };
+
+  DownloadProgress();
+  ~DownloadProgress();
+
+  DownloadProgress(const DownloadProgress&) = delete;
+  DownloadProgress& operator=(const DownloadProgress&) = delete;
+
+  // Starts reporting photo |id|; |total| is 0 when unknown. Returns null
+  // when kMaxTransfers are already reported. Any thread.
+  Transfer* Begin(int64_t id, int64_t total);
+  // Reports |transfer| finished; it is sent once more, then recycled.
+  void End(Transfer* transfer, bool ok);
+
+  // Exposes the event channel, and stats and benchmark on the
+  // "com.rabee.omran.downloads" channel. Frames are those of |view|.
+  void RegisterChannel(FlBinaryMessenger* messenger, GtkWidget* view,
+                       WorkerPool* pool);
+
+ private:
+  // Has the main thread start sampling, if it is not already. Any thread.
+  void Wake();
+  // Samples per frame or on the background timer, whichever fits now;
+  // unless |start|, only when sampling already.
+  void Schedule(bool start);
+  void Unschedule();
+  static gboolean OnTick(GtkWidget*, GdkFrameClock*, gpointer user_data);
+  static gboolean OnTimer(gpointer user_data);
+  static gboolean OnWindowState(GtkWidget*, GdkEventWindowState* event,
+                                gpointer user_data);
+  // Sends what moved since the last call. Returns false once nothing is
+  // active any more.
+  bool Sample();
+  void SendOne(int64_t id, int64_t received, int64_t total);
+
+  FlValue* Stats();
+  // Runs |transfers| concurrent downloads of |url| into nothing; with
+  // |naive|, every chunk is sent to Dart on its own instead. Blocking.
+  FlValue* Benchmark(const std::string& url, int transfers, bool naive);
+
+  Transfer transfers_[kMaxTransfers];
+  std::atomic<int> active_{0};
+  std::atomic<bool> wake_pending_{false};
+
+  // Main thread only from here on.
+  FlEventChannel* channel_ = nullptr;
+  FlMethodChannel* control_channel_ = nullptr;
+  WorkerPool* pool_ = nullptr;
+  GtkWidget* view_ = nullptr;
+  gulong window_state_handler_ = 0;
+  bool listening_ = false;
+  bool visible_ = true;
+  guint tick_id_ = 0;
+  guint timer_id_ = 0;
+
+  std::atomic<int64_t> messages_{0};
+  std::atomic<int64_t> samples_{0};
+  int64_t frame_samples_ = 0;
+  int64_t background_samples_ = 0;
+  int64_t idle_samples_ = 0;  // Nothing had moved.
+  int64_t last_frame_us_ = 0;
+  int64_t frame_interval_us_ = 0;  // Smoothed.
+};
+
+#endif  // RUNNER_DOWNLOAD_PROGRESS_H_
@@ -0,0 +1,222 @@
+#include "exif_reader.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+constexpr uint16_t kTagOrientation = 0x0112;
+constexpr uint16_t kTagDateTime = 0x0132;
+constexpr uint16_t kTagExifIfd = 0x8769;
+constexpr uint16_t kTagDateTimeOriginal = 0x9003;
+constexpr uint16_t kTypeAscii = 2;
+constexpr size_t kDateTimeLength = 19;  // "YYYY:MM:DD HH:MM:SS"
+
+// Bounds-checked reader over the TIFF block embedded in an EXIF segment.
+class TiffReader {
+ public:
+  TiffReader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+  bool Init() {
+    if (size_ < 8) return false;
+    if (data_[0] == 'I' && data_[1] == 'I') {
+      little_endian_ = true;
+    } else if (data_[0] == 'M' && data_[1] == 'M') {
+      little_endian_ = false;
+    } else {
+      return false;
+    }
+    uint16_t magic = 0;
+    return Read16(2, &magic) && magic == 42;
+  }
+
+  bool Read16(size_t offset, uint16_t* value) const {
+    if (offset + 2 > size_) return false;
+    const uint8_t* p = data_ + offset;
+    *value = little_endian_ ? (p[0] | (p[1] << 8)) : ((p[0] << 8) | p[1]);
+    return true;
+  }
+
+  // Reads an ASCII entry, whose data sits inline or at an offset depending
+  // on its length.
+  bool ReadAscii(size_t entry, std::string* value) const {
+    uint16_t type = 0;
+    uint32_t count = 0;
+    if (!Read16(entry + 2, &type) || type != kTypeAscii ||
+        !Read32(entry + 4, &count) || count == 0) {
+      return false;
+    }
+    size_t offset = entry + 8;
+    if (count > 4) {
+      uint32_t data_offset = 0;
+      if (!Read32(entry + 8, &data_offset)) return false;
+      offset = data_offset;
+    }
+    if (offset + count > size_) return false;
+    const char* text = reinterpret_cast<const char*>(data_ + offset);
+    value->assign(text, strnlen(text, count));
+    return true;
+  }
+
+  bool Read32(size_t offset, uint32_t* value) const {
+    if (offset + 4 > size_) return false;
+    const uint8_t* p = data_ + offset;
+    if (little_endian_) {
+      *value = p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+    } else {
+      *value = (uint32_t(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+    return true;
+  }
+
+ private:
+  const uint8_t* data_;
+  size_t size_;
+  bool little_endian_ = true;
+};
+
+// Converts "YYYY:MM:DD HH:MM:SS" into ISO 8601 without a zone, rejecting
+// the all-blank and zero dates some cameras write.
+bool NormalizeDateTime(const std::string& exif, std::string* iso) {
+  if (exif.size() < kDateTimeLength || exif[4] != ':' || exif[7] != ':' ||
+      exif[10] != ' ' || exif.compare(0, 4, "0000") == 0) {
+    return false;
+  }
+  for (size_t i : {0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 17, 18}) {
+    if (exif[i] < '0' || exif[i] > '9') return false;
+  }
+  *iso = exif.substr(0, kDateTimeLength);
+  (*iso)[4] = '-';
+  (*iso)[7] = '-';
+  (*iso)[10] = 'T';
+  return true;
+}
+
+}  // namespace
+
+bool ParseExif(const uint8_t* data, size_t size, ExifInfo* info) {
+  static const char kExifHeader[] = {'E', 'x', 'i', 'f', 0, 0};
+  if (size < sizeof(kExifHeader) ||
+      memcmp(data, kExifHeader, sizeof(kExifHeader)) != 0) {
+    return false;
+  }
+
+  TiffReader tiff(data + sizeof(kExifHeader), size - sizeof(kExifHeader));
+  if (!tiff.Init()) return false;
+
+  uint32_t ifd0 = 0;
+  uint16_t entry_count = 0;
+  if (!tiff.Read32(4, &ifd0) || !tiff.Read16(ifd0, &entry_count)) {
+    return false;
+  }
+
+  uint32_t exif_ifd = 0;
+  std::string date_time;
+  for (uint16_t i = 0; i < entry_count; i++) {
+    size_t entry = ifd0 + 2 + size_t(i) * 12;
+    uint16_t tag = 0;
+    if (!tiff.Read16(entry, &tag)) return false;
+    if (tag == kTagOrientation) {
+      uint16_t orientation = 1;
+      if (tiff.Read16(entry + 8, &orientation) && orientation >= 1 &&
+          orientation <= 8) {
+        info->orientation = orientation;
+      }
+    } else if (tag == kTagExifIfd) {
+      tiff.Read32(entry + 8, &exif_ifd);
+    } else if (tag == kTagDateTime) {
+      tiff.ReadAscii(entry, &date_time);
+    }
+  }
+
+  // The capture time lives in the Exif sub-IFD; DateTime in IFD0 is the
+  // last-modified time and only a fallback.
+  uint16_t exif_count = 0;
+  if (exif_ifd != 0 && tiff.Read16(exif_ifd, &exif_count)) {
+    for (uint16_t i = 0; i < exif_count; i++) {
+      size_t entry = exif_ifd + 2 + size_t(i) * 12;
+      uint16_t tag = 0;
+      if (!tiff.Read16(entry, &tag)) break;
+      std::string original;
+      if (tag == kTagDateTimeOriginal && tiff.ReadAscii(entry, &original) &&
+          NormalizeDateTime(original, &info->capture_time)) {
+        return true;
+      }
+    }
+  }
+  NormalizeDateTime(date_time, &info->capture_time);
+  return true;
+}
+
+bool FindJpegExif(const uint8_t* data, size_t size, ExifInfo* info) {
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+  // Walk the segments up to the start of scan; APP1 is almost always the
+  // first or second one.
+  size_t pos = 2;
+  while (pos + 4 <= size && data[pos] == 0xFF) {
+    uint8_t type = data[pos + 1];
+    size_t length = size_t((data[pos + 2] << 8) | data[pos + 3]);
+    if (type == 0xDA || type == 0xD9 || length < 2) break;
+    if (type == 0xE1 && pos + 2 + length <= size &&
+        ParseExif(data + pos + 4, length - 2, info)) {
+      return true;
+    }
+    pos += 2 + length;
+  }
+  return false;
+}
+
+bool FindExifBlock(const uint8_t* data, size_t size, const uint8_t** block,
+                   size_t* block_size) {
+  static const uint8_t kExifPrefix[] = {'E', 'x', 'i', 'f', 0, 0};
+  static const uint8_t kPngSignature[] = {0x89, 'P', 'N', 'G',
+                                          0x0D, 0x0A, 0x1A, 0x0A};
+  if (size >= 8 && memcmp(data, kPngSignature, sizeof(kPngSignature)) == 0) {
+    size_t pos = 8;
+    while (pos + 12 <= size) {
+      size_t length = (size_t(data[pos]) << 24) | (size_t(data[pos + 1]) << 16) |
+                      (size_t(data[pos + 2]) << 8) | size_t(data[pos + 3]);
+      const uint8_t* type = data + pos + 4;
+      if (length > size - pos - 12) return false;
+      if (memcmp(type, "eXIf", 4) == 0) {
+        *block = data + pos + 8;
+        *block_size = length;
+        return true;
+      }
+      // Encoders must put eXIf before the image data.
+      if (memcmp(type, "IDAT", 4) == 0) return false;
+      pos += 12 + length;
+    }
+    return false;
+  }
+
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+  size_t pos = 2;
+  while (pos + 4 <= size && data[pos] == 0xFF) {
+    uint8_t type = data[pos + 1];
+    size_t length = size_t((data[pos + 2] << 8) | data[pos + 3]);
+    if (type == 0xDA || type == 0xD9 || length < 2) break;
+    if (type == 0xE1 && pos + 2 + length <= size &&
+        length - 2 > sizeof(kExifPrefix) &&
+        memcmp(data + pos + 4, kExifPrefix, sizeof(kExifPrefix)) == 0) {
+      *block = data + pos + 4 + sizeof(kExifPrefix);
+      *block_size = length - 2 - sizeof(kExifPrefix);
+      return true;
+    }
+    pos += 2 + length;
+  }
+  return false;
+}
+
+bool ReadJpegExif(const std::string& path, ExifInfo* info) {
+  // EXIF must fit in one 64 KB APP1 segment, so this head covers it unless
+  // other large segments come first.
+  const size_t kHeadBytes = 256 * 1024;
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) return false;
+  std::vector<uint8_t> head(kHeadBytes);
+  size_t read = fread(head.data(), 1, head.size(), file);
+  fclose(file);
+  return FindJpegExif(head.data(), read, info);
+}
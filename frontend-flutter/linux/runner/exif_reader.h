@@ -0,0 +1,46 @@
+#ifndef RUNNER_EXIF_READER_H_
+#define RUNNER_EXIF_READER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Subset of EXIF metadata the runner cares about.
+ */
+struct ExifInfo {
+  // TIFF orientation tag (1-8); 1 means the pixels are already upright.
+  int orientation = 1;
+  // DateTimeOriginal (falling back to DateTime) as "YYYY-MM-DDTHH:MM:SS" in
+  // camera local time; empty when absent.
+  std::string capture_time;
+};
+
+/**
+ * Parses the payload of a JPEG APP1 marker (starting at "Exif\0\0").
+ * Returns false if the block is not EXIF or is malformed; |info| keeps its
+ * defaults for any tag that could not be read.
+ */
+bool ParseExif(const uint8_t* data, size_t size, ExifInfo* info);
+
+/**
+ * Finds the EXIF block among the header segments of an in-memory JPEG and
+ * parses it.
+ */
+bool FindJpegExif(const uint8_t* data, size_t size, ExifInfo* info);
+
+/**
+ * Locates the raw EXIF block (the TIFF structure, without JPEG's "Exif\0\0"
+ * prefix) of an in-memory JPEG (APP1) or PNG (eXIf chunk). |*block| points
+ * into |data|.
+ */
+bool FindExifBlock(const uint8_t* data, size_t size, const uint8_t** block,
+                   size_t* block_size);
+
+/**
+ * Same as FindJpegExif for the JPEG at |path|. Only the head of the file is
+ * read, never the compressed image data.
+ */
+bool ReadJpegExif(const std::string& path, ExifInfo* info);
+
+#endif  // RUNNER_EXIF_READER_H_
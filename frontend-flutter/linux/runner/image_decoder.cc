@@ -0,0 +1,418 @@
+#include "image_decoder.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <jpeglib.h>
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+
+#include "exif_reader.h"
+
+namespace {
+
+// Largest image decoded, in output pixels: 400 MB of RGBA. Anything bigger
+// is refused before its buffer is allocated.
+const int64_t kMaxDecodePixels = 100000000;
+
+struct JpegErrorManager {
+  jpeg_error_mgr base;
+  jmp_buf jump;
+  char message[JMSG_LENGTH_MAX];
+};
+
+void JpegErrorExit(j_common_ptr cinfo) {
+  JpegErrorManager* manager = reinterpret_cast<JpegErrorManager*>(cinfo->err);
+  (*cinfo->err->format_message)(cinfo, manager->message);
+  longjmp(manager->jump, 1);
+}
+
+bool IsJpeg(FILE* file) {
+  unsigned char magic[3] = {0, 0, 0};
+  size_t read = fread(magic, 1, sizeof(magic), file);
+  rewind(file);
+  return read == sizeof(magic) && magic[0] == 0xFF && magic[1] == 0xD8 &&
+         magic[2] == 0xFF;
+}
+
+// Largest power-of-two IDCT denominator that keeps the longest side at or
+// above |max_dimension|, so the final resample only ever shrinks.
+int PickScaleDenominator(int width, int height, int max_dimension) {
+  if (max_dimension <= 0) return 1;
+  int longest = width > height ? width : height;
+  int denom = 8;
+  while (denom > 1 && longest / denom < max_dimension) denom /= 2;
+  return denom;
+}
+
+// Sizes |buffer| to |bytes|. When it is too small and |buffers| is set, it
+// is traded for one from |buffers| instead of being reallocated.
+void SizeBuffer(PixelBufferSource* buffers, size_t bytes,
+                std::vector<uint8_t>* buffer) {
+  if (buffers != nullptr && buffer->capacity() < bytes) {
+    buffers->Release(std::move(*buffer));
+    *buffer = buffers->Acquire(bytes);
+  }
+  buffer->resize(bytes);
+}
+
+// Replaces |image|'s pixels with |pixels|, returning the old ones to
+// |buffers| when it is set.
+void SwapPixels(PixelBufferSource* buffers, std::vector<uint8_t>* pixels,
+                DecodedImage* image) {
+  image->rgba.swap(*pixels);
+  if (buffers != nullptr) buffers->Release(std::move(*pixels));
+}
+
+// Box-filter downscale into |out|, which holds width * height pixels; the
+// scaled IDCT has already brought the source within 2x of the target so the
+// kernel never gets large.
+void Downscale(const DecodedImage& source, int width, int height,
+               uint8_t* out) {
+  for (int y = 0; y < height; y++) {
+    int y0 = y * source.height / height;
+    int y1 = (y + 1) * source.height / height;
+    if (y1 <= y0) y1 = y0 + 1;
+    for (int x = 0; x < width; x++) {
+      int x0 = x * source.width / width;
+      int x1 = (x + 1) * source.width / width;
+      if (x1 <= x0) x1 = x0 + 1;
+      uint32_t sum[4] = {0, 0, 0, 0};
+      for (int sy = y0; sy < y1; sy++) {
+        const uint8_t* row = &source.rgba[(size_t(sy) * source.width + x0) * 4];
+        for (int sx = x0; sx < x1; sx++, row += 4) {
+          sum[0] += row[0];
+          sum[1] += row[1];
+          sum[2] += row[2];
+          sum[3] += row[3];
+        }
+      }
+      uint32_t count = uint32_t(y1 - y0) * uint32_t(x1 - x0);
+      uint8_t* pixel = &out[(size_t(y) * width + x) * 4];
+      for (int c = 0; c < 4; c++) pixel[c] = uint8_t(sum[c] / count);
+    }
+  }
+}
+
+// Maps the stored pixels to upright orientation as described by the EXIF
+// orientation tag (1-8).
+void ApplyOrientation(int orientation, PixelBufferSource* buffers,
+                      DecodedImage* image) {
+  if (orientation <= 1 || orientation > 8) return;
+  bool transpose = orientation >= 5;
+  int width = transpose ? image->height : image->width;
+  int height = transpose ? image->width : image->height;
+  std::vector<uint8_t> rotated;
+  SizeBuffer(buffers, image->rgba.size(), &rotated);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int sx = 0, sy = 0;
+      switch (orientation) {
+        case 2: sx = image->width - 1 - x; sy = y; break;
+        case 3: sx = image->width - 1 - x; sy = image->height - 1 - y; break;
+        case 4: sx = x; sy = image->height - 1 - y; break;
+        case 5: sx = y; sy = x; break;
+        case 6: sx = y; sy = image->height - 1 - x; break;
+        case 7: sx = image->width - 1 - y; sy = image->height - 1 - x; break;
+        case 8: sx = image->width - 1 - y; sy = x; break;
+      }
+      memcpy(&rotated[(size_t(y) * width + x) * 4],
+             &image->rgba[(size_t(sy) * image->width + sx) * 4], 4);
+    }
+  }
+  SwapPixels(buffers, &rotated, image);
+  image->width = width;
+  image->height = height;
+  if (transpose) std::swap(image->source_width, image->source_height);
+}
+
+bool WithinDecodeLimit(int64_t width, int64_t height, std::string* error) {
+  if (width * height <= kMaxDecodePixels) return true;
+  *error = "Image is too large to decode (" + std::to_string(width) + "x" +
+           std::to_string(height) + ")";
+  return false;
+}
+
+// Turns the CMYK pixels of |row| into RGBA in place. Adobe writes CMYK and
+// YCCK JPEGs with inverted ink values, which the APP14 marker flags.
+void CmykToRgba(bool inverted, int width, uint8_t* row) {
+  for (int x = 0; x < width; x++, row += 4) {
+    // What each ink leaves of white.
+    uint32_t black = inverted ? row[3] : 255 - row[3];
+    for (int c = 0; c < 3; c++) {
+      uint32_t color = inverted ? row[c] : 255 - row[c];
+      row[c] = uint8_t(color * black / 255);
+    }
+    row[3] = 255;
+  }
+}
+
+// Decodes from |file| when it is set, otherwise from |data|.
+bool DecodeJpeg(FILE* file, const uint8_t* data, size_t size,
+                int max_dimension, DecodedImage* image, int* orientation,
+                std::string* error, PixelBufferSource* buffers) {
+  jpeg_decompress_struct cinfo;
+  JpegErrorManager error_manager;
+  cinfo.err = jpeg_std_error(&error_manager.base);
+  error_manager.base.error_exit = JpegErrorExit;
+  if (setjmp(error_manager.jump)) {
+    *error = error_manager.message;
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+
+  jpeg_create_decompress(&cinfo);
+  if (file != nullptr) {
+    jpeg_stdio_src(&cinfo, file);
+  } else {
+    jpeg_mem_src(&cinfo, data, static_cast<unsigned long>(size));
+  }
+  jpeg_save_markers(&cinfo, JPEG_APP0 + 1, 0xFFFF);
+  jpeg_read_header(&cinfo, TRUE);
+
+  for (jpeg_saved_marker_ptr marker = cinfo.marker_list; marker != nullptr;
+       marker = marker->next) {
+    ExifInfo exif;
+    if (marker->marker == JPEG_APP0 + 1 &&
+        ParseExif(marker->data, marker->data_length, &exif)) {
+      *orientation = exif.orientation;
+      break;
+    }
+  }
+
+  image->source_width = int(cinfo.image_width);
+  image->source_height = int(cinfo.image_height);
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = PickScaleDenominator(
+      image->source_width, image->source_height, max_dimension);
+  // libjpeg cannot convert four-channel JPEGs to RGB, so those come out
+  // as CMYK and are converted row by row.
+  bool cmyk = cinfo.jpeg_color_space == JCS_CMYK ||
+              cinfo.jpeg_color_space == JCS_YCCK;
+  cinfo.out_color_space = cmyk ? JCS_CMYK : JCS_EXT_RGBA;
+  cinfo.dct_method = JDCT_ISLOW;
+  jpeg_calc_output_dimensions(&cinfo);
+  if (!WithinDecodeLimit(cinfo.output_width, cinfo.output_height, error)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_start_decompress(&cinfo);
+
+  image->width = int(cinfo.output_width);
+  image->height = int(cinfo.output_height);
+  SizeBuffer(buffers, size_t(image->width) * image->height * 4, &image->rgba);
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = &image->rgba[size_t(cinfo.output_scanline) * image->width * 4];
+    jpeg_read_scanlines(&cinfo, &row, 1);
+    if (cmyk) CmykToRgba(cinfo.saw_Adobe_marker, image->width, row);
+  }
+
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+bool DecodeWithPixbuf(const std::string& path, int max_dimension,
+                      DecodedImage* image, std::string* error,
+                      PixelBufferSource* buffers) {
+  int source_width = 0;
+  int source_height = 0;
+  if (gdk_pixbuf_get_file_info(path.c_str(), &source_width, &source_height) ==
+      nullptr) {
+    *error = "Unsupported image format";
+    return false;
+  }
+  // The loader scales as it goes, so only what it hands back is bounded.
+  int64_t longest = std::max(source_width, source_height);
+  int64_t shortest = std::min(source_width, source_height);
+  if (max_dimension > 0 && longest > max_dimension) {
+    shortest = shortest * max_dimension / longest;
+    longest = max_dimension;
+  }
+  if (!WithinDecodeLimit(longest, shortest, error)) return false;
+
+  GError* gerror = nullptr;
+  int bound = max_dimension > 0 ? max_dimension : -1;
+  GdkPixbuf* loaded =
+      gdk_pixbuf_new_from_file_at_scale(path.c_str(), bound, bound, TRUE, &gerror);
+  if (loaded == nullptr) {
+    *error = gerror != nullptr ? gerror->message : "Decode failed";
+    g_clear_error(&gerror);
+    return false;
+  }
+  GdkPixbuf* oriented = gdk_pixbuf_apply_embedded_orientation(loaded);
+  g_object_unref(loaded);
+  GdkPixbuf* pixbuf = gdk_pixbuf_add_alpha(oriented, FALSE, 0, 0, 0);
+  g_object_unref(oriented);
+
+  image->width = gdk_pixbuf_get_width(pixbuf);
+  image->height = gdk_pixbuf_get_height(pixbuf);
+  bool transposed = (image->width > image->height) != (source_width > source_height);
+  image->source_width = transposed ? source_height : source_width;
+  image->source_height = transposed ? source_width : source_height;
+  SizeBuffer(buffers, size_t(image->width) * image->height * 4, &image->rgba);
+  int stride = gdk_pixbuf_get_rowstride(pixbuf);
+  const guchar* pixels = gdk_pixbuf_get_pixels(pixbuf);
+  for (int y = 0; y < image->height; y++) {
+    memcpy(&image->rgba[size_t(y) * image->width * 4], pixels + size_t(y) * stride,
+           size_t(image->width) * 4);
+  }
+  g_object_unref(pixbuf);
+  return true;
+}
+
+}  // namespace
+
+bool DecodeScaledImage(const std::string& path, int max_dimension,
+                       DecodedImage* image, std::string* error,
+                       PixelBufferSource* buffers) {
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    *error = "Cannot open " + path;
+    return false;
+  }
+  bool jpeg = IsJpeg(file);
+  int orientation = 1;
+  bool decoded = false;
+  if (jpeg) {
+    decoded = DecodeJpeg(file, nullptr, 0, max_dimension, image, &orientation,
+                         error, buffers);
+  }
+  fclose(file);
+  if (!jpeg) {
+    return DecodeWithPixbuf(path, max_dimension, image, error, buffers);
+  }
+  if (!decoded) return false;
+
+  int longest = image->width > image->height ? image->width : image->height;
+  if (max_dimension > 0 && longest > max_dimension) {
+    int width = int(int64_t(image->width) * max_dimension / longest);
+    int height = int(int64_t(image->height) * max_dimension / longest);
+    width = width > 0 ? width : 1;
+    height = height > 0 ? height : 1;
+    std::vector<uint8_t> scaled;
+    SizeBuffer(buffers, size_t(width) * height * 4, &scaled);
+    Downscale(*image, width, height, scaled.data());
+    SwapPixels(buffers, &scaled, image);
+    image->width = width;
+    image->height = height;
+  }
+  ApplyOrientation(orientation, buffers, image);
+  return true;
+}
+
+bool DecodeImageData(const uint8_t* data, size_t size, DecodedImage* image,
+                     std::string* error) {
+  if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF) {
+    int orientation = 1;
+    return DecodeJpeg(nullptr, data, size, 0, image, &orientation, error,
+                      nullptr);
+  }
+
+  GdkPixbufLoader* loader = gdk_pixbuf_loader_new();
+  GError* gerror = nullptr;
+  // The loader must be closed even when writing failed.
+  bool written = gdk_pixbuf_loader_write(loader, data, size, &gerror);
+  bool closed = gdk_pixbuf_loader_close(loader, written ? &gerror : nullptr);
+  GdkPixbuf* pixbuf =
+      written && closed ? gdk_pixbuf_loader_get_pixbuf(loader) : nullptr;
+  if (pixbuf == nullptr) {
+    *error = gerror != nullptr ? gerror->message : "Unsupported image format";
+    g_clear_error(&gerror);
+    g_object_unref(loader);
+    return false;
+  }
+  GdkPixbuf* rgba = gdk_pixbuf_add_alpha(pixbuf, FALSE, 0, 0, 0);
+  g_object_unref(loader);
+
+  image->width = image->source_width = gdk_pixbuf_get_width(rgba);
+  image->height = image->source_height = gdk_pixbuf_get_height(rgba);
+  image->rgba.resize(size_t(image->width) * image->height * 4);
+  int stride = gdk_pixbuf_get_rowstride(rgba);
+  const guchar* pixels = gdk_pixbuf_get_pixels(rgba);
+  for (int y = 0; y < image->height; y++) {
+    memcpy(&image->rgba[size_t(y) * image->width * 4], pixels + size_t(y) * stride,
+           size_t(image->width) * 4);
+  }
+  g_object_unref(rgba);
+  return true;
+}
+
+bool ReadImageSize(const uint8_t* data, size_t size, int* width,
+                   int* height) {
+  static const uint8_t kPngSignature[] = {0x89, 'P', 'N', 'G',
+                                          0x0D, 0x0A, 0x1A, 0x0A};
+  if (size >= 24 && memcmp(data, kPngSignature, sizeof(kPngSignature)) == 0) {
+    // IHDR is always the first chunk.
+    *width = int((data[16] << 24) | (data[17] << 16) | (data[18] << 8) |
+                 data[19]);
+    *height = int((data[20] << 24) | (data[21] << 16) | (data[22] << 8) |
+                  data[23]);
+    return true;
+  }
+  if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+
+  size_t pos = 2;
+  while (pos + 4 <= size && data[pos] == 0xFF) {
+    uint8_t marker = data[pos + 1];
+    size_t length = size_t((data[pos + 2] << 8) | data[pos + 3]);
+    // SOF0-SOF15 carry the frame size; C4, C8 and CC are other tables.
+    bool is_frame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 &&
+                    marker != 0xC8 && marker != 0xCC;
+    if (is_frame) {
+      if (pos + 9 > size) return false;
+      *height = (data[pos + 5] << 8) | data[pos + 6];
+      *width = (data[pos + 7] << 8) | data[pos + 8];
+      return true;
+    }
+    if (marker == 0xDA || length < 2) return false;
+    pos += 2 + length;
+  }
+  return false;
+}
+
+bool EncodeJpeg(const DecodedImage& image, int quality, const std::string& path,
+                std::string* error) {
+  FILE* file = fopen(path.c_str(), "wb");
+  if (file == nullptr) {
+    *error = "Cannot create " + path;
+    return false;
+  }
+
+  jpeg_compress_struct cinfo;
+  JpegErrorManager error_manager;
+  std::vector<uint8_t> row(size_t(image.width) * 3);
+  cinfo.err = jpeg_std_error(&error_manager.base);
+  error_manager.base.error_exit = JpegErrorExit;
+  if (setjmp(error_manager.jump)) {
+    *error = error_manager.message;
+    jpeg_destroy_compress(&cinfo);
+    fclose(file);
+    return false;
+  }
+
+  jpeg_create_compress(&cinfo);
+  jpeg_stdio_dest(&cinfo, file);
+  cinfo.image_width = image.width;
+  cinfo.image_height = image.height;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  jpeg_start_compress(&cinfo, TRUE);
+  while (cinfo.next_scanline < cinfo.image_height) {
+    const uint8_t* src = &image.rgba[size_t(cinfo.next_scanline) * image.width * 4];
+    for (int x = 0; x < image.width; x++, src += 4) {
+      uint32_t alpha = src[3];
+      for (int c = 0; c < 3; c++) {
+        row[x * 3 + c] = uint8_t((src[c] * alpha + 255 * (255 - alpha)) / 255);
+      }
+    }
+    JSAMPROW row_pointer = row.data();
+    jpeg_write_scanlines(&cinfo, &row_pointer, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return fclose(file) == 0;
+}
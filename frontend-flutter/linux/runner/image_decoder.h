@@ -0,0 +1,68 @@
+#ifndef RUNNER_IMAGE_DECODER_H_
+#define RUNNER_IMAGE_DECODER_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Tightly packed RGBA8888 image produced by the native decoders.
+ */
+struct DecodedImage {
+  int width = 0;
+  int height = 0;
+  // Dimensions of the encoded source, after EXIF orientation.
+  int source_width = 0;
+  int source_height = 0;
+  std::vector<uint8_t> rgba;
+};
+
+/**
+ * Hands out and takes back pixel buffers, so a caller that decodes over and
+ * over can recycle every buffer a decode goes through.
+ */
+class PixelBufferSource {
+ public:
+  virtual ~PixelBufferSource() = default;
+
+  // Returns an empty buffer with room for at least |bytes|.
+  virtual std::vector<uint8_t> Acquire(size_t bytes) = 0;
+  virtual void Release(std::vector<uint8_t> buffer) = 0;
+};
+
+/**
+ * Decodes |path| so that its longest side is at most |max_dimension|
+ * (0 decodes at full size). JPEGs use libjpeg-turbo's scaled IDCT so the
+ * full-resolution image is never materialised; other formats go through
+ * gdk-pixbuf's scaling loader. EXIF orientation is applied.
+ *
+ * With |buffers| set, the output and the intermediate downscale and
+ * rotation buffers come from it, and every buffer replaced on the way,
+ * including the one |image| arrived with, goes back to it.
+ */
+bool DecodeScaledImage(const std::string& path, int max_dimension,
+                       DecodedImage* image, std::string* error,
+                       PixelBufferSource* buffers = nullptr);
+
+/**
+ * Decodes an in-memory JPEG (libjpeg-turbo) or any format gdk-pixbuf knows
+ * at full size. Pixels are returned as stored: EXIF orientation is not
+ * applied, for callers that carry the EXIF block over to a re-encoded copy.
+ */
+bool DecodeImageData(const uint8_t* data, size_t size, DecodedImage* image,
+                     std::string* error);
+
+/**
+ * Reads the pixel dimensions of an in-memory JPEG or PNG from its header,
+ * without decoding. EXIF orientation is not applied.
+ */
+bool ReadImageSize(const uint8_t* data, size_t size, int* width, int* height);
+
+/**
+ * Writes |image| as a baseline JPEG at |quality|, flattening alpha onto
+ * white.
+ */
+bool EncodeJpeg(const DecodedImage& image, int quality,
+                const std::string& path, std::string* error);
+
+#endif  // RUNNER_IMAGE_DECODER_H_
@@ -0,0 +1,164 @@
+#include "io_uring_queue.h"
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+namespace {
+
+int IoUringSetup(unsigned entries, io_uring_params* params) {
+  return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int IoUringEnter(int fd, unsigned to_submit, unsigned min_complete,
+                 unsigned flags) {
+  return int(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                     nullptr, 0));
+}
+
+int IoUringRegister(int fd, unsigned opcode, const void* arg,
+                    unsigned nr_args) {
+  return int(syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template <typename T>
+T* At(void* base, uint32_t offset) {
+  return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+}  // namespace
+
+IoUringQueue::~IoUringQueue() {
+  if (sqes_ != nullptr) munmap(sqes_, sqes_size_);
+  if (cq_ring_ != nullptr && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != nullptr) munmap(sq_ring_, sq_ring_size_);
+  if (ring_fd_ >= 0) close(ring_fd_);
+}
+
+bool IoUringQueue::Init(unsigned entries) {
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd_ = IoUringSetup(entries, &params);
+  if (ring_fd_ < 0) return false;
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+  }
+
+  sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    sq_ring_ = nullptr;
+    return false;
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      cq_ring_ = nullptr;
+      return false;
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) return false;
+  sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+  sq_head_ = At<unsigned>(sq_ring_, params.sq_off.head);
+  sq_tail_ = At<unsigned>(sq_ring_, params.sq_off.tail);
+  sq_mask_ = At<unsigned>(sq_ring_, params.sq_off.ring_mask);
+  sq_array_ = At<unsigned>(sq_ring_, params.sq_off.array);
+  sq_entries_ = params.sq_entries;
+  cq_head_ = At<unsigned>(cq_ring_, params.cq_off.head);
+  cq_tail_ = At<unsigned>(cq_ring_, params.cq_off.tail);
+  cq_mask_ = At<unsigned>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = At<io_uring_cqe>(cq_ring_, params.cq_off.cqes);
+  return true;
+}
+
+bool IoUringQueue::RegisterBuffers(const std::vector<iovec>& buffers) {
+  buffers_registered_ =
+      IoUringRegister(ring_fd_, IORING_REGISTER_BUFFERS, buffers.data(),
+                      unsigned(buffers.size())) == 0;
+  return buffers_registered_;
+}
+
+io_uring_sqe* IoUringQueue::NextSqe() {
+  unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+  unsigned tail = *sq_tail_ + pending_;
+  if (tail - head >= sq_entries_) return nullptr;
+  unsigned index = tail & *sq_mask_;
+  io_uring_sqe* sqe = &sqes_[index];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array_[index] = index;
+  pending_++;
+  return sqe;
+}
+
+bool IoUringQueue::PrepareWrite(int fd, const void* data, uint32_t length,
+                                uint64_t offset, int buffer_index,
+                                uint64_t user_data) {
+  io_uring_sqe* sqe = NextSqe();
+  if (sqe == nullptr) return false;
+  if (buffers_registered_ && buffer_index >= 0) {
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->buf_index = uint16_t(buffer_index);
+  } else {
+    sqe->opcode = IORING_OP_WRITE;
+  }
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(data);
+  sqe->len = length;
+  sqe->off = offset;
+  sqe->user_data = user_data;
+  return true;
+}
+
+bool IoUringQueue::PrepareFsync(int fd, bool datasync, uint64_t user_data) {
+  io_uring_sqe* sqe = NextSqe();
+  if (sqe == nullptr) return false;
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = fd;
+  sqe->fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+  sqe->user_data = user_data;
+  return true;
+}
+
+int IoUringQueue::Submit(unsigned wait_for) {
+  unsigned to_submit = pending_;
+  if (to_submit > 0) {
+    __atomic_store_n(sq_tail_, *sq_tail_ + to_submit, __ATOMIC_RELEASE);
+    pending_ = 0;
+  }
+  if (to_submit == 0 && wait_for == 0) return 0;
+  int submitted;
+  do {
+    submitted = IoUringEnter(ring_fd_, to_submit, wait_for,
+                             wait_for > 0 ? IORING_ENTER_GETEVENTS : 0);
+  } while (submitted < 0 && errno == EINTR);
+  return submitted < 0 ? -errno : submitted;
+}
+
+void IoUringQueue::Reap(std::vector<Completion>* out) {
+  unsigned head = *cq_head_;
+  unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  while (head != tail) {
+    const io_uring_cqe& cqe = cqes_[head & *cq_mask_];
+    out->push_back(Completion{cqe.user_data, cqe.res});
+    head++;
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,77 @@
+#ifndef RUNNER_IO_URING_QUEUE_H_
+#define RUNNER_IO_URING_QUEUE_H_
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Minimal single-threaded io_uring wrapper over the raw syscalls, so the
+ * runner does not need liburing at build time. Only the operations the
+ * photo writer uses are exposed.
+ */
+class IoUringQueue {
+ public:
+  struct Completion {
+    uint64_t user_data;
+    int32_t result;
+  };
+
+  IoUringQueue() = default;
+  ~IoUringQueue();
+
+  IoUringQueue(const IoUringQueue&) = delete;
+  IoUringQueue& operator=(const IoUringQueue&) = delete;
+
+  // Returns false when the kernel lacks io_uring or it is blocked (seccomp,
+  // io_uring_disabled); callers then fall back to plain syscalls.
+  bool Init(unsigned entries);
+
+  // Registers |buffers| for WRITE_FIXED. Returns false if the kernel refused
+  // (usually RLIMIT_MEMLOCK); PrepareWrite then falls back to plain writes.
+  bool RegisterBuffers(const std::vector<iovec>& buffers);
+
+  // Each Prepare* returns false when the submission queue is full; call
+  // Submit() to make room.
+  bool PrepareWrite(int fd, const void* data, uint32_t length, uint64_t offset,
+                    int buffer_index, uint64_t user_data);
+  bool PrepareFsync(int fd, bool datasync, uint64_t user_data);
+
+  // Submits queued entries and blocks until at least |wait_for| completions
+  // are available. Returns the number submitted or -errno.
+  int Submit(unsigned wait_for);
+
+  // Moves available completions into |out| without blocking.
+  void Reap(std::vector<Completion>* out);
+
+  unsigned pending() const { return pending_; }
+  bool buffers_registered() const { return buffers_registered_; }
+
+ private:
+  io_uring_sqe* NextSqe();
+
+  int ring_fd_ = -1;
+  void* sq_ring_ = nullptr;
+  void* cq_ring_ = nullptr;
+  size_t sq_ring_size_ = 0;
+  size_t cq_ring_size_ = 0;
+  io_uring_sqe* sqes_ = nullptr;
+  size_t sqes_size_ = 0;
+
+  unsigned* sq_head_ = nullptr;
+  unsigned* sq_tail_ = nullptr;
+  unsigned* sq_mask_ = nullptr;
+  unsigned* sq_array_ = nullptr;
+  unsigned sq_entries_ = 0;
+  unsigned* cq_head_ = nullptr;
+  unsigned* cq_tail_ = nullptr;
+  unsigned* cq_mask_ = nullptr;
+  io_uring_cqe* cqes_ = nullptr;
+
+  unsigned pending_ = 0;  // Prepared but not yet submitted.
+  bool buffers_registered_ = false;
+};
+
+#endif  // RUNNER_IO_URING_QUEUE_H_
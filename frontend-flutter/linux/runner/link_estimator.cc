@@ -0,0 +1,154 @@
+#include "link_estimator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+// Small transfers measure round trips, not bandwidth.
+const int64_t kMinTransferBytes = 16 * 1024;
+const double kTransferWeight = 0.3;
+const int64_t kSampleIntervalUs = 250000;
+const int64_t kInterfaceRefreshUs = 10000000;
+// A counter peak halves every 10 s without new traffic, so a link that got
+// slower is believed within a few photos.
+const double kCounterHalfLifeUs = 10e6;
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t ReadRxBytes(const std::string& interface) {
+  std::string path = "/sys/class/net/" + interface + "/statistics/rx_bytes";
+  FILE* file = fopen(path.c_str(), "r");
+  if (file == nullptr) return -1;
+  long long bytes = -1;
+  if (fscanf(file, "%lld", &bytes) != 1) bytes = -1;
+  fclose(file);
+  return int64_t(bytes);
+}
+
+}  // namespace
+
+LinkEstimator::LinkEstimator(bool sample_counters)
+    : sample_counters_(sample_counters) {}
+
+std::string LinkEstimator::DefaultRouteInterface() {
+  FILE* file = fopen("/proc/net/route", "r");
+  if (file == nullptr) return std::string();
+  char line[256];
+  std::string best;
+  long best_metric = -1;
+  // Skip the header; columns are Iface Destination Gateway Flags RefCnt Use
+  // Metric Mask ...
+  if (fgets(line, sizeof(line), file) != nullptr) {
+    while (fgets(line, sizeof(line), file) != nullptr) {
+      char name[64];
+      unsigned long destination = 0, gateway = 0, mask = 0;
+      unsigned flags = 0;
+      int refcnt = 0, use = 0;
+      long metric = 0;
+      if (sscanf(line, "%63s %lx %lx %x %d %d %ld %lx", name, &destination,
+                 &gateway, &flags, &refcnt, &use, &metric, &mask) != 8) {
+        continue;
+      }
+      if (destination != 0 || mask != 0) continue;
+      if (best_metric < 0 || metric < best_metric) {
+        best = name;
+        best_metric = metric;
+      }
+    }
+  }
+  fclose(file);
+  return best;
+}
+
+void LinkEstimator::RecordTransfer(int64_t bytes, int64_t micros) {
+  if (bytes <= 0 || micros <= 0) return;
+  double rate = double(bytes) * 1e6 / double(micros);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (bytes < kMinTransferBytes) {
+    // Latency makes this an underestimate, which is still better than
+    // nothing: it only seeds the estimate until a real measurement lands.
+    if (transfers_ == 0) transfer_bps_ = std::max(transfer_bps_, rate);
+    return;
+  }
+  transfer_bps_ = transfers_ == 0 ? rate
+                                  : transfer_bps_ * (1 - kTransferWeight) +
+                                        rate * kTransferWeight;
+  transfers_++;
+  SampleCountersLocked(NowMicros());
+}
+
+void LinkEstimator::SampleCounters() {
+  if (!sample_counters_) return;
+  // Progress callbacks of every download land here; one sample is enough.
+  std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+  if (lock.owns_lock()) SampleCountersLocked(NowMicros());
+}
+
+void LinkEstimator::SampleCountersLocked(int64_t now_us) {
+  if (!sample_counters_ || now_us - last_sample_us_ < kSampleIntervalUs) {
+    return;
+  }
+  if (interface_.empty() ||
+      now_us - interface_checked_us_ >= kInterfaceRefreshUs) {
+    std::string interface = DefaultRouteInterface();
+    interface_checked_us_ = now_us;
+    if (interface != interface_) {
+      // A different link: nothing measured on the old one applies.
+      interface_ = interface;
+      last_rx_bytes_ = -1;
+      counter_bps_ = 0;
+    }
+  }
+  if (interface_.empty()) return;
+
+  int64_t rx_bytes = ReadRxBytes(interface_);
+  int64_t elapsed_us = now_us - last_sample_us_;
+  if (rx_bytes >= 0 && last_rx_bytes_ >= 0 && rx_bytes >= last_rx_bytes_ &&
+      elapsed_us > 0) {
+    double rate = double(rx_bytes - last_rx_bytes_) * 1e6 / double(elapsed_us);
+    counter_bps_ *= std::pow(0.5, double(elapsed_us) / kCounterHalfLifeUs);
+    counter_bps_ = std::max(counter_bps_, rate);
+  }
+  last_rx_bytes_ = rx_bytes;
+  last_sample_us_ = now_us;
+}
+
+double LinkEstimator::EstimateBytesPerSecond() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  SampleCountersLocked(NowMicros());
+  return std::max(transfer_bps_, counter_bps_);
+}
+
+int LinkEstimator::Choose(const std::vector<int64_t>& sizes, int64_t budget_us,
+                          int min_index) {
+  int count = int(sizes.size());
+  if (count == 0) return -1;
+  min_index = std::max(0, std::min(min_index, count - 1));
+  double bps = EstimateBytesPerSecond();
+  if (bps <= 0) return min_index;
+  int chosen = min_index;
+  for (int i = min_index; i < count; i++) {
+    if (double(sizes[i]) * 1e6 / bps <= double(budget_us)) chosen = i;
+  }
+  return chosen;
+}
+
+LinkEstimator::Snapshot LinkEstimator::snapshot() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  SampleCountersLocked(NowMicros());
+  Snapshot snapshot;
+  snapshot.interface = interface_;
+  snapshot.transfer_bytes_per_second = transfer_bps_;
+  snapshot.counter_bytes_per_second = counter_bps_;
+  snapshot.estimate_bytes_per_second = std::max(transfer_bps_, counter_bps_);
+  snapshot.transfers = transfers_;
+  return snapshot;
+}
@@ -0,0 +1,66 @@
+#ifndef RUNNER_LINK_ESTIMATOR_H_
+#define RUNNER_LINK_ESTIMATOR_H_
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Live estimate of how fast the active link can deliver a photo.
+ *
+ * Two signals feed it: the rate finished transfers actually achieved, and
+ * the receive counter of the default-route interface in
+ * /sys/class/net/<if>/statistics, sampled while transfers run. The counter
+ * sees every concurrent download at once, so it catches capacity that a
+ * single transfer sharing the link would understate. Thread-safe.
+ */
+class LinkEstimator {
+ public:
+  struct Snapshot {
+    std::string interface;
+    double transfer_bytes_per_second = 0;
+    double counter_bytes_per_second = 0;
+    double estimate_bytes_per_second = 0;
+    int64_t transfers = 0;
+  };
+
+  // |sample_counters| false relies on transfer rates alone, e.g. for
+  // benchmarks on a throttled loopback where the counters mean nothing.
+  explicit LinkEstimator(bool sample_counters = true);
+
+  // Feeds back a finished transfer of |bytes| that took |micros|.
+  void RecordTransfer(int64_t bytes, int64_t micros);
+
+  // Reads the interface counter; cheap enough to call from a transfer's
+  // progress callback, which is rate limited here.
+  void SampleCounters();
+
+  // Bytes per second, or 0 while nothing is known yet.
+  double EstimateBytesPerSecond();
+
+  // Index into |sizes| (ascending) of the largest entry expected to arrive
+  // within |budget_us|, but at least |min_index|. With no estimate yet the
+  // smallest allowed entry wins, so something shows up quickly.
+  int Choose(const std::vector<int64_t>& sizes, int64_t budget_us,
+             int min_index = 0);
+
+  Snapshot snapshot();
+
+ private:
+  void SampleCountersLocked(int64_t now_us);
+  static std::string DefaultRouteInterface();
+
+  const bool sample_counters_;
+  std::mutex mutex_;
+  double transfer_bps_ = 0;
+  int64_t transfers_ = 0;
+
+  std::string interface_;
+  int64_t interface_checked_us_ = 0;
+  int64_t last_rx_bytes_ = -1;
+  int64_t last_sample_us_ = 0;
+  double counter_bps_ = 0;  // Recent peak, decaying while idle.
+};
+
+#endif  // RUNNER_LINK_ESTIMATOR_H_
@@ -0,0 +1,322 @@
+#include "memory_governor.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "channel_utils.h"
+
+namespace {
+
+// Stall thresholds per 2 s window, the shortest the kernel lets
+// unprivileged processes poll. "some": at least one task waited on memory
+// for 7.5% of the window; "full": every runnable task did for 5% of it.
+const char* kTriggerSpecs[MemoryGovernor::kLevelCount] = {
+    "some 150000 2000000", "full 100000 2000000"};
+
+// Firings this soon after a reclaim of at least their tier find nothing
+// left to free.
+const int64_t kCooldownUs = 1000000;
+// Moderate pressure that is back this soon after a moderate reclaim was not
+// relieved by it.
+const int64_t kEscalateUs = 10 * 1000000LL;
+
+const char* kLevelNames[MemoryGovernor::kLevelCount] = {"moderate",
+                                                        "critical"};
+
+// This process's cgroup v2 path, e.g. "/user.slice/app.scope".
+std::string CgroupPath() {
+  std::ifstream in("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 3, "0::") == 0) return line.substr(3);
+  }
+  return "";
+}
+
+}  // namespace
+
+MemoryGovernor::MemoryGovernor() {
+  for (int level = 0; level < kLevelCount; level++) {
+    triggers_[level].governor = this;
+    triggers_[level].level = Level(level);
+    triggers_[level].spec = kTriggerSpecs[level];
+  }
+}
+
+MemoryGovernor::~MemoryGovernor() {
+  DisarmTriggers();
+  if (channel_ != nullptr) g_object_unref(channel_);
+}
+
+void MemoryGovernor::Register(const std::string& name, Shrinker shrinker) {
+  ShrinkerEntry entry;
+  entry.name = name;
+  entry.shrink = std::move(shrinker);
+  shrinkers_.push_back(std::move(entry));
+}
+
+std::vector<std::string> MemoryGovernor::PressureFiles() {
+  // The cgroup's own file sees pressure from its memory.max as well as from
+  // the machine; the system-wide one only from the latter. cgroup2 is
+  // mounted on its own or, on hybrid systems, under "unified".
+  std::vector<std::string> files;
+  std::string cgroup = CgroupPath();
+  if (!cgroup.empty() && cgroup != "/") {
+    for (const char* mount : {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"}) {
+      files.push_back(std::string(mount) + cgroup + "/memory.pressure");
+    }
+  }
+  files.push_back("/proc/pressure/memory");
+  return files;
+}
+
+bool MemoryGovernor::Start(std::string* error) {
+  DisarmTriggers();
+  std::string reasons;
+  for (const std::string& path : PressureFiles()) {
+    std::string reason;
+    if (ArmTriggers(path, &reason)) {
+      pressure_path_ = path;
+      return true;
+    }
+    if (!reasons.empty()) reasons += "; ";
+    reasons += path + ": " + reason;
+  }
+  *error = reasons;
+  return false;
+}
+
+bool MemoryGovernor::ArmTriggers(const std::string& path, std::string* error) {
+  for (Trigger& trigger : triggers_) {
+    // A trigger lives as long as the descriptor it was written to.
+    int fd = open(path.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0 ||
+        write(fd, trigger.spec, strlen(trigger.spec) + 1) < 0) {
+      *error = strerror(errno);
+      if (fd >= 0) close(fd);
+      DisarmTriggers();
+      return false;
+    }
+    trigger.fd = fd;
+    trigger.source = g_unix_fd_add(
+        fd, GIOCondition(G_IO_PRI | G_IO_ERR), OnPressure, &trigger);
+  }
+  return true;
+}
+
+void MemoryGovernor::DisarmTriggers() {
+  for (Trigger& trigger : triggers_) {
+    if (trigger.source != 0) g_source_remove(trigger.source);
+    if (trigger.fd >= 0) close(trigger.fd);
+    trigger.source = 0;
+    trigger.fd = -1;
+  }
+  pressure_path_.clear();
+}
+
+gboolean MemoryGovernor::OnPressure(gint fd, GIOCondition condition,
+                                    gpointer user_data) {
+  Trigger* trigger = static_cast<Trigger*>(user_data);
+  MemoryGovernor* self = trigger->governor;
+  if (condition & G_IO_ERR) {
+    // The cgroup went away; its triggers will never fire again.
+    g_warning("Memory pressure trigger \"%s\" failed", trigger->spec);
+    close(trigger->fd);
+    trigger->fd = -1;
+    trigger->source = 0;
+    return G_SOURCE_REMOVE;
+  }
+  trigger->fired++;
+
+  Level level = trigger->level;
+  int64_t now = g_get_monotonic_time();
+  if (self->has_last_ && self->last_.from_pressure) {
+    int64_t since = now - self->last_.at_us;
+    if (since < kCooldownUs && self->last_.level >= level) {
+      self->skipped_++;
+      return G_SOURCE_CONTINUE;
+    }
+    if (level == kModerate && since < kEscalateUs) {
+      level = kCritical;
+      self->escalations_++;
+    }
+  }
+  Event event = self->Reclaim(level, true);
+  g_message("Memory pressure (%s): reclaimed %" G_GINT64_FORMAT
+            " bytes, RSS %" G_GINT64_FORMAT " -> %" G_GINT64_FORMAT,
+            kLevelNames[level], event.reclaimed(), event.rss_before,
+            event.rss_after);
+  return G_SOURCE_CONTINUE;
+}
+
+MemoryGovernor::Event MemoryGovernor::Reclaim(Level level,
+                                              bool from_pressure) {
+  Event event;
+  event.level = level;
+  event.from_pressure = from_pressure;
+  event.at_us = g_get_monotonic_time();
+  event.rss_before = ResidentBytes();
+
+  for (ShrinkerEntry& entry : shrinkers_) {
+    size_t bytes = entry.shrink(level);
+    entry.runs++;
+    entry.released += int64_t(bytes);
+    event.released += int64_t(bytes);
+  }
+
+#ifdef __GLIBC__
+  // Freed blocks stay in malloc's arenas, counted in RSS, until trimmed.
+  int64_t untrimmed = ResidentBytes();
+  malloc_trim(0);
+  event.rss_after = ResidentBytes();
+  if (untrimmed > event.rss_after) event.trimmed = untrimmed - event.rss_after;
+#else
+  event.rss_after = ResidentBytes();
+#endif
+
+  event.duration_us = g_get_monotonic_time() - event.at_us;
+  events_[level]++;
+  trimmed_ += event.trimmed;
+  reclaimed_ += event.reclaimed();
+  last_ = event;
+  has_last_ = true;
+  return event;
+}
+
+int64_t MemoryGovernor::ResidentBytes() {
+  FILE* file = fopen("/proc/self/statm", "re");
+  if (file == nullptr) return -1;
+  long long size = 0;
+  long long resident = 0;
+  int fields = fscanf(file, "%lld %lld", &size, &resident);
+  fclose(file);
+  if (fields != 2) return -1;
+  return int64_t(resident) * sysconf(_SC_PAGESIZE);
+}
+
+FlValue* MemoryGovernor::EventToFlValue(const Event& event) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "level",
+                           fl_value_new_string(kLevelNames[event.level]));
+  fl_value_set_string_take(value, "fromPressure",
+                           fl_value_new_bool(event.from_pressure));
+  fl_value_set_string_take(
+      value, "ageMicros",
+      fl_value_new_int(g_get_monotonic_time() - event.at_us));
+  fl_value_set_string_take(value, "durationMicros",
+                           fl_value_new_int(event.duration_us));
+  fl_value_set_string_take(value, "rssBeforeBytes",
+                           fl_value_new_int(event.rss_before));
+  fl_value_set_string_take(value, "rssAfterBytes",
+                           fl_value_new_int(event.rss_after));
+  fl_value_set_string_take(value, "releasedBytes",
+                           fl_value_new_int(event.released));
+  fl_value_set_string_take(value, "trimmedBytes",
+                           fl_value_new_int(event.trimmed));
+  fl_value_set_string_take(value, "reclaimedBytes",
+                           fl_value_new_int(event.reclaimed()));
+  return value;
+}
+
+FlValue* MemoryGovernor::Stats() {
+  FlValue* triggers = fl_value_new_map();
+  for (const Trigger& trigger : triggers_) {
+    FlValue* entry = fl_value_new_map();
+    fl_value_set_string_take(entry, "spec", fl_value_new_string(trigger.spec));
+    fl_value_set_string_take(entry, "armed",
+                             fl_value_new_bool(trigger.source != 0));
+    fl_value_set_string_take(entry, "fired", fl_value_new_int(trigger.fired));
+    fl_value_set_string_take(triggers, kLevelNames[trigger.level], entry);
+  }
+
+  FlValue* events = fl_value_new_map();
+  for (int level = 0; level < kLevelCount; level++) {
+    fl_value_set_string_take(events, kLevelNames[level],
+                             fl_value_new_int(events_[level]));
+  }
+
+  FlValue* shrinkers = fl_value_new_list();
+  for (const ShrinkerEntry& entry : shrinkers_) {
+    FlValue* value = fl_value_new_map();
+    fl_value_set_string_take(value, "name",
+                             fl_value_new_string(entry.name.c_str()));
+    fl_value_set_string_take(value, "runs", fl_value_new_int(entry.runs));
+    fl_value_set_string_take(value, "releasedBytes",
+                             fl_value_new_int(entry.released));
+    fl_value_append_take(shrinkers, value);
+  }
+
+  // The kernel's running averages, as the file reads.
+  std::string pressure;
+  if (!pressure_path_.empty()) {
+    std::ifstream in(pressure_path_);
+    pressure.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+  }
+
+  FlValue* result = fl_value_new_map();
+  fl_value_set_string_take(result, "source",
+                           fl_value_new_string(pressure_path_.c_str()));
+  fl_value_set_string_take(result, "pressure",
+                           fl_value_new_string(pressure.c_str()));
+  fl_value_set_string_take(result, "triggers", triggers);
+  fl_value_set_string_take(result, "events", events);
+  fl_value_set_string_take(result, "escalations",
+                           fl_value_new_int(escalations_));
+  fl_value_set_string_take(result, "skipped", fl_value_new_int(skipped_));
+  fl_value_set_string_take(result, "shrinkers", shrinkers);
+  fl_value_set_string_take(result, "trimmedBytes",
+                           fl_value_new_int(trimmed_));
+  fl_value_set_string_take(result, "reclaimedBytes",
+                           fl_value_new_int(reclaimed_));
+  fl_value_set_string_take(result, "rssBytes",
+                           fl_value_new_int(ResidentBytes()));
+  fl_value_set_string_take(result, "last", has_last_
+                                               ? EventToFlValue(last_)
+                                               : fl_value_new_null());
+  return result;
+}
+
+void MemoryGovernor::RegisterChannel(FlBinaryMessenger* messenger) {
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_method_channel_new(messenger, "com.rabee.omran.memory",
+                                   FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        MemoryGovernor* self = static_cast<MemoryGovernor*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+
+        if (strcmp(method, "stats") == 0) {
+          g_autoptr(FlValue) stats = self->Stats();
+          fl_method_call_respond_success(method_call, stats, nullptr);
+        } else if (strcmp(method, "reclaim") == 0) {
+          std::string level = ArgString(args, "level", "moderate");
+          if (level != "moderate" && level != "critical") {
+            fl_method_call_respond_error(
+                method_call, "BAD_ARGS",
+                "level must be moderate or critical", nullptr, nullptr);
+            return;
+          }
+          Event event =
+              self->Reclaim(level == "critical" ? kCritical : kModerate);
+          g_autoptr(FlValue) result = self->EventToFlValue(event);
+          fl_method_call_respond_success(method_call, result, nullptr);
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
@@ -0,0 +1,115 @@
+#ifndef RUNNER_MEMORY_GOVERNOR_H_
+#define RUNNER_MEMORY_GOVERNOR_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Gives memory back when the kernel reports memory pressure, before the
+ * OOM killer picks a victim.
+ *
+ * Pressure comes from PSI triggers on the runner's cgroup v2
+ * memory.pressure, or on /proc/pressure/memory when the cgroup has none,
+ * polled through a GSource on the main context. A "some" stall trips the
+ * moderate tier and a "full" stall, or moderate pressure that persists,
+ * the critical one. Each tier runs the registered shrinkers and then hands
+ * freed heap back to the kernel. Main thread only.
+ */
+class MemoryGovernor {
+ public:
+  enum Level { kModerate = 0, kCritical, kLevelCount };
+
+  // Frees what can be rebuilt at |level| and returns the bytes released, or
+  // 0 when they cannot be told. Runs on the main thread, so it must not
+  // wait on slow locks.
+  using Shrinker = std::function<size_t(Level level)>;
+
+  struct Event {
+    Level level = kModerate;
+    bool from_pressure = false;  // False when asked for over the channel.
+    int64_t at_us = 0;
+    int64_t duration_us = 0;
+    int64_t rss_before = 0;
+    int64_t rss_after = 0;
+    int64_t released = 0;  // As reported by the shrinkers.
+    int64_t trimmed = 0;   // Freed heap malloc handed back to the kernel.
+
+    // What actually left the resident set.
+    int64_t reclaimed() const {
+      return rss_before > rss_after ? rss_before - rss_after : 0;
+    }
+  };
+
+  MemoryGovernor();
+  ~MemoryGovernor();
+
+  MemoryGovernor(const MemoryGovernor&) = delete;
+  MemoryGovernor& operator=(const MemoryGovernor&) = delete;
+
+  // Shrinkers run in the order they were added.
+  void Register(const std::string& name, Shrinker shrinker);
+
+  // Arms the PSI triggers. Returns false, leaving only explicit reclaims,
+  // when the kernel offers no pressure information the runner may poll.
+  bool Start(std::string* error);
+
+  // Runs every shrinker for |level| now.
+  Event Reclaim(Level level, bool from_pressure = false);
+
+  // The most recent reclaim, as "stats" reports it; false before the first.
+  bool last_event(Event* event) const {
+    if (has_last_) *event = last_;
+    return has_last_;
+  }
+
+  // Exposes the governor on the "com.rabee.omran.memory" channel.
+  void RegisterChannel(FlBinaryMessenger* messenger);
+
+  // Resident set size of this process in bytes, or -1.
+  static int64_t ResidentBytes();
+
+ private:
+  struct Trigger {
+    MemoryGovernor* governor = nullptr;
+    Level level = kModerate;
+    const char* spec = "";
+    int fd = -1;
+    guint source = 0;
+    int64_t fired = 0;
+  };
+
+  struct ShrinkerEntry {
+    std::string name;
+    Shrinker shrink;
+    int64_t runs = 0;
+    int64_t released = 0;
+  };
+
+  bool ArmTriggers(const std::string& path, std::string* error);
+  void DisarmTriggers();
+  static gboolean OnPressure(gint fd, GIOCondition condition,
+                             gpointer user_data);
+  static std::vector<std::string> PressureFiles();
+  FlValue* EventToFlValue(const Event& event);
+  FlValue* Stats();
+
+  std::vector<ShrinkerEntry> shrinkers_;
+  Trigger triggers_[kLevelCount];
+  std::string pressure_path_;  // Empty while not armed.
+
+  int64_t events_[kLevelCount] = {};
+  int64_t escalations_ = 0;
+  int64_t skipped_ = 0;  // Trigger firings inside the cooldown.
+  int64_t trimmed_ = 0;
+  int64_t reclaimed_ = 0;
+  bool has_last_ = false;
+  Event last_;
+
+  FlMethodChannel* channel_ = nullptr;
+};
+
+#endif  // RUNNER_MEMORY_GOVERNOR_H_
@@ -5,18 +5,49 @@
 #include <gdk/gdkx.h>
 #endif
 
+#include "download_progress.h"
 #include "flutter/generated_plugin_registrant.h"
+#include "link_estimator.h"
+#include "memory_governor.h"
+#include "photo_catalog.h"
+#include "photo_mirror.h"
+#include "photo_pipeline.h"
+#include "photo_texture.h"
+#include "photo_tracer.h"
+#include "photo_writer.h"
+#include "preview_cache.h"
+#include "retention_engine.h"
+#include "state_store.h"
+#include "subscription_hub.h"
+#include "variant_fetcher.h"
+#include "worker_pool.h"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <ifaddrs.h>
 #include <netdb.h>
+#include <algorithm>
 
 struct _MyApplication {
   GtkApplication parent_instance;
   char** dart_entrypoint_arguments;
   NetworkDetection* network_detection;  // Network detection instance
+  WorkerPool* worker_pool;              // Shared pool for blocking native work
+  PreviewCache* preview_cache;          // Downscaled photo previews
+  PhotoTextureRegistry* photo_textures; // Previews shown as Flutter textures
+  PhotoWriter* photo_writer;            // Atomic, durable photo saves
+  StateStore* state_store;              // Crash-safe app state
+  PhotoCatalog* photo_catalog;          // History of saved photos
+  RetentionEngine* retention_engine;    // Disk quota and free-space guard
+  PhotoMirror* photo_mirror;            // Incremental backup copy of photos
+  PhotoPipeline* photo_pipeline;        // Staged download-to-disk path
+  DownloadProgress* download_progress;  // Batched per-frame download progress
+  LinkEstimator* link_estimator;        // Live download throughput
+  VariantFetcher* variant_fetcher;      // Link-sized copies for display
+  PhotoTracer* photo_tracer;            // Upload-to-disk spans per photo
+  MemoryGovernor* memory_governor;      // Sheds caches under memory pressure
+  SubscriptionHub* subscription_hub;    // Albums followed from one event loop
 };
 
 G_DEFINE_TYPE(MyApplication, my_application, GTK_TYPE_APPLICATION)
@@ -178,6 +209,13 @@ static void setup_network_channels(MyApplication* self, FlView* view) {
       }, self);
 }
 
+// Unregisters the photo textures while the view's engine, and the texture
+// registrar it owns, are still alive; both go when the window does.
+static void on_window_destroy(GtkWidget* window, gpointer user_data) {
+  MyApplication* self = MY_APPLICATION(user_data);
+  if (self->photo_textures != nullptr) self->photo_textures->Shutdown();
+}
+
 // Implements GApplication::activate.
 static void my_application_activate(GApplication* application) {
   MyApplication* self = MY_APPLICATION(application);
@@ -226,13 +264,42 @@ static void my_application_activate(GApplication* application) {
   // Setup network detection channels
   setup_network_channels(self, view);
 
+  // Setup native photo channels
+  FlEngine* engine = fl_view_get_engine(view);
+  FlBinaryMessenger* messenger = fl_engine_get_binary_messenger(engine);
+  self->preview_cache->RegisterChannel(messenger, self->worker_pool);
+  self->photo_textures->RegisterChannel(
+      messenger, fl_engine_get_texture_registrar(engine), self->worker_pool);
+  g_signal_connect(window, "destroy", G_CALLBACK(on_window_destroy), self);
+  const gchar* download_dir = g_get_user_special_dir(G_USER_DIRECTORY_DOWNLOAD);
+  g_autofree gchar* save_dir = download_dir != nullptr
+      ? g_strdup(download_dir)
+      : g_build_filename(g_get_home_dir(), "Downloads", nullptr);
+  self->photo_writer->RegisterChannel(messenger, save_dir);
+  self->state_store->RegisterChannel(messenger, self->worker_pool);
+  self->photo_catalog->RegisterChannel(messenger, self->worker_pool,
+                                       self->preview_cache);
+  self->photo_pipeline->RegisterChannel(messenger, save_dir);
+  self->retention_engine->Watch(save_dir);
+  self->retention_engine->RegisterChannel(messenger, self->worker_pool);
+  self->photo_mirror->AddRoot(save_dir);
+  self->photo_mirror->RegisterChannel(messenger, self->worker_pool);
+  self->variant_fetcher->RegisterChannel(messenger, self->worker_pool);
+  self->photo_tracer->RegisterChannel(messenger);
+  self->download_progress->RegisterChannel(messenger, GTK_WIDGET(view),
+                                           self->worker_pool);
+  self->memory_governor->RegisterChannel(messenger);
+  self->subscription_hub->RegisterChannel(messenger, save_dir);
+
   gtk_widget_grab_focus(GTK_WIDGET(view));
 }
 
 // Implements GApplication::local_command_line.
 static gboolean my_application_local_command_line(GApplication* application, gchar*** arguments, int* exit_status) {
   MyApplication* self = MY_APPLICATION(application);
-  // Strip out the first argument as it is the binary name.
+  // Strip out the first argument as it is the binary name. The rest reach
+  // Dart's main(), e.g. --backend=http://127.0.0.1:8010 for the stand-in
+  // server in linux/backend_standin.
   self->dart_entrypoint_arguments = g_strdupv(*arguments + 1);
 
   g_autoptr(GError) error = nullptr;
@@ -256,6 +323,82 @@ static void my_application_startup(GApplication* application) {
   self->network_detection = g_new0(NetworkDetection, 1);
   self->network_detection->stop_monitor = false;
 
+  // Initialize native photo services
+  self->worker_pool =
+      new WorkerPool(std::max(2u, std::thread::hardware_concurrency()));
+  g_autofree gchar* preview_dir = g_build_filename(
+      g_get_user_cache_dir(), APPLICATION_ID, "previews", nullptr);
+  self->preview_cache = new PreviewCache(preview_dir);
+  self->photo_textures = new PhotoTextureRegistry();
+  self->photo_writer = new PhotoWriter(self->worker_pool);
+  g_autofree gchar* data_dir =
+      g_build_filename(g_get_user_data_dir(), APPLICATION_ID, nullptr);
+  g_mkdir_with_parents(data_dir, 0700);
+  g_autofree gchar* state_path = g_build_filename(data_dir, "state.log", nullptr);
+  self->state_store = new StateStore(state_path);
+  std::string state_error;
+  if (!self->state_store->Open(&state_error)) {
+    g_warning("Failed to open state store: %s", state_error.c_str());
+  }
+  g_autofree gchar* catalog_path =
+      g_build_filename(data_dir, "catalog.db", nullptr);
+  self->photo_catalog = new PhotoCatalog(catalog_path);
+  std::string catalog_error;
+  if (!self->photo_catalog->Open(&catalog_error)) {
+    g_warning("Failed to open photo catalog: %s", catalog_error.c_str());
+  }
+  self->retention_engine =
+      new RetentionEngine(self->photo_catalog, self->state_store);
+  std::string retention_error;
+  if (!self->retention_engine->Start(&retention_error)) {
+    g_warning("Failed to start retention: %s", retention_error.c_str());
+  }
+  self->photo_mirror = new PhotoMirror(self->photo_catalog, self->state_store);
+  std::string mirror_error;
+  if (!self->photo_mirror->Start(&mirror_error)) {
+    g_warning("Failed to start the photo mirror: %s", mirror_error.c_str());
+  }
+  self->link_estimator = new LinkEstimator();
+  self->photo_tracer = new PhotoTracer(self->worker_pool);
+  self->download_progress = new DownloadProgress();
+  self->photo_pipeline = new PhotoPipeline(
+      self->photo_writer, self->photo_catalog, self->preview_cache,
+      self->worker_pool, self->link_estimator, self->photo_tracer,
+      self->download_progress, self->retention_engine);
+  g_autofree gchar* variant_dir = g_build_filename(
+      g_get_user_cache_dir(), APPLICATION_ID, "variants", nullptr);
+  self->variant_fetcher = new VariantFetcher(variant_dir, self->link_estimator);
+  self->subscription_hub = new SubscriptionHub(
+      self->photo_pipeline, self->state_store, self->worker_pool);
+
+  // Cheap to rebuild goes first; what costs a round trip or a rehash to get
+  // back only under critical pressure
+  self->memory_governor = new MemoryGovernor();
+  self->memory_governor->Register(
+      "textureBuffers", [self](MemoryGovernor::Level) {
+        return self->photo_textures->buffer_pool()->Trim();
+      });
+  self->memory_governor->Register(
+      "catalogPages", [self](MemoryGovernor::Level) {
+        return self->photo_catalog->ReleaseMemory();
+      });
+  self->memory_governor->Register(
+      "previewHashes", [self](MemoryGovernor::Level level) -> size_t {
+        if (level < MemoryGovernor::kCritical) return 0;
+        return self->preview_cache->ReleaseMemory();
+      });
+  self->memory_governor->Register(
+      "downloadConnections", [self](MemoryGovernor::Level level) -> size_t {
+        if (level >= MemoryGovernor::kCritical) {
+          self->photo_pipeline->ReleaseConnections();
+        }
+        return 0;
+      });
+  std::string memory_error;
+  if (!self->memory_governor->Start(&memory_error)) {
+    g_message("Memory pressure is not monitored: %s", memory_error.c_str());
+  }
+
   // Perform any actions required at application startup.
 
   G_APPLICATION_CLASS(my_application_parent_class)->startup(application);
@@ -275,6 +418,41 @@ static void my_application_shutdown(GApplication* application) {
     self->network_detection = nullptr;
   }
 
+  // Stop the pipeline, then drain the worker pool, before tearing down the
+  // services they call into. The governor's shrinkers call into all of them,
+  // and the hub feeds the pipeline
+  delete self->memory_governor;
+  self->memory_governor = nullptr;
+  delete self->subscription_hub;
+  self->subscription_hub = nullptr;
+  delete self->photo_pipeline;
+  self->photo_pipeline = nullptr;
+  delete self->worker_pool;
+  self->worker_pool = nullptr;
+  delete self->retention_engine;
+  self->retention_engine = nullptr;
+  delete self->photo_mirror;
+  self->photo_mirror = nullptr;
+  delete self->photo_writer;
+  self->photo_writer = nullptr;
+  delete self->preview_cache;
+  self->preview_cache = nullptr;
+  self->photo_textures->Shutdown();  // A no-op once the window is gone.
+  delete self->photo_textures;
+  self->photo_textures = nullptr;
+  delete self->state_store;
+  self->state_store = nullptr;
+  delete self->photo_catalog;
+  self->photo_catalog = nullptr;
+  delete self->variant_fetcher;
+  self->variant_fetcher = nullptr;
+  delete self->link_estimator;
+  self->link_estimator = nullptr;
+  delete self->photo_tracer;
+  self->photo_tracer = nullptr;
+  delete self->download_progress;
+  self->download_progress = nullptr;
+
   // Perform any actions required at application shutdown.
 
   G_APPLICATION_CLASS(my_application_parent_class)->shutdown(application);
@@ -0,0 +1,216 @@
+#include "photo_batch.h"
+
+const char kPhotoBatchProtocol[] = "photo-batch.v1";
+
+namespace {
+
+const uint8_t kVersion = 1;
+const size_t kHeaderBytes = 4;
+// Fixed part of a variant after its image name.
+const size_t kVariantBytes = 2 + 2 + 1 + 4;
+
+// Little-endian loads and stores that work on any host and alignment.
+uint64_t Load(const char* data, int bytes) {
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+  uint64_t value = 0;
+  for (int i = bytes - 1; i >= 0; i--) value = (value << 8) | in[i];
+  return value;
+}
+
+void Store(std::string* out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) out->push_back(char(value >> (8 * i)));
+}
+
+// Bounds-checked reads from [*cursor, end); each fails without moving
+// *cursor when too few bytes are left.
+bool ReadInt(const char** cursor, const char* end, int bytes,
+             uint64_t* value) {
+  if (end - *cursor < bytes) return false;
+  *value = Load(*cursor, bytes);
+  *cursor += bytes;
+  return true;
+}
+
+bool ReadInt64(const char** cursor, const char* end, int64_t* value) {
+  uint64_t bits;
+  if (!ReadInt(cursor, end, 8, &bits)) return false;
+  *value = int64_t(bits);
+  return true;
+}
+
+bool ReadString(const char** cursor, const char* end, int length_bytes,
+                PhotoBatchSlice* slice) {
+  const char* start = *cursor;
+  uint64_t length;
+  if (!ReadInt(cursor, end, length_bytes, &length)) return false;
+  if (uint64_t(end - *cursor) < length) {
+    *cursor = start;
+    return false;
+  }
+  slice->data = *cursor;
+  slice->size = size_t(length);
+  *cursor += length;
+  return true;
+}
+
+bool WriteString(std::string* out, const std::string& value,
+                 int length_bytes) {
+  if (value.size() >= (uint64_t(1) << (8 * length_bytes))) return false;
+  Store(out, value.size(), length_bytes);
+  out->append(value);
+  return true;
+}
+
+}  // namespace
+
+uint32_t PhotoUpdateView::block(size_t index) const {
+  return uint32_t(Load(blocks + 4 * index, 4));
+}
+
+PhotoBatchReader::PhotoBatchReader(const char* data, size_t size)
+    : cursor_(data), end_(data + size) {
+  if (size < kHeaderBytes || uint8_t(data[0]) != kVersion) {
+    error_ = true;
+    return;
+  }
+  count_ = size_t(Load(data + 2, 2));
+  cursor_ += kHeaderBytes;
+}
+
+bool PhotoBatchReader::Next(PhotoUpdateView* update) {
+  if (error_ || read_ == count_) return false;
+  const char* cursor = cursor_;
+  uint64_t has_digest = 0;
+  uint64_t count = 0;
+  error_ = true;
+  if (!ReadInt64(&cursor, end_, &update->id) ||
+      !ReadInt64(&cursor, end_, &update->file_size) ||
+      !ReadInt64(&cursor, end_, &update->uploaded_at_us) ||
+      !ReadString(&cursor, end_, 1, &update->album) ||
+      !ReadString(&cursor, end_, 1, &update->image) ||
+      !ReadString(&cursor, end_, 2, &update->original_file_name) ||
+      !ReadInt(&cursor, end_, 1, &has_digest) || has_digest > 1) {
+    return false;
+  }
+
+  update->has_crc32c = has_digest == 1;
+  update->crc32c = 0;
+  update->block_size = 0;
+  update->block_count = 0;
+  update->blocks = nullptr;
+  if (update->has_crc32c) {
+    uint64_t crc32c, block_size;
+    if (!ReadInt(&cursor, end_, 4, &crc32c) ||
+        !ReadInt(&cursor, end_, 4, &block_size) ||
+        !ReadInt(&cursor, end_, 2, &count) ||
+        uint64_t(end_ - cursor) < 4 * count) {
+      return false;
+    }
+    update->crc32c = uint32_t(crc32c);
+    update->block_size = uint32_t(block_size);
+    update->block_count = size_t(count);
+    update->blocks = cursor;
+    cursor += 4 * count;
+  }
+
+  if (!ReadInt(&cursor, end_, 1, &count)) return false;
+  update->variant_count = size_t(count);
+  update->variants.data = cursor;
+  for (uint64_t i = 0; i < count; i++) {
+    PhotoBatchSlice image;
+    if (!ReadString(&cursor, end_, 1, &image) ||
+        size_t(end_ - cursor) < kVariantBytes) {
+      return false;
+    }
+    cursor += kVariantBytes;
+  }
+  update->variants.size = size_t(cursor - update->variants.data);
+
+  if (!ReadString(&cursor, end_, 1, &update->trace_id)) return false;
+  update->received_us = update->stored_us = update->broadcast_us = 0;
+  if (update->trace_id.size > 0 &&
+      (!ReadInt64(&cursor, end_, &update->received_us) ||
+       !ReadInt64(&cursor, end_, &update->stored_us) ||
+       !ReadInt64(&cursor, end_, &update->broadcast_us))) {
+    return false;
+  }
+
+  error_ = false;
+  cursor_ = cursor;
+  read_++;
+  return true;
+}
+
+bool PhotoBatchReader::NextVariant(PhotoBatchSlice* variants,
+                                   PhotoVariantView* variant) {
+  const char* cursor = variants->data;
+  const char* end = variants->data + variants->size;
+  if (cursor == end || !ReadString(&cursor, end, 1, &variant->image) ||
+      size_t(end - cursor) < kVariantBytes) {
+    return false;
+  }
+  variant->width = int(Load(cursor, 2));
+  variant->height = int(Load(cursor + 2, 2));
+  variant->quality = int(Load(cursor + 4, 1));
+  variant->file_size = int64_t(Load(cursor + 5, 4));
+  cursor += kVariantBytes;
+  variants->size -= size_t(cursor - variants->data);
+  variants->data = cursor;
+  return true;
+}
+
+PhotoBatchWriter::PhotoBatchWriter() {
+  frame_.push_back(char(kVersion));
+  frame_.push_back(0);  // Flags.
+  Store(&frame_, 0, 2);
+}
+
+bool PhotoBatchWriter::Add(const PhotoUpdate& update) {
+  if (count_ == kMaxUpdates || update.blocks.size() > 0xffff ||
+      update.variants.size() > 0xff) {
+    return false;
+  }
+  size_t rollback = frame_.size();
+  Store(&frame_, uint64_t(update.id), 8);
+  Store(&frame_, uint64_t(update.file_size), 8);
+  Store(&frame_, uint64_t(update.uploaded_at_us), 8);
+  bool ok = WriteString(&frame_, update.album, 1) &&
+            WriteString(&frame_, update.image, 1) &&
+            WriteString(&frame_, update.original_file_name, 2);
+  if (ok) {
+    frame_.push_back(char(update.has_crc32c ? 1 : 0));
+    if (update.has_crc32c) {
+      Store(&frame_, update.crc32c, 4);
+      Store(&frame_, update.block_size, 4);
+      Store(&frame_, update.blocks.size(), 2);
+      for (uint32_t block : update.blocks) Store(&frame_, block, 4);
+    }
+    frame_.push_back(char(update.variants.size()));
+  }
+  for (size_t i = 0; ok && i < update.variants.size(); i++) {
+    const PhotoUpdate::Variant& variant = update.variants[i];
+    ok = WriteString(&frame_, variant.image, 1);
+    Store(&frame_, uint64_t(variant.width), 2);
+    Store(&frame_, uint64_t(variant.height), 2);
+    Store(&frame_, uint64_t(variant.quality), 1);
+    Store(&frame_, uint64_t(variant.file_size), 4);
+  }
+  ok = ok && WriteString(&frame_, update.trace_id, 1);
+  if (ok && !update.trace_id.empty()) {
+    Store(&frame_, uint64_t(update.received_us), 8);
+    Store(&frame_, uint64_t(update.stored_us), 8);
+    Store(&frame_, uint64_t(update.broadcast_us), 8);
+  }
+  if (!ok) {
+    frame_.resize(rollback);
+    return false;
+  }
+  count_++;
+  return true;
+}
+
+const std::string& PhotoBatchWriter::frame() {
+  frame_[2] = char(count_);
+  frame_[3] = char(count_ >> 8);
+  return frame_;
+}
@@ -0,0 +1,135 @@
+#ifndef RUNNER_PHOTO_BATCH_H_
+#define RUNNER_PHOTO_BATCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// WebSocket subprotocol under which the backend sends photo updates as
+// binary photo-batch frames.
+extern const char kPhotoBatchProtocol[];
+
+// Bytes inside a frame; not terminated.
+struct PhotoBatchSlice {
+  const char* data = nullptr;
+  size_t size = 0;
+
+  std::string ToString() const { return std::string(data, size); }
+  bool Equals(const std::string& other) const {
+    return other.size() == size && other.compare(0, size, data, size) == 0;
+  }
+};
+
+// One photo update, pointing into the frame it was read from.
+struct PhotoUpdateView {
+  int64_t id = 0;
+  int64_t file_size = -1;       // -1 when unknown.
+  int64_t uploaded_at_us = -1;  // Since the epoch; -1 when unknown.
+  PhotoBatchSlice album;
+  PhotoBatchSlice image;
+  PhotoBatchSlice original_file_name;
+
+  bool has_crc32c = false;
+  uint32_t crc32c = 0;
+  uint32_t block_size = 0;
+  size_t block_count = 0;
+  const char* blocks = nullptr;  // block_count little-endian u32s.
+  uint32_t block(size_t index) const;
+
+  PhotoBatchSlice variants;  // Walk with PhotoBatchReader::NextVariant.
+  size_t variant_count = 0;
+
+  PhotoBatchSlice trace_id;  // Empty when untraced.
+  int64_t received_us = 0;
+  int64_t stored_us = 0;
+  int64_t broadcast_us = 0;
+};
+
+struct PhotoVariantView {
+  PhotoBatchSlice image;
+  int width = 0;
+  int height = 0;
+  int quality = 0;
+  int64_t file_size = 0;
+};
+
+/**
+ * Reads a photo-batch.v1 frame in place: every field is decoded straight
+ * from the frame's bytes and strings point into it, so reading allocates
+ * nothing. The layout is documented in the backend's photo/wire.py.
+ */
+class PhotoBatchReader {
+ public:
+  PhotoBatchReader(const char* data, size_t size);
+
+  // Updates the header announces.
+  size_t count() const { return count_; }
+
+  // Reads the next update into |update|. Returns false after the last one,
+  // or at the first malformed byte, which error() then tells apart.
+  bool Next(PhotoUpdateView* update);
+  bool error() const { return error_; }
+
+  // Reads the next of the variants left in |variants| and advances past
+  // it. Returns false when none are left or they are malformed.
+  static bool NextVariant(PhotoBatchSlice* variants, PhotoVariantView* variant);
+
+ private:
+  const char* cursor_;
+  const char* end_;
+  size_t count_ = 0;
+  size_t read_ = 0;
+  bool error_ = false;
+};
+
+// A photo update to encode; the counterpart of PhotoUpdateView.
+struct PhotoUpdate {
+  struct Variant {
+    std::string image;
+    int width = 0;
+    int height = 0;
+    int quality = 0;
+    int64_t file_size = 0;
+  };
+
+  int64_t id = 0;
+  int64_t file_size = -1;
+  int64_t uploaded_at_us = -1;
+  std::string album;
+  std::string image;
+  std::string original_file_name;
+  bool has_crc32c = false;
+  uint32_t crc32c = 0;
+  uint32_t block_size = 0;
+  std::vector<uint32_t> blocks;
+  std::vector<Variant> variants;
+  std::string trace_id;
+  int64_t received_us = 0;
+  int64_t stored_us = 0;
+  int64_t broadcast_us = 0;
+};
+
+/**
+ * Builds a photo-batch.v1 frame, the way the backend does; for the
+ * stand-in server and benchmarks.
+ */
+class PhotoBatchWriter {
+ public:
+  static const size_t kMaxUpdates = 0xffff;
+
+  PhotoBatchWriter();
+
+  // Returns false, adding nothing, when |update| has a string too long for
+  // its field or the frame is full.
+  bool Add(const PhotoUpdate& update);
+  size_t count() const { return count_; }
+  // The frame so far; the writer can be added to further.
+  const std::string& frame();
+
+ private:
+  std::string frame_;
+  size_t count_ = 0;
+};
+
+#endif  // RUNNER_PHOTO_BATCH_H_
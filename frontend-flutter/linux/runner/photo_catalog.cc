@@ -0,0 +1,953 @@
+#include "photo_catalog.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "channel_utils.h"
+#include "exif_reader.h"
+
+namespace {
+
+const int kMaxPageSize = 1000;
+const int64_t kMmapBytes = 256 * 1024 * 1024;
+const int kBeginAttempts = 3;
+
+// Statements that bring the schema from version i to version i + 1.
+const char* const kMigrations[] = {
+    "CREATE TABLE IF NOT EXISTS photos ("
+    "  id INTEGER PRIMARY KEY,"
+    "  content_hash TEXT,"
+    "  file_size INTEGER NOT NULL DEFAULT 0,"
+    "  width INTEGER NOT NULL DEFAULT 0,"
+    "  height INTEGER NOT NULL DEFAULT 0,"
+    "  captured_at TEXT,"
+    "  local_path TEXT NOT NULL,"
+    "  file_name TEXT NOT NULL DEFAULT '',"
+    "  uploaded_at TEXT,"
+    "  saved_at INTEGER NOT NULL,"
+    "  download_us INTEGER NOT NULL DEFAULT 0,"
+    "  write_us INTEGER NOT NULL DEFAULT 0"
+    ");"
+    "CREATE INDEX IF NOT EXISTS photos_by_saved_at ON photos (saved_at, id);"
+    "CREATE INDEX IF NOT EXISTS photos_by_hash ON photos (content_hash);",
+
+    // Per-source numbering and access times for retention, and running
+    // byte totals per source and UTC day that triggers keep exact as rows
+    // come and go. Rows from before number by server id.
+    "ALTER TABLE photos ADD COLUMN source TEXT NOT NULL DEFAULT '';"
+    "ALTER TABLE photos ADD COLUMN seq INTEGER NOT NULL DEFAULT 0;"
+    "ALTER TABLE photos ADD COLUMN accessed_at INTEGER NOT NULL DEFAULT 0;"
+    "UPDATE photos SET seq = id, accessed_at = saved_at;"
+    "CREATE INDEX photos_by_source_seq ON photos (source, seq);"
+    "CREATE INDEX photos_by_accessed_at ON photos (accessed_at, id);"
+    "CREATE TABLE usage ("
+    "  source TEXT NOT NULL,"
+    "  day INTEGER NOT NULL,"
+    "  bytes INTEGER NOT NULL,"
+    "  files INTEGER NOT NULL,"
+    "  PRIMARY KEY (source, day)"
+    ") WITHOUT ROWID;"
+    "INSERT INTO usage SELECT source, saved_at / 86400000, SUM(file_size), "
+    "  COUNT(*) FROM photos GROUP BY 1, 2;"
+    "CREATE TRIGGER usage_after_insert AFTER INSERT ON photos BEGIN"
+    "  INSERT INTO usage VALUES (new.source, new.saved_at / 86400000,"
+    "    new.file_size, 1)"
+    "  ON CONFLICT (source, day) DO UPDATE SET"
+    "    bytes = bytes + excluded.bytes, files = files + 1;"
+    "END;"
+    "CREATE TRIGGER usage_after_delete AFTER DELETE ON photos BEGIN"
+    "  UPDATE usage SET bytes = bytes - old.file_size, files = files - 1"
+    "    WHERE source = old.source AND day = old.saved_at / 86400000;"
+    "  DELETE FROM usage WHERE source = old.source AND"
+    "    day = old.saved_at / 86400000 AND files <= 0;"
+    "END;",
+
+    // A catalog-wide number taken inside each insert, so rows number in the
+    // order they commit whatever their saved_at says. The counter only
+    // grows, so a deleted row's number is never handed out again. Rows from
+    // before number by server id.
+    "ALTER TABLE photos ADD COLUMN commit_seq INTEGER NOT NULL DEFAULT 0;"
+    "UPDATE photos SET commit_seq = id;"
+    "CREATE INDEX photos_by_commit_seq ON photos (commit_seq);"
+    "CREATE TABLE counters ("
+    "  name TEXT PRIMARY KEY,"
+    "  value INTEGER NOT NULL"
+    ") WITHOUT ROWID;"
+    "INSERT INTO counters VALUES ('commit_seq',"
+    "  (SELECT COALESCE(MAX(id), 0) FROM photos));"
+    "CREATE TRIGGER counters_after_insert AFTER INSERT ON photos BEGIN"
+    "  UPDATE counters SET value = new.commit_seq"
+    "    WHERE name = 'commit_seq' AND value < new.commit_seq;"
+    "END;",
+
+    // Rows keyed by source and server id, so a photo two sources both
+    // saved is kept twice instead of one overwriting the other. SQLite
+    // cannot change a primary key in place: the table is copied, and its
+    // indexes and triggers made again on the copy. The triggers go first so
+    // the drop leaves the usage totals alone.
+    "DROP TRIGGER usage_after_insert;"
+    "DROP TRIGGER usage_after_delete;"
+    "DROP TRIGGER counters_after_insert;"
+    "CREATE TABLE photos_by_source ("
+    "  id INTEGER NOT NULL,"
+    "  content_hash TEXT,"
+    "  file_size INTEGER NOT NULL DEFAULT 0,"
+    "  width INTEGER NOT NULL DEFAULT 0,"
+    "  height INTEGER NOT NULL DEFAULT 0,"
+    "  captured_at TEXT,"
+    "  local_path TEXT NOT NULL,"
+    "  file_name TEXT NOT NULL DEFAULT '',"
+    "  uploaded_at TEXT,"
+    "  saved_at INTEGER NOT NULL,"
+    "  download_us INTEGER NOT NULL DEFAULT 0,"
+    "  write_us INTEGER NOT NULL DEFAULT 0,"
+    "  source TEXT NOT NULL DEFAULT '',"
+    "  seq INTEGER NOT NULL DEFAULT 0,"
+    "  accessed_at INTEGER NOT NULL DEFAULT 0,"
+    "  commit_seq INTEGER NOT NULL DEFAULT 0,"
+    "  PRIMARY KEY (source, id)"
+    ");"
+    "INSERT INTO photos_by_source SELECT id, content_hash, file_size, width, "
+    "  height, captured_at, local_path, file_name, uploaded_at, saved_at, "
+    "  download_us, write_us, source, seq, accessed_at, commit_seq "
+    "  FROM photos;"
+    "DROP TABLE photos;"
+    "ALTER TABLE photos_by_source RENAME TO photos;"
+    "CREATE INDEX photos_by_saved_at ON photos (saved_at, id, source);"
+    "CREATE INDEX photos_by_hash ON photos (content_hash);"
+    "CREATE INDEX photos_by_source_seq ON photos (source, seq);"
+    "CREATE INDEX photos_by_accessed_at ON photos (accessed_at, id);"
+    "CREATE INDEX photos_by_commit_seq ON photos (commit_seq);"
+    "CREATE TRIGGER usage_after_insert AFTER INSERT ON photos BEGIN"
+    "  INSERT INTO usage VALUES (new.source, new.saved_at / 86400000,"
+    "    new.file_size, 1)"
+    "  ON CONFLICT (source, day) DO UPDATE SET"
+    "    bytes = bytes + excluded.bytes, files = files + 1;"
+    "END;"
+    "CREATE TRIGGER usage_after_delete AFTER DELETE ON photos BEGIN"
+    "  UPDATE usage SET bytes = bytes - old.file_size, files = files - 1"
+    "    WHERE source = old.source AND day = old.saved_at / 86400000;"
+    "  DELETE FROM usage WHERE source = old.source AND"
+    "    day = old.saved_at / 86400000 AND files <= 0;"
+    "END;"
+    "CREATE TRIGGER counters_after_insert AFTER INSERT ON photos BEGIN"
+    "  UPDATE counters SET value = new.commit_seq"
+    "    WHERE name = 'commit_seq' AND value < new.commit_seq;"
+    "END;",
+};
+const int kSchemaVersion = sizeof(kMigrations) / sizeof(kMigrations[0]);
+
+// A row with the same source and id is deleted first, which with
+// recursive_triggers on also takes it out of the usage totals.
+const char kInsertSql[] =
+    "INSERT OR REPLACE INTO photos (id, content_hash, file_size, width, "
+    "height, captured_at, local_path, file_name, uploaded_at, saved_at, "
+    "download_us, write_us, source, seq, accessed_at, commit_seq) VALUES "
+    "(?1, ?2, ?3, ?4, ?5, ?6, ?7, ?8, ?9, ?10, ?11, ?12, ?13, "
+    "(SELECT COALESCE(MAX(seq), 0) + 1 FROM photos WHERE source = ?13), ?10, "
+    "(SELECT value + 1 FROM counters WHERE name = 'commit_seq'))";
+
+// The row an insert is about to replace, read inside the same transaction.
+const char kReplacedSql[] =
+    "SELECT local_path, file_size, saved_at FROM photos "
+    "WHERE source = ?1 AND id = ?2";
+
+const char kListSql[] =
+    "SELECT id, file_size, width, height, captured_at, local_path, file_name, "
+    "saved_at, source FROM photos WHERE (saved_at, id, source) < (?1, ?2, ?5) "
+    "AND (?3 IS NULL OR file_name LIKE ?3 ESCAPE '\\') "
+    "ORDER BY saved_at DESC, id DESC, source DESC LIMIT ?4";
+
+const char kListAfterSql[] =
+    "SELECT id, local_path, file_size, saved_at, commit_seq FROM photos "
+    "WHERE commit_seq > ?1 ORDER BY commit_seq LIMIT ?2";
+
+const char kFindSql[] =
+    "SELECT id, content_hash, file_size, width, height, captured_at, "
+    "local_path, file_name, uploaded_at, saved_at, download_us, write_us, "
+    "source FROM photos WHERE source = ?1 AND id = ?2";
+
+const char kCountSql[] = "SELECT COUNT(*) FROM photos";
+
+const char kRemoveSql[] = "DELETE FROM photos WHERE source = ?1 AND id = ?2";
+
+const char kTouchSql[] =
+    "UPDATE photos SET accessed_at = ?3 WHERE source = ?1 AND id = ?2";
+
+const char kUsageSql[] = "SELECT source, day, bytes, files FROM usage";
+
+// By EvictionOrder, then all sources or one. ?1 is the source, ?2 the
+// saved-before time, ?3 the limit and ?4 the keep-every interval. Within a
+// source seq runs in the order photos were saved, so it stands in for
+// saved_at there and the (source, seq) index serves both.
+const char* const kEvictableSql[3][2] = {
+    {"SELECT id, source, local_path, file_size, saved_at FROM photos "
+     "WHERE saved_at < ?2 ORDER BY saved_at, id LIMIT ?3",
+     "SELECT id, source, local_path, file_size, saved_at FROM photos "
+     "WHERE source = ?1 AND saved_at < ?2 ORDER BY seq LIMIT ?3"},
+    {"SELECT id, source, local_path, file_size, saved_at FROM photos "
+     "WHERE saved_at < ?2 ORDER BY accessed_at, id LIMIT ?3",
+     "SELECT id, source, local_path, file_size, saved_at FROM photos "
+     "WHERE source = ?1 AND saved_at < ?2 ORDER BY accessed_at, id LIMIT ?3"},
+    {"SELECT id, source, local_path, file_size, saved_at FROM photos "
+     "WHERE seq % ?4 != 0 AND saved_at < ?2 ORDER BY saved_at, id LIMIT ?3",
+     "SELECT id, source, local_path, file_size, saved_at FROM photos "
+     "WHERE source = ?1 AND seq % ?4 != 0 AND saved_at < ?2 ORDER BY seq "
+     "LIMIT ?3"},
+};
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t WallClockMillis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+// Resets a cached statement when it goes out of scope so it can be reused
+// and does not hold a read transaction open.
+class StatementScope {
+ public:
+  explicit StatementScope(sqlite3_stmt* statement) : statement_(statement) {}
+  ~StatementScope() {
+    sqlite3_reset(statement_);
+    sqlite3_clear_bindings(statement_);
+  }
+
+ private:
+  sqlite3_stmt* statement_;
+};
+
+// Opens the write transaction a batch runs in. The busy timeout already
+// waits out other writers for a while; BEGIN is tried again a few times
+// past that, and a batch whose BEGIN still fails is not run, as its
+// statements would otherwise each commit on their own.
+bool BeginImmediate(sqlite3* db, std::string* error) {
+  int rc = SQLITE_OK;
+  for (int attempt = 0; attempt < kBeginAttempts; attempt++) {
+    rc = sqlite3_exec(db, "BEGIN IMMEDIATE", nullptr, nullptr, nullptr);
+    if (rc != SQLITE_BUSY && rc != SQLITE_LOCKED) break;
+  }
+  if (rc == SQLITE_OK) return true;
+  *error = std::string("Cannot start a write transaction: ") +
+           sqlite3_errmsg(db);
+  return false;
+}
+
+void BindText(sqlite3_stmt* statement, int index, const std::string& value) {
+  if (value.empty()) {
+    sqlite3_bind_null(statement, index);
+  } else {
+    sqlite3_bind_text(statement, index, value.data(), int(value.size()),
+                      SQLITE_TRANSIENT);
+  }
+}
+
+std::string ColumnText(sqlite3_stmt* statement, int column) {
+  const unsigned char* text = sqlite3_column_text(statement, column);
+  return text != nullptr ? reinterpret_cast<const char*>(text) : "";
+}
+
+std::string LikePattern(const std::string& search) {
+  std::string pattern = "%";
+  for (char c : search) {
+    if (c == '%' || c == '_' || c == '\\') pattern.push_back('\\');
+    pattern.push_back(c);
+  }
+  pattern.push_back('%');
+  return pattern;
+}
+
+FlValue* EntryToFlValue(const PhotoCatalog::Entry& entry) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "id", fl_value_new_int(entry.id));
+  fl_value_set_string_take(value, "hash",
+                           fl_value_new_string(entry.content_hash.c_str()));
+  fl_value_set_string_take(value, "fileSize",
+                           fl_value_new_int(entry.file_size));
+  fl_value_set_string_take(value, "width", fl_value_new_int(entry.width));
+  fl_value_set_string_take(value, "height", fl_value_new_int(entry.height));
+  fl_value_set_string_take(
+      value, "capturedAt",
+      entry.captured_at.empty()
+          ? fl_value_new_null()
+          : fl_value_new_string(entry.captured_at.c_str()));
+  fl_value_set_string_take(value, "path",
+                           fl_value_new_string(entry.local_path.c_str()));
+  fl_value_set_string_take(value, "fileName",
+                           fl_value_new_string(entry.file_name.c_str()));
+  fl_value_set_string_take(value, "uploadedAt",
+                           fl_value_new_string(entry.uploaded_at.c_str()));
+  fl_value_set_string_take(value, "savedAt",
+                           fl_value_new_int(entry.saved_at_ms));
+  fl_value_set_string_take(value, "downloadMicros",
+                           fl_value_new_int(entry.download_us));
+  fl_value_set_string_take(value, "writeMicros",
+                           fl_value_new_int(entry.write_us));
+  fl_value_set_string_take(value, "source",
+                           fl_value_new_string(entry.source.c_str()));
+  return value;
+}
+
+// Pages go over the channel column by column: numeric columns as typed
+// int64 lists, which the standard codec copies in one block, rather than one
+// map per row.
+FlValue* PageToFlValue(const PhotoCatalog::Page& page) {
+  size_t count = page.entries.size();
+  std::vector<int64_t> ids(count), sizes(count), widths(count),
+      heights(count), saved_at(count);
+  FlValue* captured_at = fl_value_new_list();
+  FlValue* paths = fl_value_new_list();
+  FlValue* names = fl_value_new_list();
+  FlValue* sources = fl_value_new_list();
+  for (size_t i = 0; i < count; i++) {
+    const PhotoCatalog::Entry& entry = page.entries[i];
+    ids[i] = entry.id;
+    sizes[i] = entry.file_size;
+    widths[i] = entry.width;
+    heights[i] = entry.height;
+    saved_at[i] = entry.saved_at_ms;
+    fl_value_append_take(captured_at,
+                         entry.captured_at.empty()
+                             ? fl_value_new_null()
+                             : fl_value_new_string(entry.captured_at.c_str()));
+    fl_value_append_take(paths, fl_value_new_string(entry.local_path.c_str()));
+    fl_value_append_take(names, fl_value_new_string(entry.file_name.c_str()));
+    fl_value_append_take(sources, fl_value_new_string(entry.source.c_str()));
+  }
+
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "ids",
+                           fl_value_new_int64_list(ids.data(), count));
+  fl_value_set_string_take(value, "fileSizes",
+                           fl_value_new_int64_list(sizes.data(), count));
+  fl_value_set_string_take(value, "widths",
+                           fl_value_new_int64_list(widths.data(), count));
+  fl_value_set_string_take(value, "heights",
+                           fl_value_new_int64_list(heights.data(), count));
+  fl_value_set_string_take(value, "savedAt",
+                           fl_value_new_int64_list(saved_at.data(), count));
+  fl_value_set_string_take(value, "capturedAt", captured_at);
+  fl_value_set_string_take(value, "paths", paths);
+  fl_value_set_string_take(value, "fileNames", names);
+  fl_value_set_string_take(value, "sources", sources);
+  fl_value_set_string_take(value, "hasMore", fl_value_new_bool(page.has_more));
+  fl_value_set_string_take(value, "nextSavedAt",
+                           fl_value_new_int(page.next.saved_at_ms));
+  fl_value_set_string_take(value, "nextId", fl_value_new_int(page.next.id));
+  fl_value_set_string_take(value, "nextSource",
+                           fl_value_new_string(page.next.source.c_str()));
+  return value;
+}
+
+}  // namespace
+
+PhotoCatalog::PhotoCatalog(std::string db_path)
+    : db_path_(std::move(db_path)) {}
+
+PhotoCatalog::~PhotoCatalog() {
+  for (sqlite3_stmt* statement :
+       {insert_, replaced_, remove_, touch_, list_, list_after_, find_, count_, usage_}) {
+    sqlite3_finalize(statement);
+  }
+  for (auto& statements : evictable_) {
+    for (sqlite3_stmt* statement : statements) sqlite3_finalize(statement);
+  }
+  sqlite3_close(reader_);
+  sqlite3_close(writer_);
+  if (channel_ != nullptr) g_object_unref(channel_);
+}
+
+bool PhotoCatalog::OpenConnection(int flags, sqlite3** db,
+                                  std::string* error) {
+  // Each connection is guarded by its own mutex, so SQLite's own locking is
+  // redundant.
+  int rc = sqlite3_open_v2(db_path_.c_str(), db,
+                           flags | SQLITE_OPEN_NOMUTEX, nullptr);
+  if (rc != SQLITE_OK) {
+    *error = *db != nullptr ? sqlite3_errmsg(*db) : sqlite3_errstr(rc);
+    return false;
+  }
+  sqlite3_busy_timeout(*db, 2000);
+  std::string pragmas = "PRAGMA journal_mode = WAL;"
+                        "PRAGMA synchronous = NORMAL;"
+                        "PRAGMA temp_store = MEMORY;"
+                        "PRAGMA recursive_triggers = ON;"
+                        "PRAGMA mmap_size = " +
+                        std::to_string(kMmapBytes) + ";";
+  char* message = nullptr;
+  if (sqlite3_exec(*db, pragmas.c_str(), nullptr, nullptr, &message) !=
+      SQLITE_OK) {
+    *error = message != nullptr ? message : "PRAGMA failed";
+    sqlite3_free(message);
+    return false;
+  }
+  return true;
+}
+
+sqlite3_stmt* PhotoCatalog::Prepare(sqlite3* db, const char* sql,
+                                    std::string* error) {
+  sqlite3_stmt* statement = nullptr;
+  if (sqlite3_prepare_v3(db, sql, -1, SQLITE_PREPARE_PERSISTENT, &statement,
+                         nullptr) != SQLITE_OK) {
+    *error = sqlite3_errmsg(db);
+    return nullptr;
+  }
+  return statement;
+}
+
+bool PhotoCatalog::Migrate(std::string* error) {
+  sqlite3_stmt* version_statement =
+      Prepare(writer_, "PRAGMA user_version", error);
+  if (version_statement == nullptr) return false;
+  int version = sqlite3_step(version_statement) == SQLITE_ROW
+                    ? sqlite3_column_int(version_statement, 0)
+                    : 0;
+  sqlite3_finalize(version_statement);
+  if (version >= kSchemaVersion) return true;
+
+  std::string sql = "BEGIN;";
+  for (int i = version; i < kSchemaVersion; i++) sql += kMigrations[i];
+  sql += "PRAGMA user_version = " + std::to_string(kSchemaVersion) +
+         ";COMMIT;";
+  char* message = nullptr;
+  if (sqlite3_exec(writer_, sql.c_str(), nullptr, nullptr, &message) !=
+      SQLITE_OK) {
+    *error = message != nullptr ? message : "Migration failed";
+    sqlite3_free(message);
+    sqlite3_exec(writer_, "ROLLBACK", nullptr, nullptr, nullptr);
+    return false;
+  }
+  return true;
+}
+
+bool PhotoCatalog::Open(std::string* error) {
+  std::lock_guard<std::mutex> write_lock(write_mutex_);
+  std::lock_guard<std::mutex> read_lock(read_mutex_);
+  if (!OpenConnection(SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, &writer_,
+                      error) ||
+      !Migrate(error) ||
+      !OpenConnection(SQLITE_OPEN_READONLY, &reader_, error)) {
+    return false;
+  }
+  insert_ = Prepare(writer_, kInsertSql, error);
+  replaced_ = Prepare(writer_, kReplacedSql, error);
+  remove_ = Prepare(writer_, kRemoveSql, error);
+  touch_ = Prepare(writer_, kTouchSql, error);
+  list_ = Prepare(reader_, kListSql, error);
+  list_after_ = Prepare(reader_, kListAfterSql, error);
+  find_ = Prepare(reader_, kFindSql, error);
+  count_ = Prepare(reader_, kCountSql, error);
+  usage_ = Prepare(reader_, kUsageSql, error);
+  bool prepared = insert_ != nullptr && replaced_ != nullptr &&
+                  remove_ != nullptr &&
+                  touch_ != nullptr && list_ != nullptr &&
+                  list_after_ != nullptr && find_ != nullptr &&
+                  count_ != nullptr && usage_ != nullptr;
+  for (int order = 0; order < 3; order++) {
+    for (int by_source = 0; by_source < 2; by_source++) {
+      evictable_[order][by_source] =
+          Prepare(reader_, kEvictableSql[order][by_source], error);
+      prepared = prepared && evictable_[order][by_source] != nullptr;
+    }
+  }
+  return prepared;
+}
+
+bool PhotoCatalog::Record(const std::vector<Entry>& entries,
+                          std::string* error) {
+  std::vector<Entry> replaced;
+  if (!RecordLocked(entries, &replaced, error)) return false;
+  std::vector<RecordListener> listeners;
+  {
+    std::lock_guard<std::mutex> lock(listeners_mutex_);
+    listeners = record_listeners_;
+  }
+  for (const RecordListener& listener : listeners) {
+    listener(entries, replaced);
+  }
+  return true;
+}
+
+void PhotoCatalog::AddRecordListener(RecordListener listener) {
+  std::lock_guard<std::mutex> lock(listeners_mutex_);
+  record_listeners_.push_back(std::move(listener));
+}
+
+bool PhotoCatalog::RecordLocked(const std::vector<Entry>& entries,
+                                std::vector<Entry>* replaced,
+                                std::string* error) {
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  if (insert_ == nullptr) {
+    *error = "Catalog is not open";
+    return false;
+  }
+  if (!BeginImmediate(writer_, error)) return false;
+  for (const Entry& entry : entries) {
+    {
+      StatementScope scope(replaced_);
+      sqlite3_bind_text(replaced_, 1, entry.source.data(),
+                        int(entry.source.size()), SQLITE_TRANSIENT);
+      sqlite3_bind_int64(replaced_, 2, entry.id);
+      if (sqlite3_step(replaced_) == SQLITE_ROW) {
+        Entry old;
+        old.id = entry.id;
+        old.source = entry.source;
+        old.local_path = ColumnText(replaced_, 0);
+        old.file_size = sqlite3_column_int64(replaced_, 1);
+        old.saved_at_ms = sqlite3_column_int64(replaced_, 2);
+        replaced->push_back(std::move(old));
+      }
+    }
+    StatementScope scope(insert_);
+    sqlite3_bind_int64(insert_, 1, entry.id);
+    BindText(insert_, 2, entry.content_hash);
+    sqlite3_bind_int64(insert_, 3, entry.file_size);
+    sqlite3_bind_int(insert_, 4, entry.width);
+    sqlite3_bind_int(insert_, 5, entry.height);
+    BindText(insert_, 6, entry.captured_at);
+    sqlite3_bind_text(insert_, 7, entry.local_path.data(),
+                      int(entry.local_path.size()), SQLITE_TRANSIENT);
+    sqlite3_bind_text(insert_, 8, entry.file_name.data(),
+                      int(entry.file_name.size()), SQLITE_TRANSIENT);
+    BindText(insert_, 9, entry.uploaded_at);
+    sqlite3_bind_int64(insert_, 10, entry.saved_at_ms);
+    sqlite3_bind_int64(insert_, 11, entry.download_us);
+    sqlite3_bind_int64(insert_, 12, entry.write_us);
+    // Bound as text even when empty: "" is the source of unsubscribed saves.
+    sqlite3_bind_text(insert_, 13, entry.source.data(),
+                      int(entry.source.size()), SQLITE_TRANSIENT);
+    if (sqlite3_step(insert_) != SQLITE_DONE) {
+      *error = sqlite3_errmsg(writer_);
+      sqlite3_exec(writer_, "ROLLBACK", nullptr, nullptr, nullptr);
+      replaced->clear();
+      return false;
+    }
+  }
+  if (sqlite3_exec(writer_, "COMMIT", nullptr, nullptr, nullptr) !=
+      SQLITE_OK) {
+    *error = sqlite3_errmsg(writer_);
+    sqlite3_exec(writer_, "ROLLBACK", nullptr, nullptr, nullptr);
+    replaced->clear();
+    return false;
+  }
+  return true;
+}
+
+bool PhotoCatalog::List(const Cursor& cursor, int limit,
+                        const std::string& search, Page* page,
+                        std::string* error) {
+  limit = std::max(1, std::min(limit, kMaxPageSize));
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  if (list_ == nullptr) {
+    *error = "Catalog is not open";
+    return false;
+  }
+  StatementScope scope(list_);
+  sqlite3_bind_int64(list_, 1, cursor.saved_at_ms);
+  sqlite3_bind_int64(list_, 2, cursor.id);
+  BindText(list_, 3, search.empty() ? search : LikePattern(search));
+  // One extra row tells us whether another page follows.
+  sqlite3_bind_int(list_, 4, limit + 1);
+  sqlite3_bind_text(list_, 5, cursor.source.data(), int(cursor.source.size()),
+                    SQLITE_TRANSIENT);
+
+  page->entries.clear();
+  page->has_more = false;
+  int rc;
+  while ((rc = sqlite3_step(list_)) == SQLITE_ROW) {
+    if (int(page->entries.size()) == limit) {
+      page->has_more = true;
+      break;
+    }
+    Entry entry;
+    entry.id = sqlite3_column_int64(list_, 0);
+    entry.file_size = sqlite3_column_int64(list_, 1);
+    entry.width = sqlite3_column_int(list_, 2);
+    entry.height = sqlite3_column_int(list_, 3);
+    entry.captured_at = ColumnText(list_, 4);
+    entry.local_path = ColumnText(list_, 5);
+    entry.file_name = ColumnText(list_, 6);
+    entry.saved_at_ms = sqlite3_column_int64(list_, 7);
+    entry.source = ColumnText(list_, 8);
+    page->entries.push_back(std::move(entry));
+  }
+  if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+    *error = sqlite3_errmsg(reader_);
+    return false;
+  }
+  if (!page->entries.empty()) {
+    page->next.saved_at_ms = page->entries.back().saved_at_ms;
+    page->next.id = page->entries.back().id;
+    page->next.source = page->entries.back().source;
+  }
+  return true;
+}
+
+bool PhotoCatalog::ListAfter(int64_t commit_seq, int limit,
+                             std::vector<Entry>* entries,
+                             std::string* error) {
+  limit = std::max(1, std::min(limit, kMaxPageSize));
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  if (list_after_ == nullptr) {
+    *error = "Catalog is not open";
+    return false;
+  }
+  StatementScope scope(list_after_);
+  sqlite3_bind_int64(list_after_, 1, commit_seq);
+  sqlite3_bind_int(list_after_, 2, limit);
+
+  entries->clear();
+  int rc;
+  while ((rc = sqlite3_step(list_after_)) == SQLITE_ROW) {
+    Entry entry;
+    entry.id = sqlite3_column_int64(list_after_, 0);
+    entry.local_path = ColumnText(list_after_, 1);
+    entry.file_size = sqlite3_column_int64(list_after_, 2);
+    entry.saved_at_ms = sqlite3_column_int64(list_after_, 3);
+    entry.commit_seq = sqlite3_column_int64(list_after_, 4);
+    entries->push_back(std::move(entry));
+  }
+  if (rc != SQLITE_DONE) {
+    *error = sqlite3_errmsg(reader_);
+    return false;
+  }
+  return true;
+}
+
+bool PhotoCatalog::Find(const std::string& source, int64_t id,
+                        Entry* entry) {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  if (find_ == nullptr) return false;
+  StatementScope scope(find_);
+  sqlite3_bind_text(find_, 1, source.data(), int(source.size()),
+                    SQLITE_TRANSIENT);
+  sqlite3_bind_int64(find_, 2, id);
+  if (sqlite3_step(find_) != SQLITE_ROW) return false;
+  entry->id = sqlite3_column_int64(find_, 0);
+  entry->content_hash = ColumnText(find_, 1);
+  entry->file_size = sqlite3_column_int64(find_, 2);
+  entry->width = sqlite3_column_int(find_, 3);
+  entry->height = sqlite3_column_int(find_, 4);
+  entry->captured_at = ColumnText(find_, 5);
+  entry->local_path = ColumnText(find_, 6);
+  entry->file_name = ColumnText(find_, 7);
+  entry->uploaded_at = ColumnText(find_, 8);
+  entry->saved_at_ms = sqlite3_column_int64(find_, 9);
+  entry->download_us = sqlite3_column_int64(find_, 10);
+  entry->write_us = sqlite3_column_int64(find_, 11);
+  entry->source = ColumnText(find_, 12);
+  return true;
+}
+
+int64_t PhotoCatalog::Count() {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  if (count_ == nullptr) return 0;
+  StatementScope scope(count_);
+  return sqlite3_step(count_) == SQLITE_ROW ? sqlite3_column_int64(count_, 0)
+                                            : 0;
+}
+
+bool PhotoCatalog::Touch(const std::string& source, int64_t id) {
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  if (touch_ == nullptr) return false;
+  StatementScope scope(touch_);
+  sqlite3_bind_text(touch_, 1, source.data(), int(source.size()),
+                    SQLITE_TRANSIENT);
+  sqlite3_bind_int64(touch_, 2, id);
+  sqlite3_bind_int64(touch_, 3, WallClockMillis());
+  return sqlite3_step(touch_) == SQLITE_DONE;
+}
+
+bool PhotoCatalog::LoadUsage(std::vector<Usage>* usage, std::string* error) {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  if (usage_ == nullptr) {
+    *error = "Catalog is not open";
+    return false;
+  }
+  StatementScope scope(usage_);
+  usage->clear();
+  int rc;
+  while ((rc = sqlite3_step(usage_)) == SQLITE_ROW) {
+    Usage row;
+    row.source = ColumnText(usage_, 0);
+    row.day = sqlite3_column_int64(usage_, 1);
+    row.bytes = sqlite3_column_int64(usage_, 2);
+    row.files = sqlite3_column_int64(usage_, 3);
+    usage->push_back(std::move(row));
+  }
+  if (rc != SQLITE_DONE) {
+    *error = sqlite3_errmsg(reader_);
+    return false;
+  }
+  return true;
+}
+
+bool PhotoCatalog::FindEvictable(const EvictionQuery& query,
+                                 std::vector<Entry>* entries,
+                                 std::string* error) {
+  std::lock_guard<std::mutex> lock(read_mutex_);
+  sqlite3_stmt* statement =
+      evictable_[int(query.order)][query.all_sources ? 0 : 1];
+  if (statement == nullptr) {
+    *error = "Catalog is not open";
+    return false;
+  }
+  StatementScope scope(statement);
+  if (!query.all_sources) {
+    sqlite3_bind_text(statement, 1, query.source.data(),
+                      int(query.source.size()), SQLITE_TRANSIENT);
+  }
+  sqlite3_bind_int64(statement, 2, query.saved_before_ms);
+  sqlite3_bind_int(statement, 3, std::max(1, query.limit));
+  if (query.order == EvictionOrder::kThinned) {
+    sqlite3_bind_int(statement, 4, std::max(2, query.keep_every));
+  }
+
+  entries->clear();
+  int rc;
+  while ((rc = sqlite3_step(statement)) == SQLITE_ROW) {
+    Entry entry;
+    entry.id = sqlite3_column_int64(statement, 0);
+    entry.source = ColumnText(statement, 1);
+    entry.local_path = ColumnText(statement, 2);
+    entry.file_size = sqlite3_column_int64(statement, 3);
+    entry.saved_at_ms = sqlite3_column_int64(statement, 4);
+    entries->push_back(std::move(entry));
+  }
+  if (rc != SQLITE_DONE) {
+    *error = sqlite3_errmsg(reader_);
+    return false;
+  }
+  return true;
+}
+
+bool PhotoCatalog::Remove(const std::vector<Entry>& entries,
+                          std::string* error) {
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  if (remove_ == nullptr) {
+    *error = "Catalog is not open";
+    return false;
+  }
+  if (!BeginImmediate(writer_, error)) return false;
+  for (const Entry& entry : entries) {
+    StatementScope scope(remove_);
+    sqlite3_bind_text(remove_, 1, entry.source.data(),
+                      int(entry.source.size()), SQLITE_TRANSIENT);
+    sqlite3_bind_int64(remove_, 2, entry.id);
+    if (sqlite3_step(remove_) != SQLITE_DONE) {
+      *error = sqlite3_errmsg(writer_);
+      sqlite3_exec(writer_, "ROLLBACK", nullptr, nullptr, nullptr);
+      return false;
+    }
+  }
+  if (sqlite3_exec(writer_, "COMMIT", nullptr, nullptr, nullptr) !=
+      SQLITE_OK) {
+    *error = sqlite3_errmsg(writer_);
+    sqlite3_exec(writer_, "ROLLBACK", nullptr, nullptr, nullptr);
+    return false;
+  }
+  return true;
+}
+
+size_t PhotoCatalog::ReleaseMemory() {
+  sqlite3_int64 before = sqlite3_memory_used();
+  // A connection busy on a worker keeps its cache rather than stall the
+  // caller.
+  std::unique_lock<std::mutex> write_lock(write_mutex_, std::try_to_lock);
+  if (write_lock.owns_lock() && writer_ != nullptr) {
+    sqlite3_db_release_memory(writer_);
+  }
+  std::unique_lock<std::mutex> read_lock(read_mutex_, std::try_to_lock);
+  if (read_lock.owns_lock() && reader_ != nullptr) {
+    sqlite3_db_release_memory(reader_);
+  }
+  sqlite3_int64 after = sqlite3_memory_used();
+  return before > after ? size_t(before - after) : 0;
+}
+
+bool PhotoCatalog::Describe(const std::string& path, Entry* entry) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return false;
+  entry->local_path = path;
+  entry->file_size = int64_t(st.st_size);
+  if (previews_ != nullptr) previews_->ContentHash(path, &entry->content_hash);
+  // Both of these read only the image header.
+  gdk_pixbuf_get_file_info(path.c_str(), &entry->width, &entry->height);
+  ExifInfo exif;
+  if (ReadJpegExif(path, &exif)) entry->captured_at = exif.capture_time;
+  return true;
+}
+
+FlValue* PhotoCatalog::Benchmark(int rows) {
+  std::string bench_path = db_path_ + ".bench";
+  for (const char* suffix : {"", "-wal", "-shm"}) {
+    unlink((bench_path + suffix).c_str());
+  }
+
+  FlValue* result = fl_value_new_map();
+  {
+    PhotoCatalog catalog(bench_path);
+    std::string error;
+    if (!catalog.Open(&error)) {
+      g_warning("PhotoCatalog: benchmark: %s", error.c_str());
+      return result;
+    }
+
+    int64_t start = NowMicros();
+    std::vector<Entry> batch;
+    for (int i = 0; i < rows; i++) {
+      Entry entry;
+      entry.id = i + 1;
+      entry.content_hash = std::to_string(i * 2654435761u);
+      entry.file_size = 1500000 + i;
+      entry.width = 4000;
+      entry.height = 3000;
+      entry.captured_at = "2025-01-01T12:00:00";
+      entry.file_name = "photo_" + std::to_string(i) + ".jpg";
+      entry.local_path = "/home/user/Downloads/" + entry.file_name;
+      entry.saved_at_ms = 1700000000000 + int64_t(i) * 1000;
+      batch.push_back(std::move(entry));
+      if (batch.size() == 1000 || i == rows - 1) {
+        catalog.Record(batch, &error);
+        batch.clear();
+      }
+    }
+    int64_t insert_us = NowMicros() - start;
+
+    Page page;
+    start = NowMicros();
+    catalog.List(Cursor(), 100, "", &page, &error);
+    int64_t first_page_us = NowMicros() - start;
+
+    Cursor middle;
+    middle.saved_at_ms = 1700000000000 + int64_t(rows / 2) * 1000;
+    middle.id = rows / 2 + 1;
+    start = NowMicros();
+    catalog.List(middle, 100, "", &page, &error);
+    int64_t deep_page_us = NowMicros() - start;
+
+    start = NowMicros();
+    catalog.List(Cursor(), 100, "photo_1234", &page, &error);
+    int64_t search_us = NowMicros() - start;
+
+    start = NowMicros();
+    int64_t count = catalog.Count();
+    int64_t count_us = NowMicros() - start;
+
+    fl_value_set_string_take(result, "rows", fl_value_new_int(count));
+    fl_value_set_string_take(result, "insertMicros",
+                             fl_value_new_int(insert_us));
+    fl_value_set_string_take(result, "firstPageMicros",
+                             fl_value_new_int(first_page_us));
+    fl_value_set_string_take(result, "deepPageMicros",
+                             fl_value_new_int(deep_page_us));
+    fl_value_set_string_take(result, "searchMicros",
+                             fl_value_new_int(search_us));
+    fl_value_set_string_take(result, "countMicros", fl_value_new_int(count_us));
+  }
+  for (const char* suffix : {"", "-wal", "-shm"}) {
+    unlink((bench_path + suffix).c_str());
+  }
+  return result;
+}
+
+void PhotoCatalog::RegisterChannel(FlBinaryMessenger* messenger,
+                                   WorkerPool* pool, PreviewCache* previews) {
+  pool_ = pool;
+  previews_ = previews;
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_method_channel_new(messenger, "com.rabee.omran.catalog",
+                                   FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        PhotoCatalog* self = static_cast<PhotoCatalog*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+
+        if (strcmp(method, "record") == 0) {
+          Entry entry;
+          entry.id = ArgInt(args, "id");
+          entry.file_name = ArgString(args, "fileName");
+          entry.uploaded_at = ArgString(args, "uploadedAt");
+          entry.download_us = ArgInt(args, "downloadMicros");
+          entry.write_us = ArgInt(args, "writeMicros");
+          entry.source = ArgString(args, "source");
+          entry.saved_at_ms = WallClockMillis();
+          std::string path = ArgString(args, "path");
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, entry, path]() mutable {
+            std::string error;
+            if (!self->Describe(path, &entry)) {
+              RespondErrorLater(method_call, "NOT_FOUND",
+                                "Cannot stat " + path);
+            } else if (!self->Record({entry}, &error)) {
+              RespondErrorLater(method_call, "RECORD_FAILED", error);
+            } else {
+              RespondSuccessLater(method_call, nullptr);
+            }
+          });
+        } else if (strcmp(method, "list") == 0) {
+          Cursor cursor;
+          cursor.saved_at_ms = ArgInt(args, "cursorSavedAt", INT64_MAX);
+          cursor.id = ArgInt(args, "cursorId", INT64_MAX);
+          cursor.source = ArgString(args, "cursorSource");
+          int limit = int(ArgInt(args, "limit", 100));
+          std::string search = ArgString(args, "search");
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, cursor, limit, search]() {
+            Page page;
+            std::string error;
+            if (self->List(cursor, limit, search, &page, &error)) {
+              RespondSuccessLater(method_call, PageToFlValue(page));
+            } else {
+              RespondErrorLater(method_call, "QUERY_FAILED", error);
+            }
+          });
+        } else if (strcmp(method, "get") == 0) {
+          std::string source = ArgString(args, "source");
+          int64_t id = ArgInt(args, "id");
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, source, id]() {
+            Entry entry;
+            bool found = self->Find(source, id, &entry);
+            if (found) self->Touch(source, id);
+            RespondSuccessLater(method_call,
+                                found ? EntryToFlValue(entry) : nullptr);
+          });
+        } else if (strcmp(method, "touch") == 0) {
+          std::string source = ArgString(args, "source");
+          int64_t id = ArgInt(args, "id");
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, source, id]() {
+            RespondSuccessLater(method_call,
+                                fl_value_new_bool(self->Touch(source, id)));
+          });
+        } else if (strcmp(method, "count") == 0) {
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call]() {
+            RespondSuccessLater(method_call, fl_value_new_int(self->Count()));
+          });
+        } else if (strcmp(method, "benchmark") == 0) {
+          int rows = int(ArgInt(args, "rows", 100000));
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, rows]() {
+            RespondSuccessLater(method_call, self->Benchmark(rows));
+          });
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
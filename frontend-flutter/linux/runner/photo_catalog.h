@@ -0,0 +1,182 @@
+#ifndef RUNNER_PHOTO_CATALOG_H_
+#define RUNNER_PHOTO_CATALOG_H_
+
+#include <flutter_linux/flutter_linux.h>
+#include <sqlite3.h>
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "preview_cache.h"
+#include "worker_pool.h"
+
+/**
+ * SQLite catalog of every photo saved on this device.
+ *
+ * The database runs in WAL mode with memory-mapped reads, using one
+ * connection for writes and one for reads so browsing never waits on a
+ * commit. Photos are keyed by source and server id, as two subscriptions may
+ * both save the server's photo 7. History is paged with a
+ * (saved_at, id, source) keyset cursor, so the cost of a page does not grow
+ * with how far back it is.
+ *
+ * Triggers keep a per-source, per-day usage table exact as rows are added
+ * and removed, so space totals never need a scan.
+ */
+class PhotoCatalog {
+ public:
+  struct Entry {
+    int64_t id = 0;  // Server photo id.
+    std::string content_hash;
+    int64_t file_size = 0;
+    int width = 0;
+    int height = 0;
+    std::string captured_at;  // EXIF capture time; empty when unknown.
+    std::string local_path;
+    std::string file_name;
+    std::string uploaded_at;
+    int64_t saved_at_ms = 0;
+    int64_t download_us = 0;
+    int64_t write_us = 0;
+    std::string source;  // Subscription that saved it; "" otherwise.
+    int64_t commit_seq = 0;  // Catalog-wide, in commit order.
+  };
+
+  // Bytes and files saved by one source on one UTC day.
+  struct Usage {
+    std::string source;
+    int64_t day = 0;  // Days since the epoch.
+    int64_t bytes = 0;
+    int64_t files = 0;
+  };
+
+  enum class EvictionOrder {
+    kOldest,
+    kLeastRecentlyUsed,
+    // Oldest first, sparing every |keep_every|-th photo of each source.
+    kThinned,
+  };
+
+  // Which photos to offer for eviction.
+  struct EvictionQuery {
+    EvictionOrder order = EvictionOrder::kOldest;
+    bool all_sources = true;
+    std::string source;  // When not |all_sources|.
+    int keep_every = 10;
+    int64_t saved_before_ms = INT64_MAX;
+    int limit = 64;
+  };
+
+  // Called after rows are committed by Record(), on the caller's thread,
+  // with the rows as they were before any that |recorded| replaced: id,
+  // source, path, size and saved time filled in.
+  using RecordListener = std::function<void(
+      const std::vector<Entry>& recorded, const std::vector<Entry>& replaced)>;
+
+  // Position after the last row of a page. The default starts at the newest.
+  struct Cursor {
+    int64_t saved_at_ms = INT64_MAX;
+    int64_t id = INT64_MAX;
+    std::string source;
+  };
+
+  struct Page {
+    std::vector<Entry> entries;  // Without hash and timings.
+    bool has_more = false;
+    Cursor next;
+  };
+
+  explicit PhotoCatalog(std::string db_path);
+  ~PhotoCatalog();
+
+  PhotoCatalog(const PhotoCatalog&) = delete;
+  PhotoCatalog& operator=(const PhotoCatalog&) = delete;
+
+  bool Open(std::string* error);
+
+  // Inserts or replaces rows by source and id, all in one transaction.
+  bool Record(const std::vector<Entry>& entries, std::string* error);
+
+  // Newest-first page after |cursor|. A non-empty |search| filters on the
+  // file name (substring, case-insensitive for ASCII).
+  bool List(const Cursor& cursor, int limit, const std::string& search,
+            Page* page, std::string* error);
+
+  // Rows committed after |commit_seq|, in commit order, with id, path,
+  // size, saved time and commit_seq filled in. Start from 0. A replaced row
+  // comes again under a new number.
+  bool ListAfter(int64_t commit_seq, int limit, std::vector<Entry>* entries,
+                 std::string* error);
+
+  bool Find(const std::string& source, int64_t id, Entry* entry);
+  int64_t Count();
+
+  // Marks a photo as just viewed, for least-recently-used eviction.
+  bool Touch(const std::string& source, int64_t id);
+
+  // Every row of the usage table.
+  bool LoadUsage(std::vector<Usage>* usage, std::string* error);
+
+  // Photos |query| would evict first, with id, source, path, size and
+  // saved time filled in.
+  bool FindEvictable(const EvictionQuery& query, std::vector<Entry>* entries,
+                     std::string* error);
+
+  // Deletes the rows of |entries| by source and id, all in one
+  // transaction. The files are the caller's.
+  bool Remove(const std::vector<Entry>& entries, std::string* error);
+
+  // Listeners are called until the catalog is destroyed, so whatever
+  // records photos must stop before their owners go.
+  void AddRecordListener(RecordListener listener);
+
+  // Drops SQLite's page caches on connections that are idle right now;
+  // returns the bytes released.
+  size_t ReleaseMemory();
+
+  // Exposes the catalog on the "com.rabee.omran.catalog" channel. Content
+  // hashes are shared with |previews| so a just-catalogued photo is not
+  // hashed again when its preview is requested.
+  void RegisterChannel(FlBinaryMessenger* messenger, WorkerPool* pool,
+                       PreviewCache* previews);
+
+ private:
+  bool OpenConnection(int flags, sqlite3** db, std::string* error);
+  bool Migrate(std::string* error);
+  bool RecordLocked(const std::vector<Entry>& entries,
+                    std::vector<Entry>* replaced, std::string* error);
+  sqlite3_stmt* Prepare(sqlite3* db, const char* sql, std::string* error);
+  bool Describe(const std::string& path, Entry* entry);
+  FlValue* Benchmark(int rows);
+
+  std::string db_path_;
+
+  std::mutex write_mutex_;
+  sqlite3* writer_ = nullptr;
+  sqlite3_stmt* insert_ = nullptr;
+  sqlite3_stmt* replaced_ = nullptr;
+  sqlite3_stmt* remove_ = nullptr;
+  sqlite3_stmt* touch_ = nullptr;
+
+  std::mutex read_mutex_;
+  sqlite3* reader_ = nullptr;
+  sqlite3_stmt* list_ = nullptr;
+  sqlite3_stmt* list_after_ = nullptr;
+  sqlite3_stmt* find_ = nullptr;
+  sqlite3_stmt* count_ = nullptr;
+  sqlite3_stmt* usage_ = nullptr;
+  // By EvictionOrder, then all sources or one.
+  sqlite3_stmt* evictable_[3][2] = {};
+
+  std::mutex listeners_mutex_;
+  std::vector<RecordListener> record_listeners_;
+
+  FlMethodChannel* channel_ = nullptr;
+  WorkerPool* pool_ = nullptr;
+  PreviewCache* previews_ = nullptr;
+};
+
+#endif  // RUNNER_PHOTO_CATALOG_H_
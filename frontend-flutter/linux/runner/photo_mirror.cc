@@ -0,0 +1,691 @@
+#include "photo_mirror.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+
+#include "channel_utils.h"
+
+namespace {
+
+const int kPageSize = 256;
+// Large enough that a buffered copy to a USB stick or over NFS is not
+// dominated by per-call overhead.
+const size_t kCopyBufferBytes = 1 << 20;
+// How often the cursor is synced while copies keep completing. A crash
+// costs at most this much re-checking, never a missed photo.
+const int64_t kPersistIntervalUs = 1000000;
+const int64_t kMaxBackoffUs = 60 * 1000000LL;
+// FAT, common on USB drives, keeps modification times to 2 s.
+const int64_t kMtimeSlackNs = 2000000000LL;
+
+const char kTargetKey[] = "mirror/target";
+const char kConcurrencyKey[] = "mirror/concurrency";
+const char kCursorKey[] = "mirror/cursor";
+
+const char* kMethodNames[PhotoMirror::kMethodCount] = {
+    "cloned", "copyFileRange", "buffered"};
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t MtimeNanos(const struct stat& st) {
+  return int64_t(st.st_mtim.tv_sec) * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+std::string Dirname(const std::string& path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+std::string Basename(const std::string& path) {
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+bool WriteAll(int fd, const char* data, size_t size) {
+  while (size > 0) {
+    ssize_t written = write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += written;
+    size -= size_t(written);
+  }
+  return true;
+}
+
+// Copies |size| bytes from |in| to |out| in the kernel where it can, or
+// through a buffer otherwise.
+bool CopyContents(int in, int out, int64_t size, PhotoMirror::Method* method,
+                  std::string* error) {
+  int64_t copied = 0;
+  *method = PhotoMirror::kCopyFileRange;
+  while (copied < size) {
+    ssize_t moved = copy_file_range(in, nullptr, out, nullptr,
+                                    size_t(size - copied), 0);
+    if (moved > 0) {
+      copied += moved;
+      continue;
+    }
+    if (moved == 0) return true;  // The source shrank.
+    if (errno == EINTR) continue;
+    // Older kernels and some filesystem pairs cannot; nothing was written
+    // yet, so the buffered copy starts clean.
+    if (copied == 0 && (errno == EXDEV || errno == EINVAL ||
+                        errno == ENOSYS || errno == EOPNOTSUPP)) {
+      break;
+    }
+    *error = strerror(errno);
+    return false;
+  }
+  if (copied >= size) return true;
+
+  *method = PhotoMirror::kBuffered;
+  posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+  thread_local std::vector<char> buffer(kCopyBufferBytes);
+  while (true) {
+    ssize_t count = read(in, buffer.data(), buffer.size());
+    if (count < 0 && errno == EINTR) continue;
+    if (count < 0) {
+      *error = strerror(errno);
+      return false;
+    }
+    if (count == 0) return true;
+    if (!WriteAll(out, buffer.data(), size_t(count))) {
+      *error = strerror(errno);
+      return false;
+    }
+  }
+}
+
+int RemoveEntry(const char* path, const struct stat*, int, struct FTW*) {
+  remove(path);
+  return 0;
+}
+
+void RemoveTree(const std::string& path) {
+  nftw(path.c_str(), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// What an rsync-style run does before it copies anything: walk the source
+// and stat each file's counterpart in the mirror. Returns the files that
+// differ.
+int64_t Rescan(const std::string& source, const std::string& target,
+               int64_t* files) {
+  int64_t changed = 0;
+  DIR* dir = opendir(source.c_str());
+  if (dir == nullptr) return 0;
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] == '.') continue;
+    std::string from = source + "/" + entry->d_name;
+    std::string to = target + "/" + entry->d_name;
+    struct stat st;
+    if (lstat(from.c_str(), &st) != 0) continue;
+    if (S_ISDIR(st.st_mode)) {
+      changed += Rescan(from, to, files);
+      continue;
+    }
+    ++*files;
+    struct stat mirrored;
+    if (stat(to.c_str(), &mirrored) != 0 || mirrored.st_size != st.st_size ||
+        std::abs(MtimeNanos(mirrored) - MtimeNanos(st)) > kMtimeSlackNs) {
+      changed++;
+    }
+  }
+  closedir(dir);
+  return changed;
+}
+
+StateStore::Mutation IntMutation(const char* key, int64_t value) {
+  StateStore::Mutation mutation;
+  mutation.key = key;
+  mutation.value.type = StateStore::Type::kInt;
+  mutation.value.int_value = value;
+  return mutation;
+}
+
+}  // namespace
+
+// std::min takes it by reference, which needs the definition.
+const int PhotoMirror::kMaxConcurrency;
+
+PhotoMirror::PhotoMirror(PhotoCatalog* catalog, StateStore* state)
+    : catalog_(catalog), state_(state) {}
+
+PhotoMirror::~PhotoMirror() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& worker : workers_) worker.join();
+  if (channel_ != nullptr) g_object_unref(channel_);
+}
+
+bool PhotoMirror::Start(std::string* error) {
+  if (state_ != nullptr) {
+    StateStore::Value value;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (state_->Get(kTargetKey, &value) &&
+        value.type == StateStore::Type::kString) {
+      target_ = value.string_value;
+    }
+    if (state_->Get(kConcurrencyKey, &value) &&
+        value.type == StateStore::Type::kInt) {
+      concurrency_ = std::max(1, std::min(int(value.int_value),
+                                          kMaxConcurrency));
+    }
+    if (state_->Get(kCursorKey, &value) &&
+        value.type == StateStore::Type::kInt) {
+      cursor_ = value.int_value;
+    }
+    fetched_ = cursor_;
+  }
+  catalog_->AddRecordListener(
+      [this](const std::vector<PhotoCatalog::Entry>&,
+             const std::vector<PhotoCatalog::Entry>&) {
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          recorded_++;
+          more_ = true;
+        }
+        work_cv_.notify_all();
+      });
+  for (int i = 0; i < kMaxConcurrency; i++) {
+    workers_.emplace_back(&PhotoMirror::Work, this);
+  }
+  return true;
+}
+
+void PhotoMirror::AddRoot(const std::string& root) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string trimmed = root;
+  while (trimmed.size() > 1 && trimmed.back() == '/') trimmed.pop_back();
+  roots_.push_back(trimmed);
+  // Longest first, so a root inside another wins.
+  std::sort(roots_.begin(), roots_.end(),
+            [](const std::string& a, const std::string& b) {
+              return a.size() > b.size();
+            });
+}
+
+std::vector<StateStore::Mutation> PhotoMirror::ConfigMutations() const {
+  StateStore::Mutation target;
+  target.key = kTargetKey;
+  target.value.type = StateStore::Type::kString;
+  target.value.string_value = target_;
+  return {target, IntMutation(kConcurrencyKey, concurrency_),
+          IntMutation(kCursorKey, cursor_)};
+}
+
+bool PhotoMirror::Configure(const std::string& target, int concurrency,
+                            std::string* error) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Wait out a cursor commit, so it cannot land after this one.
+  idle_cv_.wait(lock, [this]() { return !persisting_; });
+  concurrency_ = std::max(1, std::min(concurrency, kMaxConcurrency));
+  if (target != target_) {
+    target_ = target;
+    generation_++;
+    cursor_ = 0;
+    fetched_ = 0;
+    queue_.clear();
+    outstanding_.clear();
+    unsynced_ = false;
+    more_ = true;
+    failures_ = 0;
+    paused_until_us_ = 0;
+    last_error_.clear();
+  }
+  std::vector<StateStore::Mutation> mutations = ConfigMutations();
+  cursor_dirty_ = false;
+  persisting_ = true;
+  lock.unlock();
+  bool ok = state_ == nullptr || state_->Commit(mutations, error);
+  lock.lock();
+  persisting_ = false;
+  lock.unlock();
+  idle_cv_.notify_all();
+  work_cv_.notify_all();
+  return ok;
+}
+
+std::string PhotoMirror::DestinationFor(const std::string& target,
+                                        const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const std::string& root : roots_) {
+    if (path.size() > root.size() + 1 &&
+        path.compare(0, root.size(), root) == 0 && path[root.size()] == '/') {
+      return target + path.substr(root.size());
+    }
+  }
+  return target + "/" + Basename(path);
+}
+
+PhotoMirror::Outcome PhotoMirror::CopyFile(const std::string& source,
+                                           const std::string& destination,
+                                           Method* method, int64_t* bytes,
+                                           std::string* error) {
+  int in = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) {
+    *error = source + ": " + strerror(errno);
+    return errno == ENOENT ? kMissing : kUnreadable;
+  }
+  struct stat st;
+  if (fstat(in, &st) != 0) {
+    *error = source + ": " + strerror(errno);
+    close(in);
+    return kUnreadable;
+  }
+  *bytes = int64_t(st.st_size);
+  struct stat mirrored;
+  if (stat(destination.c_str(), &mirrored) == 0 &&
+      mirrored.st_size == st.st_size &&
+      std::abs(MtimeNanos(mirrored) - MtimeNanos(st)) <= kMtimeSlackNs) {
+    close(in);
+    return kPresent;
+  }
+
+  std::string directory = Dirname(destination);
+  g_mkdir_with_parents(directory.c_str(), 0755);
+  std::string temp =
+      directory + "/." + Basename(destination) + ".mirror-part";
+  int out = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (out < 0) {
+    *error = temp + ": " + strerror(errno);
+    close(in);
+    return kFailed;
+  }
+  bool ok;
+  if (ioctl(out, FICLONE, in) == 0) {
+    *method = kCloned;
+    ok = true;
+  } else {
+    ok = CopyContents(in, out, *bytes, method, error);
+  }
+  if (ok) {
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    futimens(out, times);
+  }
+  close(out);
+  close(in);
+  if (ok && rename(temp.c_str(), destination.c_str()) != 0) {
+    *error = strerror(errno);
+    ok = false;
+  }
+  if (!ok) {
+    unlink(temp.c_str());
+    *error = destination + ": " + *error;
+    return kFailed;
+  }
+  return kCopied;
+}
+
+bool PhotoMirror::IdleLocked() const {
+  return target_.empty() || (queue_.empty() && outstanding_.empty() &&
+                             !more_ && !fetching_ && active_ == 0 &&
+                             !cursor_dirty_ && !persisting_);
+}
+
+bool PhotoMirror::WaitIdle(int64_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return idle_cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms),
+                           [this]() { return IdleLocked(); });
+}
+
+void PhotoMirror::PersistLocked(std::unique_lock<std::mutex>* lock) {
+  std::vector<StateStore::Mutation> mutations = ConfigMutations();
+  std::string target = unsynced_ ? target_ : "";
+  unsynced_ = false;
+  cursor_dirty_ = false;
+  persisting_ = true;
+  lock->unlock();
+
+  // Copies are not synced one by one; one syncfs makes everything behind
+  // the cursor durable before the cursor is. Past it, a restart checks
+  // each file again.
+  if (!target.empty()) {
+    int fd = open(target.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0) {
+      syncfs(fd);
+      close(fd);
+    }
+  }
+  std::string error;
+  if (state_ != nullptr && !state_->Commit(mutations, &error)) {
+    g_warning("PhotoMirror: cannot save the cursor: %s", error.c_str());
+  }
+
+  lock->lock();
+  persisting_ = false;
+  persisted_us_ = NowMicros();
+  idle_cv_.notify_all();
+}
+
+void PhotoMirror::Work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    int64_t now = NowMicros();
+    if (target_.empty()) {
+      work_cv_.wait(lock);
+      continue;
+    }
+
+    // Refill from the catalog once the queue runs dry.
+    if (queue_.empty() && more_ && !fetching_) {
+      fetching_ = true;
+      int generation = generation_;
+      int64_t recorded = recorded_;
+      int64_t after = fetched_;
+      lock.unlock();
+      std::vector<PhotoCatalog::Entry> page;
+      std::string error;
+      bool ok = catalog_->ListAfter(after, kPageSize, &page, &error);
+      lock.lock();
+      fetching_ = false;
+      if (generation != generation_) continue;
+      if (!ok) {
+        last_error_ = error;
+        g_warning("PhotoMirror: %s", error.c_str());
+        more_ = false;  // Tried again when the next photo is recorded.
+      } else {
+        for (PhotoCatalog::Entry& entry : page) {
+          outstanding_[entry.commit_seq] = false;
+          queue_.push_back(std::move(entry));
+        }
+        if (!page.empty()) fetched_ = queue_.back().commit_seq;
+        more_ = int(page.size()) == kPageSize || recorded != recorded_;
+      }
+      work_cv_.notify_all();
+      idle_cv_.notify_all();
+      continue;
+    }
+
+    if (queue_.empty() || active_ >= concurrency_ || now < paused_until_us_) {
+      if (cursor_dirty_ && !persisting_ && active_ == 0) {
+        PersistLocked(&lock);
+        continue;
+      }
+      if (now < paused_until_us_ && !queue_.empty()) {
+        work_cv_.wait_for(
+            lock, std::chrono::microseconds(paused_until_us_ - now));
+      } else {
+        work_cv_.wait(lock);
+      }
+      continue;
+    }
+
+    PhotoCatalog::Entry entry = std::move(queue_.front());
+    queue_.pop_front();
+    if (active_++ == 0) busy_since_us_ = now;
+    int generation = generation_;
+    std::string target = target_;
+    lock.unlock();
+
+    std::string destination = DestinationFor(target, entry.local_path);
+    Method method = kBuffered;
+    int64_t bytes = 0;
+    std::string error;
+    int64_t start = NowMicros();
+    Outcome outcome =
+        CopyFile(entry.local_path, destination, &method, &bytes, &error);
+    int64_t end = NowMicros();
+
+    lock.lock();
+    if (--active_ == 0) stats_.busy_us += end - busy_since_us_;
+    stats_.copy_us += end - start;
+    if (generation != generation_) {
+      work_cv_.notify_all();
+      continue;
+    }
+    if (outcome == kFailed) {
+      // The mirror is likely unmounted or full; every copy would fail the
+      // same way, so all of them wait.
+      stats_.failures++;
+      last_error_ = error;
+      failures_++;
+      int64_t backoff =
+          std::min(kMaxBackoffUs, int64_t(1000000) << std::min(failures_, 6));
+      paused_until_us_ = end + backoff;
+      queue_.push_front(std::move(entry));
+      if (failures_ == 1) g_warning("PhotoMirror: %s", error.c_str());
+      work_cv_.notify_all();
+      continue;
+    }
+
+    failures_ = 0;
+    switch (outcome) {
+      case kCopied:
+        stats_.copied++;
+        stats_.bytes += bytes;
+        stats_.by_method[method]++;
+        unsynced_ = true;
+        break;
+      case kPresent:
+        stats_.present++;
+        break;
+      case kMissing:
+        stats_.missing++;
+        break;
+      default:
+        stats_.unreadable++;
+        last_error_ = error;
+        break;
+    }
+    outstanding_[entry.commit_seq] = true;
+    // The cursor moves over photos done in order; one done ahead waits
+    // for those before it.
+    while (!outstanding_.empty() && outstanding_.begin()->second) {
+      cursor_ = outstanding_.begin()->first;
+      outstanding_.erase(outstanding_.begin());
+      cursor_dirty_ = true;
+    }
+    if (cursor_dirty_ && !persisting_ &&
+        end - persisted_us_ >= kPersistIntervalUs) {
+      PersistLocked(&lock);
+    }
+    work_cv_.notify_all();
+    idle_cv_.notify_all();
+  }
+}
+
+FlValue* PhotoMirror::StatsToFlValue() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  int64_t busy_us = stats_.busy_us;
+  if (active_ > 0) busy_us += NowMicros() - busy_since_us_;
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "target",
+                           fl_value_new_string(target_.c_str()));
+  fl_value_set_string_take(value, "concurrency",
+                           fl_value_new_int(concurrency_));
+  fl_value_set_string_take(value, "cursor", fl_value_new_int(cursor_));
+  fl_value_set_string_take(value, "queued",
+                           fl_value_new_int(int64_t(queue_.size())));
+  fl_value_set_string_take(value, "inFlight", fl_value_new_int(active_));
+  fl_value_set_string_take(value, "idle", fl_value_new_bool(IdleLocked()));
+  fl_value_set_string_take(value, "copied", fl_value_new_int(stats_.copied));
+  fl_value_set_string_take(value, "bytes", fl_value_new_int(stats_.bytes));
+  for (int method = 0; method < kMethodCount; method++) {
+    fl_value_set_string_take(value, kMethodNames[method],
+                             fl_value_new_int(stats_.by_method[method]));
+  }
+  fl_value_set_string_take(value, "present", fl_value_new_int(stats_.present));
+  fl_value_set_string_take(value, "missing", fl_value_new_int(stats_.missing));
+  fl_value_set_string_take(value, "unreadable",
+                           fl_value_new_int(stats_.unreadable));
+  fl_value_set_string_take(value, "failures",
+                           fl_value_new_int(stats_.failures));
+  fl_value_set_string_take(value, "busyMicros", fl_value_new_int(busy_us));
+  fl_value_set_string_take(value, "copyMicros",
+                           fl_value_new_int(stats_.copy_us));
+  fl_value_set_string_take(
+      value, "bytesPerSecond",
+      fl_value_new_float(busy_us > 0 ? stats_.bytes * 1e6 / busy_us : 0));
+  fl_value_set_string_take(value, "lastError",
+                           fl_value_new_string(last_error_.c_str()));
+  return value;
+}
+
+FlValue* PhotoMirror::Benchmark(int files, int file_bytes, int concurrency,
+                                const std::string& directory) {
+  std::string bench = directory + "/photo-mirror-bench-" +
+                      std::to_string(getpid());
+  std::string source = bench + "/source";
+  std::string target = bench + "/mirror";
+  RemoveTree(bench);
+  g_mkdir_with_parents(source.c_str(), 0755);
+
+  FlValue* result = fl_value_new_map();
+  {
+    PhotoCatalog catalog(bench + "/catalog.db");
+    std::string error;
+    if (!catalog.Open(&error)) {
+      g_warning("PhotoMirror: benchmark: %s", error.c_str());
+      RemoveTree(bench);
+      return result;
+    }
+    // Photos spread over one directory per 1000, like a few years of
+    // dated folders.
+    std::string data(size_t(file_bytes), '\0');
+    int64_t saved_at = 1700000000000;
+    auto write_photos = [&](int first, int count) {
+      std::vector<PhotoCatalog::Entry> batch;
+      for (int i = first; i < first + count; i++) {
+        std::string folder = source + "/" + std::to_string(i / 1000);
+        if (i % 1000 == 0 || i == first) {
+          g_mkdir_with_parents(folder.c_str(), 0755);
+        }
+        PhotoCatalog::Entry entry;
+        entry.id = i + 1;
+        entry.file_name = "photo_" + std::to_string(i) + ".jpg";
+        entry.local_path = folder + "/" + entry.file_name;
+        memcpy(&data[0], &i, std::min(sizeof(i), data.size()));
+        std::ofstream(entry.local_path, std::ios::binary) << data;
+        entry.file_size = file_bytes;
+        entry.saved_at_ms = saved_at++;
+        batch.push_back(std::move(entry));
+        if (batch.size() == 1000) {
+          catalog.Record(batch, &error);
+          batch.clear();
+        }
+      }
+      if (!batch.empty()) catalog.Record(batch, &error);
+    };
+    write_photos(0, files);
+
+    PhotoMirror mirror(&catalog, nullptr);
+    mirror.AddRoot(source);
+    mirror.Start(&error);
+    int64_t start = NowMicros();
+    mirror.Configure(target, concurrency, &error);
+    mirror.WaitIdle(3600 * 1000);
+    int64_t initial_us = NowMicros() - start;
+
+    // Ten new photos: the mirror copies just them, where a rescan first
+    // looks at every file on both sides.
+    const int kNewPhotos = 10;
+    int64_t scanned = 0;
+    start = NowMicros();
+    int64_t changed = Rescan(source, target, &scanned);
+    int64_t rescan_us = NowMicros() - start;
+
+    start = NowMicros();
+    write_photos(files, kNewPhotos);
+    mirror.WaitIdle(60 * 1000);
+    int64_t incremental_us = NowMicros() - start;
+
+    fl_value_set_string_take(result, "files", fl_value_new_int(files));
+    fl_value_set_string_take(result, "fileBytes", fl_value_new_int(file_bytes));
+    fl_value_set_string_take(result, "initialMicros",
+                             fl_value_new_int(initial_us));
+    fl_value_set_string_take(result, "rescanMicros",
+                             fl_value_new_int(rescan_us));
+    fl_value_set_string_take(result, "rescanFiles", fl_value_new_int(scanned));
+    fl_value_set_string_take(result, "rescanChanged",
+                             fl_value_new_int(changed));
+    fl_value_set_string_take(result, "incrementalMicros",
+                             fl_value_new_int(incremental_us));
+    fl_value_set_string_take(result, "incrementalFiles",
+                             fl_value_new_int(kNewPhotos));
+    fl_value_set_string_take(result, "mirror", mirror.StatsToFlValue());
+  }
+  RemoveTree(bench);
+  return result;
+}
+
+void PhotoMirror::RegisterChannel(FlBinaryMessenger* messenger,
+                                  WorkerPool* pool) {
+  pool_ = pool;
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_method_channel_new(messenger, "com.rabee.omran.mirror",
+                                   FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        PhotoMirror* self = static_cast<PhotoMirror*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+
+        if (strcmp(method, "stats") == 0) {
+          g_autoptr(FlValue) stats = self->StatsToFlValue();
+          fl_method_call_respond_success(method_call, stats, nullptr);
+        } else if (strcmp(method, "configure") == 0) {
+          std::string target = ArgString(args, "target");
+          int concurrency;
+          {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            concurrency = self->concurrency_;
+          }
+          concurrency = int(ArgInt(args, "concurrency", concurrency));
+          if (!target.empty() && target[0] != '/') {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         "target must be an absolute path",
+                                         nullptr, nullptr);
+            return;
+          }
+          while (target.size() > 1 && target.back() == '/') target.pop_back();
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, target, concurrency]() {
+            std::string error;
+            if (self->Configure(target, concurrency, &error)) {
+              RespondSuccessLater(method_call, self->StatsToFlValue());
+            } else {
+              RespondErrorLater(method_call, "CONFIGURE_FAILED", error);
+            }
+          });
+        } else if (strcmp(method, "benchmark") == 0) {
+          int files = int(ArgInt(args, "files", 50000));
+          int file_bytes = int(ArgInt(args, "fileBytes", 4096));
+          int concurrency = int(ArgInt(args, "concurrency", 2));
+          std::string directory =
+              ArgString(args, "directory", g_get_tmp_dir());
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, files, file_bytes,
+                             concurrency, directory]() {
+            RespondSuccessLater(
+                method_call,
+                self->Benchmark(files, file_bytes, concurrency, directory));
+          });
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
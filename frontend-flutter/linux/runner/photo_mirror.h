@@ -0,0 +1,135 @@
+#ifndef RUNNER_PHOTO_MIRROR_H_
+#define RUNNER_PHOTO_MIRROR_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "photo_catalog.h"
+#include "state_store.h"
+#include "worker_pool.h"
+
+/**
+ * Keeps a second copy of every saved photo in a mirror directory, such as
+ * a USB drive or an NFS mount, without rescanning either side.
+ *
+ * The catalog is the queue: the mirror keeps a cursor on the catalog's
+ * commit sequence below which every photo has been copied, persisted in
+ * the state store, and copies whatever the catalog committed past it. Recorded photos wake it, and
+ * after a restart it carries on from the cursor. A bounded number of
+ * workers copy each file under a temporary name and rename it into place,
+ * cloning it with FICLONE where the filesystem can share extents, else with
+ * copy_file_range, else through a large buffer. The target is synced once
+ * per cursor commit rather than once per file.
+ */
+class PhotoMirror {
+ public:
+  enum Method { kCloned = 0, kCopyFileRange, kBuffered, kMethodCount };
+
+  struct Stats {
+    int64_t copied = 0;
+    int64_t bytes = 0;
+    int64_t by_method[kMethodCount] = {};
+    int64_t present = 0;      // Already in the mirror, as after a restart.
+    int64_t missing = 0;      // Gone from the catalog's path.
+    int64_t unreadable = 0;   // Could not be read; skipped.
+    int64_t failures = 0;     // Could not be written; retried.
+    int64_t busy_us = 0;      // Time with at least one copy running.
+    int64_t copy_us = 0;      // Summed over copies.
+  };
+
+  static const int kMaxConcurrency = 8;
+
+  // |state| may be null to keep the target and cursor in memory.
+  PhotoMirror(PhotoCatalog* catalog, StateStore* state);
+  ~PhotoMirror();
+
+  PhotoMirror(const PhotoMirror&) = delete;
+  PhotoMirror& operator=(const PhotoMirror&) = delete;
+
+  // Loads the stored target and cursor, listens for recorded photos and
+  // starts the workers.
+  bool Start(std::string* error);
+
+  // Photos under |root| keep their path below it in the mirror; others go
+  // to its top level.
+  void AddRoot(const std::string& root);
+
+  // Mirrors into |target|, or stops when it is empty, with up to
+  // |concurrency| copies at once. A new target starts over from the oldest
+  // photo; files already there are not copied again.
+  bool Configure(const std::string& target, int concurrency,
+                 std::string* error);
+
+  // Waits until everything recorded so far is mirrored or |timeout_ms|
+  // passes; returns whether it was.
+  bool WaitIdle(int64_t timeout_ms);
+
+  // Exposes the mirror on the "com.rabee.omran.mirror" channel.
+  void RegisterChannel(FlBinaryMessenger* messenger, WorkerPool* pool);
+
+ private:
+  enum Outcome { kCopied, kPresent, kMissing, kUnreadable, kFailed };
+
+  static Outcome CopyFile(const std::string& source,
+                          const std::string& destination, Method* method,
+                          int64_t* bytes, std::string* error);
+  std::string DestinationFor(const std::string& target,
+                             const std::string& path);
+
+  void Work();
+  bool IdleLocked() const;
+  void PersistLocked(std::unique_lock<std::mutex>* lock);
+  std::vector<StateStore::Mutation> ConfigMutations() const;
+
+  FlValue* StatsToFlValue();
+  FlValue* Benchmark(int files, int file_bytes, int concurrency,
+                     const std::string& directory);
+
+  PhotoCatalog* catalog_;
+  StateStore* state_;
+
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable idle_cv_;
+  bool stopping_ = false;
+  std::vector<std::thread> workers_;
+  std::vector<std::string> roots_;
+
+  std::string target_;
+  int concurrency_ = 2;
+  int generation_ = 0;  // Bumped with the target; stale copies are dropped.
+
+  // Commit sequence numbers, which unlike saved_at follow commit order.
+  int64_t cursor_ = 0;   // Everything up to here is mirrored.
+  int64_t fetched_ = 0;  // Last row read into |queue_|.
+  std::deque<PhotoCatalog::Entry> queue_;
+  std::map<int64_t, bool> outstanding_;  // Fetched, and whether done.
+  bool more_ = true;        // The catalog may hold rows past |fetched_|.
+  bool fetching_ = false;
+  int64_t recorded_ = 0;    // Bumped with every recorded batch.
+  int active_ = 0;
+  int failures_ = 0;        // In a row; sets the backoff.
+  int64_t paused_until_us_ = 0;
+  std::string last_error_;
+
+  bool unsynced_ = false;  // Files copied since the target was synced.
+  bool cursor_dirty_ = false;
+  bool persisting_ = false;
+  int64_t persisted_us_ = 0;
+
+  Stats stats_;
+  int64_t busy_since_us_ = 0;
+
+  FlMethodChannel* channel_ = nullptr;
+  WorkerPool* pool_ = nullptr;
+};
+
+#endif  // RUNNER_PHOTO_MIRROR_H_
@@ -0,0 +1,1229 @@
+#include "photo_pipeline.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "channel_utils.h"
+#include "crc32c.h"
+#include "exif_reader.h"
+#include "image_decoder.h"
+
+namespace {
+
+struct StageConfig {
+  const char* name;
+  int concurrency;
+  size_t queue_capacity;
+};
+
+// Downloads are latency bound, so several run at once. The later queues are
+// short: each slot holds a whole photo in memory.
+const StageConfig kStageConfigs[PhotoPipeline::kStageCount] = {
+    {"download", 4, 64},
+    {"verify", 1, 4},
+    {"process", 2, 4},
+    {"transcode", 2, 4},
+    {"write", 2, 4},
+};
+
+// Trace mark set when each stage finishes a photo, or -1.
+const int kStageMarks[PhotoPipeline::kStageCount] = {
+    PhotoTracer::kLastByte, PhotoTracer::kVerified, -1, -1,
+    PhotoTracer::kWritten};
+
+const int kDownloadAttempts = 3;
+// Photos a catch-up keeps in the pipeline at once; one fewer than the
+// download threads, leaving a slot for live photos.
+const int kCatchUpParallelism = 3;
+const int kRepairRounds = 2;
+const size_t kMaxPhotoBytes = 512u * 1024 * 1024;
+const size_t kSampleWindow = 512;
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+size_t AppendToBuffer(char* data, size_t size, size_t count, void* user_data) {
+  auto* buffer = static_cast<std::vector<uint8_t>*>(user_data);
+  size_t bytes = size * count;
+  if (buffer->size() + bytes > kMaxPhotoBytes) return 0;  // Aborts transfer.
+  buffer->insert(buffer->end(), data, data + bytes);
+  return bytes;
+}
+
+// A download that stops early still looks like a valid prefix. Formats with
+// an explicit trailer let us tell the two apart even without a length.
+bool HasImageTrailer(const std::vector<uint8_t>& data) {
+  size_t size = data.size();
+  if (size >= 2 && data[0] == 0xFF && data[1] == 0xD8) {
+    // Some encoders pad after EOI, so look near the end rather than at it.
+    size_t from = size > 64 ? size - 64 : 0;
+    for (size_t i = size - 1; i > from; i--) {
+      if (data[i - 1] == 0xFF && data[i] == 0xD9) return true;
+    }
+    return false;
+  }
+  static const uint8_t kPngSignature[] = {0x89, 'P', 'N', 'G'};
+  if (size >= 8 && memcmp(data.data(), kPngSignature, 4) == 0) {
+    static const uint8_t kIend[] = {'I', 'E', 'N', 'D', 0xAE, 0x42, 0x60, 0x82};
+    return size >= 12 && memcmp(&data[size - 8], kIend, sizeof(kIend)) == 0;
+  }
+  return true;  // Unknown format: nothing to check.
+}
+
+std::string Sha256Hex(const std::vector<uint8_t>& data) {
+  GChecksum* checksum = g_checksum_new(G_CHECKSUM_SHA256);
+  g_checksum_update(checksum, data.data(), gssize(data.size()));
+  std::string hex = g_checksum_get_string(checksum);
+  g_checksum_free(checksum);
+  return hex;
+}
+
+int64_t Percentile(std::vector<int64_t> samples, double p) {
+  if (samples.empty()) return 0;
+  std::sort(samples.begin(), samples.end());
+  return samples[size_t(p * double(samples.size() - 1))];
+}
+
+FlValue* ResultToFlValue(const PhotoPipeline::Result& result) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "path",
+                           fl_value_new_string(result.path.c_str()));
+  fl_value_set_string_take(value, "bytes", fl_value_new_int(result.bytes));
+  static const char* kKeys[PhotoPipeline::kStageCount] = {
+      "downloadMicros", "verifyMicros", "processMicros", "transcodeMicros",
+      "writeMicros"};
+  for (int stage = 0; stage < PhotoPipeline::kStageCount; stage++) {
+    fl_value_set_string_take(value, kKeys[stage],
+                             fl_value_new_int(result.stage_us[stage]));
+  }
+  fl_value_set_string_take(value, "totalMicros",
+                           fl_value_new_int(result.total_us));
+  return value;
+}
+
+bool ParseHex32(const char* text, uint32_t* value) {
+  char* end = nullptr;
+  errno = 0;
+  unsigned long parsed = strtoul(text, &end, 16);
+  if (errno != 0 || end == text || *end != '\0' || parsed > 0xFFFFFFFFul) {
+    return false;
+  }
+  *value = uint32_t(parsed);
+  return true;
+}
+
+// |us| since the epoch the way the server formats times, for photos whose
+// upload time came as a number.
+std::string FormatUploadedAt(int64_t us) {
+  if (us < 0) return std::string();
+  time_t seconds = time_t(us / 1000000);
+  struct tm utc;
+  gmtime_r(&seconds, &utc);
+  char text[40];
+  size_t length = strftime(text, sizeof(text), "%Y-%m-%dT%H:%M:%S", &utc);
+  int micros = int(us % 1000000);
+  if (micros != 0) {
+    length += size_t(snprintf(text + length, sizeof(text) - length, ".%06d",
+                              micros));
+  }
+  snprintf(text + length, sizeof(text) - length, "Z");
+  return text;
+}
+
+// Reads an optional CRC-32C digest (hex strings, as the server sends them)
+// into |request|: the whole-file value, block size and block values under
+// the given keys of |args|.
+bool ParseDigest(FlValue* args, const char* value_key,
+                 const char* block_size_key, const char* blocks_key,
+                 PhotoPipeline::Request* request) {
+  std::string crc = ArgString(args, value_key);
+  if (crc.empty()) return true;
+  if (!ParseHex32(crc.c_str(), &request->crc32c)) return false;
+  request->has_crc32c = true;
+
+  int64_t block_size = ArgInt(args, block_size_key);
+  FlValue* blocks = fl_value_lookup_string(args, blocks_key);
+  if (block_size <= 0 || blocks == nullptr ||
+      fl_value_get_type(blocks) != FL_VALUE_TYPE_LIST) {
+    return true;  // Whole-file check only; mismatches cannot be repaired.
+  }
+  for (size_t i = 0; i < fl_value_get_length(blocks); i++) {
+    FlValue* block = fl_value_get_list_value(blocks, i);
+    uint32_t value = 0;
+    if (fl_value_get_type(block) != FL_VALUE_TYPE_STRING ||
+        !ParseHex32(fl_value_get_string(block), &value)) {
+      return false;
+    }
+    request->crc32c_blocks.push_back(value);
+  }
+  request->crc32c_block_size = size_t(block_size);
+  return true;
+}
+
+// Fills |request| from the arguments of one photo, as sent by "enqueue" and
+// as each entry of "catchUp".
+bool ParseRequest(FlValue* args, const std::string& directory,
+                  PhotoPipeline::Request* request, std::string* error) {
+  request->id = ArgInt(args, "id");
+  request->url = ArgString(args, "url");
+  request->file_name = ArgString(args, "fileName", "photo.jpg");
+  request->uploaded_at = ArgString(args, "uploadedAt");
+  request->expected_size = ArgInt(args, "expectedSize");
+  request->directory = directory;
+  request->trace.trace_id = ArgString(args, "traceId");
+  request->trace.received_us = ArgInt(args, "serverReceivedMicros");
+  request->trace.stored_us = ArgInt(args, "serverStoredMicros");
+  request->trace.broadcast_us = ArgInt(args, "serverBroadcastMicros");
+  if (!ParseDigest(args, "crc32c", "crc32cBlockSize", "crc32cBlocks",
+                   request)) {
+    *error = "Malformed crc32c digest";
+    return false;
+  }
+  if (request->url.empty()) {
+    *error = "url is required";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+PhotoPipeline::PhotoPipeline(PhotoWriter* writer, PhotoCatalog* catalog,
+                             PreviewCache* previews, WorkerPool* pool,
+                             LinkEstimator* link, PhotoTracer* tracer,
+                             DownloadProgress* progress,
+                             RetentionEngine* retention)
+    : writer_(writer),
+      catalog_(catalog),
+      previews_(previews),
+      pool_(pool),
+      link_(link),
+      tracer_(tracer),
+      progress_(progress),
+      retention_(retention) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  for (int stage = 0; stage < kStageCount; stage++) {
+    StageState& state = stages_[stage];
+    state.name = kStageConfigs[stage].name;
+    state.concurrency = kStageConfigs[stage].concurrency;
+    state.input.reset(new JobQueue(kStageConfigs[stage].queue_capacity));
+  }
+  for (int stage = 0; stage < kStageCount; stage++) {
+    for (int i = 0; i < stages_[stage].concurrency; i++) {
+      stages_[stage].threads.emplace_back(&PhotoPipeline::RunStage, this,
+                                          stage);
+    }
+  }
+}
+
+PhotoPipeline::~PhotoPipeline() {
+  // Shut down front to back so work already past a stage can drain; the
+  // stopping flag cuts off transfers that are still in progress.
+  stopping_ = true;
+  for (StageState& state : stages_) {
+    state.input->Close();
+    for (std::thread& thread : state.threads) thread.join();
+  }
+  {
+    std::unique_lock<std::mutex> lock(write_mutex_);
+    write_cv_.wait(lock, [this] { return writes_in_flight_ == 0; });
+  }
+  // Catch-ups and benchmarks see the closed queues and stop submitting.
+  for (BackgroundTask& task : background_) task.thread.join();
+  if (channel_ != nullptr) g_object_unref(channel_);
+  curl_global_cleanup();
+}
+
+bool PhotoPipeline::ParseServerPhoto(FlValue* photo,
+                                     const std::string& media_url,
+                                     const std::string& directory,
+                                     Request* request, std::string* error) {
+  std::string image = ArgString(photo, "image");
+  if (image.empty()) {
+    *error = "Photo has no image";
+    return false;
+  }
+  request->id = ArgInt(photo, "id");
+  request->url = media_url + image;
+  request->file_name = ArgString(photo, "original_file_name", image);
+  request->uploaded_at = ArgString(photo, "uploaded_at");
+  request->expected_size = ArgInt(photo, "file_size");
+  request->directory = directory;
+  FlValue* digest = fl_value_lookup_string(photo, "content_digest");
+  if (digest != nullptr && fl_value_get_type(digest) == FL_VALUE_TYPE_MAP &&
+      ArgString(digest, "algorithm") == "crc32c" &&
+      !ParseDigest(digest, "value", "block_size", "blocks", request)) {
+    *error = "Malformed crc32c digest";
+    return false;
+  }
+  return true;
+}
+
+bool PhotoPipeline::ParseBatchedPhoto(const PhotoUpdateView& photo,
+                                      const std::string& media_url,
+                                      const std::string& directory,
+                                      Request* request, std::string* error) {
+  if (photo.image.size == 0) {
+    *error = "Photo has no image";
+    return false;
+  }
+  request->id = photo.id;
+  request->url = media_url;
+  request->url.append(photo.image.data, photo.image.size);
+  request->file_name = photo.original_file_name.size > 0
+                           ? photo.original_file_name.ToString()
+                           : photo.image.ToString();
+  request->uploaded_at = FormatUploadedAt(photo.uploaded_at_us);
+  request->expected_size = std::max<int64_t>(0, photo.file_size);
+  request->directory = directory;
+  if (photo.has_crc32c) {
+    request->has_crc32c = true;
+    request->crc32c = photo.crc32c;
+    if (photo.block_size > 0) {
+      request->crc32c_block_size = photo.block_size;
+      request->crc32c_blocks.resize(photo.block_count);
+      for (size_t i = 0; i < photo.block_count; i++) {
+        request->crc32c_blocks[i] = photo.block(i);
+      }
+    }
+  }
+  return true;
+}
+
+bool PhotoPipeline::Submit(const Request& request, Callback done) {
+  std::unique_ptr<Job> job(new Job());
+  job->request = request;
+  job->done = std::move(done);
+  job->submitted_us = job->enqueued_us = NowMicros();
+  job->marks_us[PhotoTracer::kReceived] = PhotoTracer::NowMicros();
+  if (!stages_[kDownload].input->TryPush(job)) return false;
+  in_flight_++;
+  return true;
+}
+
+int PhotoPipeline::AbortIfStopping(void* user_data, curl_off_t, curl_off_t,
+                                   curl_off_t, curl_off_t) {
+  PhotoPipeline* self = static_cast<PhotoPipeline*>(user_data);
+  // Interface counters are most telling while transfers are running.
+  if (self->link_ != nullptr) self->link_->SampleCounters();
+  return self->stopping_ ? 1 : 0;
+}
+
+void PhotoPipeline::RunStage(int stage) {
+  StageState& state = stages_[stage];
+  // Download workers keep one handle each so connections are reused.
+  CURL* curl = stage == kDownload ? curl_easy_init() : nullptr;
+  int generation = connection_generation_;
+
+  std::unique_ptr<Job> job;
+  while (state.input->Pop(&job)) {
+    if (stage == kDownload && generation != connection_generation_) {
+      if (curl != nullptr) curl_easy_cleanup(curl);
+      curl = curl_easy_init();
+      generation = connection_generation_;
+    }
+    int64_t start = NowMicros();
+    int64_t wait_us = start - job->enqueued_us;
+    state.busy++;
+    if (stage == kWrite) {
+      StartWrite(std::move(job), start, wait_us);
+      continue;
+    }
+    std::string error;
+    bool ok = RunJob(stage, job.get(), curl, &error);
+    if (!EndStage(stage, job.get(), ok, error, start, wait_us)) {
+      Finish(std::move(job));
+      continue;
+    }
+
+    // Push blocks while the next stage is saturated; that time is this
+    // stage's backpressure.
+    int64_t push_start = NowMicros();
+    job->enqueued_us = push_start;
+    if (!stages_[stage + 1].input->Push(job)) {
+      job->result.error = "Pipeline is shutting down";
+      Finish(std::move(job));
+      continue;
+    }
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.blocked_us += NowMicros() - push_start;
+  }
+
+  if (curl != nullptr) curl_easy_cleanup(curl);
+}
+
+bool PhotoPipeline::EndStage(int stage, Job* job, bool ok,
+                             const std::string& error, int64_t start_us,
+                             int64_t wait_us) {
+  StageState& state = stages_[stage];
+  int64_t run_us = NowMicros() - start_us;
+  state.busy--;
+  job->result.stage_us[stage] = run_us;
+  RecordSample(&state, run_us, wait_us);
+  if (!ok) {
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      state.failed++;
+    }
+    job->result.error = std::string(state.name) + ": " + error;
+    return false;
+  }
+  if (kStageMarks[stage] >= 0) {
+    job->marks_us[kStageMarks[stage]] = PhotoTracer::NowMicros();
+  }
+  return true;
+}
+
+void PhotoPipeline::ReleaseConnections() {
+  connection_generation_++;
+}
+
+bool PhotoPipeline::RunJob(int stage, Job* job, CURL* curl,
+                           std::string* error) {
+  switch (stage) {
+    case kDownload: {
+      if (progress_ == nullptr) return Download(job, curl, error);
+      job->progress =
+          progress_->Begin(job->request.id, job->request.expected_size);
+      bool ok = Download(job, curl, error);
+      if (job->progress != nullptr) progress_->End(job->progress, ok);
+      job->progress = nullptr;
+      return ok;
+    }
+    case kVerify:
+      return Verify(job, error);
+    case kProcess:
+      return Process(job, error);
+    case kTranscode:
+      return Transcode(job);
+  }
+  // kWrite goes through StartWrite instead.
+  return false;
+}
+
+void PhotoPipeline::PrepareTransfer(CURL* curl, const std::string& url) {
+  curl_easy_reset(curl);
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+  // Give up on a stalled transfer rather than holding a download slot.
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1024L);
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 30L);
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, AbortIfStopping);
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
+}
+
+void PhotoPipeline::ResetDigest(Job* job) {
+  job->data.clear();
+  job->crc32c = 0;
+  job->block_crc32c = 0;
+  job->block_fill = 0;
+  job->block_crc32cs.clear();
+}
+
+void PhotoPipeline::UpdateDigest(Job* job, const uint8_t* data, size_t size) {
+  job->crc32c = Crc32c(job->crc32c, data, size);
+  size_t block_size = job->request.crc32c_block_size;
+  if (block_size == 0) return;
+  while (size > 0) {
+    size_t take = std::min(size, block_size - job->block_fill);
+    job->block_crc32c = Crc32c(job->block_crc32c, data, take);
+    job->block_fill += take;
+    data += take;
+    size -= take;
+    if (job->block_fill == block_size) {
+      job->block_crc32cs.push_back(job->block_crc32c);
+      job->block_crc32c = 0;
+      job->block_fill = 0;
+    }
+  }
+}
+
+size_t PhotoPipeline::ReceiveData(char* data, size_t size, size_t count,
+                                  void* user_data) {
+  Job* job = static_cast<Job*>(user_data);
+  size_t bytes = size * count;
+  if (!job->transfer_started) {
+    job->transfer_started = true;
+    if (job->marks_us[PhotoTracer::kFirstByte] == 0) {
+      job->marks_us[PhotoTracer::kFirstByte] = PhotoTracer::NowMicros();
+    }
+    long status = 0;
+    curl_easy_getinfo(job->transfer, CURLINFO_RESPONSE_CODE, &status);
+    // A server that ignores Range answers 200 with the whole file again.
+    if (job->transfer_offset > 0 && status != 206) ResetDigest(job);
+    if (job->progress != nullptr && job->request.expected_size <= 0) {
+      curl_off_t length = -1;
+      curl_easy_getinfo(job->transfer, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+                        &length);
+      if (length > 0) {
+        job->progress->SetTotal(int64_t(job->data.size()) + int64_t(length));
+      }
+    }
+  }
+  if (job->data.size() + bytes > kMaxPhotoBytes) return 0;  // Aborts transfer.
+  const uint8_t* begin = reinterpret_cast<const uint8_t*>(data);
+  UpdateDigest(job, begin, bytes);
+  job->data.insert(job->data.end(), begin, begin + bytes);
+  if (job->progress != nullptr) {
+    job->progress->Update(int64_t(job->data.size()));
+  }
+  return bytes;
+}
+
+bool PhotoPipeline::Download(Job* job, CURL* curl, std::string* error) {
+  if (curl == nullptr) {
+    *error = "curl_easy_init failed";
+    return false;
+  }
+  const Request& request = job->request;
+  ResetDigest(job);
+  if (request.expected_size > 0 &&
+      size_t(request.expected_size) <= kMaxPhotoBytes) {
+    job->data.reserve(size_t(request.expected_size));
+  }
+
+  bool complete = false;
+  for (int attempt = 1; attempt <= kDownloadAttempts; attempt++) {
+    // A transfer that broke off is continued from where it stopped instead
+    // of starting over; the digest simply keeps running.
+    PrepareTransfer(curl, request.url);
+    job->transfer = curl;
+    job->transfer_offset = job->data.size();
+    job->transfer_started = false;
+    if (job->transfer_offset > 0) {
+      std::string range = std::to_string(job->transfer_offset) + "-";
+      curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+      resumes_++;
+    }
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, ReceiveData);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, job);
+
+    int64_t transfer_start = NowMicros();
+    CURLcode code = curl_easy_perform(curl);
+    job->transfer = nullptr;
+    if (link_ != nullptr && code == CURLE_OK) {
+      link_->RecordTransfer(int64_t(job->data.size() - job->transfer_offset),
+                            NowMicros() - transfer_start);
+    }
+    bool short_read = request.expected_size > 0 &&
+                      int64_t(job->data.size()) < request.expected_size;
+    if (code == CURLE_OK && !short_read) {
+      complete = true;
+      break;
+    }
+    *error = code == CURLE_OK ? "Connection closed early"
+                              : curl_easy_strerror(code);
+    long status = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+    // Client errors will not fix themselves.
+    if (stopping_ || (status >= 400 && status < 500)) break;
+    // Only back off when the last attempt made no progress at all.
+    if (attempt < kDownloadAttempts && job->data.size() == job->transfer_offset) {
+      usleep(useconds_t(attempt) * 500000);
+    }
+  }
+  if (!complete) return false;
+  if (!request.has_crc32c || job->crc32c == request.crc32c) return true;
+  return RepairBlocks(job, curl, error);
+}
+
+bool PhotoPipeline::RepairBlocks(Job* job, CURL* curl, std::string* error) {
+  const Request& request = job->request;
+  std::vector<uint32_t> received = job->block_crc32cs;
+  if (job->block_fill > 0) received.push_back(job->block_crc32c);
+  size_t block_size = request.crc32c_block_size;
+  if (block_size == 0 || received.size() != request.crc32c_blocks.size()) {
+    checksum_failures_++;
+    *error = "Checksum mismatch";
+    return false;
+  }
+
+  // Only the blocks whose checksum disagrees are fetched again.
+  std::vector<uint8_t> chunk;
+  for (int round = 0; round < kRepairRounds; round++) {
+    bool repaired = false;
+    for (size_t i = 0; i < received.size(); i++) {
+      if (received[i] == request.crc32c_blocks[i]) continue;
+      size_t begin = i * block_size;
+      size_t end = std::min(job->data.size(), begin + block_size);
+      chunk.clear();
+      PrepareTransfer(curl, request.url);
+      std::string range =
+          std::to_string(begin) + "-" + std::to_string(end - 1);
+      curl_easy_setopt(curl, CURLOPT_RANGE, range.c_str());
+      curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, AppendToBuffer);
+      curl_easy_setopt(curl, CURLOPT_WRITEDATA, &chunk);
+      CURLcode code = curl_easy_perform(curl);
+      long status = 0;
+      curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+      if (code != CURLE_OK || status != 206 || chunk.size() != end - begin) {
+        checksum_failures_++;
+        *error = "Checksum mismatch in block " + std::to_string(i) +
+                 " and the server would not resend it";
+        return false;
+      }
+      memcpy(&job->data[begin], chunk.data(), chunk.size());
+      received[i] = Crc32c(0, chunk.data(), chunk.size());
+      repaired_blocks_++;
+      repaired_bytes_ += int64_t(chunk.size());
+      repaired = true;
+    }
+    if (!repaired) break;
+  }
+
+  // Block checksums can agree while the whole-file one still does not (a
+  // stale block list), so settle it on the repaired bytes.
+  job->crc32c = Crc32c(0, job->data.data(), job->data.size());
+  if (job->crc32c != request.crc32c) {
+    checksum_failures_++;
+    *error = "Checksum mismatch after re-fetching damaged blocks";
+    return false;
+  }
+  return true;
+}
+
+bool PhotoPipeline::Verify(Job* job, std::string* error) {
+  int64_t expected = job->request.expected_size;
+  if (expected > 0 && int64_t(job->data.size()) != expected) {
+    *error = "Expected " + std::to_string(expected) + " bytes, got " +
+             std::to_string(job->data.size());
+    return false;
+  }
+  if (job->data.empty() || !HasImageTrailer(job->data)) {
+    *error = "Image is truncated";
+    return false;
+  }
+  if (job->request.has_crc32c && job->crc32c != job->request.crc32c) {
+    *error = "Checksum mismatch";
+    return false;
+  }
+  return true;
+}
+
+bool PhotoPipeline::Process(Job* job, std::string* error) {
+  // Everything the catalog needs comes from the bytes already in memory.
+  const uint8_t* data = job->data.data();
+  size_t size = job->data.size();
+  ReadImageSize(data, size, &job->width, &job->height);
+  ExifInfo exif;
+  if (FindJpegExif(data, size, &exif)) {
+    job->captured_at = exif.capture_time;
+    if (exif.orientation >= 5) std::swap(job->width, job->height);
+  }
+  job->content_hash = Sha256Hex(job->data);
+  return true;
+}
+
+bool PhotoPipeline::Transcode(Job* job) {
+  TranscodeFormat format = TranscodeFormat(int(transcode_format_));
+  if (format == kTranscodeOff) return true;
+
+  TranscodeResult transcoded;
+  std::string error;
+  // Never lose a photo over this: any failure saves the original instead.
+  if (!TranscodeImage(job->data.data(), job->data.size(), format,
+                      transcode_quality_, &transcoded, &error)) {
+    g_warning("PhotoPipeline: transcode %s: %s",
+              job->request.file_name.c_str(), error.c_str());
+    std::lock_guard<std::mutex> lock(transcode_mutex_);
+    transcode_failed_++;
+    return true;
+  }
+  bool smaller = transcoded.data.size() < job->data.size();
+  {
+    std::lock_guard<std::mutex> lock(transcode_mutex_);
+    transcode_pixels_ += transcoded.pixels;
+    transcode_cpu_us_ += transcoded.cpu_us;
+    transcode_bytes_in_ += int64_t(job->data.size());
+    if (smaller) {
+      transcoded_++;
+      transcode_bytes_out_ += int64_t(transcoded.data.size());
+    } else {
+      transcode_kept_++;
+      transcode_bytes_out_ += int64_t(job->data.size());
+    }
+  }
+  if (!smaller) return true;
+
+  job->data.swap(transcoded.data);
+  std::string& name = job->request.file_name;
+  size_t dot = name.rfind('.');
+  if (dot != std::string::npos && dot > 0) name.erase(dot);
+  name += TranscodeExtension(format);
+  // The hash identifies the bytes on disk, which have just changed.
+  job->content_hash = Sha256Hex(job->data);
+  return true;
+}
+
+void PhotoPipeline::StartWrite(std::unique_ptr<Job> job, int64_t start_us,
+                               int64_t wait_us) {
+  {
+    // Keeps the writes in flight to the stage's concurrency, so a slow disk
+    // still backs up into the write queue.
+    std::unique_lock<std::mutex> lock(write_mutex_);
+    write_cv_.wait(lock, [this] {
+      return writes_in_flight_ < stages_[kWrite].concurrency;
+    });
+    writes_in_flight_++;
+  }
+  const Request& request = job->request;
+  g_mkdir_with_parents(request.directory.c_str(), 0755);
+  PhotoWriter::Result reserved;
+  if (retention_ != nullptr &&
+      !retention_->Reserve(request.directory, int64_t(job->data.size()),
+                           &reserved.error)) {
+    FinishWrite(std::move(job), reserved, start_us, wait_us);
+    return;
+  }
+
+  job->result.bytes = int64_t(job->data.size());
+  // The callback runs exactly once, so it can own the job through a plain
+  // pointer and stay copyable.
+  Job* pending = job.release();
+  writer_->Write(
+      pending->request.directory, pending->request.file_name,
+      std::move(pending->data),
+      [this, pending, start_us, wait_us](const PhotoWriter::Result& written) {
+        // The catalog write blocks, so keep it off the writer's thread.
+        auto finish = [this, pending, written, start_us, wait_us]() {
+          FinishWrite(std::unique_ptr<Job>(pending), written, start_us,
+                      wait_us);
+        };
+        if (pool_ != nullptr) {
+          pool_->Post(finish);
+        } else {
+          finish();
+        }
+      });
+}
+
+void PhotoPipeline::FinishWrite(std::unique_ptr<Job> job,
+                                const PhotoWriter::Result& written,
+                                int64_t start_us, int64_t wait_us) {
+  if (written.ok) RecordWrite(job.get(), written);
+  if (EndStage(kWrite, job.get(), written.ok, written.error, start_us,
+               wait_us)) {
+    job->result.ok = true;
+  }
+  Finish(std::move(job));
+  // Last, and under the lock: the destructor waits for this count.
+  std::lock_guard<std::mutex> lock(write_mutex_);
+  writes_in_flight_--;
+  write_cv_.notify_all();
+}
+
+void PhotoPipeline::RecordWrite(Job* job, const PhotoWriter::Result& written) {
+  const Request& request = job->request;
+  int64_t bytes = job->result.bytes;
+  job->result.path = written.path;
+
+  if (previews_ != nullptr) {
+    previews_->RememberHash(written.path, job->content_hash);
+  }
+  if (catalog_ != nullptr) {
+    PhotoCatalog::Entry entry;
+    entry.id = request.id;
+    entry.content_hash = job->content_hash;
+    entry.file_size = bytes;
+    entry.width = job->width;
+    entry.height = job->height;
+    entry.captured_at = job->captured_at;
+    entry.local_path = written.path;
+    entry.file_name = request.file_name;
+    entry.uploaded_at = request.uploaded_at;
+    entry.saved_at_ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    entry.download_us = job->result.stage_us[kDownload];
+    entry.write_us = written.latency_us;
+    entry.source = request.source;
+    std::string catalog_error;
+    if (!catalog_->Record({entry}, &catalog_error)) {
+      g_warning("PhotoPipeline: catalog: %s", catalog_error.c_str());
+    }
+  }
+
+  int preview_size = warm_preview_size_;
+  if (preview_size > 0 && previews_ != nullptr && pool_ != nullptr) {
+    PreviewCache* previews = previews_;
+    std::string path = written.path;
+    pool_->Post([previews, path, preview_size]() {
+      PreviewCache::Result preview;
+      std::string preview_error;
+      previews->GetPreview(path, preview_size, &preview, &preview_error);
+    });
+  }
+}
+
+void PhotoPipeline::Finish(std::unique_ptr<Job> job) {
+  job->result.total_us = NowMicros() - job->submitted_us;
+  job->data.clear();
+  job->data.shrink_to_fit();
+  in_flight_--;
+  // Benchmark photos have negative ids and would only skew the spans.
+  if (tracer_ != nullptr && job->request.id >= 0) {
+    tracer_->Record(job->request.id, job->request.url, job->request.trace,
+                    job->marks_us, job->result.ok);
+  }
+  if (job->done) job->done(job->result);
+}
+
+void PhotoPipeline::RecordSample(StageState* state, int64_t run_us,
+                                 int64_t wait_us) {
+  std::lock_guard<std::mutex> lock(state->mutex);
+  state->processed++;
+  if (state->run_samples.size() < kSampleWindow) {
+    state->run_samples.push_back(run_us);
+    state->wait_samples.push_back(wait_us);
+  } else {
+    state->run_samples[state->next_sample] = run_us;
+    state->wait_samples[state->next_sample] = wait_us;
+  }
+  state->next_sample = (state->next_sample + 1) % kSampleWindow;
+}
+
+FlValue* PhotoPipeline::Stats() {
+  FlValue* stages = fl_value_new_list();
+  for (StageState& state : stages_) {
+    FlValue* value = fl_value_new_map();
+    fl_value_set_string_take(value, "name", fl_value_new_string(state.name));
+    fl_value_set_string_take(value, "concurrency",
+                             fl_value_new_int(state.concurrency));
+    fl_value_set_string_take(value, "busy", fl_value_new_int(state.busy));
+    fl_value_set_string_take(value, "queueDepth",
+                             fl_value_new_int(int64_t(state.input->depth())));
+    fl_value_set_string_take(
+        value, "maxQueueDepth",
+        fl_value_new_int(int64_t(state.input->max_depth())));
+    fl_value_set_string_take(
+        value, "queueCapacity",
+        fl_value_new_int(int64_t(state.input->capacity())));
+    std::lock_guard<std::mutex> lock(state.mutex);
+    fl_value_set_string_take(value, "processed",
+                             fl_value_new_int(state.processed));
+    fl_value_set_string_take(value, "failed", fl_value_new_int(state.failed));
+    fl_value_set_string_take(value, "blockedMicros",
+                             fl_value_new_int(state.blocked_us));
+    fl_value_set_string_take(
+        value, "p50Micros", fl_value_new_int(Percentile(state.run_samples, 0.5)));
+    fl_value_set_string_take(
+        value, "p99Micros",
+        fl_value_new_int(Percentile(state.run_samples, 0.99)));
+    fl_value_set_string_take(
+        value, "waitP50Micros",
+        fl_value_new_int(Percentile(state.wait_samples, 0.5)));
+    fl_value_set_string_take(
+        value, "waitP99Micros",
+        fl_value_new_int(Percentile(state.wait_samples, 0.99)));
+    fl_value_append_take(stages, value);
+  }
+  FlValue* result = fl_value_new_map();
+  fl_value_set_string_take(result, "stages", stages);
+  fl_value_set_string_take(result, "inFlight", fl_value_new_int(in_flight_));
+  fl_value_set_string_take(result, "resumes", fl_value_new_int(resumes_));
+  fl_value_set_string_take(result, "repairedBlocks",
+                           fl_value_new_int(repaired_blocks_));
+  fl_value_set_string_take(result, "repairedBytes",
+                           fl_value_new_int(repaired_bytes_));
+  fl_value_set_string_take(result, "checksumFailures",
+                           fl_value_new_int(checksum_failures_));
+  fl_value_set_string_take(result, "crc32cHardware",
+                           fl_value_new_bool(Crc32cIsHardwareAccelerated()));
+  fl_value_set_string_take(result, "transcode", TranscodeStats());
+  return result;
+}
+
+FlValue* PhotoPipeline::TranscodeStats() {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(
+      value, "format",
+      fl_value_new_string(
+          TranscodeFormatName(TranscodeFormat(int(transcode_format_)))));
+  fl_value_set_string_take(value, "quality",
+                           fl_value_new_int(transcode_quality_));
+  std::lock_guard<std::mutex> lock(transcode_mutex_);
+  fl_value_set_string_take(value, "transcoded", fl_value_new_int(transcoded_));
+  fl_value_set_string_take(value, "keptOriginal",
+                           fl_value_new_int(transcode_kept_));
+  fl_value_set_string_take(value, "failed", fl_value_new_int(transcode_failed_));
+  fl_value_set_string_take(value, "bytesIn",
+                           fl_value_new_int(transcode_bytes_in_));
+  fl_value_set_string_take(value, "bytesSaved",
+                           fl_value_new_int(transcode_bytes_in_ -
+                                            transcode_bytes_out_));
+  double megapixels = double(transcode_pixels_) / 1e6;
+  fl_value_set_string_take(
+      value, "cpuMicrosPerMegapixel",
+      fl_value_new_float(megapixels > 0 ? double(transcode_cpu_us_) / megapixels
+                                        : 0.0));
+  return value;
+}
+
+FlValue* PhotoPipeline::Benchmark(const std::string& url, int count,
+                                  const std::string& directory) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  int remaining = count;
+  int failures = 0;
+  int64_t bytes = 0;
+  std::vector<std::string> paths;
+
+  int64_t start = NowMicros();
+  for (int i = 0; i < count; i++) {
+    Request request;
+    request.id = -1 - i;  // Keeps benchmark rows apart from real photos.
+    request.url = url;
+    request.file_name = "pipeline-bench-" + std::to_string(i) + ".jpg";
+    request.directory = directory;
+    auto done = [&](const Result& result) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (result.ok) {
+        bytes += result.bytes;
+        paths.push_back(result.path);
+      } else {
+        failures++;
+      }
+      if (--remaining == 0) cv.notify_all();
+    };
+    // Unlike Submit from the channel, wait for room: the point is to keep
+    // every stage saturated.
+    while (!Submit(request, done)) {
+      if (stopping_) {
+        std::lock_guard<std::mutex> lock(mutex);
+        failures++;
+        remaining--;
+        break;
+      }
+      usleep(1000);
+    }
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return remaining == 0; });
+  }
+  int64_t elapsed_us = std::max<int64_t>(1, NowMicros() - start);
+  for (const std::string& path : paths) unlink(path.c_str());
+
+  FlValue* result = Stats();
+  fl_value_set_string_take(result, "photos", fl_value_new_int(count));
+  fl_value_set_string_take(result, "failures", fl_value_new_int(failures));
+  fl_value_set_string_take(result, "elapsedMicros",
+                           fl_value_new_int(elapsed_us));
+  fl_value_set_string_take(
+      result, "photosPerSecond",
+      fl_value_new_float(double(count - failures) * 1e6 / double(elapsed_us)));
+  fl_value_set_string_take(
+      result, "megabytesPerSecond",
+      fl_value_new_float(double(bytes) / double(elapsed_us)));
+  return result;
+}
+
+FlValue* PhotoPipeline::CatchUp(const std::vector<Request>& requests,
+                                int parallelism) {
+  parallelism = std::max(1, parallelism);
+  std::mutex mutex;
+  std::condition_variable cv;
+  int in_flight = 0;
+  int failures = 0;
+  int64_t bytes = 0;
+  std::vector<Result> results(requests.size());
+
+  int64_t start = NowMicros();
+  for (size_t i = 0; i < requests.size(); i++) {
+    {
+      // Keeps a long backlog from taking every download slot, so a photo
+      // that arrives live still gets through.
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&] { return in_flight < parallelism; });
+      in_flight++;
+    }
+    auto done = [&, i](const Result& result) {
+      std::lock_guard<std::mutex> lock(mutex);
+      results[i] = result;
+      if (result.ok) {
+        bytes += result.bytes;
+      } else {
+        failures++;
+      }
+      in_flight--;
+      cv.notify_all();
+    };
+    while (!Submit(requests[i], done)) {
+      if (stopping_) {
+        std::lock_guard<std::mutex> lock(mutex);
+        results[i].error = "Pipeline is stopping";
+        failures++;
+        in_flight--;
+        break;
+      }
+      usleep(1000);
+    }
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return in_flight == 0; });
+  }
+  int64_t elapsed_us = NowMicros() - start;
+
+  FlValue* value = fl_value_new_map();
+  FlValue* list = fl_value_new_list();
+  for (size_t i = 0; i < requests.size(); i++) {
+    FlValue* item = results[i].ok ? ResultToFlValue(results[i])
+                                   : fl_value_new_map();
+    fl_value_set_string_take(item, "id", fl_value_new_int(requests[i].id));
+    fl_value_set_string_take(item, "ok", fl_value_new_bool(results[i].ok));
+    if (!results[i].ok) {
+      fl_value_set_string_take(item, "error",
+                               fl_value_new_string(results[i].error.c_str()));
+    }
+    fl_value_append_take(list, item);
+  }
+  fl_value_set_string_take(value, "results", list);
+  fl_value_set_string_take(value, "failures", fl_value_new_int(failures));
+  fl_value_set_string_take(value, "bytes", fl_value_new_int(bytes));
+  fl_value_set_string_take(value, "elapsedMicros",
+                           fl_value_new_int(elapsed_us));
+  return value;
+}
+
+FlValue* PhotoPipeline::TranscodeBenchmark(const std::string& corpus,
+                                           TranscodeFormat format,
+                                           int quality) {
+  std::vector<std::string> paths;
+  GDir* dir = g_dir_open(corpus.c_str(), 0, nullptr);
+  if (dir != nullptr) {
+    while (const gchar* name = g_dir_read_name(dir)) {
+      if (g_str_has_suffix(name, ".jpg") || g_str_has_suffix(name, ".jpeg") ||
+          g_str_has_suffix(name, ".png")) {
+        paths.push_back(corpus + "/" + name);
+      }
+    }
+    g_dir_close(dir);
+  }
+
+  // Every photo is a separate pool task, so the pool threads encode at once
+  // (this thread only waits) and the CPU time adds up to what the cores
+  // actually spent.
+  std::mutex mutex;
+  std::condition_variable cv;
+  size_t remaining = paths.size();
+  int failures = 0;
+  int64_t bytes_in = 0;
+  int64_t bytes_out = 0;
+  int64_t pixels = 0;
+  int64_t cpu_us = 0;
+  int64_t start = NowMicros();
+  for (const std::string& path : paths) {
+    pool_->Post([&, path]() {
+      gchar* contents = nullptr;
+      gsize length = 0;
+      TranscodeResult transcoded;
+      std::string error;
+      bool ok = g_file_get_contents(path.c_str(), &contents, &length, nullptr) &&
+                TranscodeImage(reinterpret_cast<const uint8_t*>(contents),
+                               length, format, quality, &transcoded, &error);
+      g_free(contents);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (ok) {
+        bytes_in += int64_t(length);
+        bytes_out += int64_t(transcoded.data.size());
+        pixels += transcoded.pixels;
+        cpu_us += transcoded.cpu_us;
+      } else {
+        failures++;
+      }
+      if (--remaining == 0) cv.notify_all();
+    });
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [&] { return remaining == 0; });
+  }
+  int64_t elapsed_us = std::max<int64_t>(1, NowMicros() - start);
+  double megapixels = double(pixels) / 1e6;
+
+  FlValue* result = fl_value_new_map();
+  fl_value_set_string_take(result, "format",
+                           fl_value_new_string(TranscodeFormatName(format)));
+  fl_value_set_string_take(result, "quality", fl_value_new_int(quality));
+  fl_value_set_string_take(result, "photos",
+                           fl_value_new_int(int64_t(paths.size())));
+  fl_value_set_string_take(result, "failures", fl_value_new_int(failures));
+  fl_value_set_string_take(
+      result, "threads", fl_value_new_int(int64_t(pool_->thread_count())));
+  fl_value_set_string_take(result, "bytesIn", fl_value_new_int(bytes_in));
+  fl_value_set_string_take(result, "bytesOut", fl_value_new_int(bytes_out));
+  fl_value_set_string_take(result, "bytesSaved",
+                           fl_value_new_int(bytes_in - bytes_out));
+  fl_value_set_string_take(result, "elapsedMicros",
+                           fl_value_new_int(elapsed_us));
+  fl_value_set_string_take(
+      result, "cpuMicrosPerMegapixel",
+      fl_value_new_float(megapixels > 0 ? double(cpu_us) / megapixels : 0.0));
+  // Megapixels per CPU-second is throughput per fully busy core.
+  fl_value_set_string_take(
+      result, "megapixelsPerCoreSecond",
+      fl_value_new_float(cpu_us > 0 ? megapixels * 1e6 / double(cpu_us) : 0.0));
+  fl_value_set_string_take(
+      result, "megapixelsPerSecond",
+      fl_value_new_float(megapixels * 1e6 / double(elapsed_us)));
+  return result;
+}
+
+void PhotoPipeline::RunInBackground(std::function<void()> task) {
+  std::lock_guard<std::mutex> lock(background_mutex_);
+  for (auto it = background_.begin(); it != background_.end();) {
+    if (*it->done) {
+      it->thread.join();
+      it = background_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  std::shared_ptr<std::atomic<bool>> done(new std::atomic<bool>(false));
+  BackgroundTask background;
+  background.done = done;
+  background.thread = std::thread([task, done]() {
+    task();
+    *done = true;
+  });
+  background_.push_back(std::move(background));
+}
+
+void PhotoPipeline::RegisterChannel(FlBinaryMessenger* messenger,
+                                    const std::string& default_directory) {
+  default_directory_ = default_directory;
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_method_channel_new(messenger, "com.rabee.omran.pipeline",
+                                   FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        PhotoPipeline* self = static_cast<PhotoPipeline*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+        std::string directory =
+            ArgString(args, "directory", self->default_directory_);
+
+        if (strcmp(method, "enqueue") == 0) {
+          Request request;
+          std::string error;
+          if (!ParseRequest(args, directory, &request, &error)) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         error.c_str(), nullptr, nullptr);
+            return;
+          }
+          g_object_ref(method_call);
+          bool queued = self->Submit(request, [method_call](const Result& r) {
+            if (r.ok) {
+              RespondSuccessLater(method_call, ResultToFlValue(r));
+            } else {
+              RespondErrorLater(method_call, "PIPELINE_FAILED", r.error);
+            }
+          });
+          if (!queued) {
+            g_object_unref(method_call);
+            fl_method_call_respond_error(method_call, "QUEUE_FULL",
+                                         "Download queue is full", nullptr,
+                                         nullptr);
+          }
+        } else if (strcmp(method, "catchUp") == 0) {
+          FlValue* photos = fl_value_lookup_string(args, "photos");
+          if (photos == nullptr ||
+              fl_value_get_type(photos) != FL_VALUE_TYPE_LIST) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         "photos is required", nullptr,
+                                         nullptr);
+            return;
+          }
+          std::vector<Request> requests(fl_value_get_length(photos));
+          for (size_t i = 0; i < requests.size(); i++) {
+            FlValue* photo = fl_value_get_list_value(photos, i);
+            std::string error;
+            if (fl_value_get_type(photo) != FL_VALUE_TYPE_MAP ||
+                !ParseRequest(photo, directory, &requests[i], &error)) {
+              fl_method_call_respond_error(
+                  method_call, "BAD_ARGS",
+                  ("photos[" + std::to_string(i) + "]: " + error).c_str(),
+                  nullptr, nullptr);
+              return;
+            }
+          }
+          int parallelism = int(ArgInt(args, "parallelism", kCatchUpParallelism));
+          g_object_ref(method_call);
+          self->RunInBackground([self, method_call, requests, parallelism]() {
+            RespondSuccessLater(method_call,
+                                self->CatchUp(requests, parallelism));
+          });
+        } else if (strcmp(method, "configure") == 0) {
+          TranscodeFormat format =
+              TranscodeFormat(int(self->transcode_format_));
+          std::string format_name = ArgString(args, "transcodeFormat");
+          if (!format_name.empty() &&
+              !ParseTranscodeFormat(format_name, &format)) {
+            fl_method_call_respond_error(
+                method_call, "BAD_ARGS",
+                "Unknown transcode format, or not built in", nullptr,
+                nullptr);
+            return;
+          }
+          self->transcode_format_ = format;
+          self->transcode_quality_ = int(std::min<int64_t>(
+              100, std::max<int64_t>(0, ArgInt(args, "transcodeQuality",
+                                               self->transcode_quality_))));
+          self->warm_preview_size_ =
+              int(ArgInt(args, "warmPreviewSize", self->warm_preview_size_));
+          fl_method_call_respond_success(method_call, nullptr, nullptr);
+        } else if (strcmp(method, "stats") == 0) {
+          g_autoptr(FlValue) stats = self->Stats();
+          fl_method_call_respond_success(method_call, stats, nullptr);
+        } else if (strcmp(method, "benchmark") == 0) {
+          std::string url = ArgString(args, "url");
+          int count = int(ArgInt(args, "count", 50));
+          g_object_ref(method_call);
+          self->RunInBackground([self, method_call, url, count, directory]() {
+            RespondSuccessLater(method_call,
+                                self->Benchmark(url, count, directory));
+          });
+        } else if (strcmp(method, "transcodeBenchmark") == 0) {
+          std::string corpus = ArgString(args, "corpus");
+          TranscodeFormat format = kTranscodeWebp;
+          if (corpus.empty() ||
+              !ParseTranscodeFormat(ArgString(args, "format", "webp"),
+                                    &format) ||
+              format == kTranscodeOff) {
+            fl_method_call_respond_error(
+                method_call, "BAD_ARGS",
+                "corpus and a built-in format of webp or avif are required",
+                nullptr, nullptr);
+            return;
+          }
+          int quality = int(ArgInt(args, "quality", self->transcode_quality_));
+          g_object_ref(method_call);
+          self->RunInBackground([self, method_call, corpus, format, quality]() {
+            RespondSuccessLater(method_call, self->TranscodeBenchmark(
+                                                 corpus, format, quality));
+          });
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
@@ -0,0 +1,259 @@
+#ifndef RUNNER_PHOTO_PIPELINE_H_
+#define RUNNER_PHOTO_PIPELINE_H_
+
+#include <curl/curl.h>
+#include <flutter_linux/flutter_linux.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+#include "download_progress.h"
+#include "link_estimator.h"
+#include "photo_batch.h"
+#include "photo_catalog.h"
+#include "photo_tracer.h"
+#include "photo_transcoder.h"
+#include "photo_writer.h"
+#include "preview_cache.h"
+#include "retention_engine.h"
+#include "worker_pool.h"
+
+/**
+ * Downloads and saves photos in overlapping stages:
+ *
+ *   download -> verify -> process -> transcode -> write
+ *
+ * Each stage has its own worker threads and a bounded input queue. A stage
+ * that falls behind fills its queue and blocks the one before it, so a slow
+ * disk throttles downloads instead of piling photos up in memory, while a
+ * burst still keeps both the link and the disk busy.
+ */
+class PhotoPipeline {
+ public:
+  enum Stage {
+    kDownload = 0,
+    kVerify,
+    kProcess,
+    kTranscode,  // Passes photos through unchanged unless configured.
+    kWrite,
+    kStageCount
+  };
+
+  struct Request {
+    int64_t id = 0;
+    std::string url;
+    std::string file_name;
+    std::string uploaded_at;
+    int64_t expected_size = 0;  // 0 when unknown.
+    std::string directory;
+    std::string source;  // Subscription it came through; "" for none.
+
+    // Server-advertised CRC-32C of the whole file and of each
+    // |crc32c_block_size| block of it. Checked only when |has_crc32c|.
+    bool has_crc32c = false;
+    uint32_t crc32c = 0;
+    size_t crc32c_block_size = 0;
+    std::vector<uint32_t> crc32c_blocks;
+
+    // The server's side of the photo's trace; empty for photos it did not
+    // announce live.
+    PhotoTracer::ServerStamps trace;
+  };
+
+  struct Result {
+    bool ok = false;
+    std::string path;
+    std::string error;
+    int64_t bytes = 0;
+    int64_t stage_us[kStageCount] = {};  // Time spent inside each stage.
+    int64_t total_us = 0;                // Including time spent queued.
+  };
+  using Callback = std::function<void(const Result&)>;
+
+  // |link| may be null; otherwise downloads feed its throughput estimate.
+  // |tracer| may be null; otherwise every photo's marks are recorded in it.
+  // |progress| may be null; otherwise downloads report their bytes to it.
+  // |retention| may be null; otherwise each write reserves its space first.
+  PhotoPipeline(PhotoWriter* writer, PhotoCatalog* catalog,
+                PreviewCache* previews, WorkerPool* pool,
+                LinkEstimator* link = nullptr, PhotoTracer* tracer = nullptr,
+                DownloadProgress* progress = nullptr,
+                RetentionEngine* retention = nullptr);
+  ~PhotoPipeline();
+
+  PhotoPipeline(const PhotoPipeline&) = delete;
+  PhotoPipeline& operator=(const PhotoPipeline&) = delete;
+
+  // Queues |request|. Returns false without queueing when the intake queue
+  // is full; |done| runs on a pipeline thread otherwise.
+  bool Submit(const Request& request, Callback done);
+
+  // Fills |request| from a photo as the server serializes it, in
+  // photo_update messages and sync pages; the file is |media_url| followed
+  // by its image name. Leaves the trace alone.
+  static bool ParseServerPhoto(FlValue* photo, const std::string& media_url,
+                               const std::string& directory, Request* request,
+                               std::string* error);
+  // The same for a photo of a photo-batch.v1 frame.
+  static bool ParseBatchedPhoto(const PhotoUpdateView& photo,
+                                const std::string& media_url,
+                                const std::string& directory, Request* request,
+                                std::string* error);
+
+  // Saves every photo of |requests|, keeping at most |parallelism| of them
+  // in the pipeline at once, and reports each outcome in order. Blocks
+  // until the last one is done, so never call it from the shared pool: the
+  // photos it waits for need those threads.
+  FlValue* CatchUp(const std::vector<Request>& requests, int parallelism);
+
+  // Has every download worker close its pooled connections and forget its
+  // DNS and TLS session caches before its next photo.
+  void ReleaseConnections();
+
+  // Exposes the pipeline on the "com.rabee.omran.pipeline" channel.
+  void RegisterChannel(FlBinaryMessenger* messenger,
+                       const std::string& default_directory);
+
+ private:
+  struct Job {
+    Request request;
+    Callback done;
+    std::vector<uint8_t> data;
+
+    // Checksums of |data|, kept up to date as bytes arrive so verifying
+    // costs no second pass.
+    uint32_t crc32c = 0;
+    uint32_t block_crc32c = 0;
+    size_t block_fill = 0;
+    std::vector<uint32_t> block_crc32cs;  // Completed blocks only.
+
+    // The transfer currently writing into |data|.
+    CURL* transfer = nullptr;
+    size_t transfer_offset = 0;  // Range start; 0 for a full request.
+    bool transfer_started = false;
+    DownloadProgress::Transfer* progress = nullptr;  // May be null.
+
+    std::string content_hash;
+    int width = 0;
+    int height = 0;
+    std::string captured_at;
+    int64_t submitted_us = 0;
+    int64_t enqueued_us = 0;  // When the job entered its current queue.
+    int64_t marks_us[PhotoTracer::kMarkCount] = {};  // Wall clock.
+    Result result;
+  };
+  using JobQueue = BoundedQueue<std::unique_ptr<Job>>;
+
+  struct StageState {
+    const char* name = "";
+    int concurrency = 1;
+    std::unique_ptr<JobQueue> input;
+    std::vector<std::thread> threads;
+    std::atomic<int> busy{0};
+
+    std::mutex mutex;
+    int64_t processed = 0;
+    int64_t failed = 0;
+    int64_t blocked_us = 0;  // Spent waiting for room in the next queue.
+    std::vector<int64_t> run_samples;
+    std::vector<int64_t> wait_samples;
+    size_t next_sample = 0;
+  };
+
+  // A thread of its own for a catch-up or benchmark, which blocks until
+  // the photos it submitted are done.
+  struct BackgroundTask {
+    std::thread thread;
+    std::shared_ptr<std::atomic<bool>> done;
+  };
+
+  void RunStage(int stage);
+  bool EndStage(int stage, Job* job, bool ok, const std::string& error,
+                int64_t start_us, int64_t wait_us);
+  bool RunJob(int stage, Job* job, CURL* curl, std::string* error);
+  bool Download(Job* job, CURL* curl, std::string* error);
+  bool RepairBlocks(Job* job, CURL* curl, std::string* error);
+  bool Verify(Job* job, std::string* error);
+  bool Process(Job* job, std::string* error);
+  bool Transcode(Job* job);
+  // Hands |job| to the writer and returns; the job finishes from the
+  // writer's completion, so no thread waits on the disk.
+  void StartWrite(std::unique_ptr<Job> job, int64_t start_us, int64_t wait_us);
+  void FinishWrite(std::unique_ptr<Job> job, const PhotoWriter::Result& written,
+                   int64_t start_us, int64_t wait_us);
+  // Tells the preview cache and catalog about a saved photo.
+  void RecordWrite(Job* job, const PhotoWriter::Result& written);
+  void Finish(std::unique_ptr<Job> job);
+  void RecordSample(StageState* state, int64_t run_us, int64_t wait_us);
+
+  FlValue* Stats();
+  FlValue* Benchmark(const std::string& url, int count,
+                     const std::string& directory);
+  FlValue* TranscodeStats();
+  FlValue* TranscodeBenchmark(const std::string& corpus,
+                              TranscodeFormat format, int quality);
+
+  void RunInBackground(std::function<void()> task);
+
+  void PrepareTransfer(CURL* curl, const std::string& url);
+  static void ResetDigest(Job* job);
+  static void UpdateDigest(Job* job, const uint8_t* data, size_t size);
+  static size_t ReceiveData(char* data, size_t size, size_t count,
+                            void* user_data);
+  static int AbortIfStopping(void* user_data, curl_off_t, curl_off_t,
+                             curl_off_t, curl_off_t);
+
+  PhotoWriter* writer_;
+  PhotoCatalog* catalog_;
+  PreviewCache* previews_;
+  WorkerPool* pool_;
+  LinkEstimator* link_;
+  PhotoTracer* tracer_;
+  DownloadProgress* progress_;
+  RetentionEngine* retention_;
+
+  StageState stages_[kStageCount];
+  std::atomic<bool> stopping_{false};
+  std::atomic<int> in_flight_{0};
+  std::atomic<int> warm_preview_size_{0};
+  std::atomic<int> connection_generation_{0};
+
+  // Writes handed to the writer and not yet finished; at most the write
+  // stage's concurrency.
+  std::mutex write_mutex_;
+  std::condition_variable write_cv_;
+  int writes_in_flight_ = 0;
+
+  std::mutex background_mutex_;
+  std::list<BackgroundTask> background_;
+
+  std::atomic<int64_t> resumes_{0};         // Transfers continued by Range.
+  std::atomic<int64_t> repaired_blocks_{0};  // Re-fetched after a mismatch.
+  std::atomic<int64_t> repaired_bytes_{0};
+  std::atomic<int64_t> checksum_failures_{0};
+
+  std::atomic<int> transcode_format_{kTranscodeOff};
+  std::atomic<int> transcode_quality_{80};
+  std::mutex transcode_mutex_;
+  int64_t transcoded_ = 0;
+  int64_t transcode_kept_ = 0;  // Originals kept because the copy was larger.
+  int64_t transcode_failed_ = 0;
+  int64_t transcode_bytes_in_ = 0;
+  int64_t transcode_bytes_out_ = 0;
+  int64_t transcode_pixels_ = 0;
+  int64_t transcode_cpu_us_ = 0;
+
+  FlMethodChannel* channel_ = nullptr;
+  std::string default_directory_;
+};
+
+#endif  // RUNNER_PHOTO_PIPELINE_H_
@@ -0,0 +1,307 @@
+#include "photo_texture.h"
+
+#include <cstring>
+#include <memory>
+
+#include "channel_utils.h"
+#include "image_decoder.h"
+
+namespace {
+
+// Four 2048px previews; more than one window ever shows at once.
+const size_t kMaxPooledBytes = size_t(4) * 2048 * 2048 * 4;
+
+struct TextureFrame {
+  std::vector<uint8_t> pixels;
+  uint32_t width = 0;
+  uint32_t height = 0;
+};
+
+// Frame hand-off between the main thread (which publishes new frames) and
+// the raster thread (which calls copy_pixels). A retired frame is only
+// recycled on the following copy_pixels call, once the engine has finished
+// uploading it.
+struct TextureFrames {
+  std::mutex mutex;
+  std::unique_ptr<TextureFrame> front;
+  std::unique_ptr<TextureFrame> pending;
+  std::vector<std::unique_ptr<TextureFrame>> retired;
+  PixelBufferPool* pool = nullptr;
+
+  void Recycle(std::unique_ptr<TextureFrame> frame) {
+    if (frame) pool->Release(std::move(frame->pixels));
+  }
+};
+
+}  // namespace
+
+struct _PhotoTexture {
+  FlPixelBufferTexture parent_instance;
+  TextureFrames* frames;
+};
+
+G_DEFINE_TYPE(PhotoTexture, photo_texture, fl_pixel_buffer_texture_get_type())
+
+// Implements FlPixelBufferTexture::copy_pixels. Runs on the raster thread.
+static gboolean photo_texture_copy_pixels(FlPixelBufferTexture* texture,
+                                          const uint8_t** out_buffer,
+                                          uint32_t* width, uint32_t* height,
+                                          GError** error) {
+  TextureFrames* frames = PHOTO_TEXTURE(texture)->frames;
+  std::lock_guard<std::mutex> lock(frames->mutex);
+  for (auto& frame : frames->retired) frames->Recycle(std::move(frame));
+  frames->retired.clear();
+  if (frames->pending) {
+    if (frames->front) frames->retired.push_back(std::move(frames->front));
+    frames->front = std::move(frames->pending);
+  }
+  if (!frames->front) {
+    // Nothing decoded yet; a transparent pixel keeps the engine happy.
+    static const uint8_t kEmpty[4] = {0, 0, 0, 0};
+    *out_buffer = kEmpty;
+    *width = 1;
+    *height = 1;
+    return TRUE;
+  }
+  *out_buffer = frames->front->pixels.data();
+  *width = frames->front->width;
+  *height = frames->front->height;
+  return TRUE;
+}
+
+static void photo_texture_finalize(GObject* object) {
+  TextureFrames* frames = PHOTO_TEXTURE(object)->frames;
+  frames->Recycle(std::move(frames->front));
+  frames->Recycle(std::move(frames->pending));
+  for (auto& frame : frames->retired) frames->Recycle(std::move(frame));
+  delete frames;
+  G_OBJECT_CLASS(photo_texture_parent_class)->finalize(object);
+}
+
+static void photo_texture_class_init(PhotoTextureClass* klass) {
+  FL_PIXEL_BUFFER_TEXTURE_CLASS(klass)->copy_pixels = photo_texture_copy_pixels;
+  G_OBJECT_CLASS(klass)->finalize = photo_texture_finalize;
+}
+
+static void photo_texture_init(PhotoTexture* self) {
+  self->frames = new TextureFrames();
+}
+
+static PhotoTexture* photo_texture_new(PixelBufferPool* pool) {
+  PhotoTexture* self =
+      PHOTO_TEXTURE(g_object_new(photo_texture_get_type(), nullptr));
+  self->frames->pool = pool;
+  return self;
+}
+
+// Queues |frame| for the next copy_pixels call. A frame that was published
+// but never shown is recycled straight away.
+static void photo_texture_publish(PhotoTexture* self,
+                                  std::unique_ptr<TextureFrame> frame) {
+  TextureFrames* frames = self->frames;
+  std::lock_guard<std::mutex> lock(frames->mutex);
+  frames->Recycle(std::move(frames->pending));
+  frames->pending = std::move(frame);
+}
+
+PixelBufferPool::PixelBufferPool(size_t max_pooled_bytes)
+    : max_pooled_bytes_(max_pooled_bytes) {}
+
+std::vector<uint8_t> PixelBufferPool::Acquire(size_t bytes) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Best fit, so a thumbnail does not pin a full-size buffer.
+  auto best = free_.end();
+  for (auto it = free_.begin(); it != free_.end(); ++it) {
+    if (it->capacity() >= bytes &&
+        (best == free_.end() || it->capacity() < best->capacity())) {
+      best = it;
+    }
+  }
+  if (best == free_.end()) {
+    allocations_++;
+    std::vector<uint8_t> buffer;
+    buffer.reserve(bytes);
+    return buffer;
+  }
+  reuses_++;
+  std::vector<uint8_t> buffer = std::move(*best);
+  free_.erase(best);
+  pooled_bytes_ -= buffer.capacity();
+  return buffer;
+}
+
+void PixelBufferPool::Release(std::vector<uint8_t> buffer) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (buffer.capacity() == 0 ||
+      pooled_bytes_ + buffer.capacity() > max_pooled_bytes_) {
+    return;
+  }
+  pooled_bytes_ += buffer.capacity();
+  buffer.clear();
+  free_.push_back(std::move(buffer));
+}
+
+size_t PixelBufferPool::Trim() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t released = pooled_bytes_;
+  free_.clear();
+  free_.shrink_to_fit();
+  pooled_bytes_ = 0;
+  return released;
+}
+
+size_t PixelBufferPool::pooled_bytes() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return pooled_bytes_;
+}
+
+int64_t PixelBufferPool::allocations() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return allocations_;
+}
+
+int64_t PixelBufferPool::reuses() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return reuses_;
+}
+
+PhotoTextureRegistry::PhotoTextureRegistry() : buffer_pool_(kMaxPooledBytes) {}
+
+PhotoTextureRegistry::~PhotoTextureRegistry() {
+  // The registrar may be gone with the engine by now, so textures still
+  // here are only dropped; Shutdown() is what unregisters them.
+  for (auto& entry : textures_) g_object_unref(entry.second);
+  textures_.clear();
+  g_clear_object(&channel_);
+}
+
+void PhotoTextureRegistry::Shutdown() {
+  if (registrar_ == nullptr) return;
+  for (auto& entry : textures_) {
+    fl_texture_registrar_unregister_texture(registrar_, FL_TEXTURE(entry.second));
+    g_object_unref(entry.second);
+  }
+  textures_.clear();
+  registrar_ = nullptr;
+}
+
+int64_t PhotoTextureRegistry::Create() {
+  if (registrar_ == nullptr) return -1;
+  PhotoTexture* texture = photo_texture_new(&buffer_pool_);
+  if (!fl_texture_registrar_register_texture(registrar_, FL_TEXTURE(texture))) {
+    g_object_unref(texture);
+    return -1;
+  }
+  int64_t texture_id = fl_texture_get_id(FL_TEXTURE(texture));
+  textures_[texture_id] = texture;
+  return texture_id;
+}
+
+void PhotoTextureRegistry::Release(int64_t texture_id) {
+  auto it = textures_.find(texture_id);
+  if (it == textures_.end()) return;
+  fl_texture_registrar_unregister_texture(registrar_, FL_TEXTURE(it->second));
+  g_object_unref(it->second);
+  textures_.erase(it);
+}
+
+void PhotoTextureRegistry::SetImage(FlMethodCall* method_call,
+                                    int64_t texture_id, const std::string& path,
+                                    int max_dimension) {
+  g_object_ref(method_call);
+  pool_->Post([this, method_call, texture_id, path, max_dimension]() {
+    std::unique_ptr<TextureFrame> frame(new TextureFrame());
+    DecodedImage image;
+    // The decode, downscale and rotation buffers all come from the pool, and
+    // the ones replaced along the way go back to it.
+    std::string error;
+    if (!DecodeScaledImage(path, max_dimension, &image, &error,
+                           &buffer_pool_)) {
+      buffer_pool_.Release(std::move(image.rgba));
+      RespondErrorLater(method_call, "TEXTURE_DECODE_FAILED", error);
+      return;
+    }
+    frame->width = uint32_t(image.width);
+    frame->height = uint32_t(image.height);
+    frame->pixels = std::move(image.rgba);
+
+    std::shared_ptr<TextureFrame> shared(frame.release());
+    RunOnMainThread([this, method_call, texture_id, shared]() {
+      uint32_t width = shared->width;
+      uint32_t height = shared->height;
+      auto it = textures_.find(texture_id);
+      if (it == textures_.end()) {
+        // Released while decoding.
+        buffer_pool_.Release(std::move(shared->pixels));
+        fl_method_call_respond_error(method_call, "TEXTURE_RELEASED",
+                                     "Texture was released", nullptr, nullptr);
+      } else {
+        std::unique_ptr<TextureFrame> owned(new TextureFrame());
+        owned->pixels = std::move(shared->pixels);
+        owned->width = width;
+        owned->height = height;
+        photo_texture_publish(it->second, std::move(owned));
+        fl_texture_registrar_mark_texture_frame_available(
+            registrar_, FL_TEXTURE(it->second));
+        frames_published_++;
+
+        g_autoptr(FlValue) result = fl_value_new_map();
+        fl_value_set_string_take(result, "width", fl_value_new_int(width));
+        fl_value_set_string_take(result, "height", fl_value_new_int(height));
+        fl_method_call_respond_success(method_call, result, nullptr);
+      }
+      g_object_unref(method_call);
+    });
+  });
+}
+
+FlValue* PhotoTextureRegistry::Stats() {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "textures",
+                           fl_value_new_int(int64_t(textures_.size())));
+  fl_value_set_string_take(value, "framesPublished",
+                           fl_value_new_int(frames_published_));
+  fl_value_set_string_take(value, "bufferAllocations",
+                           fl_value_new_int(buffer_pool_.allocations()));
+  fl_value_set_string_take(value, "bufferReuses",
+                           fl_value_new_int(buffer_pool_.reuses()));
+  fl_value_set_string_take(value, "pooledBytes",
+                           fl_value_new_int(int64_t(buffer_pool_.pooled_bytes())));
+  return value;
+}
+
+void PhotoTextureRegistry::RegisterChannel(FlBinaryMessenger* messenger,
+                                           FlTextureRegistrar* registrar,
+                                           WorkerPool* pool) {
+  registrar_ = registrar;
+  pool_ = pool;
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_method_channel_new(messenger, "com.rabee.omran.texture",
+                                   FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        PhotoTextureRegistry* self = static_cast<PhotoTextureRegistry*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+
+        if (strcmp(method, "create") == 0) {
+          g_autoptr(FlValue) result = fl_value_new_int(self->Create());
+          fl_method_call_respond_success(method_call, result, nullptr);
+        } else if (strcmp(method, "setImage") == 0) {
+          self->SetImage(method_call, ArgInt(args, "textureId", -1),
+                         ArgString(args, "path"),
+                         int(ArgInt(args, "size", 1024)));
+        } else if (strcmp(method, "release") == 0) {
+          self->Release(ArgInt(args, "textureId", -1));
+          fl_method_call_respond_success(method_call, nullptr, nullptr);
+        } else if (strcmp(method, "stats") == 0) {
+          g_autoptr(FlValue) result = self->Stats();
+          fl_method_call_respond_success(method_call, result, nullptr);
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
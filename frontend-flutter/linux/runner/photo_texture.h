@@ -0,0 +1,84 @@
+#ifndef RUNNER_PHOTO_TEXTURE_H_
+#define RUNNER_PHOTO_TEXTURE_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "image_decoder.h"
+#include "worker_pool.h"
+
+/**
+ * Recycles RGBA pixel buffers between texture frames so replacing a photo
+ * does not allocate a fresh multi-megabyte buffer each time.
+ */
+class PixelBufferPool : public PixelBufferSource {
+ public:
+  explicit PixelBufferPool(size_t max_pooled_bytes);
+
+  // Returns a buffer (possibly recycled) with room for at least |bytes|.
+  std::vector<uint8_t> Acquire(size_t bytes) override;
+  void Release(std::vector<uint8_t> buffer) override;
+
+  // Drops every pooled buffer; returns the bytes released.
+  size_t Trim();
+
+  // Read under the pool's lock, as Acquire() and Release() run on the
+  // workers.
+  size_t pooled_bytes();
+  int64_t allocations();
+  int64_t reuses();
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::vector<uint8_t>> free_;
+  size_t max_pooled_bytes_;
+  size_t pooled_bytes_ = 0;
+  int64_t allocations_ = 0;
+  int64_t reuses_ = 0;
+};
+
+G_DECLARE_FINAL_TYPE(PhotoTexture, photo_texture, PHOTO, TEXTURE,
+                     FlPixelBufferTexture)
+
+/**
+ * Owns the photo textures shown by the Dart `Texture` widget.
+ *
+ * Decoded previews are handed to the engine through FlPixelBufferTexture, so
+ * pixels never cross the platform channel. Only texture ids and dimensions
+ * travel over "com.rabee.omran.texture".
+ */
+class PhotoTextureRegistry {
+ public:
+  PhotoTextureRegistry();
+  ~PhotoTextureRegistry();
+
+  void RegisterChannel(FlBinaryMessenger* messenger,
+                       FlTextureRegistrar* registrar, WorkerPool* pool);
+
+  // Unregisters every texture from the registrar. Call before the engine
+  // that owns the registrar goes away; textures cannot be created after.
+  void Shutdown();
+
+  PixelBufferPool* buffer_pool() { return &buffer_pool_; }
+
+ private:
+  int64_t Create();
+  void Release(int64_t texture_id);
+  void SetImage(FlMethodCall* method_call, int64_t texture_id,
+                const std::string& path, int max_dimension);
+  FlValue* Stats();
+
+  PixelBufferPool buffer_pool_;
+  std::map<int64_t, PhotoTexture*> textures_;
+  FlTextureRegistrar* registrar_ = nullptr;
+  FlMethodChannel* channel_ = nullptr;
+  WorkerPool* pool_ = nullptr;
+  int64_t frames_published_ = 0;
+};
+
+#endif  // RUNNER_PHOTO_TEXTURE_H_
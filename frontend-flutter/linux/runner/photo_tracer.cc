@@ -0,0 +1,378 @@
+#include "photo_tracer.h"
+
+#include <curl/curl.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "channel_utils.h"
+
+namespace {
+
+const size_t kTraceWindow = 512;
+const int kClockProbes = 8;
+// Clocks drift apart and NTP steps them; an estimate this old is redone.
+const int64_t kClockMaxAgeUs = 10 * 60 * 1000000LL;
+// A server without /api/time/ is not asked again on every photo.
+const int64_t kClockRetryUs = 60 * 1000000LL;
+
+// Timeline of one photo with the server's stamps moved onto the device
+// clock: the three server stamps, then PhotoTracer::Mark.
+enum Point {
+  kServerReceived = 0,
+  kServerStored,
+  kServerBroadcast,
+  kDeviceMarks,
+  kPointCount = kDeviceMarks + PhotoTracer::kMarkCount
+};
+
+struct Span {
+  const char* name;
+  int from;
+  int to;
+};
+
+const Span kSpans[] = {
+    {"store", kServerReceived, kServerStored},
+    {"broadcast", kServerStored, kServerBroadcast},
+    {"notify", kServerBroadcast, kDeviceMarks + PhotoTracer::kReceived},
+    {"request", kDeviceMarks + PhotoTracer::kReceived,
+     kDeviceMarks + PhotoTracer::kFirstByte},
+    {"download", kDeviceMarks + PhotoTracer::kFirstByte,
+     kDeviceMarks + PhotoTracer::kLastByte},
+    {"verify", kDeviceMarks + PhotoTracer::kLastByte,
+     kDeviceMarks + PhotoTracer::kVerified},
+    {"write", kDeviceMarks + PhotoTracer::kVerified,
+     kDeviceMarks + PhotoTracer::kWritten},
+    {"total", kServerReceived, kDeviceMarks + PhotoTracer::kWritten},
+};
+const size_t kSpanCount = sizeof(kSpans) / sizeof(kSpans[0]);
+
+const char* kMarkNames[PhotoTracer::kMarkCount] = {
+    "received", "firstByte", "lastByte", "verified", "written"};
+
+size_t AppendToString(char* data, size_t size, size_t count, void* user_data) {
+  static_cast<std::string*>(user_data)->append(data, size * count);
+  return size * count;
+}
+
+// "scheme://host[:port]/api/time/" for the server that served |url|.
+std::string TimeUrlFor(const std::string& url) {
+  size_t scheme = url.find("://");
+  if (scheme == std::string::npos) return std::string();
+  size_t path = url.find('/', scheme + 3);
+  return url.substr(0, path) + "/api/time/";
+}
+
+int64_t Percentile(std::vector<int64_t> samples, double p) {
+  if (samples.empty()) return 0;
+  std::sort(samples.begin(), samples.end());
+  return samples[size_t(p * double(samples.size() - 1))];
+}
+
+}  // namespace
+
+PhotoTracer::PhotoTracer(WorkerPool* pool) : pool_(pool) {}
+
+PhotoTracer::~PhotoTracer() {
+  if (channel_ != nullptr) g_object_unref(channel_);
+}
+
+int64_t PhotoTracer::NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+void PhotoTracer::Record(int64_t photo_id, const std::string& url,
+                         const ServerStamps& server,
+                         const int64_t (&marks)[kMarkCount], bool ok) {
+  Trace trace;
+  trace.photo_id = photo_id;
+  trace.ok = ok;
+  trace.server = server;
+  std::copy(marks, marks + kMarkCount, trace.marks);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (server.broadcast_us > 0 && marks[kReceived] > 0) {
+    causal_offset_us_ =
+        std::max(causal_offset_us_, server.broadcast_us - marks[kReceived]);
+  }
+  if (traces_.size() < kTraceWindow) {
+    traces_.push_back(std::move(trace));
+  } else {
+    traces_[next_trace_] = std::move(trace);
+  }
+  next_trace_ = (next_trace_ + 1) % kTraceWindow;
+  recorded_++;
+  if (!server.trace_id.empty()) MaybeSyncLocked(url);
+}
+
+void PhotoTracer::MaybeSyncLocked(const std::string& url) {
+  if (pool_ == nullptr || syncing_) return;
+  std::string time_url = TimeUrlFor(url);
+  if (time_url.empty()) return;
+  int64_t now_us = NowMicros();
+  bool stale = clock_.error_us < 0 || clock_.time_url != time_url ||
+               now_us - clock_.measured_us > kClockMaxAgeUs;
+  if (!stale || now_us - last_sync_attempt_us_ < kClockRetryUs) return;
+  syncing_ = true;
+  last_sync_attempt_us_ = now_us;
+  pool_->Post([this, time_url]() {
+    std::string error;
+    if (!SyncClock(time_url, &error)) {
+      g_warning("PhotoTracer: clock sync with %s: %s", time_url.c_str(),
+                error.c_str());
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    syncing_ = false;
+  });
+}
+
+bool PhotoTracer::SyncClock(const std::string& time_url, std::string* error) {
+  CURL* curl = curl_easy_init();
+  if (curl == nullptr) {
+    *error = "curl_easy_init failed";
+    return false;
+  }
+  ClockEstimate best;
+  best.time_url = time_url;
+  // The first probe also connects; curl's timings leave that out, and
+  // later probes reuse the connection anyway.
+  for (int i = 0; i < kClockProbes; i++) {
+    std::string body;
+    curl_easy_setopt(curl, CURLOPT_URL, time_url.c_str());
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT, 5L);
+    curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, AppendToString);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+    int64_t start_us = NowMicros();
+    CURLcode code = curl_easy_perform(curl);
+    if (code != CURLE_OK) {
+      *error = curl_easy_strerror(code);
+      continue;
+    }
+    const char* field = strstr(body.c_str(), "\"server_time_us\"");
+    const char* colon = field ? strchr(field, ':') : nullptr;
+    if (colon == nullptr) {
+      *error = "No server_time_us in the response";
+      continue;
+    }
+    int64_t server_us = strtoll(colon + 1, nullptr, 10);
+    // The request left when the transfer began and the answer started
+    // arriving at the first byte; the server read its clock in between.
+    curl_off_t sent = 0;
+    curl_off_t answered = 0;
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &sent);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &answered);
+    int64_t round_trip_us = std::max<int64_t>(0, answered - sent);
+    int64_t midpoint_us = start_us + (int64_t(sent) + int64_t(answered)) / 2;
+    if (best.error_us < 0 || round_trip_us / 2 < best.error_us) {
+      best.offset_us = server_us - midpoint_us;
+      best.error_us = round_trip_us / 2;
+      best.measured_us = NowMicros();
+    }
+  }
+  curl_easy_cleanup(curl);
+  if (best.error_us < 0) return false;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // A tighter estimate wins; an old one or another server's is replaced.
+  if (clock_.error_us < 0 || clock_.time_url != time_url ||
+      best.error_us <= clock_.error_us ||
+      best.measured_us - clock_.measured_us > kClockMaxAgeUs) {
+    clock_ = best;
+    // Either clock may have been stepped since the bound was taken.
+    causal_offset_us_ = INT64_MIN;
+  }
+  return true;
+}
+
+int64_t PhotoTracer::OffsetLocked(const char** source) {
+  if (clock_.error_us >= 0) {
+    *source = "probe";
+    // The probe is only as good as its round trip; causality is exact.
+    return causal_offset_us_ == INT64_MIN
+               ? clock_.offset_us
+               : std::max(clock_.offset_us, causal_offset_us_);
+  }
+  if (causal_offset_us_ != INT64_MIN) {
+    *source = "causal";
+    return causal_offset_us_;
+  }
+  *source = "none";
+  return 0;
+}
+
+void PhotoTracer::Timeline(const Trace& trace, int64_t offset_us,
+                           int64_t* points) {
+  const int64_t server[] = {trace.server.received_us, trace.server.stored_us,
+                            trace.server.broadcast_us};
+  for (int i = 0; i < kDeviceMarks; i++) {
+    points[i] = server[i] > 0 ? server[i] - offset_us : 0;
+  }
+  for (int i = 0; i < kMarkCount; i++) {
+    points[kDeviceMarks + i] = trace.marks[i];
+  }
+}
+
+FlValue* PhotoTracer::TraceToFlValue(const Trace& trace, int64_t offset_us) {
+  int64_t points[kPointCount];
+  Timeline(trace, offset_us, points);
+
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "traceId",
+                           fl_value_new_string(trace.server.trace_id.c_str()));
+  fl_value_set_string_take(value, "photoId", fl_value_new_int(trace.photo_id));
+  fl_value_set_string_take(value, "ok", fl_value_new_bool(trace.ok));
+  FlValue* server_value = fl_value_new_map();
+  fl_value_set_string_take(server_value, "received",
+                           fl_value_new_int(trace.server.received_us));
+  fl_value_set_string_take(server_value, "stored",
+                           fl_value_new_int(trace.server.stored_us));
+  fl_value_set_string_take(server_value, "broadcast",
+                           fl_value_new_int(trace.server.broadcast_us));
+  fl_value_set_string_take(value, "serverMicros", server_value);
+  FlValue* marks = fl_value_new_map();
+  for (int i = 0; i < kMarkCount; i++) {
+    fl_value_set_string_take(marks, kMarkNames[i],
+                             fl_value_new_int(trace.marks[i]));
+  }
+  fl_value_set_string_take(value, "deviceMicros", marks);
+  // Spans missing an end are left out: the photo failed before it, or the
+  // server sent no trace.
+  FlValue* spans = fl_value_new_map();
+  for (const Span& span : kSpans) {
+    if (points[span.from] == 0 || points[span.to] == 0) continue;
+    fl_value_set_string_take(spans, span.name,
+                             fl_value_new_int(points[span.to] -
+                                              points[span.from]));
+  }
+  fl_value_set_string_take(value, "spans", spans);
+  return value;
+}
+
+FlValue* PhotoTracer::ClockToFlValue() {
+  const char* source = "none";
+  int64_t offset_us = OffsetLocked(&source);
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "source", fl_value_new_string(source));
+  fl_value_set_string_take(value, "offsetMicros", fl_value_new_int(offset_us));
+  fl_value_set_string_take(value, "errorMicros",
+                           fl_value_new_int(clock_.error_us));
+  fl_value_set_string_take(
+      value, "ageMicros",
+      fl_value_new_int(clock_.error_us < 0 ? -1
+                                           : NowMicros() - clock_.measured_us));
+  fl_value_set_string_take(value, "url",
+                           fl_value_new_string(clock_.time_url.c_str()));
+  return value;
+}
+
+FlValue* PhotoTracer::Stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const char* source = "none";
+  int64_t offset_us = OffsetLocked(&source);
+
+  std::vector<int64_t> samples[kSpanCount];
+  for (const Trace& trace : traces_) {
+    int64_t points[kPointCount];
+    Timeline(trace, offset_us, points);
+    for (size_t s = 0; s < kSpanCount; s++) {
+      if (points[kSpans[s].from] == 0 || points[kSpans[s].to] == 0) continue;
+      samples[s].push_back(points[kSpans[s].to] - points[kSpans[s].from]);
+    }
+  }
+
+  FlValue* spans = fl_value_new_map();
+  for (size_t s = 0; s < kSpanCount; s++) {
+    FlValue* span = fl_value_new_map();
+    fl_value_set_string_take(span, "count",
+                             fl_value_new_int(int64_t(samples[s].size())));
+    fl_value_set_string_take(span, "p50Micros",
+                             fl_value_new_int(Percentile(samples[s], 0.5)));
+    fl_value_set_string_take(span, "p90Micros",
+                             fl_value_new_int(Percentile(samples[s], 0.9)));
+    fl_value_set_string_take(span, "p99Micros",
+                             fl_value_new_int(Percentile(samples[s], 0.99)));
+    fl_value_set_string_take(span, "maxMicros",
+                             fl_value_new_int(Percentile(samples[s], 1.0)));
+    fl_value_set_string_take(spans, kSpans[s].name, span);
+  }
+
+  FlValue* result = fl_value_new_map();
+  fl_value_set_string_take(result, "recorded", fl_value_new_int(recorded_));
+  fl_value_set_string_take(result, "retained",
+                           fl_value_new_int(int64_t(traces_.size())));
+  fl_value_set_string_take(result, "clock", ClockToFlValue());
+  fl_value_set_string_take(result, "spans", spans);
+  return result;
+}
+
+FlValue* PhotoTracer::Traces(size_t limit) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const char* source = "none";
+  int64_t offset_us = OffsetLocked(&source);
+  FlValue* list = fl_value_new_list();
+  // Newest first.
+  size_t count = std::min(limit, traces_.size());
+  for (size_t i = 0; i < count; i++) {
+    size_t index = (next_trace_ + kTraceWindow - 1 - i) % kTraceWindow;
+    fl_value_append_take(list, TraceToFlValue(traces_[index], offset_us));
+  }
+  FlValue* result = fl_value_new_map();
+  fl_value_set_string_take(result, "clock", ClockToFlValue());
+  fl_value_set_string_take(result, "traces", list);
+  return result;
+}
+
+void PhotoTracer::RegisterChannel(FlBinaryMessenger* messenger) {
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_method_channel_new(messenger, "com.rabee.omran.trace",
+                                   FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        PhotoTracer* self = static_cast<PhotoTracer*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+
+        if (strcmp(method, "stats") == 0) {
+          g_autoptr(FlValue) stats = self->Stats();
+          fl_method_call_respond_success(method_call, stats, nullptr);
+        } else if (strcmp(method, "traces") == 0) {
+          size_t limit =
+              size_t(std::max<int64_t>(0, ArgInt(args, "limit", 50)));
+          g_autoptr(FlValue) traces = self->Traces(limit);
+          fl_method_call_respond_success(method_call, traces, nullptr);
+        } else if (strcmp(method, "syncClock") == 0) {
+          std::string url = ArgString(args, "url");
+          if (url.empty() || self->pool_ == nullptr) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         "url is required", nullptr, nullptr);
+            return;
+          }
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, url]() {
+            std::string error;
+            if (!self->SyncClock(url, &error)) {
+              RespondErrorLater(method_call, "SYNC_FAILED", error);
+              return;
+            }
+            FlValue* clock;
+            {
+              std::lock_guard<std::mutex> lock(self->mutex_);
+              clock = self->ClockToFlValue();
+            }
+            RespondSuccessLater(method_call, clock);
+          });
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
@@ -0,0 +1,108 @@
+#ifndef RUNNER_PHOTO_TRACER_H_
+#define RUNNER_PHOTO_TRACER_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "worker_pool.h"
+
+/**
+ * Follows each photo from upload to saved file, so a slow photo can be
+ * blamed on the upload, the broadcast, the download or the disk.
+ *
+ * The server stamps a trace id and its own timestamps into photo_update;
+ * the pipeline adds native marks as the photo moves through it. Server and
+ * device clocks disagree, so the offset between them is estimated NTP
+ * style: the server's /api/time/ is sampled a few times and the sample
+ * with the shortest round trip wins, its half round trip bounding the
+ * error. Spans that cross from one clock to the other are corrected by it.
+ * Thread-safe.
+ */
+class PhotoTracer {
+ public:
+  // Device-side marks, in microseconds since the epoch.
+  enum Mark {
+    kReceived = 0,  // The pipeline was handed the photo.
+    kFirstByte,
+    kLastByte,
+    kVerified,
+    kWritten,  // The file is durable and catalogued.
+    kMarkCount
+  };
+
+  // What the server put in photo_update.
+  struct ServerStamps {
+    std::string trace_id;
+    int64_t received_us = 0;   // The upload's body was in.
+    int64_t stored_us = 0;     // The photo and its file were saved.
+    int64_t broadcast_us = 0;  // photo_update was handed to the layer.
+  };
+
+  // |pool| runs clock probes; may be null to only estimate on request.
+  explicit PhotoTracer(WorkerPool* pool);
+  ~PhotoTracer();
+
+  PhotoTracer(const PhotoTracer&) = delete;
+  PhotoTracer& operator=(const PhotoTracer&) = delete;
+
+  // Records a photo that left the pipeline. |url| is what was downloaded;
+  // the clock of its origin is sampled when the estimate is missing or old.
+  void Record(int64_t photo_id, const std::string& url,
+              const ServerStamps& server, const int64_t (&marks)[kMarkCount],
+              bool ok);
+
+  // Samples |time_url| now and keeps the result if it is better than the
+  // current estimate. Blocking; call from a worker thread.
+  bool SyncClock(const std::string& time_url, std::string* error);
+
+  // Exposes traces on the "com.rabee.omran.trace" channel.
+  void RegisterChannel(FlBinaryMessenger* messenger);
+
+  static int64_t NowMicros();
+
+ private:
+  struct Trace {
+    int64_t photo_id = 0;
+    bool ok = false;
+    ServerStamps server;
+    int64_t marks[kMarkCount] = {};
+  };
+
+  struct ClockEstimate {
+    std::string time_url;
+    int64_t offset_us = 0;  // Server clock minus device clock.
+    int64_t error_us = -1;  // Half the round trip; -1 while unknown.
+    int64_t measured_us = 0;
+  };
+
+  void MaybeSyncLocked(const std::string& url);
+  // Offset to apply and where it came from; callers hold |mutex_|.
+  int64_t OffsetLocked(const char** source);
+  // The trace's server stamps on the device clock, then its marks.
+  static void Timeline(const Trace& trace, int64_t offset_us,
+                       int64_t* points);
+  FlValue* TraceToFlValue(const Trace& trace, int64_t offset_us);
+  FlValue* ClockToFlValue();
+  FlValue* Stats();
+  FlValue* Traces(size_t limit);
+
+  WorkerPool* pool_;
+  std::mutex mutex_;
+  std::vector<Trace> traces_;  // Ring of the most recent.
+  size_t next_trace_ = 0;
+  int64_t recorded_ = 0;
+  ClockEstimate clock_;
+  bool syncing_ = false;
+  int64_t last_sync_attempt_us_ = 0;
+  // Largest lower bound on the offset since the last probe: no device can
+  // receive a photo_update before the server sent it.
+  int64_t causal_offset_us_ = INT64_MIN;
+
+  FlMethodChannel* channel_ = nullptr;
+};
+
+#endif  // RUNNER_PHOTO_TRACER_H_
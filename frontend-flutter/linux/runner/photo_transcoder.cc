@@ -0,0 +1,230 @@
+#include "photo_transcoder.h"
+
+#include <time.h>
+
+#ifdef HAVE_LIBAVIF
+#include <avif/avif.h>
+#endif
+#ifdef HAVE_LIBWEBP
+#include <webp/encode.h>
+#include <webp/mux.h>
+#endif
+
+#include <cstring>
+
+#include "exif_reader.h"
+#include "image_decoder.h"
+
+namespace {
+
+int64_t ThreadCpuMicros() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return int64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+#ifdef HAVE_LIBWEBP
+// Middle of libwebp's 0-6 effort range: most of the size win at a fraction
+// of the slowest setting's CPU time.
+const int kWebpMethod = 4;
+
+bool EncodeWebp(const DecodedImage& image, int quality, const uint8_t* exif,
+                size_t exif_size, std::vector<uint8_t>* output,
+                std::string* error) {
+  WebPConfig config;
+  if (!WebPConfigInit(&config)) {
+    *error = "libwebp version mismatch";
+    return false;
+  }
+  config.quality = float(quality);
+  config.method = kWebpMethod;
+
+  WebPPicture picture;
+  WebPPictureInit(&picture);
+  picture.width = image.width;
+  picture.height = image.height;
+  WebPMemoryWriter writer;
+  WebPMemoryWriterInit(&writer);
+  picture.writer = WebPMemoryWrite;
+  picture.custom_ptr = &writer;
+  // An all-opaque alpha plane is detected and dropped by the encoder.
+  bool encoded = WebPPictureImportRGBA(&picture, image.rgba.data(),
+                                       image.width * 4) &&
+                 WebPEncode(&config, &picture);
+  if (!encoded) {
+    *error = "WebP encoding failed (" + std::to_string(picture.error_code) + ")";
+  }
+  WebPPictureFree(&picture);
+  if (!encoded) {
+    WebPMemoryWriterClear(&writer);
+    return false;
+  }
+
+  if (exif == nullptr) {
+    output->assign(writer.mem, writer.mem + writer.size);
+    WebPMemoryWriterClear(&writer);
+    return true;
+  }
+
+  // EXIF lives in its own chunk of the extended (VP8X) container.
+  WebPMux* mux = WebPMuxNew();
+  WebPData bitstream = {writer.mem, writer.size};
+  WebPData exif_chunk = {exif, exif_size};
+  WebPData assembled;
+  WebPDataInit(&assembled);
+  bool muxed = mux != nullptr &&
+               WebPMuxSetImage(mux, &bitstream, 0) == WEBP_MUX_OK &&
+               WebPMuxSetChunk(mux, "EXIF", &exif_chunk, 0) == WEBP_MUX_OK &&
+               WebPMuxAssemble(mux, &assembled) == WEBP_MUX_OK;
+  if (muxed) {
+    output->assign(assembled.bytes, assembled.bytes + assembled.size);
+  } else {
+    *error = "Cannot attach EXIF to WebP";
+  }
+  WebPDataClear(&assembled);
+  WebPMuxDelete(mux);
+  WebPMemoryWriterClear(&writer);
+  return muxed;
+}
+
+#endif  // HAVE_LIBWEBP
+
+#ifdef HAVE_LIBAVIF
+// Middle of libavif's 0-10 speed range, likewise.
+const int kAvifSpeed = 6;
+
+bool IsOpaque(const DecodedImage& image) {
+  for (size_t i = 3; i < image.rgba.size(); i += 4) {
+    if (image.rgba[i] != 0xFF) return false;
+  }
+  return true;
+}
+
+bool EncodeAvif(DecodedImage* image, int quality, const uint8_t* exif,
+                size_t exif_size, std::vector<uint8_t>* output,
+                std::string* error) {
+  avifImage* avif = avifImageCreate(uint32_t(image->width),
+                                    uint32_t(image->height), 8,
+                                    AVIF_PIXEL_FORMAT_YUV420);
+  if (avif == nullptr) {
+    *error = "Cannot allocate AVIF image";
+    return false;
+  }
+  avifRGBImage rgb;
+  avifRGBImageSetDefaults(&rgb, avif);
+  rgb.format = AVIF_RGB_FORMAT_RGBA;
+  rgb.ignoreAlpha = IsOpaque(*image) ? AVIF_TRUE : AVIF_FALSE;
+  rgb.pixels = image->rgba.data();
+  rgb.rowBytes = uint32_t(image->width) * 4;
+
+  avifEncoder* encoder = avifEncoderCreate();
+  if (encoder == nullptr) {
+    avifImageDestroy(avif);
+    *error = "Cannot create AVIF encoder";
+    return false;
+  }
+  encoder->quality = quality;
+  encoder->qualityAlpha = quality;
+  encoder->speed = kAvifSpeed;
+  encoder->maxThreads = 1;
+  avifRWData encoded = AVIF_DATA_EMPTY;
+
+  avifResult status = avifImageRGBToYUV(avif, &rgb);
+  if (status == AVIF_RESULT_OK && exif != nullptr) {
+    status = avifImageSetMetadataExif(avif, exif, exif_size);
+  }
+  if (status == AVIF_RESULT_OK) {
+    status = avifEncoderWrite(encoder, avif, &encoded);
+  }
+  if (status == AVIF_RESULT_OK) {
+    output->assign(encoded.data, encoded.data + encoded.size);
+  } else {
+    *error = std::string("AVIF encoding failed: ") + avifResultToString(status);
+  }
+  avifRWDataFree(&encoded);
+  avifEncoderDestroy(encoder);
+  avifImageDestroy(avif);
+  return status == AVIF_RESULT_OK;
+}
+#endif  // HAVE_LIBAVIF
+
+}  // namespace
+
+bool ParseTranscodeFormat(const std::string& name, TranscodeFormat* format) {
+  if (name == "off") {
+    *format = kTranscodeOff;
+#ifdef HAVE_LIBWEBP
+  } else if (name == "webp") {
+    *format = kTranscodeWebp;
+#endif
+#ifdef HAVE_LIBAVIF
+  } else if (name == "avif") {
+    *format = kTranscodeAvif;
+#endif
+  } else {
+    return false;
+  }
+  return true;
+}
+
+const char* TranscodeFormatName(TranscodeFormat format) {
+  switch (format) {
+    case kTranscodeWebp:
+      return "webp";
+    case kTranscodeAvif:
+      return "avif";
+    case kTranscodeOff:
+      break;
+  }
+  return "off";
+}
+
+const char* TranscodeExtension(TranscodeFormat format) {
+  switch (format) {
+    case kTranscodeWebp:
+      return ".webp";
+    case kTranscodeAvif:
+      return ".avif";
+    case kTranscodeOff:
+      break;
+  }
+  return "";
+}
+
+bool TranscodeImage(const uint8_t* data, size_t size, TranscodeFormat format,
+                    int quality, TranscodeResult* result, std::string* error) {
+  if (format == kTranscodeOff) {
+    *error = "Transcoding is off";
+    return false;
+  }
+  int64_t cpu_start = ThreadCpuMicros();
+  DecodedImage image;
+  if (!DecodeImageData(data, size, &image, error)) return false;
+  result->pixels = int64_t(image.width) * image.height;
+
+  const uint8_t* exif = nullptr;
+  size_t exif_size = 0;
+  FindExifBlock(data, size, &exif, &exif_size);
+
+  bool ok = false;
+  switch (format) {
+    case kTranscodeWebp:
+#ifdef HAVE_LIBWEBP
+      ok = EncodeWebp(image, quality, exif, exif_size, &result->data, error);
+#else
+      *error = "Built without WebP support";
+#endif
+      break;
+    case kTranscodeAvif:
+#ifdef HAVE_LIBAVIF
+      ok = EncodeAvif(&image, quality, exif, exif_size, &result->data, error);
+#else
+      *error = "Built without AVIF support";
+#endif
+      break;
+    case kTranscodeOff:
+      break;
+  }
+  result->cpu_us = ThreadCpuMicros() - cpu_start;
+  return ok;
+}
@@ -0,0 +1,35 @@
+#ifndef RUNNER_PHOTO_TRANSCODER_H_
+#define RUNNER_PHOTO_TRANSCODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum TranscodeFormat { kTranscodeOff = 0, kTranscodeWebp, kTranscodeAvif };
+
+struct TranscodeResult {
+  std::vector<uint8_t> data;
+  int64_t pixels = 0;
+  int64_t cpu_us = 0;  // Decode plus encode, on the calling thread.
+};
+
+// Accepts "off", and "webp" and "avif" when the runner was built with
+// libwebp and libavif respectively.
+bool ParseTranscodeFormat(const std::string& name, TranscodeFormat* format);
+const char* TranscodeFormatName(TranscodeFormat format);
+
+// File extension for |format|, including the dot.
+const char* TranscodeExtension(TranscodeFormat format);
+
+/**
+ * Re-encodes an in-memory JPEG or PNG as lossy WebP (libwebp) or AVIF
+ * (libavif) at |quality| (0-100). Pixels keep their stored orientation and
+ * the EXIF block is copied over, so viewers rotate the copy exactly as they
+ * did the original. Both encoders pick their SIMD paths at run time; each
+ * call stays on the calling thread so callers control the parallelism.
+ */
+bool TranscodeImage(const uint8_t* data, size_t size, TranscodeFormat format,
+                    int quality, TranscodeResult* result, std::string* error);
+
+#endif  // RUNNER_PHOTO_TRANSCODER_H_
@@ -0,0 +1,593 @@
+#include "photo_writer.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <set>
+
+#include "channel_utils.h"
+
+namespace {
+
+const unsigned kRingEntries = 256;
+const size_t kBufferCount = 16;
+const size_t kBufferSize = 256 * 1024;
+const size_t kMaxBatch = 256;
+const auto kGroupCommitWindow = std::chrono::milliseconds(5);
+
+// user_data layout: operation in the top byte, request index in the next
+// three, buffer index (writes only) in the low 32 bits.
+const uint64_t kOpWrite = uint64_t(1) << 56;
+const uint64_t kOpFsync = uint64_t(2) << 56;
+
+// One registered buffer's write: |length| bytes from |start| within the
+// buffer, going to |offset| in the file of batch entry |request|.
+struct BufferWrite {
+  size_t request = 0;
+  uint64_t offset = 0;
+  uint32_t start = 0;
+  uint32_t length = 0;
+};
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::string ErrnoMessage(const char* what, int error) {
+  return std::string(what) + ": " + strerror(error);
+}
+
+// Opens an unnamed file in |directory|. Falls back to a hidden temporary
+// name on filesystems without O_TMPFILE support.
+int OpenAnonymous(const std::string& directory, std::string* temp_path,
+                  std::string* error) {
+  int fd = open(directory.c_str(), O_TMPFILE | O_WRONLY | O_CLOEXEC, 0644);
+  if (fd >= 0) return fd;
+  if (errno != EOPNOTSUPP && errno != EISDIR && errno != EINVAL) {
+    *error = ErrnoMessage("open", errno);
+    return -1;
+  }
+  std::string pattern = directory + "/.photo-XXXXXX";
+  std::vector<char> name(pattern.begin(), pattern.end());
+  name.push_back('\0');
+  fd = mkostemp(name.data(), O_CLOEXEC);
+  if (fd < 0) {
+    *error = ErrnoMessage("mkostemp", errno);
+    return -1;
+  }
+  fchmod(fd, 0644);
+  *temp_path = name.data();
+  return fd;
+}
+
+std::string CandidateName(const std::string& file_name, int attempt) {
+  if (attempt == 0) return file_name;
+  size_t dot = file_name.rfind('.');
+  std::string suffix = " (" + std::to_string(attempt) + ")";
+  if (dot == std::string::npos || dot == 0) return file_name + suffix;
+  return file_name.substr(0, dot) + suffix + file_name.substr(dot);
+}
+
+// Gives the written file its final name without ever replacing an existing
+// photo.
+bool Publish(int fd, const std::string& temp_path, const std::string& directory,
+             const std::string& file_name, std::string* path,
+             std::string* error) {
+  char proc_path[64];
+  snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+  for (int attempt = 0; attempt < 1000; attempt++) {
+    std::string candidate = directory + "/" + CandidateName(file_name, attempt);
+    int rc = temp_path.empty()
+                 ? linkat(AT_FDCWD, proc_path, AT_FDCWD, candidate.c_str(),
+                          AT_SYMLINK_FOLLOW)
+                 : link(temp_path.c_str(), candidate.c_str());
+    if (rc == 0) {
+      if (!temp_path.empty()) unlink(temp_path.c_str());
+      *path = candidate;
+      return true;
+    }
+    if (errno != EEXIST) {
+      *error = ErrnoMessage("link", errno);
+      return false;
+    }
+  }
+  *error = "No free file name for " + file_name;
+  return false;
+}
+
+void SyncDirectory(const std::string& directory) {
+  int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0) return;
+  fsync(fd);
+  close(fd);
+}
+
+void Discard(int fd, const std::string& temp_path) {
+  if (fd >= 0) close(fd);
+  if (!temp_path.empty()) unlink(temp_path.c_str());
+}
+
+const char* PolicyName(FsyncPolicy policy) {
+  switch (policy) {
+    case FsyncPolicy::kPerFile:
+      return "perFile";
+    case FsyncPolicy::kGroupCommit:
+      return "group";
+    case FsyncPolicy::kNone:
+      return "none";
+  }
+  return "group";
+}
+
+bool ParsePolicy(const std::string& name, FsyncPolicy* policy) {
+  for (FsyncPolicy candidate :
+       {FsyncPolicy::kPerFile, FsyncPolicy::kGroupCommit, FsyncPolicy::kNone}) {
+    if (name == PolicyName(candidate)) {
+      *policy = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
+PhotoWriter::PhotoWriter(WorkerPool* fallback_pool)
+    : fallback_pool_(fallback_pool) {
+  ring_ready_ = ring_.Init(kRingEntries);
+  if (ring_ready_) {
+    std::vector<iovec> iovecs;
+    buffers_.resize(kBufferCount);
+    for (auto& buffer : buffers_) {
+      buffer.resize(kBufferSize);
+      iovecs.push_back(iovec{buffer.data(), buffer.size()});
+    }
+    // Unregistered buffers still work; they just cost a page pin per write.
+    ring_.RegisterBuffers(iovecs);
+    thread_ = std::thread(&PhotoWriter::Run, this);
+  }
+}
+
+PhotoWriter::~PhotoWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+  g_clear_object(&channel_);
+}
+
+void PhotoWriter::Write(const std::string& directory,
+                        const std::string& file_name, std::vector<uint8_t> data,
+                        Callback done) {
+  std::unique_ptr<Request> request(new Request());
+  request->directory = directory;
+  request->file_name = file_name;
+  request->data = std::move(data);
+  request->done = std::move(done);
+  request->queued_at_us = NowMicros();
+
+  if (!ring_ready_) {
+    std::shared_ptr<Request> shared(request.release());
+    fallback_pool_->Post([this, shared]() { WriteWithSyscalls(shared.get()); });
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(request));
+  }
+  cv_.notify_one();
+}
+
+void PhotoWriter::WriteWithSyscalls(Request* request) {
+  Result& result = request->result;
+  int fd = OpenAnonymous(request->directory, &request->temp_path, &result.error);
+  bool ok = fd >= 0;
+  size_t written = 0;
+  while (ok && written < request->data.size()) {
+    ssize_t rc = pwrite(fd, request->data.data() + written,
+                        request->data.size() - written, off_t(written));
+    if (rc < 0 && errno == EINTR) continue;
+    if (rc <= 0) {
+      result.error = ErrnoMessage("write", errno);
+      ok = false;
+    } else {
+      written += size_t(rc);
+    }
+  }
+  // Without a ring there is no batch to share a sync with, so group commit
+  // degrades to per-file syncing here.
+  bool sync = policy_ != FsyncPolicy::kNone;
+  if (ok && sync && fdatasync(fd) != 0) {
+    result.error = ErrnoMessage("fdatasync", errno);
+    ok = false;
+  }
+  if (ok) {
+    ok = Publish(fd, request->temp_path, request->directory,
+                 request->file_name, &result.path, &result.error);
+    if (ok) request->temp_path.clear();
+  }
+  if (ok && sync) SyncDirectory(request->directory);
+  Discard(fd, request->temp_path);
+  result.ok = ok;
+  result.latency_us = NowMicros() - request->queued_at_us;
+  request->done(result);
+}
+
+void PhotoWriter::Run() {
+  while (true) {
+    std::vector<std::unique_ptr<Request>> batch;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cv_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+      if (queue_.empty()) return;
+      // Group commit trades a few milliseconds of latency for one sync
+      // round per burst instead of one per photo.
+      if (policy_ == FsyncPolicy::kGroupCommit && !stopping_) {
+        cv_.wait_for(lock, kGroupCommitWindow,
+                     [this] { return stopping_ || queue_.size() >= kMaxBatch; });
+      }
+      while (!queue_.empty() && batch.size() < kMaxBatch) {
+        batch.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+      }
+    }
+    ProcessBatch(&batch);
+  }
+}
+
+bool PhotoWriter::SubmitAndWait(
+    unsigned wait_for, std::vector<IoUringQueue::Completion>* completions) {
+  int rc = ring_.Submit(wait_for);
+  if (rc < 0) return false;
+  ring_.Reap(completions);
+  return true;
+}
+
+void PhotoWriter::ProcessBatch(std::vector<std::unique_ptr<Request>>* batch) {
+  FsyncPolicy policy = policy_;
+  std::vector<std::unique_ptr<Request>>& requests = *batch;
+  if (!ring_ready_) {
+    for (auto& request : requests) WriteWithSyscalls(request.get());
+    return;
+  }
+
+  for (auto& request : requests) {
+    request->fd = OpenAnonymous(request->directory, &request->temp_path,
+                                &request->result.error);
+    request->result.ok = request->fd >= 0;
+  }
+
+  // Each file is synced as soon as its own writes are done and published
+  // as soon as its sync is, so its latency is its own rather than the
+  // batch's. Under group commit the names only become durable with the
+  // directory sync at the end, so that is when those files are reported.
+  std::vector<BufferWrite> writes(kBufferCount);
+  std::vector<size_t> free_buffers;
+  for (size_t i = 0; i < kBufferCount; i++) free_buffers.push_back(i);
+  std::deque<size_t> rewrites;  // Buffers whose write came back short.
+  std::deque<size_t> syncs;     // Requests whose writes are all done.
+  std::set<std::string> directories;
+  std::vector<IoUringQueue::Completion> completions;
+  size_t in_flight = 0;
+  bool ring_failed = false;
+
+  auto fail = [](Request* request, const std::string& error) {
+    if (!request->result.ok) return;
+    request->result.ok = false;
+    request->result.error = error;
+  };
+
+  auto finish = [&](Request* request) {
+    Result& result = request->result;
+    if (result.ok) {
+      result.ok = Publish(request->fd, request->temp_path, request->directory,
+                          request->file_name, &result.path, &result.error);
+      if (result.ok) request->temp_path.clear();
+    }
+    if (result.ok && policy == FsyncPolicy::kPerFile) {
+      SyncDirectory(request->directory);
+    } else if (result.ok && policy == FsyncPolicy::kGroupCommit) {
+      directories.insert(request->directory);
+    }
+    Discard(request->fd, request->temp_path);
+    request->fd = -1;
+    request->temp_path.clear();
+    request->finished = true;
+    if (policy != FsyncPolicy::kGroupCommit) {
+      result.latency_us = NowMicros() - request->queued_at_us;
+      request->done(result);
+      request->reported = true;
+    }
+  };
+
+  // Runs once nothing of |index| is in flight and all its data went out.
+  auto io_done = [&](size_t index) {
+    Request* request = requests[index].get();
+    if (request->result.ok && policy != FsyncPolicy::kNone &&
+        !request->synced) {
+      request->synced = true;
+      syncs.push_back(index);
+      return;
+    }
+    finish(request);
+  };
+
+  auto handle_completions = [&]() {
+    for (const auto& completion : completions) {
+      in_flight--;
+      size_t index = (completion.user_data >> 32) & 0xFFFFFF;
+      Request* request = requests[index].get();
+      if ((completion.user_data & kOpWrite) != 0) {
+        size_t buffer = completion.user_data & 0xFFFFFFFF;
+        BufferWrite& write = writes[buffer];
+        if (completion.result > 0 &&
+            uint32_t(completion.result) < write.length &&
+            request->result.ok) {
+          // A short write: the rest goes out again from the same buffer.
+          write.start += uint32_t(completion.result);
+          write.offset += uint64_t(completion.result);
+          write.length -= uint32_t(completion.result);
+          rewrites.push_back(buffer);
+          continue;
+        }
+        if (completion.result < 0) {
+          fail(request, ErrnoMessage("write", -completion.result));
+        } else if (uint32_t(completion.result) != write.length) {
+          fail(request, "Write made no progress");
+        }
+        free_buffers.push_back(buffer);
+      } else if (completion.result < 0) {
+        fail(request, ErrnoMessage("fsync", -completion.result));
+      }
+      if (--request->pending == 0 && request->writes_queued) io_done(index);
+    }
+    completions.clear();
+  };
+
+  // Prepares one entry with |prepare|, submitting to make room as needed.
+  auto queue = [&](const std::function<bool()>& prepare) {
+    while (!prepare()) {
+      if (!SubmitAndWait(0, &completions)) return false;
+      handle_completions();
+    }
+    in_flight++;
+    return true;
+  };
+
+  auto write_from = [&](size_t buffer) {
+    const BufferWrite& write = writes[buffer];
+    Request* request = requests[write.request].get();
+    uint64_t user_data =
+        kOpWrite | (uint64_t(write.request) << 32) | uint64_t(buffer);
+    return queue([&]() {
+      return ring_.PrepareWrite(request->fd,
+                                buffers_[buffer].data() + write.start,
+                                write.length, write.offset, int(buffer),
+                                user_data);
+    });
+  };
+
+  // Queues what completions asked for: the rest of short writes and the
+  // syncs of files whose writes are done.
+  auto queue_follow_ups = [&]() {
+    while (!rewrites.empty() || !syncs.empty()) {
+      if (!rewrites.empty()) {
+        size_t buffer = rewrites.front();
+        rewrites.pop_front();
+        if (!write_from(buffer)) return false;
+        continue;
+      }
+      size_t index = syncs.front();
+      syncs.pop_front();
+      int fd = requests[index]->fd;
+      uint64_t user_data = kOpFsync | (uint64_t(index) << 32);
+      if (!queue([&]() { return ring_.PrepareFsync(fd, true, user_data); })) {
+        return false;
+      }
+      requests[index]->pending++;
+    }
+    return true;
+  };
+
+  // Stream every file through the registered buffers, keeping as many
+  // writes in flight as there are free buffers.
+  for (size_t index = 0; index < requests.size() && !ring_failed; index++) {
+    Request* request = requests[index].get();
+    while (request->result.ok && request->queued_bytes < request->data.size()) {
+      if (free_buffers.empty()) {
+        if (!SubmitAndWait(1, &completions)) {
+          ring_failed = true;
+          break;
+        }
+        handle_completions();
+        if (!queue_follow_ups()) {
+          ring_failed = true;
+          break;
+        }
+        continue;
+      }
+      size_t buffer = free_buffers.back();
+      free_buffers.pop_back();
+      BufferWrite& write = writes[buffer];
+      write.request = index;
+      write.offset = request->queued_bytes;
+      write.start = 0;
+      write.length = uint32_t(
+          std::min(kBufferSize, request->data.size() - request->queued_bytes));
+      memcpy(buffers_[buffer].data(),
+             request->data.data() + request->queued_bytes, write.length);
+      if (!write_from(buffer)) {
+        ring_failed = true;
+        break;
+      }
+      request->pending++;
+      request->queued_bytes += write.length;
+    }
+    if (ring_failed) break;
+    request->writes_queued = true;
+    if (request->pending == 0) io_done(index);
+    if (!queue_follow_ups()) ring_failed = true;
+  }
+  while (!ring_failed && in_flight > 0) {
+    if (!SubmitAndWait(1, &completions)) {
+      ring_failed = true;
+      break;
+    }
+    handle_completions();
+    if (!queue_follow_ups()) ring_failed = true;
+  }
+
+  if (ring_failed) {
+    // The ring is wedged; finish this batch and all later ones on the pool.
+    ring_ready_ = false;
+    for (auto& request : requests) {
+      if (request->finished) continue;
+      Discard(request->fd, request->temp_path);
+      request->fd = -1;
+      request->temp_path.clear();
+      request->result = Result();
+      WriteWithSyscalls(request.get());
+      request->finished = true;
+      request->reported = true;
+    }
+  }
+  if (policy == FsyncPolicy::kGroupCommit) {
+    // One directory sync makes every name in the batch durable.
+    for (const auto& directory : directories) SyncDirectory(directory);
+    for (auto& request : requests) {
+      if (request->reported) continue;
+      request->result.latency_us = NowMicros() - request->queued_at_us;
+      request->done(request->result);
+    }
+  }
+}
+
+FlValue* PhotoWriter::Benchmark(const std::string& directory, int count,
+                                size_t size) {
+  std::mutex mutex;
+  std::condition_variable done_cv;
+  std::vector<int64_t> latencies;
+  std::vector<std::string> paths;
+  int failures = 0;
+
+  std::vector<uint8_t> payload(size);
+  for (size_t i = 0; i < size; i++) payload[i] = uint8_t(i * 31);
+
+  int64_t start = NowMicros();
+  for (int i = 0; i < count; i++) {
+    Write(directory, "bench-" + std::to_string(i) + ".jpg", payload,
+          [&](const Result& result) {
+            std::lock_guard<std::mutex> lock(mutex);
+            latencies.push_back(result.latency_us);
+            if (result.ok) {
+              paths.push_back(result.path);
+            } else {
+              failures++;
+            }
+            done_cv.notify_one();
+          });
+  }
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    done_cv.wait(lock, [&] { return int(latencies.size()) == count; });
+  }
+  int64_t elapsed = NowMicros() - start;
+  for (const auto& path : paths) unlink(path.c_str());
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) -> int64_t {
+    if (latencies.empty()) return 0;
+    return latencies[std::min(latencies.size() - 1,
+                              size_t(p * double(latencies.size())))];
+  };
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "ioUring", fl_value_new_bool(ring_ready_));
+  fl_value_set_string_take(value, "policy",
+                           fl_value_new_string(PolicyName(policy_)));
+  fl_value_set_string_take(value, "files", fl_value_new_int(count));
+  fl_value_set_string_take(value, "failures", fl_value_new_int(failures));
+  fl_value_set_string_take(
+      value, "filesPerSecond",
+      fl_value_new_float(elapsed > 0 ? count * 1e6 / double(elapsed) : 0));
+  fl_value_set_string_take(value, "p50Micros", fl_value_new_int(percentile(0.50)));
+  fl_value_set_string_take(value, "p99Micros", fl_value_new_int(percentile(0.99)));
+  fl_value_set_string_take(value, "maxMicros", fl_value_new_int(percentile(1.0)));
+  return value;
+}
+
+void PhotoWriter::RegisterChannel(FlBinaryMessenger* messenger,
+                                  const std::string& default_directory) {
+  default_directory_ = default_directory;
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_method_channel_new(messenger, "com.rabee.omran.writer",
+                                   FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        PhotoWriter* self = static_cast<PhotoWriter*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+        std::string directory =
+            ArgString(args, "directory", self->default_directory_);
+
+        if (strcmp(method, "saveFile") == 0) {
+          FlValue* bytes = args != nullptr &&
+                                   fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                               ? fl_value_lookup_string(args, "bytes")
+                               : nullptr;
+          if (bytes == nullptr ||
+              fl_value_get_type(bytes) != FL_VALUE_TYPE_UINT8_LIST) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         "bytes is required", nullptr, nullptr);
+            return;
+          }
+          const uint8_t* data = fl_value_get_uint8_list(bytes);
+          std::vector<uint8_t> copy(data, data + fl_value_get_length(bytes));
+          g_mkdir_with_parents(directory.c_str(), 0755);
+          g_object_ref(method_call);
+          self->Write(directory, ArgString(args, "name", "photo.jpg"),
+                      std::move(copy), [method_call](const Result& result) {
+                        if (result.ok) {
+                          RespondSuccessLater(
+                              method_call,
+                              fl_value_new_string(result.path.c_str()));
+                        } else {
+                          RespondErrorLater(method_call, "WRITE_FAILED",
+                                            result.error);
+                        }
+                      });
+        } else if (strcmp(method, "setFsyncPolicy") == 0) {
+          FsyncPolicy policy;
+          if (!ParsePolicy(ArgString(args, "policy"), &policy)) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         "Unknown fsync policy", nullptr,
+                                         nullptr);
+            return;
+          }
+          self->set_fsync_policy(policy);
+          fl_method_call_respond_success(method_call, nullptr, nullptr);
+        } else if (strcmp(method, "benchmark") == 0) {
+          int count = int(ArgInt(args, "count", 1000));
+          size_t size = size_t(ArgInt(args, "size", 64 * 1024));
+          g_mkdir_with_parents(directory.c_str(), 0755);
+          g_object_ref(method_call);
+          self->fallback_pool_->Post([self, method_call, directory, count, size]() {
+            RespondSuccessLater(method_call,
+                                self->Benchmark(directory, count, size));
+          });
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
@@ -0,0 +1,107 @@
+#ifndef RUNNER_PHOTO_WRITER_H_
+#define RUNNER_PHOTO_WRITER_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "io_uring_queue.h"
+#include "worker_pool.h"
+
+/**
+ * How hard the writer works to make a saved photo survive a crash.
+ */
+enum class FsyncPolicy {
+  kPerFile,      // fsync each file and its directory before reporting it.
+  kGroupCommit,  // Collect a short window of files and sync them together.
+  kNone,         // Leave flushing to the kernel.
+};
+
+/**
+ * Saves photos without ever exposing a partially written file.
+ *
+ * Each file is created anonymously with O_TMPFILE, filled through io_uring
+ * using registered buffers, synced according to the FsyncPolicy and only
+ * then given its name with linkat(). When io_uring is unavailable the same
+ * sequence runs with plain syscalls on the shared worker pool.
+ */
+class PhotoWriter {
+ public:
+  struct Result {
+    bool ok = false;
+    std::string path;
+    std::string error;
+    int64_t latency_us = 0;
+  };
+  using Callback = std::function<void(const Result&)>;
+
+  explicit PhotoWriter(WorkerPool* fallback_pool);
+  ~PhotoWriter();
+
+  // Queues |data| to be published as |directory|/|file_name|. If the name is
+  // taken a " (n)" suffix is added. |done| runs on a writer thread.
+  void Write(const std::string& directory, const std::string& file_name,
+             std::vector<uint8_t> data, Callback done);
+
+  void set_fsync_policy(FsyncPolicy policy) { policy_ = policy; }
+  FsyncPolicy fsync_policy() const { return policy_; }
+  bool using_io_uring() const { return ring_ready_; }
+
+  // Exposes the writer on the "com.rabee.omran.writer" channel.
+  void RegisterChannel(FlBinaryMessenger* messenger,
+                       const std::string& default_directory);
+
+ private:
+  struct Request {
+    std::string directory;
+    std::string file_name;
+    std::vector<uint8_t> data;
+    Callback done;
+    int64_t queued_at_us = 0;
+    int fd = -1;
+    std::string temp_path;  // Set only when O_TMPFILE is unsupported.
+    Result result;
+
+    // Progress through the ring.
+    size_t queued_bytes = 0;
+    int pending = 0;  // Writes and syncs in flight.
+    bool writes_queued = false;
+    bool synced = false;
+    bool finished = false;
+    bool reported = false;  // |done| ran during the batch.
+  };
+
+  void Run();
+  void ProcessBatch(std::vector<std::unique_ptr<Request>>* batch);
+  void WriteWithSyscalls(Request* request);
+  bool SubmitAndWait(unsigned wait_for,
+                     std::vector<IoUringQueue::Completion>* completions);
+  FlValue* Benchmark(const std::string& directory, int count, size_t size);
+
+  WorkerPool* fallback_pool_;
+  std::atomic<FsyncPolicy> policy_{FsyncPolicy::kGroupCommit};
+
+  IoUringQueue ring_;
+  std::atomic<bool> ring_ready_{false};
+  std::vector<std::vector<uint8_t>> buffers_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::unique_ptr<Request>> queue_;
+  bool stopping_ = false;
+  std::thread thread_;
+
+  FlMethodChannel* channel_ = nullptr;
+  std::string default_directory_;
+};
+
+#endif  // RUNNER_PHOTO_WRITER_H_
@@ -0,0 +1,284 @@
+#include "preview_cache.h"
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "channel_utils.h"
+#include "image_decoder.h"
+
+namespace {
+
+// Mip levels, smallest first. Anything larger than the last bucket is served
+// from the last bucket; the UI never needs more than a window's worth.
+const int kBuckets[] = {128, 256, 512, 1024, 2048};
+const int kBucketCount = sizeof(kBuckets) / sizeof(kBuckets[0]);
+const int kPreviewQuality = 85;
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+bool FileExists(const std::string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
+}
+
+FlValue* ResultToValue(const PreviewCache::Result& result) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "path", fl_value_new_string(result.path.c_str()));
+  fl_value_set_string_take(value, "width", fl_value_new_int(result.width));
+  fl_value_set_string_take(value, "height", fl_value_new_int(result.height));
+  fl_value_set_string_take(value, "bucket", fl_value_new_int(result.bucket));
+  fl_value_set_string_take(value, "cacheHit", fl_value_new_bool(result.cache_hit));
+  fl_value_set_string_take(value, "decodeMicros", fl_value_new_int(result.decode_us));
+  return value;
+}
+
+// Hands a decode fresh buffers and keeps count of the pixel memory it holds
+// at once: the output plus any downscale and rotation buffers alive beside
+// it. libjpeg's working memory and gdk-pixbuf's own pixbufs are not seen.
+class PeakCountingBuffers : public PixelBufferSource {
+ public:
+  std::vector<uint8_t> Acquire(size_t bytes) override {
+    std::vector<uint8_t> buffer;
+    buffer.reserve(bytes);
+    live_ += int64_t(buffer.capacity());
+    peak_ = std::max(peak_, live_);
+    return buffer;
+  }
+
+  void Release(std::vector<uint8_t> buffer) override {
+    live_ -= int64_t(buffer.capacity());
+  }
+
+  int64_t peak() const { return peak_; }
+
+ private:
+  int64_t live_ = 0;
+  int64_t peak_ = 0;
+};
+
+struct DecodeSample {
+  int64_t micros = -1;
+  int64_t peak_bytes = -1;    // Pixel buffers held at once while decoding.
+  int64_t output_bytes = -1;  // The RGBA buffer handed back.
+};
+
+// Decodes |path| on the calling thread. The decoder's size limit and its
+// libjpeg error handler keep a hostile file to an error rather than a
+// crash or a runaway allocation.
+DecodeSample SampleDecode(const std::string& path, int max_dimension) {
+  DecodeSample sample;
+  PeakCountingBuffers buffers;
+  DecodedImage image;
+  std::string error;
+  int64_t start = NowMicros();
+  if (DecodeScaledImage(path, max_dimension, &image, &error, &buffers)) {
+    sample.micros = NowMicros() - start;
+    sample.peak_bytes = buffers.peak();
+    sample.output_bytes = int64_t(image.rgba.capacity());
+  }
+  return sample;
+}
+
+// Decodes |path| at full size and at |max_dimension| and reports the time,
+// peak pixel memory and output size of each, so the scaled pipeline can be
+// compared against what a full decode costs on the same box.
+FlValue* BenchmarkDecode(const std::string& path, int max_dimension) {
+  FlValue* value = fl_value_new_map();
+  const int sizes[] = {0, max_dimension};
+  const char* labels[] = {"full", "scaled"};
+  for (int i = 0; i < 2; i++) {
+    DecodeSample sample = SampleDecode(path, sizes[i]);
+    std::string prefix = labels[i];
+    fl_value_set_string_take(value, (prefix + "DecodeMicros").c_str(),
+                             fl_value_new_int(sample.micros));
+    fl_value_set_string_take(value, (prefix + "PeakPixelBytes").c_str(),
+                             fl_value_new_int(sample.peak_bytes));
+    fl_value_set_string_take(value, (prefix + "OutputBytes").c_str(),
+                             fl_value_new_int(sample.output_bytes));
+  }
+  return value;
+}
+
+}  // namespace
+
+PreviewCache::PreviewCache(std::string root_dir)
+    : root_dir_(std::move(root_dir)) {
+  for (int bucket : kBuckets) {
+    g_mkdir_with_parents(
+        (root_dir_ + "/" + std::to_string(bucket)).c_str(), 0700);
+  }
+}
+
+PreviewCache::~PreviewCache() {
+  g_clear_object(&channel_);
+}
+
+int PreviewCache::BucketFor(int max_dimension) {
+  for (int bucket : kBuckets) {
+    if (bucket >= max_dimension) return bucket;
+  }
+  return kBuckets[kBucketCount - 1];
+}
+
+std::string PreviewCache::EntryPath(int bucket, const std::string& hash) const {
+  return root_dir_ + "/" + std::to_string(bucket) + "/" + hash + ".jpg";
+}
+
+bool PreviewCache::ContentHash(const std::string& path, std::string* hash) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return false;
+  int64_t mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = hashes_.find(path);
+    if (it != hashes_.end() && it->second.size == st.st_size &&
+        it->second.mtime == mtime) {
+      *hash = it->second.hash;
+      return true;
+    }
+  }
+
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) return false;
+  GChecksum* checksum = g_checksum_new(G_CHECKSUM_SHA256);
+  guchar buffer[64 * 1024];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    g_checksum_update(checksum, buffer, read);
+  }
+  fclose(file);
+  *hash = g_checksum_get_string(checksum);
+  g_checksum_free(checksum);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  hashes_[path] = HashEntry{int64_t(st.st_size), mtime, *hash};
+  return true;
+}
+
+void PreviewCache::RememberHash(const std::string& path,
+                                const std::string& hash) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) return;
+  int64_t mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+  std::lock_guard<std::mutex> lock(mutex_);
+  hashes_[path] = HashEntry{int64_t(st.st_size), mtime, hash};
+}
+
+size_t PreviewCache::ReleaseMemory() {
+  std::unordered_map<std::string, HashEntry> hashes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    hashes.swap(hashes_);
+  }
+  size_t bytes = hashes.bucket_count() * sizeof(void*);
+  for (const auto& entry : hashes) {
+    bytes += sizeof(entry) + entry.first.capacity() +
+             entry.second.hash.capacity();
+  }
+  return bytes;
+}
+
+bool PreviewCache::GetPreview(const std::string& source_path, int max_dimension,
+                              Result* result, std::string* error) {
+  std::string hash;
+  if (!ContentHash(source_path, &hash)) {
+    *error = "Cannot read " + source_path;
+    return false;
+  }
+
+  int bucket = BucketFor(max_dimension);
+  result->bucket = bucket;
+  result->path = EntryPath(bucket, hash);
+
+  if (FileExists(result->path)) {
+    // Hits only need the dimensions, which come from the JPEG header alone.
+    result->cache_hit = true;
+    if (gdk_pixbuf_get_file_info(result->path.c_str(), &result->width,
+                                 &result->height) == nullptr) {
+      *error = "Corrupt preview " + result->path;
+      unlink(result->path.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  // Derive from the nearest larger mip level when one is cached, so that
+  // thumbnails never have to touch the full-resolution original again.
+  std::string decode_from = source_path;
+  for (int level : kBuckets) {
+    if (level > bucket && FileExists(EntryPath(level, hash))) {
+      decode_from = EntryPath(level, hash);
+      break;
+    }
+  }
+
+  DecodedImage image;
+  int64_t start = NowMicros();
+  if (!DecodeScaledImage(decode_from, bucket, &image, error)) return false;
+  result->decode_us = NowMicros() - start;
+  result->width = image.width;
+  result->height = image.height;
+
+  // Publish atomically so concurrent readers never see a partial entry.
+  std::string temp_path = result->path + ".tmp." + std::to_string(getpid()) +
+                          "." + std::to_string(NowMicros());
+  if (!EncodeJpeg(image, kPreviewQuality, temp_path, error)) {
+    unlink(temp_path.c_str());
+    return false;
+  }
+  if (rename(temp_path.c_str(), result->path.c_str()) != 0) {
+    unlink(temp_path.c_str());
+    *error = "Cannot publish " + result->path;
+    return false;
+  }
+  return true;
+}
+
+void PreviewCache::RegisterChannel(FlBinaryMessenger* messenger,
+                                   WorkerPool* pool) {
+  pool_ = pool;
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_method_channel_new(messenger, "com.rabee.omran.preview",
+                                   FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        PreviewCache* self = static_cast<PreviewCache*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+        std::string path = ArgString(args, "path");
+        int size = int(ArgInt(args, "size", 512));
+
+        if (strcmp(method, "getPreview") == 0) {
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, path, size]() {
+            Result result;
+            std::string error;
+            if (self->GetPreview(path, size, &result, &error)) {
+              RespondSuccessLater(method_call, ResultToValue(result));
+            } else {
+              RespondErrorLater(method_call, "PREVIEW_FAILED", error);
+            }
+          });
+        } else if (strcmp(method, "benchmarkDecode") == 0) {
+          g_object_ref(method_call);
+          self->pool_->Post([method_call, path, size]() {
+            RespondSuccessLater(method_call, BenchmarkDecode(path, size));
+          });
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
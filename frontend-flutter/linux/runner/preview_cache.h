@@ -0,0 +1,73 @@
+#ifndef RUNNER_PREVIEW_CACHE_H_
+#define RUNNER_PREVIEW_CACHE_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "worker_pool.h"
+
+/**
+ * Size-bucketed on-disk cache of downscaled photo previews.
+ *
+ * Entries live at <root>/<bucket>/<sha256>.jpg, keyed by the content hash of
+ * the source so renamed or re-downloaded files share one entry. Buckets are
+ * power-of-two mip levels; a small request is served from the nearest larger
+ * cached level instead of the full-resolution source when one exists.
+ */
+class PreviewCache {
+ public:
+  struct Result {
+    std::string path;
+    int width = 0;
+    int height = 0;
+    int bucket = 0;
+    bool cache_hit = false;
+    int64_t decode_us = 0;
+  };
+
+  explicit PreviewCache(std::string root_dir);
+  ~PreviewCache();
+
+  // Returns the cached preview of |source_path| for the smallest bucket that
+  // covers |max_dimension|, decoding it on a miss. Blocking; call from a
+  // worker thread.
+  bool GetPreview(const std::string& source_path, int max_dimension,
+                  Result* result, std::string* error);
+
+  // Exposes the preview methods on the "com.rabee.omran.preview" channel.
+  void RegisterChannel(FlBinaryMessenger* messenger, WorkerPool* pool);
+
+  static int BucketFor(int max_dimension);
+
+  // Hex SHA-256 of the file at |path|, memoised by path, size and mtime.
+  bool ContentHash(const std::string& path, std::string* hash);
+
+  // Seeds the memo with a hash computed elsewhere, e.g. from bytes that were
+  // just written to |path|.
+  void RememberHash(const std::string& path, const std::string& hash);
+
+  // Forgets every memoised hash; returns roughly the bytes they held.
+  size_t ReleaseMemory();
+
+ private:
+  struct HashEntry {
+    int64_t size;
+    int64_t mtime;
+    std::string hash;
+  };
+
+  std::string EntryPath(int bucket, const std::string& hash) const;
+
+  std::string root_dir_;
+  std::mutex mutex_;
+  // Memoised content hashes keyed by source path, revalidated by size/mtime.
+  std::unordered_map<std::string, HashEntry> hashes_;
+  FlMethodChannel* channel_ = nullptr;
+  WorkerPool* pool_ = nullptr;
+};
+
+#endif  // RUNNER_PREVIEW_CACHE_H_
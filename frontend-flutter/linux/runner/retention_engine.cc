@@ -0,0 +1,755 @@
+#include "retention_engine.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "channel_utils.h"
+
+namespace {
+
+const int kBatchSize = 64;
+const int64_t kDayMs = 86400000;
+// Passes also run on a timer, for photos ageing out and for space other
+// programs take.
+const std::chrono::seconds kPassInterval(15);
+// Reservations within this long of a check count down from it rather than
+// asking the kernel again.
+const int64_t kVolumeRecheckUs = 1000000;
+const std::chrono::milliseconds kRoomWait(2000);
+const std::chrono::milliseconds kRoomPoll(250);
+const int kBenchmarkLookups = 100000;
+
+const char kStatePrefix[] = "retention/";
+const char kSourcesPrefix[] = "retention/sources/";
+const char kQuotaSuffix[] = "/quotaBytes";
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t WallClockMillis() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+const char* PolicyName(RetentionEngine::Policy policy) {
+  switch (policy) {
+    case RetentionEngine::Policy::kLeastRecentlyUsed:
+      return "leastRecentlyUsed";
+    case RetentionEngine::Policy::kKeepEveryNth:
+      return "keepEveryNth";
+    default:
+      return "oldestFirst";
+  }
+}
+
+bool ParsePolicy(const std::string& name, RetentionEngine::Policy* policy) {
+  for (RetentionEngine::Policy candidate :
+       {RetentionEngine::Policy::kOldestFirst,
+        RetentionEngine::Policy::kLeastRecentlyUsed,
+        RetentionEngine::Policy::kKeepEveryNth}) {
+    if (name == PolicyName(candidate)) {
+      *policy = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+PhotoCatalog::EvictionOrder OrderFor(RetentionEngine::Policy policy) {
+  switch (policy) {
+    case RetentionEngine::Policy::kLeastRecentlyUsed:
+      return PhotoCatalog::EvictionOrder::kLeastRecentlyUsed;
+    case RetentionEngine::Policy::kKeepEveryNth:
+      return PhotoCatalog::EvictionOrder::kThinned;
+    default:
+      return PhotoCatalog::EvictionOrder::kOldest;
+  }
+}
+
+std::string SourceQuotaKey(const std::string& source) {
+  return kSourcesPrefix + source + kQuotaSuffix;
+}
+
+StateStore::Mutation IntMutation(const std::string& key, int64_t value) {
+  StateStore::Mutation mutation;
+  mutation.key = key;
+  mutation.value.type = StateStore::Type::kInt;
+  mutation.value.int_value = value;
+  return mutation;
+}
+
+// Counts what a walk of the directory tree would, for comparison with the
+// running totals.
+void ScanDirectory(const std::string& path, int64_t* files, int64_t* bytes) {
+  DIR* dir = opendir(path.c_str());
+  if (dir == nullptr) return;
+  while (struct dirent* entry = readdir(dir)) {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+      continue;
+    }
+    struct stat st;
+    if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      ScanDirectory(path + "/" + entry->d_name, files, bytes);
+    } else if (S_ISREG(st.st_mode)) {
+      ++*files;
+      *bytes += int64_t(st.st_size);
+    }
+  }
+  closedir(dir);
+}
+
+FlValue* TotalsToFlValue(int64_t bytes, int64_t files) {
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "bytes", fl_value_new_int(bytes));
+  fl_value_set_string_take(value, "files", fl_value_new_int(files));
+  return value;
+}
+
+}  // namespace
+
+RetentionEngine::RetentionEngine(PhotoCatalog* catalog, StateStore* state)
+    : catalog_(catalog), state_(state) {}
+
+RetentionEngine::~RetentionEngine() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_cv_.notify_all();
+  room_cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+  if (channel_ != nullptr) g_object_unref(channel_);
+}
+
+bool RetentionEngine::Start(std::string* error) {
+  if (!LoadConfig(error) || !ReloadTotals(error)) return false;
+  catalog_->AddRecordListener(
+      [this](const std::vector<PhotoCatalog::Entry>& recorded,
+             const std::vector<PhotoCatalog::Entry>& replaced) {
+        OnRecorded(recorded, replaced);
+      });
+  wake_ = true;
+  thread_ = std::thread(&RetentionEngine::Loop, this);
+  return true;
+}
+
+bool RetentionEngine::LoadConfig(std::string* error) {
+  if (state_ == nullptr) return true;
+  Config config;
+  size_t prefix_length = strlen(kStatePrefix);
+  size_t sources_length = strlen(kSourcesPrefix);
+  size_t suffix_length = strlen(kQuotaSuffix);
+  for (const auto& entry : state_->GetAll()) {
+    const std::string& key = entry.first;
+    const StateStore::Value& value = entry.second;
+    if (key.compare(0, prefix_length, kStatePrefix) != 0) continue;
+    std::string name = key.substr(prefix_length);
+    if (value.type == StateStore::Type::kString && name == "policy") {
+      ParsePolicy(value.string_value, &config.policy);
+    }
+    if (value.type != StateStore::Type::kInt) continue;
+    if (name == "quotaBytes") {
+      config.quota_bytes = value.int_value;
+    } else if (name == "maxAgeDays") {
+      config.max_age_days = int(value.int_value);
+    } else if (name == "keepEvery") {
+      config.keep_every = int(value.int_value);
+    } else if (name == "lowSpaceBytes") {
+      config.low_space_bytes = value.int_value;
+    } else if (name == "criticalSpaceBytes") {
+      config.critical_space_bytes = value.int_value;
+    } else if (key.compare(0, sources_length, kSourcesPrefix) == 0 &&
+               key.size() > sources_length + suffix_length &&
+               key.compare(key.size() - suffix_length, suffix_length,
+                           kQuotaSuffix) == 0) {
+      std::string source = key.substr(
+          sources_length, key.size() - sources_length - suffix_length);
+      config.source_quotas[source] = value.int_value;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  config_ = config;
+  return true;
+}
+
+bool RetentionEngine::Configure(const Config& config, std::string* error) {
+  if (state_ != nullptr) {
+    Config previous = this->config();
+    std::vector<StateStore::Mutation> mutations;
+    StateStore::Mutation policy;
+    policy.key = std::string(kStatePrefix) + "policy";
+    policy.value.type = StateStore::Type::kString;
+    policy.value.string_value = PolicyName(config.policy);
+    mutations.push_back(policy);
+    mutations.push_back(IntMutation(std::string(kStatePrefix) + "quotaBytes",
+                                    config.quota_bytes));
+    mutations.push_back(IntMutation(std::string(kStatePrefix) + "maxAgeDays",
+                                    config.max_age_days));
+    mutations.push_back(IntMutation(std::string(kStatePrefix) + "keepEvery",
+                                    config.keep_every));
+    mutations.push_back(IntMutation(
+        std::string(kStatePrefix) + "lowSpaceBytes", config.low_space_bytes));
+    mutations.push_back(
+        IntMutation(std::string(kStatePrefix) + "criticalSpaceBytes",
+                    config.critical_space_bytes));
+    for (const auto& quota : previous.source_quotas) {
+      if (config.source_quotas.count(quota.first) > 0) continue;
+      StateStore::Mutation removed;
+      removed.key = SourceQuotaKey(quota.first);
+      mutations.push_back(removed);
+    }
+    for (const auto& quota : config.source_quotas) {
+      mutations.push_back(
+          IntMutation(SourceQuotaKey(quota.first), quota.second));
+    }
+    if (!state_->Commit(mutations, error)) return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    config_ = config;
+    wake_ = true;
+  }
+  wake_cv_.notify_one();
+  return true;
+}
+
+RetentionEngine::Config RetentionEngine::config() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return config_;
+}
+
+void RetentionEngine::Watch(const std::string& directory) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  volumes_[directory];
+}
+
+void RetentionEngine::AddLocked(const std::string& source, int64_t day,
+                                int64_t bytes, int64_t files) {
+  total_.bytes += bytes;
+  total_.files += files;
+  auto by_source = by_source_.find(source);
+  if (by_source == by_source_.end()) {
+    by_source = by_source_.emplace(source, Totals()).first;
+  }
+  by_source->second.bytes += bytes;
+  by_source->second.files += files;
+  if (by_source->second.files <= 0) by_source_.erase(by_source);
+  Totals& by_day = by_day_[day];
+  by_day.bytes += bytes;
+  by_day.files += files;
+  if (by_day.files <= 0) by_day_.erase(day);
+}
+
+void RetentionEngine::OnRecorded(
+    const std::vector<PhotoCatalog::Entry>& recorded,
+    const std::vector<PhotoCatalog::Entry>& replaced) {
+  bool over = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    recorded_++;
+    // Replaced rows are out of the usage table already; the totals follow.
+    for (const PhotoCatalog::Entry& entry : replaced) {
+      AddLocked(entry.source, entry.saved_at_ms / kDayMs, -entry.file_size,
+                -1);
+    }
+    for (const PhotoCatalog::Entry& entry : recorded) {
+      AddLocked(entry.source, entry.saved_at_ms / kDayMs, entry.file_size, 1);
+      auto quota = config_.source_quotas.find(entry.source);
+      if (quota != config_.source_quotas.end() &&
+          by_source_[entry.source].bytes > quota->second) {
+        over = true;
+      }
+    }
+    if (config_.quota_bytes > 0 && total_.bytes > config_.quota_bytes) {
+      over = true;
+    }
+    if (over) wake_ = true;
+  }
+  if (over) wake_cv_.notify_one();
+}
+
+bool RetentionEngine::ReloadTotals(std::string* error) {
+  int64_t recorded;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    recorded = recorded_;
+  }
+  std::vector<PhotoCatalog::Usage> usage;
+  if (!catalog_->LoadUsage(&usage, error)) return false;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // A batch recorded meanwhile may or may not be in |usage|; keep the
+  // running totals, which have it, until the next pass.
+  if (recorded != recorded_) return true;
+  total_ = Totals();
+  by_source_.clear();
+  by_day_.clear();
+  for (const PhotoCatalog::Usage& row : usage) {
+    AddLocked(row.source, row.day, row.bytes, row.files);
+  }
+  return true;
+}
+
+int64_t RetentionEngine::CheckVolume(const std::string& directory) {
+  struct statvfs st;
+  if (statvfs(directory.c_str(), &st) != 0) return -1;
+  int64_t free_bytes = int64_t(st.f_bavail) * int64_t(st.f_frsize);
+  std::lock_guard<std::mutex> lock(mutex_);
+  Volume& volume = volumes_[directory];
+  volume.fsid = st.f_fsid;
+  volume.free_bytes = free_bytes;
+  volume.reserved = 0;
+  volume.checked_us = NowMicros();
+  return free_bytes;
+}
+
+bool RetentionEngine::Reserve(const std::string& directory, int64_t bytes,
+                              std::string* error) {
+  int64_t available = -1;  // Free once |bytes| are written.
+  int64_t low_space_bytes, critical_space_bytes;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.reservations++;
+    low_space_bytes = config_.low_space_bytes;
+    critical_space_bytes = config_.critical_space_bytes;
+    auto volume = volumes_.find(directory);
+    if (volume != volumes_.end() && volume->second.free_bytes >= 0 &&
+        NowMicros() - volume->second.checked_us < kVolumeRecheckUs) {
+      volume->second.reserved += bytes;
+      available = volume->second.free_bytes - volume->second.reserved;
+    }
+  }
+  if (available < 0) {
+    int64_t free_bytes = CheckVolume(directory);
+    // When the volume cannot be told the write finds out for itself.
+    if (free_bytes < 0) return true;
+    std::lock_guard<std::mutex> lock(mutex_);
+    volumes_[directory].reserved += bytes;
+    available = free_bytes - bytes;
+  }
+  if (available >= std::max(low_space_bytes, critical_space_bytes)) {
+    return true;
+  }
+  bool evicts = low_space_bytes > 0;
+  if (evicts) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      wake_ = true;
+    }
+    wake_cv_.notify_one();
+  }
+  if (available >= critical_space_bytes) return true;
+
+  // Too close to full to write; give the deleter a moment to make room.
+  if (evicts) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.waits++;
+  }
+  auto deadline = std::chrono::steady_clock::now() + kRoomWait;
+  while (evicts && std::chrono::steady_clock::now() < deadline) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (stopping_) break;
+      room_cv_.wait_for(lock, kRoomPoll);
+    }
+    int64_t free_bytes = CheckVolume(directory);
+    if (free_bytes < 0 || free_bytes - bytes >= critical_space_bytes) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      volumes_[directory].reserved += bytes;
+      return true;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  stats_.refusals++;
+  *error = "Not enough free space in " + directory;
+  return false;
+}
+
+void RetentionEngine::Enforce() { Pass(); }
+
+void RetentionEngine::Loop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_) {
+    wake_cv_.wait_for(lock, kPassInterval,
+                      [this]() { return wake_ || stopping_; });
+    if (stopping_) break;
+    wake_ = false;
+    lock.unlock();
+    Pass();
+    lock.lock();
+  }
+}
+
+void RetentionEngine::Pass() {
+  std::lock_guard<std::mutex> pass_lock(pass_mutex_);
+  int64_t start = NowMicros();
+  Config config = this->config();
+
+  PhotoCatalog::EvictionQuery query;
+  query.order = OrderFor(config.policy);
+  query.keep_every = config.keep_every;
+  query.limit = kBatchSize;
+
+  if (config.max_age_days > 0) {
+    PhotoCatalog::EvictionQuery aged;
+    aged.limit = kBatchSize;
+    aged.saved_before_ms =
+        WallClockMillis() - int64_t(config.max_age_days) * kDayMs;
+    EvictWhile(aged, []() { return INT64_MAX; });
+  }
+
+  for (const auto& quota : config.source_quotas) {
+    PhotoCatalog::EvictionQuery by_source = query;
+    by_source.all_sources = false;
+    by_source.source = quota.first;
+    EvictWhile(by_source, [this, &quota]() -> int64_t {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto totals = by_source_.find(quota.first);
+      return totals == by_source_.end() ? 0
+                                        : totals->second.bytes - quota.second;
+    });
+  }
+
+  if (config.quota_bytes > 0) {
+    EvictWhile(query, [this, &config]() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return total_.bytes - config.quota_bytes;
+    });
+  }
+
+  // Directories on one filesystem share its free space; check each once.
+  std::vector<std::string> directories;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<uint64_t> seen;
+    for (const auto& volume : volumes_) {
+      uint64_t fsid = volume.second.fsid;
+      if (fsid != 0 &&
+          std::find(seen.begin(), seen.end(), fsid) != seen.end()) {
+        continue;
+      }
+      seen.push_back(fsid);
+      directories.push_back(volume.first);
+    }
+  }
+  for (const std::string& directory : directories) {
+    if (config.low_space_bytes <= 0) break;
+    EvictWhile(query, [this, &directory, &config]() -> int64_t {
+      int64_t free_bytes = CheckVolume(directory);
+      return free_bytes < 0 ? 0 : config.low_space_bytes - free_bytes;
+    });
+  }
+
+  std::string error;
+  if (!ReloadTotals(&error)) {
+    g_warning("RetentionEngine: usage: %s", error.c_str());
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.passes++;
+    stats_.last_pass_us = NowMicros() - start;
+  }
+  room_cv_.notify_all();
+}
+
+void RetentionEngine::EvictWhile(PhotoCatalog::EvictionQuery query,
+                                 const std::function<int64_t()>& over) {
+  int64_t need;
+  while ((need = over()) > 0) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (stopping_) return;
+    }
+    if (EvictBatch(query, need) > 0) {
+      room_cv_.notify_all();
+      continue;
+    }
+    if (query.order != PhotoCatalog::EvictionOrder::kThinned) return;
+    // Only every Nth photo is left; those go oldest first.
+    query.order = PhotoCatalog::EvictionOrder::kOldest;
+  }
+}
+
+int64_t RetentionEngine::EvictBatch(const PhotoCatalog::EvictionQuery& query,
+                                    int64_t need) {
+  std::vector<PhotoCatalog::Entry> candidates;
+  std::string error;
+  if (!catalog_->FindEvictable(query, &candidates, &error)) {
+    g_warning("RetentionEngine: %s", error.c_str());
+    return 0;
+  }
+
+  std::vector<PhotoCatalog::Entry> rows;
+  std::vector<const PhotoCatalog::Entry*> removed;
+  int64_t freed = 0;
+  int64_t failures = 0;
+  for (const PhotoCatalog::Entry& entry : candidates) {
+    if (freed >= need) break;
+    // A file that is already gone still leaves its row to drop.
+    if (unlink(entry.local_path.c_str()) != 0 && errno != ENOENT) {
+      g_warning("RetentionEngine: cannot remove %s: %s",
+                entry.local_path.c_str(), strerror(errno));
+      failures++;
+      continue;
+    }
+    rows.push_back(entry);
+    removed.push_back(&entry);
+    freed += entry.file_size;
+  }
+  if (!rows.empty() && !catalog_->Remove(rows, &error)) {
+    g_warning("RetentionEngine: %s", error.c_str());
+    removed.clear();
+    freed = 0;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const PhotoCatalog::Entry* entry : removed) {
+    AddLocked(entry->source, entry->saved_at_ms / kDayMs, -entry->file_size,
+              -1);
+  }
+  stats_.batches++;
+  stats_.evicted_files += int64_t(removed.size());
+  stats_.evicted_bytes += freed;
+  stats_.unlink_failures += failures;
+  return freed;
+}
+
+FlValue* RetentionEngine::Usage() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  FlValue* value = fl_value_new_map();
+  fl_value_set_string_take(value, "totalBytes", fl_value_new_int(total_.bytes));
+  fl_value_set_string_take(value, "totalFiles", fl_value_new_int(total_.files));
+
+  FlValue* sources = fl_value_new_map();
+  for (const auto& entry : by_source_) {
+    fl_value_set_string_take(
+        sources, entry.first.c_str(),
+        TotalsToFlValue(entry.second.bytes, entry.second.files));
+  }
+  fl_value_set_string_take(value, "sources", sources);
+
+  // Days go column by column, like catalog pages.
+  std::vector<int64_t> days, day_bytes, day_files;
+  for (const auto& entry : by_day_) {
+    days.push_back(entry.first);
+    day_bytes.push_back(entry.second.bytes);
+    day_files.push_back(entry.second.files);
+  }
+  fl_value_set_string_take(value, "days",
+                           fl_value_new_int64_list(days.data(), days.size()));
+  fl_value_set_string_take(
+      value, "dayBytes",
+      fl_value_new_int64_list(day_bytes.data(), day_bytes.size()));
+  fl_value_set_string_take(
+      value, "dayFiles",
+      fl_value_new_int64_list(day_files.data(), day_files.size()));
+
+  FlValue* volumes = fl_value_new_map();
+  for (const auto& entry : volumes_) {
+    fl_value_set_string_take(volumes, entry.first.c_str(),
+                             fl_value_new_int(entry.second.free_bytes));
+  }
+  fl_value_set_string_take(value, "freeBytes", volumes);
+
+  FlValue* config = fl_value_new_map();
+  fl_value_set_string_take(config, "policy",
+                           fl_value_new_string(PolicyName(config_.policy)));
+  fl_value_set_string_take(config, "quotaBytes",
+                           fl_value_new_int(config_.quota_bytes));
+  FlValue* source_quotas = fl_value_new_map();
+  for (const auto& quota : config_.source_quotas) {
+    fl_value_set_string_take(source_quotas, quota.first.c_str(),
+                             fl_value_new_int(quota.second));
+  }
+  fl_value_set_string_take(config, "sourceQuotas", source_quotas);
+  fl_value_set_string_take(config, "maxAgeDays",
+                           fl_value_new_int(config_.max_age_days));
+  fl_value_set_string_take(config, "keepEvery",
+                           fl_value_new_int(config_.keep_every));
+  fl_value_set_string_take(config, "lowSpaceBytes",
+                           fl_value_new_int(config_.low_space_bytes));
+  fl_value_set_string_take(config, "criticalSpaceBytes",
+                           fl_value_new_int(config_.critical_space_bytes));
+  fl_value_set_string_take(value, "config", config);
+
+  FlValue* stats = fl_value_new_map();
+  fl_value_set_string_take(stats, "passes", fl_value_new_int(stats_.passes));
+  fl_value_set_string_take(stats, "batches", fl_value_new_int(stats_.batches));
+  fl_value_set_string_take(stats, "evictedFiles",
+                           fl_value_new_int(stats_.evicted_files));
+  fl_value_set_string_take(stats, "evictedBytes",
+                           fl_value_new_int(stats_.evicted_bytes));
+  fl_value_set_string_take(stats, "unlinkFailures",
+                           fl_value_new_int(stats_.unlink_failures));
+  fl_value_set_string_take(stats, "reservations",
+                           fl_value_new_int(stats_.reservations));
+  fl_value_set_string_take(stats, "waits", fl_value_new_int(stats_.waits));
+  fl_value_set_string_take(stats, "refusals",
+                           fl_value_new_int(stats_.refusals));
+  fl_value_set_string_take(stats, "lastPassMicros",
+                           fl_value_new_int(stats_.last_pass_us));
+  fl_value_set_string_take(value, "stats", stats);
+  return value;
+}
+
+FlValue* RetentionEngine::Benchmark(const std::string& directory) {
+  int64_t scan_files = 0, scan_bytes = 0;
+  int64_t start = NowMicros();
+  ScanDirectory(directory, &scan_files, &scan_bytes);
+  int64_t scan_us = NowMicros() - start;
+
+  // What checking a quota costs now: the overall total and one source's.
+  int64_t checksum = 0;
+  start = NowMicros();
+  for (int i = 0; i < kBenchmarkLookups; i++) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    checksum += total_.bytes;
+    auto source = by_source_.find("");
+    if (source != by_source_.end()) checksum += source->second.bytes;
+  }
+  int64_t lookup_us = NowMicros() - start;
+
+  int64_t total_bytes, total_files;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    total_bytes = total_.bytes;
+    total_files = total_.files;
+  }
+  FlValue* result = fl_value_new_map();
+  fl_value_set_string_take(result, "directory",
+                           fl_value_new_string(directory.c_str()));
+  fl_value_set_string_take(result, "scanFiles", fl_value_new_int(scan_files));
+  fl_value_set_string_take(result, "scanBytes", fl_value_new_int(scan_bytes));
+  fl_value_set_string_take(result, "scanMicros", fl_value_new_int(scan_us));
+  fl_value_set_string_take(result, "trackedFiles",
+                           fl_value_new_int(total_files));
+  fl_value_set_string_take(result, "trackedBytes",
+                           fl_value_new_int(total_bytes));
+  fl_value_set_string_take(
+      result, "lookupNanos",
+      fl_value_new_float(lookup_us * 1000.0 / kBenchmarkLookups));
+  fl_value_set_string_take(result, "checksum", fl_value_new_int(checksum));
+  return result;
+}
+
+void RetentionEngine::RegisterChannel(FlBinaryMessenger* messenger,
+                                      WorkerPool* pool) {
+  pool_ = pool;
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_method_channel_new(messenger, "com.rabee.omran.retention",
+                                   FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        RetentionEngine* self = static_cast<RetentionEngine*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+
+        if (strcmp(method, "usage") == 0) {
+          g_autoptr(FlValue) usage = self->Usage();
+          fl_method_call_respond_success(method_call, usage, nullptr);
+        } else if (strcmp(method, "configure") == 0) {
+          // Anything left out keeps its current value.
+          Config config = self->config();
+          std::string policy =
+              ArgString(args, "policy", PolicyName(config.policy));
+          if (!ParsePolicy(policy, &config.policy)) {
+            fl_method_call_respond_error(
+                method_call, "BAD_ARGS",
+                "policy must be oldestFirst, leastRecentlyUsed or "
+                "keepEveryNth",
+                nullptr, nullptr);
+            return;
+          }
+          config.quota_bytes = ArgInt(args, "quotaBytes", config.quota_bytes);
+          config.max_age_days =
+              int(ArgInt(args, "maxAgeDays", config.max_age_days));
+          config.keep_every =
+              int(ArgInt(args, "keepEvery", config.keep_every));
+          config.low_space_bytes =
+              ArgInt(args, "lowSpaceBytes", config.low_space_bytes);
+          config.critical_space_bytes =
+              ArgInt(args, "criticalSpaceBytes", config.critical_space_bytes);
+          FlValue* quotas =
+              args != nullptr && fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                  ? fl_value_lookup_string(args, "sourceQuotas")
+                  : nullptr;
+          if (quotas != nullptr &&
+              fl_value_get_type(quotas) == FL_VALUE_TYPE_MAP) {
+            config.source_quotas.clear();
+            for (size_t i = 0; i < fl_value_get_length(quotas); i++) {
+              FlValue* key = fl_value_get_map_key(quotas, i);
+              FlValue* quota = fl_value_get_map_value(quotas, i);
+              if (fl_value_get_type(key) != FL_VALUE_TYPE_STRING ||
+                  fl_value_get_type(quota) != FL_VALUE_TYPE_INT) {
+                fl_method_call_respond_error(
+                    method_call, "BAD_ARGS",
+                    "sourceQuotas maps source ids to bytes", nullptr,
+                    nullptr);
+                return;
+              }
+              config.source_quotas[fl_value_get_string(key)] =
+                  fl_value_get_int(quota);
+            }
+          }
+          if (config.keep_every < 2) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         "keepEvery must be at least 2",
+                                         nullptr, nullptr);
+            return;
+          }
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, config]() {
+            std::string error;
+            if (self->Configure(config, &error)) {
+              RespondSuccessLater(method_call, self->Usage());
+            } else {
+              RespondErrorLater(method_call, "CONFIGURE_FAILED", error);
+            }
+          });
+        } else if (strcmp(method, "enforce") == 0) {
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call]() {
+            self->Enforce();
+            RespondSuccessLater(method_call, self->Usage());
+          });
+        } else if (strcmp(method, "benchmark") == 0) {
+          std::string directory = ArgString(args, "directory");
+          if (directory.empty()) {
+            std::lock_guard<std::mutex> lock(self->mutex_);
+            if (!self->volumes_.empty()) {
+              directory = self->volumes_.begin()->first;
+            }
+          }
+          if (directory.empty()) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         "directory is required", nullptr,
+                                         nullptr);
+            return;
+          }
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, directory]() {
+            RespondSuccessLater(method_call, self->Benchmark(directory));
+          });
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
@@ -0,0 +1,156 @@
+#ifndef RUNNER_RETENTION_ENGINE_H_
+#define RUNNER_RETENTION_ENGINE_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "photo_catalog.h"
+#include "state_store.h"
+#include "worker_pool.h"
+
+/**
+ * Keeps saved photos within a disk quota and clear of a full disk.
+ *
+ * Space used is kept as running totals per source and per UTC day, loaded
+ * once from the catalog's usage table and bumped as each photo is recorded,
+ * so checking a quota costs the same however many photos there are. A
+ * deleter thread evicts in batches when a total is over its quota, photos
+ * pass the maximum age, or a watched volume runs low on space. Writes ask
+ * Reserve() first, so space is made before a write would fail for lack of
+ * it rather than after.
+ */
+class RetentionEngine {
+ public:
+  enum class Policy {
+    kOldestFirst,
+    kLeastRecentlyUsed,
+    // Thins each source to every |keep_every|-th photo before removing
+    // whole stretches of it.
+    kKeepEveryNth,
+  };
+
+  struct Config {
+    Policy policy = Policy::kOldestFirst;
+    int64_t quota_bytes = 0;                       // Overall; 0 for none.
+    std::map<std::string, int64_t> source_quotas;  // By source id.
+    int max_age_days = 0;                          // 0 keeps any age.
+    int keep_every = 10;
+    // Free space on a watched volume below which photos are evicted; 0,
+    // the default, leaves them be however full it gets.
+    int64_t low_space_bytes = 0;
+    // Free space below which writes wait for the deleter, or fail when it
+    // is not evicting for space.
+    int64_t critical_space_bytes = 256LL << 20;
+  };
+
+  struct Stats {
+    int64_t passes = 0;
+    int64_t batches = 0;
+    int64_t evicted_files = 0;
+    int64_t evicted_bytes = 0;
+    int64_t unlink_failures = 0;
+    int64_t reservations = 0;
+    int64_t waits = 0;     // Reservations that had to wait for room.
+    int64_t refusals = 0;  // Of those, ones that never got it.
+    int64_t last_pass_us = 0;
+  };
+
+  RetentionEngine(PhotoCatalog* catalog, StateStore* state);
+  ~RetentionEngine();
+
+  RetentionEngine(const RetentionEngine&) = delete;
+  RetentionEngine& operator=(const RetentionEngine&) = delete;
+
+  // Loads the stored config and the usage totals, listens for recorded
+  // photos and starts the deleter.
+  bool Start(std::string* error);
+
+  // Evicts when |directory|'s volume runs low. Reserve() watches the
+  // directories it is asked about as well.
+  void Watch(const std::string& directory);
+
+  // Applies and stores |config|, then wakes the deleter.
+  bool Configure(const Config& config, std::string* error);
+  Config config();
+
+  // Called before writing |bytes| into |directory|. Below the low mark this
+  // wakes the deleter; below the critical mark it waits briefly for room
+  // and fails if none is made, so the disk is never filled to the last
+  // block.
+  bool Reserve(const std::string& directory, int64_t bytes,
+               std::string* error);
+
+  // Runs a pass on the calling thread.
+  void Enforce();
+
+  // Exposes the engine on the "com.rabee.omran.retention" channel.
+  void RegisterChannel(FlBinaryMessenger* messenger, WorkerPool* pool);
+
+ private:
+  struct Totals {
+    int64_t bytes = 0;
+    int64_t files = 0;
+  };
+
+  struct Volume {
+    uint64_t fsid = 0;
+    int64_t free_bytes = -1;  // -1 until checked.
+    int64_t reserved = 0;     // Handed out since it was checked.
+    int64_t checked_us = 0;
+  };
+
+  void OnRecorded(const std::vector<PhotoCatalog::Entry>& recorded,
+                  const std::vector<PhotoCatalog::Entry>& replaced);
+  void AddLocked(const std::string& source, int64_t day, int64_t bytes,
+                 int64_t files);
+  bool ReloadTotals(std::string* error);
+  bool LoadConfig(std::string* error);
+
+  // Refreshes |directory|'s free space; -1 when it cannot be told.
+  int64_t CheckVolume(const std::string& directory);
+
+  void Loop();
+  void Pass();
+  // Evicts in batches from what |query| offers until |over| reports
+  // nothing more to free or a batch frees nothing.
+  void EvictWhile(PhotoCatalog::EvictionQuery query,
+                  const std::function<int64_t()>& over);
+  // Deletes up to one batch covering |need| bytes; returns bytes freed.
+  int64_t EvictBatch(const PhotoCatalog::EvictionQuery& query, int64_t need);
+
+  FlValue* Usage();
+  FlValue* Benchmark(const std::string& directory);
+
+  PhotoCatalog* catalog_;
+  StateStore* state_;
+
+  std::mutex mutex_;
+  std::condition_variable wake_cv_;
+  std::condition_variable room_cv_;
+  bool wake_ = false;
+  bool stopping_ = false;
+  Config config_;
+  Stats stats_;
+  Totals total_;
+  std::unordered_map<std::string, Totals> by_source_;
+  std::map<int64_t, Totals> by_day_;
+  int64_t recorded_ = 0;  // Bumped with every recorded batch.
+  std::map<std::string, Volume> volumes_;
+
+  std::mutex pass_mutex_;  // One pass at a time.
+  std::thread thread_;
+
+  FlMethodChannel* channel_ = nullptr;
+  WorkerPool* pool_ = nullptr;
+};
+
+#endif  // RUNNER_RETENTION_ENGINE_H_
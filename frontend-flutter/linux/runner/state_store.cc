@@ -0,0 +1,741 @@
+#include "state_store.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+#include "channel_utils.h"
+#include "crc32c.h"
+
+namespace {
+
+// Log layout: an 8 byte file header followed by batch records. Each record is
+// a 16 byte header (magic, payload length, entry count, CRC-32C of the
+// payload) and its entries: type u8, reserved u8, key length u16, value
+// length u32, key bytes, value bytes. Integers are little-endian.
+const char kFileMagic[8] = {'A', 'P', 'S', 'T', 'A', 'T', 'E', '1'};
+const uint32_t kRecordMagic = 0x42535041;  // "APSB"
+const size_t kRecordHeaderSize = 16;
+const size_t kEntryHeaderSize = 8;
+const size_t kMinMapCapacity = 64 * 1024;
+
+// Rewrite the log once it is this big and mostly dead history.
+const uint64_t kCompactMinBytes = 256 * 1024;
+const uint64_t kCompactRatio = 4;
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void PutU16(std::string* out, uint16_t v) {
+  out->push_back(char(v & 0xFF));
+  out->push_back(char(v >> 8));
+}
+
+void PutU32(std::string* out, uint32_t v) {
+  for (int i = 0; i < 4; i++) out->push_back(char((v >> (8 * i)) & 0xFF));
+}
+
+void PutU64(std::string* out, uint64_t v) {
+  for (int i = 0; i < 8; i++) out->push_back(char((v >> (8 * i)) & 0xFF));
+}
+
+uint16_t GetU16(const uint8_t* p) { return uint16_t(p[0] | (p[1] << 8)); }
+
+uint32_t GetU32(const uint8_t* p) {
+  return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) |
+         (uint32_t(p[3]) << 24);
+}
+
+uint64_t GetU64(const uint8_t* p) {
+  return uint64_t(GetU32(p)) | (uint64_t(GetU32(p + 4)) << 32);
+}
+
+std::string EncodeValue(const StateStore::Value& value) {
+  std::string out;
+  switch (value.type) {
+    case StateStore::Type::kString:
+      out = value.string_value;
+      break;
+    case StateStore::Type::kInt:
+      PutU64(&out, uint64_t(value.int_value));
+      break;
+    case StateStore::Type::kDouble: {
+      uint64_t bits;
+      memcpy(&bits, &value.double_value, sizeof(bits));
+      PutU64(&out, bits);
+      break;
+    }
+    case StateStore::Type::kBool:
+      out.push_back(value.bool_value ? 1 : 0);
+      break;
+    case StateStore::Type::kDelete:
+      break;
+  }
+  return out;
+}
+
+// Builds one batch record. Returns false if a key or value is too large for
+// the entry header.
+bool EncodeRecord(const std::vector<StateStore::Mutation>& mutations,
+                  std::string* record) {
+  std::string payload;
+  for (const auto& mutation : mutations) {
+    std::string value = EncodeValue(mutation.value);
+    if (mutation.key.size() > 0xFFFF || value.size() > 0xFFFFFFFFu) {
+      return false;
+    }
+    payload.push_back(char(mutation.value.type));
+    payload.push_back(0);
+    PutU16(&payload, uint16_t(mutation.key.size()));
+    PutU32(&payload, uint32_t(value.size()));
+    payload += mutation.key;
+    payload += value;
+  }
+  record->clear();
+  PutU32(record, kRecordMagic);
+  PutU32(record, uint32_t(payload.size()));
+  PutU32(record, uint32_t(mutations.size()));
+  PutU32(record, Crc32c(0, payload.data(), payload.size()));
+  *record += payload;
+  return true;
+}
+
+bool WriteFully(int fd, const char* data, size_t length, uint64_t offset) {
+  while (length > 0) {
+    ssize_t written = pwrite(fd, data, length, off_t(offset));
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      return false;
+    }
+    data += written;
+    length -= size_t(written);
+    offset += uint64_t(written);
+  }
+  return true;
+}
+
+std::string ErrnoMessage(const char* what) {
+  return std::string(what) + ": " + strerror(errno);
+}
+
+bool ParseFlValue(FlValue* value, StateStore::Value* out) {
+  switch (fl_value_get_type(value)) {
+    case FL_VALUE_TYPE_NULL:
+      out->type = StateStore::Type::kDelete;
+      return true;
+    case FL_VALUE_TYPE_STRING:
+      out->type = StateStore::Type::kString;
+      out->string_value = fl_value_get_string(value);
+      return true;
+    case FL_VALUE_TYPE_INT:
+      out->type = StateStore::Type::kInt;
+      out->int_value = fl_value_get_int(value);
+      return true;
+    case FL_VALUE_TYPE_FLOAT:
+      out->type = StateStore::Type::kDouble;
+      out->double_value = fl_value_get_float(value);
+      return true;
+    case FL_VALUE_TYPE_BOOL:
+      out->type = StateStore::Type::kBool;
+      out->bool_value = fl_value_get_bool(value);
+      return true;
+    default:
+      return false;
+  }
+}
+
+FlValue* ToFlValue(const StateStore::Value& value) {
+  switch (value.type) {
+    case StateStore::Type::kString:
+      return fl_value_new_string(value.string_value.c_str());
+    case StateStore::Type::kInt:
+      return fl_value_new_int(value.int_value);
+    case StateStore::Type::kDouble:
+      return fl_value_new_float(value.double_value);
+    case StateStore::Type::kBool:
+      return fl_value_new_bool(value.bool_value);
+    case StateStore::Type::kDelete:
+      break;
+  }
+  return fl_value_new_null();
+}
+
+int64_t Percentile(std::vector<int64_t> samples, double p) {
+  if (samples.empty()) return 0;
+  std::sort(samples.begin(), samples.end());
+  size_t index = size_t(p * double(samples.size() - 1));
+  return samples[index];
+}
+
+}  // namespace
+
+StateStore::StateStore(const std::string& path) : path_(path) {}
+
+StateStore::~StateStore() {
+  if (map_ != nullptr) munmap(map_, map_capacity_);
+  if (fd_ >= 0) close(fd_);
+  if (channel_ != nullptr) g_object_unref(channel_);
+}
+
+bool StateStore::Open(std::string* error) {
+  std::lock_guard<std::mutex> io_lock(io_mutex_);
+  std::lock_guard<std::mutex> lock(mutex_);
+  fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+  if (fd_ < 0) {
+    *error = ErrnoMessage("open");
+    return false;
+  }
+  return Replay(error);
+}
+
+bool StateStore::Remap(uint64_t size, std::string* error) {
+  size_t page = size_t(sysconf(_SC_PAGESIZE));
+  size_t capacity = std::max(kMinMapCapacity, size_t(size) * 2);
+  capacity = (capacity + page - 1) / page * page;
+  if (map_ != nullptr) munmap(map_, map_capacity_);
+  // Mapping past EOF is fine as long as we never read there, which lets the
+  // log grow for a while without remapping after every commit.
+  map_ = mmap(nullptr, capacity, PROT_READ, MAP_SHARED, fd_, 0);
+  if (map_ == MAP_FAILED) {
+    map_ = nullptr;
+    map_capacity_ = 0;
+    *error = ErrnoMessage("mmap");
+    return false;
+  }
+  map_capacity_ = capacity;
+  return true;
+}
+
+bool StateStore::Replay(std::string* error) {
+  index_.clear();
+  live_bytes_ = 0;
+
+  struct stat st;
+  if (fstat(fd_, &st) != 0) {
+    *error = ErrnoMessage("fstat");
+    return false;
+  }
+  uint64_t size = uint64_t(st.st_size);
+  if (size < sizeof(kFileMagic)) {
+    if (ftruncate(fd_, 0) != 0 ||
+        !WriteFully(fd_, kFileMagic, sizeof(kFileMagic), 0) ||
+        fdatasync(fd_) != 0) {
+      *error = ErrnoMessage("init");
+      return false;
+    }
+    size = sizeof(kFileMagic);
+  }
+  if (!Remap(size, error)) return false;
+
+  const uint8_t* base = static_cast<const uint8_t*>(map_);
+  if (memcmp(base, kFileMagic, sizeof(kFileMagic)) != 0) {
+    *error = "Not a state log: " + path_;
+    return false;
+  }
+
+  uint64_t offset = sizeof(kFileMagic);
+  while (offset + kRecordHeaderSize <= size) {
+    const uint8_t* header = base + offset;
+    uint32_t payload_size = GetU32(header + 4);
+    uint32_t count = GetU32(header + 8);
+    if (GetU32(header) != kRecordMagic ||
+        offset + kRecordHeaderSize + payload_size > size) {
+      break;
+    }
+    const uint8_t* payload = header + kRecordHeaderSize;
+    if (Crc32c(0, payload, payload_size) != GetU32(header + 12)) break;
+
+    // Validate the entries before touching the index so a record is applied
+    // whole or not at all.
+    std::vector<std::pair<std::string, Slot>> entries;
+    uint64_t pos = 0;
+    bool valid = true;
+    for (uint32_t i = 0; i < count && valid; i++) {
+      if (pos + kEntryHeaderSize > payload_size) {
+        valid = false;
+        break;
+      }
+      const uint8_t* entry = payload + pos;
+      uint16_t key_size = GetU16(entry + 2);
+      uint32_t value_size = GetU32(entry + 4);
+      uint64_t entry_size = kEntryHeaderSize + key_size + uint64_t(value_size);
+      if (entry[0] > uint8_t(Type::kBool) || pos + entry_size > payload_size) {
+        valid = false;
+        break;
+      }
+      Slot slot;
+      slot.type = Type(entry[0]);
+      slot.offset = offset + kRecordHeaderSize + pos + kEntryHeaderSize +
+                    key_size;
+      slot.length = value_size;
+      slot.record_bytes = uint32_t(entry_size);
+      entries.emplace_back(
+          std::string(reinterpret_cast<const char*>(entry + kEntryHeaderSize),
+                      key_size),
+          slot);
+      pos += entry_size;
+    }
+    if (!valid) break;
+
+    for (auto& entry : entries) {
+      auto it = index_.find(entry.first);
+      if (it != index_.end()) {
+        live_bytes_ -= it->second.record_bytes;
+        index_.erase(it);
+      }
+      if (entry.second.type != Type::kDelete) {
+        live_bytes_ += entry.second.record_bytes;
+        index_.emplace(std::move(entry.first), entry.second);
+      }
+    }
+    offset += kRecordHeaderSize + payload_size;
+  }
+
+  if (offset < size) {
+    // A torn or corrupt tail from an interrupted commit. Everything before
+    // it is intact, so cut it off and carry on.
+    g_warning("StateStore: dropping %llu bytes of torn log tail",
+              static_cast<unsigned long long>(size - offset));
+    if (ftruncate(fd_, off_t(offset)) != 0 || fdatasync(fd_) != 0) {
+      *error = ErrnoMessage("truncate");
+      return false;
+    }
+  }
+  end_offset_ = offset;
+  stats_.log_bytes = int64_t(end_offset_);
+  stats_.live_bytes = int64_t(live_bytes_);
+  return true;
+}
+
+bool StateStore::Get(const std::string& key, Value* value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end()) return false;
+  *value = ReadSlotLocked(it->second);
+  return true;
+}
+
+std::map<std::string, StateStore::Value> StateStore::GetAll() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::map<std::string, Value> values;
+  for (const auto& entry : index_) {
+    values.emplace(entry.first, ReadSlotLocked(entry.second));
+  }
+  return values;
+}
+
+StateStore::Value StateStore::ReadSlotLocked(const Slot& slot) const {
+  const uint8_t* data = static_cast<const uint8_t*>(map_) + slot.offset;
+  Value value;
+  value.type = slot.type;
+  switch (slot.type) {
+    case Type::kString:
+      value.string_value.assign(reinterpret_cast<const char*>(data),
+                                slot.length);
+      break;
+    case Type::kInt:
+      if (slot.length == 8) value.int_value = int64_t(GetU64(data));
+      break;
+    case Type::kDouble:
+      if (slot.length == 8) {
+        uint64_t bits = GetU64(data);
+        memcpy(&value.double_value, &bits, sizeof(bits));
+      }
+      break;
+    case Type::kBool:
+      value.bool_value = slot.length > 0 && data[0] != 0;
+      break;
+    case Type::kDelete:
+      break;
+  }
+  return value;
+}
+
+bool StateStore::Commit(const std::vector<Mutation>& mutations,
+                        std::string* error) {
+  if (mutations.empty()) return true;
+  std::string record;
+  if (!EncodeRecord(mutations, &record)) {
+    *error = "Key or value too large";
+    return false;
+  }
+
+  // Only the write and its sync run under |io_mutex_|. Readers take
+  // |mutex_| alone, which is held just long enough to publish the record,
+  // so Get() on the main thread never waits for the disk.
+  std::lock_guard<std::mutex> io_lock(io_mutex_);
+  int64_t start = NowMicros();
+  uint64_t record_offset;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0) {
+      *error = "State store is not open";
+      return false;
+    }
+    record_offset = end_offset_;
+  }
+  if (!Append(record, record_offset, error)) return false;
+
+  bool compact;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    PublishLocked(record.size());
+    ApplyLocked(mutations, record_offset);
+    stats_.commits++;
+    stats_.last_commit_us = NowMicros() - start;
+    compact = end_offset_ >= kCompactMinBytes &&
+              end_offset_ > kCompactRatio * (live_bytes_ + sizeof(kFileMagic));
+  }
+  if (compact) {
+    std::string compact_error;
+    if (!Compact(&compact_error)) {
+      g_warning("StateStore: compaction failed: %s", compact_error.c_str());
+    }
+  }
+  return true;
+}
+
+bool StateStore::Append(const std::string& record, uint64_t offset,
+                        std::string* error) {
+  // Past |end_offset_|, so readers of the mapping never see these bytes
+  // until PublishLocked() moves the end over them.
+  if (!WriteFully(fd_, record.data(), record.size(), offset) ||
+      fdatasync(fd_) != 0) {
+    *error = ErrnoMessage("append");
+    // Leave no partial record behind; replay would drop it anyway.
+    if (ftruncate(fd_, off_t(offset)) != 0) {
+      g_warning("StateStore: could not roll back failed append");
+    }
+    return false;
+  }
+  return true;
+}
+
+void StateStore::PublishLocked(size_t record_size) {
+  end_offset_ += record_size;
+  stats_.syncs++;
+  stats_.bytes_appended += int64_t(record_size);
+  stats_.log_bytes = int64_t(end_offset_);
+
+  if (end_offset_ > map_capacity_) {
+    std::string remap_error;
+    if (!Remap(end_offset_, &remap_error)) {
+      // The data is durable; only reads are affected until the next remap.
+      g_warning("StateStore: %s", remap_error.c_str());
+    }
+  }
+}
+
+void StateStore::ApplyLocked(const std::vector<Mutation>& mutations,
+                             uint64_t record_offset) {
+  // Walk the record we just wrote to recover each value's offset, using the
+  // same layout EncodeRecord produced.
+  uint64_t pos = record_offset + kRecordHeaderSize;
+  for (const auto& mutation : mutations) {
+    uint32_t value_size = uint32_t(EncodeValue(mutation.value).size());
+    uint32_t entry_size =
+        uint32_t(kEntryHeaderSize + mutation.key.size() + value_size);
+    auto it = index_.find(mutation.key);
+    if (it != index_.end()) {
+      live_bytes_ -= it->second.record_bytes;
+      index_.erase(it);
+    }
+    if (mutation.value.type != Type::kDelete) {
+      Slot slot;
+      slot.type = mutation.value.type;
+      slot.offset = pos + kEntryHeaderSize + mutation.key.size();
+      slot.length = value_size;
+      slot.record_bytes = entry_size;
+      index_.emplace(mutation.key, slot);
+      live_bytes_ += entry_size;
+    }
+    pos += entry_size;
+  }
+  stats_.live_bytes = int64_t(live_bytes_);
+}
+
+bool StateStore::Compact(std::string* error) {
+  // Holding |io_mutex_| keeps the snapshot current: no commit can land
+  // between it and the swap to the new log.
+  std::vector<Mutation> live;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    live.reserve(index_.size());
+    for (const auto& entry : index_) {
+      live.push_back(Mutation{entry.first, ReadSlotLocked(entry.second)});
+    }
+  }
+  std::string record;
+  if (!EncodeRecord(live, &record)) {
+    *error = "Encode failed";
+    return false;
+  }
+
+  std::string temp_path = path_ + ".compact";
+  int fd = open(temp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                0600);
+  if (fd < 0) {
+    *error = ErrnoMessage("open");
+    return false;
+  }
+  bool ok = WriteFully(fd, kFileMagic, sizeof(kFileMagic), 0) &&
+            (live.empty() ||
+             WriteFully(fd, record.data(), record.size(), sizeof(kFileMagic))) &&
+            fdatasync(fd) == 0 && rename(temp_path.c_str(), path_.c_str()) == 0;
+  if (!ok) {
+    *error = ErrnoMessage("compact");
+    close(fd);
+    unlink(temp_path.c_str());
+    return false;
+  }
+
+  // Make the rename itself durable before dropping the old log.
+  std::string directory = path_.substr(0, path_.find_last_of('/'));
+  int dir_fd = open(directory.empty() ? "/" : directory.c_str(),
+                    O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  close(fd_);
+  fd_ = fd;
+  stats_.compactions++;
+  return Replay(error);
+}
+
+StateStore::Stats StateStore::stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return stats_;
+}
+
+void StateStore::DrainPending() {
+  // Only one drain runs at a time, so batches are committed in the order
+  // they were queued. Commits queued while it was syncing are folded into
+  // its next record, so a burst of writes still costs one fsync.
+  {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    if (draining_) return;
+    draining_ = true;
+  }
+  while (true) {
+    std::deque<PendingCommit> batch;
+    {
+      std::lock_guard<std::mutex> lock(pending_mutex_);
+      batch.swap(pending_);
+      if (batch.empty()) {
+        draining_ = false;
+        return;
+      }
+    }
+
+    std::vector<Mutation> mutations;
+    for (const auto& commit : batch) {
+      mutations.insert(mutations.end(), commit.mutations.begin(),
+                       commit.mutations.end());
+    }
+    std::string error;
+    bool ok = Commit(mutations, &error);
+    for (const auto& commit : batch) commit.done(ok, error);
+  }
+}
+
+FlValue* StateStore::Benchmark(int iterations) {
+  // Persist the six-field "last photo" record |iterations| times through a
+  // scratch store, and separately the way shared_preferences_linux does it:
+  // the whole JSON document rewritten once per field.
+  std::string log_path = path_ + ".bench";
+  std::string json_path = path_ + ".bench.json";
+  unlink(log_path.c_str());
+
+  std::vector<int64_t> store_samples;
+  std::vector<int64_t> json_samples;
+  int64_t json_bytes = 0;
+  int64_t store_bytes = 0;
+  {
+    StateStore store(log_path);
+    std::string error;
+    if (!store.Open(&error)) {
+      g_warning("StateStore: benchmark: %s", error.c_str());
+      return fl_value_new_null();
+    }
+
+    // A representative prefs document: settings plus the photo fields.
+    std::string json_prefix =
+        "{\"flutter.settings_language\":\"en\","
+        "\"flutter.settings_theme\":\"system\","
+        "\"flutter.settings_background_fetch\":1,";
+    for (int i = 0; i < iterations; i++) {
+      std::string path =
+          "/home/user/Downloads/photo_" + std::to_string(i) + ".jpg";
+      std::vector<Mutation> record(6);
+      record[0].key = "last_photo_id";
+      record[0].value.type = Type::kInt;
+      record[0].value.int_value = i;
+      record[1].key = "last_photo_path";
+      record[1].value.type = Type::kString;
+      record[1].value.string_value = path;
+      record[2].key = "last_photo_file_name";
+      record[2].value.type = Type::kString;
+      record[2].value.string_value = "photo_" + std::to_string(i) + ".jpg";
+      record[3].key = "last_photo_uploaded_at";
+      record[3].value.type = Type::kString;
+      record[3].value.string_value = "2025-01-01T12:00:00.000000Z";
+      record[4].key = "last_photo_file_size";
+      record[4].value.type = Type::kInt;
+      record[4].value.int_value = 2 * 1024 * 1024;
+      record[5].key = "last_download_date";
+      record[5].value.type = Type::kString;
+      record[5].value.string_value = "2025-01-01T12:00:01.000000";
+
+      int64_t start = NowMicros();
+      if (!store.Commit(record, &error)) break;
+      store_samples.push_back(NowMicros() - start);
+
+      start = NowMicros();
+      std::string json = json_prefix;
+      for (int field = 0; field < 6; field++) {
+        const Mutation& m = record[size_t(field)];
+        json += "\"flutter." + m.key + "\":";
+        json += m.value.type == Type::kInt
+                    ? std::to_string(m.value.int_value)
+                    : "\"" + m.value.string_value + "\"";
+        std::string document = json + "}";
+        int fd = open(json_path.c_str(),
+                      O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) break;
+        WriteFully(fd, document.data(), document.size(), 0);
+        close(fd);
+        json_bytes += int64_t(document.size());
+        json += ",";
+      }
+      json_samples.push_back(NowMicros() - start);
+    }
+    store_bytes = store.stats().bytes_appended;
+  }
+  unlink(log_path.c_str());
+  unlink(json_path.c_str());
+
+  int64_t runs = std::max<int64_t>(1, int64_t(store_samples.size()));
+  FlValue* result = fl_value_new_map();
+  fl_value_set_string_take(result, "iterations",
+                           fl_value_new_int(int64_t(store_samples.size())));
+  fl_value_set_string_take(result, "storeP50Micros",
+                           fl_value_new_int(Percentile(store_samples, 0.5)));
+  fl_value_set_string_take(result, "storeP99Micros",
+                           fl_value_new_int(Percentile(store_samples, 0.99)));
+  fl_value_set_string_take(result, "storeBytesPerPhoto",
+                           fl_value_new_int(store_bytes / runs));
+  fl_value_set_string_take(result, "storeSyncsPerPhoto", fl_value_new_int(1));
+  fl_value_set_string_take(result, "jsonP50Micros",
+                           fl_value_new_int(Percentile(json_samples, 0.5)));
+  fl_value_set_string_take(result, "jsonP99Micros",
+                           fl_value_new_int(Percentile(json_samples, 0.99)));
+  fl_value_set_string_take(result, "jsonBytesPerPhoto",
+                           fl_value_new_int(json_bytes / runs));
+  fl_value_set_string_take(result, "jsonSyncsPerPhoto", fl_value_new_int(0));
+  return result;
+}
+
+void StateStore::RegisterChannel(FlBinaryMessenger* messenger,
+                                 WorkerPool* pool) {
+  pool_ = pool;
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_method_channel_new(messenger, "com.rabee.omran.state",
+                                   FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        StateStore* self = static_cast<StateStore*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+
+        if (strcmp(method, "getAll") == 0) {
+          g_autoptr(FlValue) values = fl_value_new_map();
+          for (const auto& entry : self->GetAll()) {
+            fl_value_set_string_take(values, entry.first.c_str(),
+                                     ToFlValue(entry.second));
+          }
+          fl_method_call_respond_success(method_call, values, nullptr);
+        } else if (strcmp(method, "commit") == 0) {
+          FlValue* entries = args != nullptr &&
+                                     fl_value_get_type(args) == FL_VALUE_TYPE_MAP
+                                 ? fl_value_lookup_string(args, "entries")
+                                 : nullptr;
+          if (entries == nullptr ||
+              fl_value_get_type(entries) != FL_VALUE_TYPE_MAP) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         "entries is required", nullptr,
+                                         nullptr);
+            return;
+          }
+          PendingCommit commit;
+          for (size_t i = 0; i < fl_value_get_length(entries); i++) {
+            FlValue* key = fl_value_get_map_key(entries, i);
+            Mutation mutation;
+            if (fl_value_get_type(key) != FL_VALUE_TYPE_STRING ||
+                !ParseFlValue(fl_value_get_map_value(entries, i),
+                              &mutation.value)) {
+              fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                           "Unsupported key or value type",
+                                           nullptr, nullptr);
+              return;
+            }
+            mutation.key = fl_value_get_string(key);
+            commit.mutations.push_back(std::move(mutation));
+          }
+          g_object_ref(method_call);
+          commit.done = [method_call](bool ok, const std::string& error) {
+            if (ok) {
+              RespondSuccessLater(method_call, nullptr);
+            } else {
+              RespondErrorLater(method_call, "COMMIT_FAILED", error);
+            }
+          };
+          {
+            std::lock_guard<std::mutex> lock(self->pending_mutex_);
+            self->pending_.push_back(std::move(commit));
+          }
+          self->pool_->Post([self]() { self->DrainPending(); });
+        } else if (strcmp(method, "stats") == 0) {
+          Stats stats = self->stats();
+          g_autoptr(FlValue) result = fl_value_new_map();
+          fl_value_set_string_take(result, "commits",
+                                   fl_value_new_int(stats.commits));
+          fl_value_set_string_take(result, "syncs",
+                                   fl_value_new_int(stats.syncs));
+          fl_value_set_string_take(result, "bytesAppended",
+                                   fl_value_new_int(stats.bytes_appended));
+          fl_value_set_string_take(result, "compactions",
+                                   fl_value_new_int(stats.compactions));
+          fl_value_set_string_take(result, "logBytes",
+                                   fl_value_new_int(stats.log_bytes));
+          fl_value_set_string_take(result, "liveBytes",
+                                   fl_value_new_int(stats.live_bytes));
+          fl_value_set_string_take(result, "lastCommitMicros",
+                                   fl_value_new_int(stats.last_commit_us));
+          fl_method_call_respond_success(method_call, result, nullptr);
+        } else if (strcmp(method, "benchmark") == 0) {
+          int iterations = int(ArgInt(args, "iterations", 200));
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, iterations]() {
+            RespondSuccessLater(method_call, self->Benchmark(iterations));
+          });
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
@@ -0,0 +1,126 @@
+#ifndef RUNNER_STATE_STORE_H_
+#define RUNNER_STATE_STORE_H_
+
+#include <flutter_linux/flutter_linux.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "worker_pool.h"
+
+/**
+ * Small crash-safe key-value store for app state.
+ *
+ * Every commit appends one checksummed batch record to a log file and syncs
+ * it once, so a batch is either fully visible after a crash or not at all.
+ * The log is mapped read-only and an in-memory index points each key at its
+ * latest value inside the mapping. The log is rewritten once most of it is
+ * dead history. The index is rebuilt by replaying that small log at open
+ * rather than stored, so a commit has one file to keep consistent.
+ */
+class StateStore {
+ public:
+  enum class Type : uint8_t {
+    kDelete = 0,
+    kString = 1,
+    kInt = 2,
+    kDouble = 3,
+    kBool = 4,
+  };
+
+  struct Value {
+    Type type = Type::kDelete;
+    std::string string_value;
+    int64_t int_value = 0;
+    double double_value = 0;
+    bool bool_value = false;
+  };
+
+  struct Mutation {
+    std::string key;
+    Value value;  // Type::kDelete removes the key.
+  };
+
+  struct Stats {
+    int64_t commits = 0;
+    int64_t syncs = 0;
+    int64_t bytes_appended = 0;
+    int64_t compactions = 0;
+    int64_t log_bytes = 0;
+    int64_t live_bytes = 0;
+    int64_t last_commit_us = 0;
+  };
+
+  explicit StateStore(const std::string& path);
+  ~StateStore();
+
+  StateStore(const StateStore&) = delete;
+  StateStore& operator=(const StateStore&) = delete;
+
+  // Opens or creates the log, dropping a torn batch left by a crash.
+  bool Open(std::string* error);
+
+  bool Get(const std::string& key, Value* value);
+  std::map<std::string, Value> GetAll();
+
+  // Appends |mutations| as one record and syncs it. Either all of them are
+  // applied or, on failure, none.
+  bool Commit(const std::vector<Mutation>& mutations, std::string* error);
+
+  Stats stats();
+
+  // Exposes the store on the "com.rabee.omran.state" channel. Commits run on
+  // |pool| and are applied in the order they arrive.
+  void RegisterChannel(FlBinaryMessenger* messenger, WorkerPool* pool);
+
+ private:
+  struct Slot {
+    Type type;
+    uint64_t offset;  // Of the value bytes within the log.
+    uint32_t length;
+    uint32_t record_bytes;  // Size of the whole entry, for compaction.
+  };
+
+  struct PendingCommit {
+    std::vector<Mutation> mutations;
+    std::function<void(bool ok, const std::string& error)> done;
+  };
+
+  bool Remap(uint64_t size, std::string* error);
+  bool Replay(std::string* error);
+  bool Append(const std::string& record, uint64_t offset, std::string* error);
+  void PublishLocked(size_t record_size);
+  void ApplyLocked(const std::vector<Mutation>& mutations,
+                   uint64_t record_offset);
+  bool Compact(std::string* error);
+  Value ReadSlotLocked(const Slot& slot) const;
+  void DrainPending();
+  FlValue* Benchmark(int iterations);
+
+  std::string path_;
+  int fd_ = -1;
+  void* map_ = nullptr;
+  size_t map_capacity_ = 0;
+  uint64_t end_offset_ = 0;
+  uint64_t live_bytes_ = 0;
+  std::map<std::string, Slot> index_;
+  Stats stats_;
+  std::mutex mutex_;  // Guards the index, the mapping and the stats.
+  // Held by the one commit or compaction writing the log, across its syncs;
+  // taken before |mutex_|.
+  std::mutex io_mutex_;
+
+  std::mutex pending_mutex_;
+  std::deque<PendingCommit> pending_;
+  bool draining_ = false;  // Guarded by |pending_mutex_|.
+
+  FlMethodChannel* channel_ = nullptr;
+  WorkerPool* pool_ = nullptr;
+};
+
+#endif  // RUNNER_STATE_STORE_H_
@@ -0,0 +1,1268 @@
+#include "subscription_hub.h"
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstring>
+#include <iterator>
+
+#include "channel_utils.h"
+#include "memory_governor.h"
+#include "photo_batch.h"
+
+namespace {
+
+// Photos handed to the pipeline at once. Twice its download threads keeps
+// them busy while leaving room in its intake queue for the app's own
+// enqueues.
+const int kMaxInFlight = 8;
+// Catch-ups running at once; each holds a pool thread while it fetches.
+const int kMaxSyncs = 2;
+// A source fetches its next page once fewer photos than this are waiting.
+const size_t kSyncLowWater = 32;
+const int kSaveAttempts = 2;
+
+const int64_t kPingIntervalUs = 30 * 1000000LL;
+// Silence for this long, pings included, means the connection is gone.
+const int64_t kDeadAfterUs = 75 * 1000000LL;
+const int64_t kUpgradeTimeoutUs = 15 * 1000000LL;
+const int64_t kMinBackoffUs = 1000000;
+const int64_t kMaxBackoffUs = 60 * 1000000LL;
+const int64_t kDispatchRetryUs = 200000;  // After the pipeline turned us away.
+const int64_t kPersistIntervalUs = 2 * 1000000LL;
+
+const long kConnectTimeoutSeconds = 10;
+const long kSyncTimeoutSeconds = 30;
+
+const char* kStateNames[] = {"idle", "connecting", "open", "backoff"};
+
+// Splits "https://host:port/prefix" into its origin and path prefix.
+bool SplitServer(const std::string& server, std::string* origin,
+                 std::string* host, std::string* prefix) {
+  size_t scheme_end = server.find("://");
+  if (scheme_end == std::string::npos) return false;
+  std::string scheme = server.substr(0, scheme_end);
+  if (scheme != "http" && scheme != "https") return false;
+  std::string rest = server.substr(scheme_end + 3);
+  size_t slash = rest.find('/');
+  *host = rest.substr(0, slash);
+  *prefix = slash == std::string::npos ? "" : rest.substr(slash);
+  while (!prefix->empty() && prefix->back() == '/') prefix->pop_back();
+  *origin = scheme + "://" + *host;
+  return !host->empty();
+}
+
+// Album names as the server accepts them; also safe in URLs and JSON as is.
+bool ValidAlbum(const std::string& album) {
+  if (album.size() > 64) return false;
+  for (char c : album) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+std::string CursorKey(const std::string& source_id) {
+  return "subscriptions/" + source_id + "/cursor";
+}
+
+int64_t ThreadCpuMicros() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return int64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+// Bytes malloc has handed out, or -1 where that cannot be told.
+int64_t HeapBytes() {
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+  return int64_t(mallinfo2().uordblks);
+#else
+  return -1;
+#endif
+}
+
+size_t AppendToString(char* data, size_t size, size_t count, void* user_data) {
+  static_cast<std::string*>(user_data)->append(data, size * count);
+  return size * count;
+}
+
+}  // namespace
+
+class SubscriptionHub::MessageSink : public WsConnection::Sink {
+ public:
+  MessageSink(SubscriptionHub* hub, Endpoint* endpoint)
+      : hub_(hub), endpoint_(endpoint) {}
+
+  void OnMessage(const char* data, size_t size, bool binary) override {
+    hub_->OnMessage(endpoint_, data, size, binary);
+  }
+
+ private:
+  SubscriptionHub* hub_;
+  Endpoint* endpoint_;
+};
+
+SubscriptionHub::SubscriptionHub(PhotoPipeline* pipeline, StateStore* state,
+                                 WorkerPool* pool)
+    : pipeline_(pipeline),
+      state_(state),
+      pool_(pool),
+      mailbox_(std::make_shared<Mailbox>()) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  share_ = curl_share_init();
+  curl_share_setopt(share_, CURLSHOPT_LOCKFUNC, LockShare);
+  curl_share_setopt(share_, CURLSHOPT_UNLOCKFUNC, UnlockShare);
+  curl_share_setopt(share_, CURLSHOPT_USERDATA, this);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+  json_ = fl_json_message_codec_new();
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+  mailbox_->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.ptr = nullptr;  // Everything else points at its Endpoint.
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, mailbox_->wake_fd, &event);
+  thread_ = std::thread(&SubscriptionHub::Loop, this);
+}
+
+SubscriptionHub::~SubscriptionHub() {
+  stopping_ = true;
+  Wake(mailbox_);
+  thread_.join();
+  {
+    std::unique_lock<std::mutex> lock(blocking_mutex_);
+    blocking_cv_.wait(lock, [this]() { return blocking_tasks_ == 0; });
+  }
+
+  // Pipeline callbacks that land from now on are dropped. What already
+  // arrived still runs, so connections made meanwhile are closed.
+  std::vector<std::function<void()>> tasks;
+  {
+    std::lock_guard<std::mutex> lock(mailbox_->mutex);
+    mailbox_->closed = true;
+    tasks.swap(mailbox_->tasks);
+    close(mailbox_->wake_fd);
+  }
+  for (auto& task : tasks) task();
+
+  if (state_ != nullptr) {
+    std::vector<StateStore::Mutation> mutations = DirtyCursors();
+    std::string error;
+    if (!mutations.empty() && !state_->Commit(mutations, &error)) {
+      g_warning("Could not save subscription cursors: %s", error.c_str());
+    }
+  }
+  for (auto& entry : endpoints_) Close(entry.second.get());
+  close(epoll_fd_);
+  curl_share_cleanup(share_);
+  g_object_unref(json_);
+  FlMethodChannel* channel = channel_.load();
+  if (channel != nullptr) g_object_unref(channel);
+  curl_global_cleanup();
+}
+
+bool SubscriptionHub::AddSource(const Source& source, std::string* error) {
+  std::string origin, host, prefix;
+  if (source.id.empty()) {
+    *error = "id is required";
+    return false;
+  }
+  if (!SplitServer(source.server, &origin, &host, &prefix)) {
+    *error = "server must be an http or https URL";
+    return false;
+  }
+  if (!ValidAlbum(source.album)) {
+    *error = "album is up to 64 letters, digits, \"-\" or \"_\"";
+    return false;
+  }
+  Post([this, source]() { AddOnLoop(source); });
+  return true;
+}
+
+void SubscriptionHub::RemoveSource(const std::string& id) {
+  Post([this, id]() { RemoveOnLoop(id); });
+}
+
+void SubscriptionHub::Deliver(const std::shared_ptr<Mailbox>& mailbox,
+                              std::function<void()> task) {
+  // Woken under the lock, so the descriptor cannot be closed meanwhile.
+  std::lock_guard<std::mutex> lock(mailbox->mutex);
+  if (mailbox->closed) return;
+  mailbox->tasks.push_back(std::move(task));
+  Wake(mailbox);
+}
+
+void SubscriptionHub::Wake(const std::shared_ptr<Mailbox>& mailbox) {
+  uint64_t one = 1;
+  ssize_t written = write(mailbox->wake_fd, &one, sizeof(one));
+  (void)written;  // A full counter already means "wake up".
+}
+
+void SubscriptionHub::Post(std::function<void()> task) {
+  Deliver(mailbox_, std::move(task));
+}
+
+void SubscriptionHub::RunBlocking(std::function<void()> task) {
+  if (stopping_) return;
+  {
+    std::lock_guard<std::mutex> lock(blocking_mutex_);
+    blocking_tasks_++;
+  }
+  pool_->Post([this, task]() {
+    task();
+    std::lock_guard<std::mutex> lock(blocking_mutex_);
+    if (--blocking_tasks_ == 0) blocking_cv_.notify_all();
+  });
+}
+
+void SubscriptionHub::RunAndWait(std::function<void()> task) {
+  std::mutex mutex;
+  std::condition_variable done_cv;
+  bool done = false;
+  Post([&]() {
+    task();
+    std::lock_guard<std::mutex> lock(mutex);
+    done = true;
+    done_cv.notify_all();
+  });
+  std::unique_lock<std::mutex> lock(mutex);
+  done_cv.wait(lock, [&]() { return done; });
+}
+
+void SubscriptionHub::Loop() {
+  epoll_event events[64];
+  while (!stopping_) {
+    int count = epoll_wait(epoll_fd_, events, 64,
+                           TimeoutMillis(g_get_monotonic_time()));
+    wakeups_++;
+    bool woken = false;
+    // Sockets first: queued tasks may remove endpoints the batch points at.
+    for (int i = 0; i < count; i++) {
+      Endpoint* endpoint = static_cast<Endpoint*>(events[i].data.ptr);
+      if (endpoint == nullptr) {
+        woken = true;
+        continue;
+      }
+      if (endpoint->fd == CURL_SOCKET_BAD) continue;
+      OnReadable(endpoint);
+      if ((events[i].events & EPOLLOUT) && endpoint->fd != CURL_SOCKET_BAD) {
+        Flush(endpoint);
+      }
+    }
+    if (woken) {
+      uint64_t value;
+      ssize_t bytes = read(mailbox_->wake_fd, &value, sizeof(value));
+      (void)bytes;
+      std::vector<std::function<void()>> tasks;
+      {
+        std::lock_guard<std::mutex> lock(mailbox_->mutex);
+        tasks.swap(mailbox_->tasks);
+      }
+      for (auto& task : tasks) task();
+    }
+
+    int64_t now = g_get_monotonic_time();
+    RunTimers(now);
+    for (auto& entry : endpoints_) FlushSubscriptions(entry.second.get());
+    StartSyncs();
+    Dispatch(now);
+    loop_cpu_us_ = ThreadCpuMicros();
+  }
+}
+
+int SubscriptionHub::TimeoutMillis(int64_t now_us) {
+  int64_t next = INT64_MAX;
+  if (!queue_.empty() && dispatch_retry_us_ > now_us) {
+    next = dispatch_retry_us_;
+  }
+  if (!sync_retries_.empty()) next = std::min(next, sync_retries_.begin()->first);
+  if (dirty_cursors_ && state_ != nullptr) next = std::min(next, persist_us_);
+  for (auto& entry : endpoints_) {
+    Endpoint* endpoint = entry.second.get();
+    if (endpoint->state == Endpoint::kBackoff) {
+      next = std::min(next, endpoint->retry_us);
+    } else if (endpoint->fd != CURL_SOCKET_BAD) {
+      bool open = endpoint->state == Endpoint::kOpen;
+      next = std::min(next, endpoint->last_read_us +
+                                (open ? kDeadAfterUs : kUpgradeTimeoutUs));
+      if (open) next = std::min(next, endpoint->ping_us);
+    }
+  }
+  if (next == INT64_MAX) return -1;
+  if (next <= now_us) return 0;
+  return int(std::min<int64_t>((next - now_us + 999) / 1000, INT32_MAX));
+}
+
+void SubscriptionHub::RunTimers(int64_t now_us) {
+  for (auto& entry : endpoints_) {
+    Endpoint* endpoint = entry.second.get();
+    if (endpoint->state == Endpoint::kBackoff && now_us >= endpoint->retry_us) {
+      Connect(endpoint);
+    } else if (endpoint->fd != CURL_SOCKET_BAD) {
+      bool open = endpoint->state == Endpoint::kOpen;
+      if (now_us - endpoint->last_read_us >=
+          (open ? kDeadAfterUs : kUpgradeTimeoutUs)) {
+        Fail(endpoint, open ? "Server went silent" : "Upgrade timed out");
+      } else if (open && now_us >= endpoint->ping_us) {
+        endpoint->ping_us = now_us + kPingIntervalUs;
+        Send(endpoint, WsConnection::Frame(WsConnection::kPing, "", 0));
+      }
+    }
+  }
+  while (!sync_retries_.empty() && sync_retries_.begin()->first <= now_us) {
+    auto source = sources_.find(sync_retries_.begin()->second);
+    if (source != sources_.end()) QueueSync(source->second.get());
+    sync_retries_.erase(sync_retries_.begin());
+  }
+  if (dirty_cursors_ && now_us >= persist_us_) PersistCursors();
+}
+
+void SubscriptionHub::AddOnLoop(const Source& config) {
+  auto existing = sources_.find(config.id);
+  if (existing != sources_.end()) {
+    SourceState* source = existing->second.get();
+    if (source->config.server == config.server &&
+        source->config.album == config.album) {
+      // Photos already queued keep the priority they were queued with.
+      source->config.priority = config.priority;
+      source->config.directory = config.directory;
+      return;
+    }
+    Detach(source);
+    sources_.erase(existing);
+  }
+
+  std::unique_ptr<SourceState> source(new SourceState());
+  source->config = config;
+  source->cursor = config.cursor;
+  StateStore::Value stored;
+  if (source->cursor < 0 && state_ != nullptr &&
+      state_->Get(CursorKey(config.id), &stored) &&
+      stored.type == StateStore::Type::kInt) {
+    source->cursor = stored.int_value;
+  }
+  source->cursor = std::max<int64_t>(source->cursor, 0);
+  source->newest = source->cursor;
+  source->synced_to = source->cursor;
+
+  std::string origin, host, prefix;
+  SplitServer(config.server, &origin, &host, &prefix);
+  std::unique_ptr<Endpoint>& endpoint = endpoints_[origin + prefix];
+  if (!endpoint) {
+    endpoint.reset(new Endpoint());
+    endpoint->origin = origin;
+    endpoint->host = host;
+    endpoint->prefix = prefix;
+  }
+  source->endpoint = endpoint.get();
+  endpoint->sources.push_back(source.get());
+  endpoint->subscriptions_dirty = true;
+  if (endpoint->albums.count(config.album) != 0) OnSubscribed(source.get());
+  if (endpoint->state == Endpoint::kIdle) Connect(endpoint.get());
+  sources_[config.id] = std::move(source);
+}
+
+void SubscriptionHub::RemoveOnLoop(const std::string& id) {
+  auto it = sources_.find(id);
+  if (it == sources_.end()) return;
+  Detach(it->second.get());
+  sources_.erase(it);
+  // Queued photos of the source are skipped as they come up.
+}
+
+void SubscriptionHub::Detach(SourceState* source) {
+  Endpoint* endpoint = source->endpoint;
+  auto& sources = endpoint->sources;
+  sources.erase(std::find(sources.begin(), sources.end(), source));
+  if (!sources.empty()) {
+    endpoint->subscriptions_dirty = true;
+    return;
+  }
+  if (endpoint->state == Endpoint::kOpen) {
+    static const char kGoingAway[] = {'\x03', '\xE9'};  // 1001
+    Send(endpoint, WsConnection::Frame(WsConnection::kClose, kGoingAway, 2));
+  }
+  std::string origin = endpoint->origin + endpoint->prefix;
+  Close(endpoint);
+  endpoints_.erase(origin);
+}
+
+void SubscriptionHub::Connect(Endpoint* endpoint) {
+  if (stopping_) return;
+  endpoint->state = Endpoint::kConnecting;
+  endpoint->generation = ++next_generation_;
+  std::string key = endpoint->origin + endpoint->prefix;
+  std::string origin = endpoint->origin;
+  int generation = endpoint->generation;
+  RunBlocking([this, key, origin, generation]() {
+    std::string error;
+    CURL* curl = OpenConnection(origin, &error);
+    Post([this, key, generation, curl, error]() {
+      OnConnected(key, generation, curl, error);
+    });
+  });
+}
+
+CURL* SubscriptionHub::OpenConnection(const std::string& origin,
+                                      std::string* error) {
+  // libcurl here predates its WebSocket support, so it only connects (and
+  // does TLS); WsConnection speaks the protocol over the socket.
+  CURL* curl = curl_easy_init();
+  curl_easy_setopt(curl, CURLOPT_URL, (origin + "/").c_str());
+  curl_easy_setopt(curl, CURLOPT_CONNECT_ONLY, 1L);
+  curl_easy_setopt(curl, CURLOPT_SHARE, share_);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, kConnectTimeoutSeconds);
+  curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  CURLcode code = curl_easy_perform(curl);
+  if (code != CURLE_OK) {
+    *error = curl_easy_strerror(code);
+    curl_easy_cleanup(curl);
+    return nullptr;
+  }
+  return curl;
+}
+
+void SubscriptionHub::OnConnected(const std::string& key, int generation,
+                                  CURL* curl, const std::string& error) {
+  auto it = endpoints_.find(key);
+  if (stopping_ || it == endpoints_.end() ||
+      it->second->generation != generation) {
+    if (curl != nullptr) curl_easy_cleanup(curl);
+    return;
+  }
+  Endpoint* endpoint = it->second.get();
+  if (curl == nullptr) {
+    Fail(endpoint, error);
+    return;
+  }
+  curl_socket_t fd = CURL_SOCKET_BAD;
+  if (curl_easy_getinfo(curl, CURLINFO_ACTIVESOCKET, &fd) != CURLE_OK ||
+      fd == CURL_SOCKET_BAD) {
+    curl_easy_cleanup(curl);
+    Fail(endpoint, "No socket after connecting");
+    return;
+  }
+  endpoint->curl = curl;
+  endpoint->fd = fd;
+  endpoint->ws.reset(new WsConnection());
+  endpoint->last_read_us = g_get_monotonic_time();
+  endpoint->connects++;
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.ptr = endpoint;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+  // Albums are subscribed once the socket is open; an empty list here keeps
+  // the server from joining it to the default album unasked. Servers that
+  // know photo-batch send updates batched and binary, others one JSON
+  // message each.
+  Send(endpoint, endpoint->ws->UpgradeRequest(
+                     endpoint->host, endpoint->prefix + "/ws/photo/?albums=",
+                     kPhotoBatchProtocol));
+}
+
+void SubscriptionHub::Fail(Endpoint* endpoint, const std::string& error) {
+  g_warning("Photo subscription to %s failed: %s", endpoint->origin.c_str(),
+            error.c_str());
+  endpoint->last_error = error;
+  Close(endpoint);
+  int shift = std::min(endpoint->failures, 6);
+  int64_t backoff = std::min(kMaxBackoffUs, kMinBackoffUs << shift);
+  endpoint->failures++;
+  // Jittered so devices that lost the same server do not return in step.
+  endpoint->retry_us = g_get_monotonic_time() + backoff / 2 +
+                       g_random_int_range(0, int(backoff / 2));
+  endpoint->state = Endpoint::kBackoff;
+}
+
+void SubscriptionHub::Close(Endpoint* endpoint) {
+  if (endpoint->curl != nullptr) {
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, endpoint->fd, nullptr);
+    curl_easy_cleanup(endpoint->curl);
+  }
+  endpoint->curl = nullptr;
+  endpoint->fd = CURL_SOCKET_BAD;
+  endpoint->ws.reset();
+  endpoint->outgoing.clear();
+  endpoint->want_write = false;
+  endpoint->state = Endpoint::kIdle;
+  endpoint->albums.clear();
+  endpoint->requested.clear();
+  for (SourceState* source : endpoint->sources) {
+    // A page still in flight belongs to the old subscription.
+    source->subscribed = false;
+    source->caught_up = false;
+    source->sync_more = false;
+    source->sync_epoch++;
+  }
+}
+
+void SubscriptionHub::OnReadable(Endpoint* endpoint) {
+  char buffer[16 * 1024];
+  MessageSink sink(this, endpoint);
+  while (endpoint->fd != CURL_SOCKET_BAD) {
+    size_t received = 0;
+    CURLcode code =
+        curl_easy_recv(endpoint->curl, buffer, sizeof(buffer), &received);
+    if (code == CURLE_AGAIN) return;
+    if (code != CURLE_OK || received == 0) {
+      Fail(endpoint, code != CURLE_OK ? curl_easy_strerror(code)
+                                      : "Connection closed by server");
+      return;
+    }
+    endpoint->bytes_in += int64_t(received);
+    endpoint->last_read_us = g_get_monotonic_time();
+
+    std::string reply;
+    bool was_open = endpoint->ws->state() == WsConnection::State::kOpen;
+    bool usable = endpoint->ws->Feed(buffer, received, &sink, &reply);
+    if (!reply.empty()) Send(endpoint, reply);
+    if (endpoint->fd == CURL_SOCKET_BAD) return;
+    if (!usable) {
+      Fail(endpoint, was_open ? "Closed by server" : "Upgrade refused");
+      return;
+    }
+    if (!was_open && endpoint->ws->state() == WsConnection::State::kOpen) {
+      endpoint->state = Endpoint::kOpen;
+      endpoint->failures = 0;
+      endpoint->last_error.clear();
+      endpoint->ping_us = endpoint->last_read_us + kPingIntervalUs;
+      endpoint->subscriptions_dirty = true;
+    }
+  }
+}
+
+void SubscriptionHub::Send(Endpoint* endpoint, const std::string& data) {
+  if (endpoint->fd == CURL_SOCKET_BAD) return;
+  endpoint->outgoing += data;
+  Flush(endpoint);
+}
+
+void SubscriptionHub::Flush(Endpoint* endpoint) {
+  while (!endpoint->outgoing.empty()) {
+    size_t sent = 0;
+    CURLcode code = curl_easy_send(endpoint->curl, endpoint->outgoing.data(),
+                                   endpoint->outgoing.size(), &sent);
+    if (code == CURLE_AGAIN) break;
+    if (code != CURLE_OK) {
+      Fail(endpoint, curl_easy_strerror(code));
+      return;
+    }
+    endpoint->outgoing.erase(0, sent);
+  }
+  bool want_write = !endpoint->outgoing.empty();
+  if (want_write == endpoint->want_write) return;
+  endpoint->want_write = want_write;
+  epoll_event event = {};
+  event.events = EPOLLIN | (want_write ? EPOLLOUT : 0);
+  event.data.ptr = endpoint;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, endpoint->fd, &event);
+}
+
+void SubscriptionHub::FlushSubscriptions(Endpoint* endpoint) {
+  // Batched per loop turn: adding hundreds of sources costs one message,
+  // and one answer, rather than one each.
+  if (!endpoint->subscriptions_dirty || endpoint->state != Endpoint::kOpen) {
+    return;
+  }
+  endpoint->subscriptions_dirty = false;
+  std::set<std::string> wanted;
+  for (SourceState* source : endpoint->sources) {
+    wanted.insert(source->config.album);
+  }
+  std::vector<std::string> added, removed;
+  std::set_difference(wanted.begin(), wanted.end(),
+                      endpoint->requested.begin(), endpoint->requested.end(),
+                      std::back_inserter(added));
+  std::set_difference(endpoint->requested.begin(), endpoint->requested.end(),
+                      wanted.begin(), wanted.end(),
+                      std::back_inserter(removed));
+  if (!added.empty()) SendSubscription(endpoint, "subscribe", added);
+  if (!removed.empty()) SendSubscription(endpoint, "unsubscribe", removed);
+  endpoint->requested.swap(wanted);
+}
+
+void SubscriptionHub::SendSubscription(Endpoint* endpoint, const char* type,
+                                       const std::vector<std::string>& albums) {
+  // Album names were validated, so they need no escaping.
+  std::string text = std::string("{\"type\":\"") + type + "\",\"albums\":[";
+  for (size_t i = 0; i < albums.size(); i++) {
+    if (i > 0) text += ',';
+    text += '"' + albums[i] + '"';
+  }
+  text += "]}";
+  Send(endpoint,
+       WsConnection::Frame(WsConnection::kText, text.data(), text.size()));
+}
+
+void SubscriptionHub::OnMessage(Endpoint* endpoint, const char* data,
+                                size_t size, bool binary) {
+  endpoint->messages++;
+  if (binary) {
+    OnPhotoBatch(endpoint, data, size);
+    return;
+  }
+  std::string text(data, size);
+  g_autoptr(GError) error = nullptr;
+  g_autoptr(FlValue) message =
+      fl_json_message_codec_decode(json_, text.c_str(), &error);
+  if (message == nullptr) {
+    g_warning("Unreadable message from %s: %s", endpoint->origin.c_str(),
+              error->message);
+    return;
+  }
+  std::string type = ArgString(message, "type");
+
+  if (type == "subscribed") {
+    FlValue* albums = fl_value_lookup_string(message, "albums");
+    endpoint->albums.clear();
+    if (albums != nullptr && fl_value_get_type(albums) == FL_VALUE_TYPE_LIST) {
+      for (size_t i = 0; i < fl_value_get_length(albums); i++) {
+        FlValue* album = fl_value_get_list_value(albums, i);
+        if (fl_value_get_type(album) == FL_VALUE_TYPE_STRING) {
+          endpoint->albums.insert(fl_value_get_string(album));
+        }
+      }
+    }
+    for (SourceState* source : endpoint->sources) {
+      bool subscribed = endpoint->albums.count(source->config.album) != 0;
+      if (subscribed && !source->subscribed) OnSubscribed(source);
+    }
+  } else if (type == "error") {
+    endpoint->last_error = ArgString(message, "detail");
+    g_warning("Photo subscription to %s: %s", endpoint->origin.c_str(),
+              endpoint->last_error.c_str());
+  } else if (type == "photo_update") {
+    std::string album = ArgString(message, "album");
+    PhotoPipeline::Request request;
+    std::string parse_error;
+    if (!PhotoPipeline::ParseServerPhoto(
+            fl_value_lookup_string(message, "image"), MediaUrl(endpoint), "",
+            &request, &parse_error)) {
+      g_warning("Bad photo_update from %s: %s", endpoint->origin.c_str(),
+                parse_error.c_str());
+      return;
+    }
+    FlValue* trace = fl_value_lookup_string(message, "trace");
+    request.trace.trace_id = ArgString(trace, "id");
+    request.trace.received_us = ArgInt(trace, "received_us");
+    request.trace.stored_us = ArgInt(trace, "stored_us");
+    request.trace.broadcast_us = ArgInt(trace, "broadcast_us");
+    OnPhotoUpdate(endpoint, request, album);
+  }
+}
+
+void SubscriptionHub::OnPhotoBatch(Endpoint* endpoint, const char* data,
+                                   size_t size) {
+  PhotoBatchReader reader(data, size);
+  PhotoUpdateView update;
+  std::string media_url = MediaUrl(endpoint);
+  std::string album;
+  while (reader.Next(&update)) {
+    PhotoPipeline::Request request;
+    std::string parse_error;
+    if (!PhotoPipeline::ParseBatchedPhoto(update, media_url, "", &request,
+                                          &parse_error)) {
+      g_warning("Bad photo_update from %s: %s", endpoint->origin.c_str(),
+                parse_error.c_str());
+      continue;
+    }
+    request.trace.trace_id = update.trace_id.ToString();
+    request.trace.received_us = update.received_us;
+    request.trace.stored_us = update.stored_us;
+    request.trace.broadcast_us = update.broadcast_us;
+    album.assign(update.album.data, update.album.size);
+    OnPhotoUpdate(endpoint, request, album);
+  }
+  if (reader.error()) {
+    g_warning("Unreadable photo batch from %s", endpoint->origin.c_str());
+  }
+}
+
+void SubscriptionHub::OnPhotoUpdate(Endpoint* endpoint,
+                                    const PhotoPipeline::Request& request,
+                                    const std::string& album) {
+  endpoint->updates++;
+  for (SourceState* source : endpoint->sources) {
+    if (source->subscribed && source->config.album == album &&
+        Enqueue(source, request)) {
+      source->live++;
+    }
+  }
+}
+
+std::string SubscriptionHub::MediaUrl(const Endpoint* endpoint) {
+  return endpoint->origin + endpoint->prefix + "/media/photos/";
+}
+
+void SubscriptionHub::OnSubscribed(SourceState* source) {
+  // Photos from here on arrive live; the ones before are fetched from the
+  // cursor up.
+  source->subscribed = true;
+  source->caught_up = false;
+  source->sync_more = false;
+  source->sync_epoch++;
+  source->synced_to = source->cursor;
+  QueueSync(source);
+}
+
+void SubscriptionHub::QueueSync(SourceState* source) {
+  if (source->sync_queued || source->syncing || !source->subscribed) return;
+  source->sync_queued = true;
+  sync_queue_.push_back(source->config.id);
+}
+
+void SubscriptionHub::StartSyncs() {
+  while (syncs_in_flight_ < kMaxSyncs && !sync_queue_.empty() && !stopping_) {
+    auto it = sources_.find(sync_queue_.front());
+    sync_queue_.pop_front();
+    if (it == sources_.end()) continue;
+    SourceState* source = it->second.get();
+    source->sync_queued = false;
+    if (!source->subscribed || source->syncing) continue;
+
+    source->syncing = true;
+    syncs_in_flight_++;
+    Endpoint* endpoint = source->endpoint;
+    std::string url = endpoint->origin + endpoint->prefix +
+                      "/api/photo/sync/?album=" + source->config.album +
+                      "&since=" + std::to_string(source->synced_to);
+    std::string media_url = MediaUrl(endpoint);
+    std::string id = source->config.id;
+    int epoch = source->sync_epoch;
+    RunBlocking([this, url, media_url, id, epoch]() {
+      SyncPage page;
+      page.ok = FetchSyncPage(url, media_url, &page);
+      Post([this, id, epoch, page]() { OnSyncPage(id, epoch, page); });
+    });
+  }
+}
+
+int SubscriptionHub::AbortIfStopping(void* user_data, curl_off_t, curl_off_t,
+                                     curl_off_t, curl_off_t) {
+  return static_cast<SubscriptionHub*>(user_data)->stopping_ ? 1 : 0;
+}
+
+bool SubscriptionHub::FetchSyncPage(const std::string& url,
+                                    const std::string& media_url,
+                                    SyncPage* page) {
+  std::string body;
+  CURL* curl = curl_easy_init();
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_SHARE, share_);
+  curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, kConnectTimeoutSeconds);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT, kSyncTimeoutSeconds);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, AppendToString);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &body);
+  curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, AbortIfStopping);
+  curl_easy_setopt(curl, CURLOPT_XFERINFODATA, this);
+  CURLcode code = curl_easy_perform(curl);
+  long status = 0;
+  long connects = 0;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+  curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+  curl_easy_cleanup(curl);
+  http_requests_++;
+  http_connections_ += connects;
+  if (code != CURLE_OK) {
+    page->error = curl_easy_strerror(code);
+    return false;
+  }
+  if (status != 200) {
+    page->error = "HTTP " + std::to_string(status);
+    return false;
+  }
+
+  g_autoptr(GError) error = nullptr;
+  g_autoptr(FlValue) value =
+      fl_json_message_codec_decode(json_, body.c_str(), &error);
+  FlValue* photos =
+      value != nullptr ? fl_value_lookup_string(value, "photos") : nullptr;
+  if (photos == nullptr || fl_value_get_type(photos) != FL_VALUE_TYPE_LIST) {
+    page->error = "Malformed sync page";
+    return false;
+  }
+  for (size_t i = 0; i < fl_value_get_length(photos); i++) {
+    PhotoPipeline::Request request;
+    if (!PhotoPipeline::ParseServerPhoto(fl_value_get_list_value(photos, i),
+                                         media_url, "", &request,
+                                         &page->error)) {
+      return false;
+    }
+    page->photos.push_back(std::move(request));
+  }
+  page->cursor = ArgInt(value, "cursor", -1);
+  page->has_more = ArgBool(value, "has_more");
+  if (page->cursor < 0) {
+    page->error = "Sync page has no cursor";
+    return false;
+  }
+  return true;
+}
+
+void SubscriptionHub::OnSyncPage(const std::string& source_id, int epoch,
+                                 const SyncPage& page) {
+  syncs_in_flight_--;
+  auto it = sources_.find(source_id);
+  if (it == sources_.end()) return;
+  SourceState* source = it->second.get();
+  source->syncing = false;
+  if (epoch != source->sync_epoch) {
+    // Resubscribed meanwhile; a newer catch-up starts from the cursor.
+    QueueSync(source);
+    return;
+  }
+  if (!page.ok) {
+    source->sync_failures++;
+    source->last_error = page.error;
+    int shift = std::min(source->sync_failures - 1, 6);
+    sync_retries_.emplace(
+        g_get_monotonic_time() + std::min(kMaxBackoffUs, kMinBackoffUs << shift),
+        source_id);
+    return;
+  }
+  source->sync_failures = 0;
+  for (const PhotoPipeline::Request& request : page.photos) {
+    if (Enqueue(source, request)) source->synced++;
+  }
+  source->synced_to = std::max(source->synced_to, page.cursor);
+  source->sync_more = page.has_more;
+  source->caught_up = !page.has_more;
+  if (page.has_more && source->outstanding.size() < kSyncLowWater) {
+    QueueSync(source);
+  }
+  AdvanceCursor(source);
+}
+
+bool SubscriptionHub::Enqueue(SourceState* source,
+                              PhotoPipeline::Request request) {
+  int64_t id = request.id;
+  if (id <= source->cursor || source->outstanding.count(id) != 0 ||
+      source->saved_ahead.count(id) != 0) {
+    return false;  // Seen through both the socket and a sync page.
+  }
+  source->outstanding.insert(id);
+  source->newest = std::max(source->newest, id);
+  request.directory = source->config.directory.empty()
+                          ? default_directory_
+                          : source->config.directory;
+  request.source = source->config.id;
+  Pending pending;
+  pending.priority = source->config.priority;
+  pending.sequence = next_sequence_++;
+  pending.source_id = source->config.id;
+  pending.request = std::move(request);
+  queue_.push(std::move(pending));
+  return true;
+}
+
+void SubscriptionHub::Dispatch(int64_t now_us) {
+  while (!queue_.empty() && in_flight_ < kMaxInFlight &&
+         now_us >= dispatch_retry_us_) {
+    Pending pending = queue_.top();
+    if (sources_.count(pending.source_id) == 0) {
+      queue_.pop();  // Its source was removed.
+      continue;
+    }
+    if (pipeline_ == nullptr) {
+      queue_.pop();
+      PhotoPipeline::Result result;
+      result.ok = true;
+      OnSaved(pending, result);
+      continue;
+    }
+    std::shared_ptr<Mailbox> mailbox = mailbox_;
+    bool queued = pipeline_->Submit(
+        pending.request,
+        [this, mailbox, pending](const PhotoPipeline::Result& result) {
+          Deliver(mailbox, [this, pending, result]() {
+            in_flight_--;
+            OnSaved(pending, result);
+          });
+        });
+    if (!queued) {
+      dispatch_retry_us_ = now_us + kDispatchRetryUs;
+      return;
+    }
+    queue_.pop();
+    in_flight_++;
+  }
+}
+
+void SubscriptionHub::OnSaved(Pending pending,
+                              const PhotoPipeline::Result& result) {
+  auto it = sources_.find(pending.source_id);
+  if (it == sources_.end()) return;
+  SourceState* source = it->second.get();
+  int64_t id = pending.request.id;
+  if (source->outstanding.count(id) == 0) return;  // Source was replaced.
+  if (!result.ok && ++pending.attempts < kSaveAttempts) {
+    queue_.push(std::move(pending));
+    return;
+  }
+
+  source->outstanding.erase(id);
+  if (result.ok) {
+    source->saved++;
+  } else {
+    // Given up on; the cursor moves past it like the app's own sync does.
+    source->failed++;
+    source->last_error = result.error;
+    g_warning("Photo %" G_GINT64_FORMAT " of %s not saved: %s", id,
+              source->config.id.c_str(), result.error.c_str());
+  }
+  source->saved_ahead.insert(id);
+  AdvanceCursor(source);
+  if (source->sync_more && source->outstanding.size() < kSyncLowWater) {
+    QueueSync(source);
+  }
+  NotifySaved(source, pending.request, result);
+}
+
+void SubscriptionHub::AdvanceCursor(SourceState* source) {
+  // Until a catch-up reaches the end, photos past its last page may exist
+  // that neither the socket nor a page has shown yet.
+  int64_t frontier = source->caught_up
+                         ? std::max(source->synced_to, source->newest)
+                         : source->synced_to;
+  if (!source->outstanding.empty()) {
+    frontier = std::min(frontier, *source->outstanding.begin() - 1);
+  }
+  if (frontier <= source->cursor) return;
+  source->cursor = frontier;
+  source->saved_ahead.erase(source->saved_ahead.begin(),
+                            source->saved_ahead.upper_bound(frontier));
+  source->cursor_dirty = true;
+  if (!dirty_cursors_) {
+    dirty_cursors_ = true;
+    persist_us_ = g_get_monotonic_time() + kPersistIntervalUs;
+  }
+}
+
+std::vector<StateStore::Mutation> SubscriptionHub::DirtyCursors() {
+  std::vector<StateStore::Mutation> mutations;
+  for (auto& entry : sources_) {
+    SourceState* source = entry.second.get();
+    if (!source->cursor_dirty) continue;
+    source->cursor_dirty = false;
+    StateStore::Mutation mutation;
+    mutation.key = CursorKey(source->config.id);
+    mutation.value.type = StateStore::Type::kInt;
+    mutation.value.int_value = source->cursor;
+    mutations.push_back(std::move(mutation));
+  }
+  dirty_cursors_ = false;
+  return mutations;
+}
+
+void SubscriptionHub::PersistCursors() {
+  // One batch, and one sync, for every cursor that moved; one at a time so
+  // an older batch never lands after a newer one.
+  if (state_ == nullptr || persisting_) return;
+  std::vector<StateStore::Mutation> mutations = DirtyCursors();
+  if (mutations.empty()) return;
+  persisting_ = true;
+  StateStore* state = state_;
+  RunBlocking([this, state, mutations]() {
+    std::string error;
+    if (!state->Commit(mutations, &error)) {
+      g_warning("Could not save subscription cursors: %s", error.c_str());
+    }
+    Post([this]() { persisting_ = false; });
+  });
+}
+
+void SubscriptionHub::NotifySaved(SourceState* source,
+                                  const PhotoPipeline::Request& request,
+                                  const PhotoPipeline::Result& result) {
+  FlMethodChannel* channel = channel_.load();
+  if (channel == nullptr) return;
+  FlValue* args = fl_value_new_map();
+  fl_value_set_string_take(args, "sourceId",
+                           fl_value_new_string(source->config.id.c_str()));
+  fl_value_set_string_take(args, "album",
+                           fl_value_new_string(source->config.album.c_str()));
+  fl_value_set_string_take(args, "id", fl_value_new_int(request.id));
+  fl_value_set_string_take(args, "ok", fl_value_new_bool(result.ok));
+  fl_value_set_string_take(args, "path",
+                           fl_value_new_string(result.path.c_str()));
+  fl_value_set_string_take(args, "bytes", fl_value_new_int(result.bytes));
+  fl_value_set_string_take(args, "error",
+                           fl_value_new_string(result.error.c_str()));
+  fl_value_set_string_take(args, "cursor", fl_value_new_int(source->cursor));
+  g_object_ref(channel);
+  RunOnMainThread([channel, args]() {
+    fl_method_channel_invoke_method(channel, "photoSaved", args, nullptr,
+                                    nullptr, nullptr);
+    fl_value_unref(args);
+    g_object_unref(channel);
+  });
+}
+
+void SubscriptionHub::LockShare(CURL*, curl_lock_data data, curl_lock_access,
+                                void* user_data) {
+  static_cast<SubscriptionHub*>(user_data)->share_locks_[data].lock();
+}
+
+void SubscriptionHub::UnlockShare(CURL*, curl_lock_data data,
+                                  void* user_data) {
+  static_cast<SubscriptionHub*>(user_data)->share_locks_[data].unlock();
+}
+
+FlValue* SubscriptionHub::Stats() {
+  FlValue* sources = fl_value_new_list();
+  for (auto& entry : sources_) {
+    SourceState* source = entry.second.get();
+    FlValue* value = fl_value_new_map();
+    fl_value_set_string_take(value, "id",
+                             fl_value_new_string(source->config.id.c_str()));
+    fl_value_set_string_take(
+        value, "server", fl_value_new_string(source->config.server.c_str()));
+    fl_value_set_string_take(
+        value, "album", fl_value_new_string(source->config.album.c_str()));
+    fl_value_set_string_take(value, "priority",
+                             fl_value_new_int(source->config.priority));
+    fl_value_set_string_take(value, "cursor", fl_value_new_int(source->cursor));
+    fl_value_set_string_take(value, "subscribed",
+                             fl_value_new_bool(source->subscribed));
+    fl_value_set_string_take(value, "caughtUp",
+                             fl_value_new_bool(source->caught_up));
+    fl_value_set_string_take(
+        value, "outstanding",
+        fl_value_new_int(int64_t(source->outstanding.size())));
+    fl_value_set_string_take(value, "live", fl_value_new_int(source->live));
+    fl_value_set_string_take(value, "synced", fl_value_new_int(source->synced));
+    fl_value_set_string_take(value, "saved", fl_value_new_int(source->saved));
+    fl_value_set_string_take(value, "failed", fl_value_new_int(source->failed));
+    fl_value_set_string_take(value, "lastError",
+                             fl_value_new_string(source->last_error.c_str()));
+    fl_value_append_take(sources, value);
+  }
+
+  FlValue* endpoints = fl_value_new_list();
+  for (auto& entry : endpoints_) {
+    Endpoint* endpoint = entry.second.get();
+    FlValue* value = fl_value_new_map();
+    fl_value_set_string_take(value, "server",
+                             fl_value_new_string(entry.first.c_str()));
+    fl_value_set_string_take(value, "state",
+                             fl_value_new_string(kStateNames[endpoint->state]));
+    fl_value_set_string_take(
+        value, "sources", fl_value_new_int(int64_t(endpoint->sources.size())));
+    fl_value_set_string_take(value, "albums",
+                             fl_value_new_int(int64_t(endpoint->albums.size())));
+    fl_value_set_string_take(value, "connects",
+                             fl_value_new_int(endpoint->connects));
+    fl_value_set_string_take(
+        value, "batched",
+        fl_value_new_bool(endpoint->ws != nullptr &&
+                          endpoint->ws->protocol_accepted()));
+    fl_value_set_string_take(value, "messages",
+                             fl_value_new_int(endpoint->messages));
+    fl_value_set_string_take(value, "updates",
+                             fl_value_new_int(endpoint->updates));
+    fl_value_set_string_take(value, "bytesIn",
+                             fl_value_new_int(endpoint->bytes_in));
+    fl_value_set_string_take(value, "lastError",
+                             fl_value_new_string(endpoint->last_error.c_str()));
+    fl_value_append_take(endpoints, value);
+  }
+
+  FlValue* result = fl_value_new_map();
+  fl_value_set_string_take(result, "sources", sources);
+  fl_value_set_string_take(result, "endpoints", endpoints);
+  fl_value_set_string_take(result, "queued",
+                           fl_value_new_int(int64_t(queue_.size())));
+  fl_value_set_string_take(result, "inFlight", fl_value_new_int(in_flight_));
+  fl_value_set_string_take(result, "syncing",
+                           fl_value_new_int(syncs_in_flight_));
+  fl_value_set_string_take(result, "httpRequests",
+                           fl_value_new_int(http_requests_));
+  fl_value_set_string_take(result, "httpConnections",
+                           fl_value_new_int(http_connections_));
+  fl_value_set_string_take(result, "wakeups", fl_value_new_int(wakeups_));
+  fl_value_set_string_take(result, "loopCpuMicros",
+                           fl_value_new_int(loop_cpu_us_));
+  return result;
+}
+
+FlValue* SubscriptionHub::Benchmark(const std::string& server,
+                                    const std::vector<int64_t>& counts,
+                                    int idle_ms) {
+  // A hub of its own with no pipeline, so only following costs anything.
+  // Its albums are empty, so each source's catch-up is a single page.
+  WorkerPool pool(kMaxSyncs);
+  SubscriptionHub hub(nullptr, nullptr, &pool);
+  std::string run = std::to_string(g_get_real_time());
+  FlValue* rows = fl_value_new_list();
+
+  for (int64_t count : counts) {
+    int64_t heap_before = HeapBytes();
+    int64_t rss_before = MemoryGovernor::ResidentBytes();
+    int64_t cpu_before = 0, requests_before = 0, connections_before = 0;
+    hub.RunAndWait([&]() {
+      cpu_before = ThreadCpuMicros();
+      requests_before = hub.http_requests_;
+      connections_before = hub.http_connections_;
+    });
+
+    int64_t start = g_get_monotonic_time();
+    for (int64_t i = 0; i < count; i++) {
+      Source source;
+      source.id = "bench-" + std::to_string(i);
+      source.server = server;
+      source.album = "bench-" + run + "-" + std::to_string(i);
+      std::string error;
+      hub.AddSource(source, &error);
+    }
+    bool ready = false;
+    std::string endpoint_error;
+    while (!ready && g_get_monotonic_time() - start < 60 * 1000000LL) {
+      g_usleep(5000);
+      hub.RunAndWait([&]() {
+        ready = hub.sources_.size() == size_t(count);
+        for (auto& entry : hub.sources_) {
+          ready = ready && entry.second->caught_up;
+        }
+        for (auto& entry : hub.endpoints_) {
+          endpoint_error = entry.second->last_error;
+        }
+      });
+    }
+    int64_t ready_us = g_get_monotonic_time() - start;
+    int64_t heap_after = HeapBytes();
+    int64_t rss_after = MemoryGovernor::ResidentBytes();
+    int64_t cpu_ready = 0, requests = 0, connections = 0, messages = 0;
+    hub.RunAndWait([&]() {
+      cpu_ready = ThreadCpuMicros();
+      requests = hub.http_requests_ - requests_before;
+      connections = hub.http_connections_ - connections_before;
+      for (auto& entry : hub.endpoints_) messages += entry.second->messages;
+    });
+    g_usleep(gulong(idle_ms) * 1000);
+    int64_t cpu_idle = 0;
+    hub.RunAndWait([&]() { cpu_idle = ThreadCpuMicros(); });
+
+    for (int64_t i = 0; i < count; i++) {
+      hub.RemoveSource("bench-" + std::to_string(i));
+    }
+    bool drained = false;
+    while (!drained) {
+      hub.RunAndWait([&]() {
+        drained = hub.endpoints_.empty() && hub.syncs_in_flight_ == 0;
+      });
+      if (!drained) g_usleep(5000);
+    }
+
+    FlValue* row = fl_value_new_map();
+    fl_value_set_string_take(row, "sources", fl_value_new_int(count));
+    fl_value_set_string_take(row, "ready", fl_value_new_bool(ready));
+    fl_value_set_string_take(row, "error",
+                             fl_value_new_string(endpoint_error.c_str()));
+    fl_value_set_string_take(row, "readyMicros", fl_value_new_int(ready_us));
+    fl_value_set_string_take(
+        row, "heapBytesPerSource",
+        fl_value_new_int(heap_before < 0 ? -1
+                                         : (heap_after - heap_before) / count));
+    fl_value_set_string_take(row, "rssBytesPerSource",
+                             fl_value_new_int((rss_after - rss_before) / count));
+    fl_value_set_string_take(
+        row, "loopCpuMicrosPerSource",
+        fl_value_new_int((cpu_ready - cpu_before) / count));
+    fl_value_set_string_take(
+        row, "idleLoopCpuMicrosPerSecond",
+        fl_value_new_int((cpu_idle - cpu_ready) * 1000 / std::max(1, idle_ms)));
+    fl_value_set_string_take(row, "messages", fl_value_new_int(messages));
+    fl_value_set_string_take(row, "httpRequests", fl_value_new_int(requests));
+    fl_value_set_string_take(row, "httpConnections",
+                             fl_value_new_int(connections));
+    fl_value_append_take(rows, row);
+  }
+  return rows;
+}
+
+void SubscriptionHub::RegisterChannel(FlBinaryMessenger* messenger,
+                                      const std::string& default_directory) {
+  Post([this, default_directory]() { default_directory_ = default_directory; });
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  FlMethodChannel* channel = fl_method_channel_new(
+      messenger, "com.rabee.omran.subscriptions", FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        SubscriptionHub* self = static_cast<SubscriptionHub*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+
+        if (strcmp(method, "addSource") == 0) {
+          Source source;
+          source.id = ArgString(args, "id");
+          source.server = ArgString(args, "server");
+          source.album = ArgString(args, "album");
+          source.directory = ArgString(args, "directory");
+          source.priority = int(ArgInt(args, "priority"));
+          source.cursor = ArgInt(args, "cursor", -1);
+          std::string error;
+          if (!self->AddSource(source, &error)) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         error.c_str(), nullptr, nullptr);
+            return;
+          }
+          fl_method_call_respond_success(method_call, nullptr, nullptr);
+        } else if (strcmp(method, "removeSource") == 0) {
+          self->RemoveSource(ArgString(args, "id"));
+          fl_method_call_respond_success(method_call, nullptr, nullptr);
+        } else if (strcmp(method, "stats") == 0) {
+          FlValue* stats = nullptr;
+          self->RunAndWait([self, &stats]() { stats = self->Stats(); });
+          fl_method_call_respond_success(method_call, stats, nullptr);
+          fl_value_unref(stats);
+        } else if (strcmp(method, "benchmark") == 0) {
+          std::string server = ArgString(args, "server");
+          std::vector<int64_t> counts;
+          FlValue* list = fl_value_lookup_string(args, "counts");
+          if (list != nullptr && fl_value_get_type(list) == FL_VALUE_TYPE_LIST) {
+            for (size_t i = 0; i < fl_value_get_length(list); i++) {
+              FlValue* count = fl_value_get_list_value(list, i);
+              if (fl_value_get_type(count) == FL_VALUE_TYPE_INT &&
+                  fl_value_get_int(count) > 0) {
+                counts.push_back(fl_value_get_int(count));
+              }
+            }
+          }
+          std::string origin, host, prefix;
+          if (!SplitServer(server, &origin, &host, &prefix) || counts.empty()) {
+            fl_method_call_respond_error(
+                method_call, "BAD_ARGS",
+                "server (an http or https URL) and counts are required",
+                nullptr, nullptr);
+            return;
+          }
+          int idle_ms = int(ArgInt(args, "idleMillis", 2000));
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, server, counts, idle_ms]() {
+            RespondSuccessLater(method_call,
+                                self->Benchmark(server, counts, idle_ms));
+          });
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+  channel_ = channel;
+}
@@ -0,0 +1,267 @@
+#ifndef RUNNER_SUBSCRIPTION_HUB_H_
+#define RUNNER_SUBSCRIPTION_HUB_H_
+
+#include <curl/curl.h>
+#include <flutter_linux/flutter_linux.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "photo_pipeline.h"
+#include "state_store.h"
+#include "worker_pool.h"
+#include "ws_connection.h"
+
+/**
+ * Follows any number of photo sources, each one album on one server, from a
+ * single epoll thread.
+ *
+ * Sources on the same server share one WebSocket and subscribe to their
+ * albums over it. Connections are opened by libcurl through one share
+ * handle, so DNS answers, TLS sessions and the keep-alive connections used
+ * for catching up are shared by every source too. After each (re)connect a
+ * source subscribes first and then pages through /api/photo/sync/ from its
+ * cursor, so nothing published while it was away is missed.
+ *
+ * A source's cursor is the newest photo id below which everything has been
+ * saved; it is kept in the state store. When photos queue up for the
+ * pipeline, sources with a higher priority go first.
+ */
+class SubscriptionHub {
+ public:
+  struct Source {
+    std::string id;         // Chosen by the app; names the stored cursor.
+    std::string server;     // Origin, e.g. "https://example.com".
+    std::string album;      // "" for the server's default album.
+    std::string directory;  // Where photos are saved; "" for the default.
+    int priority = 0;
+    int64_t cursor = -1;  // -1 resumes from the stored cursor, if any.
+  };
+
+  // |pipeline| may be null to only follow sources, e.g. for benchmarks.
+  // |state| may be null to keep cursors in memory.
+  SubscriptionHub(PhotoPipeline* pipeline, StateStore* state, WorkerPool* pool);
+  ~SubscriptionHub();
+
+  SubscriptionHub(const SubscriptionHub&) = delete;
+  SubscriptionHub& operator=(const SubscriptionHub&) = delete;
+
+  // Adds |source|, or updates the one with its id. Thread-safe.
+  bool AddSource(const Source& source, std::string* error);
+  void RemoveSource(const std::string& id);
+
+  // Exposes the hub on the "com.rabee.omran.subscriptions" channel. Saved
+  // photos are reported to Dart with "photoSaved".
+  void RegisterChannel(FlBinaryMessenger* messenger,
+                       const std::string& default_directory);
+
+ private:
+  struct Endpoint;
+
+  struct SourceState {
+    Source config;
+    Endpoint* endpoint = nullptr;
+    int64_t cursor = 0;
+    int64_t newest = 0;             // Highest id ever queued.
+    std::set<int64_t> outstanding;  // Queued or in the pipeline.
+    std::set<int64_t> saved_ahead;  // Done, but past the cursor.
+
+    bool subscribed = false;
+    // Catch-up: pages run from the cursor up to |synced_to|, until one
+    // says nothing follows. Bumping |sync_epoch| discards pages in flight.
+    bool caught_up = false;
+    bool sync_queued = false;
+    bool syncing = false;
+    bool sync_more = false;
+    int sync_epoch = 0;
+    int sync_failures = 0;
+    int64_t synced_to = 0;
+
+    bool cursor_dirty = false;
+    int64_t live = 0;  // Photos announced over the socket.
+    int64_t synced = 0;
+    int64_t saved = 0;
+    int64_t failed = 0;
+    std::string last_error;
+  };
+
+  struct Endpoint {
+    enum State { kIdle, kConnecting, kOpen, kBackoff };
+
+    std::string origin;  // Scheme, host and port.
+    std::string host;    // As sent in Host:.
+    std::string prefix;  // Path the backend is mounted under, if any.
+    std::vector<SourceState*> sources;
+    std::set<std::string> requested;  // Albums asked for on this socket.
+    std::set<std::string> albums;     // As the server last confirmed.
+    bool subscriptions_dirty = false;
+
+    State state = kIdle;
+    int generation = 0;  // Of the connection attempt; stale ones are dropped.
+    CURL* curl = nullptr;
+    curl_socket_t fd = CURL_SOCKET_BAD;
+    bool want_write = false;
+    std::unique_ptr<WsConnection> ws;
+    std::string outgoing;
+    int failures = 0;
+    int64_t retry_us = 0;
+    int64_t last_read_us = 0;
+    int64_t ping_us = 0;
+    std::string last_error;
+
+    int64_t connects = 0;
+    int64_t messages = 0;
+    int64_t updates = 0;  // photo_updates, several to a batched message.
+    int64_t bytes_in = 0;
+  };
+
+  // A photo waiting for the pipeline; higher priority first, then oldest.
+  struct Pending {
+    int priority = 0;
+    uint64_t sequence = 0;
+    std::string source_id;
+    PhotoPipeline::Request request;
+    int attempts = 0;
+
+    bool operator<(const Pending& other) const {
+      if (priority != other.priority) return priority < other.priority;
+      return sequence > other.sequence;
+    }
+  };
+
+  struct SyncPage {
+    bool ok = false;
+    std::vector<PhotoPipeline::Request> photos;
+    int64_t cursor = -1;
+    bool has_more = false;
+    std::string error;
+  };
+
+  // Tasks for the hub thread. Shared with pipeline callbacks, which may
+  // outlive the hub; once it is closed they are dropped.
+  struct Mailbox {
+    std::mutex mutex;
+    std::vector<std::function<void()>> tasks;
+    int wake_fd = -1;
+    bool closed = false;
+  };
+
+  class MessageSink;
+
+  static void Deliver(const std::shared_ptr<Mailbox>& mailbox,
+                      std::function<void()> task);
+  static void Wake(const std::shared_ptr<Mailbox>& mailbox);
+  // Runs |task| on the hub thread.
+  void Post(std::function<void()> task);
+  // Runs |task| on the hub thread and waits for it; not from the hub thread.
+  void RunAndWait(std::function<void()> task);
+  // Runs blocking |task| on |pool_|; the destructor waits for it.
+  void RunBlocking(std::function<void()> task);
+
+  void Loop();
+  int TimeoutMillis(int64_t now_us);
+  void RunTimers(int64_t now_us);
+
+  void AddOnLoop(const Source& config);
+  void RemoveOnLoop(const std::string& id);
+  void Detach(SourceState* source);
+
+  void Connect(Endpoint* endpoint);
+  CURL* OpenConnection(const std::string& origin, std::string* error);
+  void OnConnected(const std::string& key, int generation, CURL* curl,
+                   const std::string& error);
+  void Fail(Endpoint* endpoint, const std::string& error);
+  void Close(Endpoint* endpoint);
+  void OnReadable(Endpoint* endpoint);
+  void Send(Endpoint* endpoint, const std::string& data);
+  void Flush(Endpoint* endpoint);
+  void FlushSubscriptions(Endpoint* endpoint);
+  void SendSubscription(Endpoint* endpoint, const char* type,
+                        const std::vector<std::string>& albums);
+  void OnMessage(Endpoint* endpoint, const char* data, size_t size,
+                 bool binary);
+  void OnPhotoBatch(Endpoint* endpoint, const char* data, size_t size);
+  void OnPhotoUpdate(Endpoint* endpoint, const PhotoPipeline::Request& request,
+                     const std::string& album);
+  static std::string MediaUrl(const Endpoint* endpoint);
+
+  void OnSubscribed(SourceState* source);
+  void QueueSync(SourceState* source);
+  void StartSyncs();
+  // Blocking; run on |pool_|.
+  bool FetchSyncPage(const std::string& url, const std::string& media_url,
+                     SyncPage* page);
+  void OnSyncPage(const std::string& source_id, int epoch,
+                  const SyncPage& page);
+  static int AbortIfStopping(void* user_data, curl_off_t, curl_off_t,
+                             curl_off_t, curl_off_t);
+
+  // Returns false for photos the source already has.
+  bool Enqueue(SourceState* source, PhotoPipeline::Request request);
+  void Dispatch(int64_t now_us);
+  void OnSaved(Pending pending, const PhotoPipeline::Result& result);
+  void NotifySaved(SourceState* source, const PhotoPipeline::Request& request,
+                   const PhotoPipeline::Result& result);
+  void AdvanceCursor(SourceState* source);
+  std::vector<StateStore::Mutation> DirtyCursors();
+  void PersistCursors();
+
+  FlValue* Stats();
+  FlValue* Benchmark(const std::string& server,
+                     const std::vector<int64_t>& counts, int idle_ms);
+
+  static void LockShare(CURL*, curl_lock_data data, curl_lock_access,
+                        void* user_data);
+  static void UnlockShare(CURL*, curl_lock_data data, void* user_data);
+
+  PhotoPipeline* pipeline_;
+  StateStore* state_;
+  WorkerPool* pool_;
+
+  CURLSH* share_ = nullptr;
+  std::mutex share_locks_[CURL_LOCK_DATA_LAST];
+  std::atomic<int64_t> http_requests_{0};
+  std::atomic<int64_t> http_connections_{0};  // New ones only.
+  FlJsonMessageCodec* json_ = nullptr;
+
+  int epoll_fd_ = -1;
+  std::thread thread_;
+  std::atomic<bool> stopping_{false};
+  std::shared_ptr<Mailbox> mailbox_;
+  std::mutex blocking_mutex_;
+  std::condition_variable blocking_cv_;
+  int blocking_tasks_ = 0;
+
+  // Hub thread only from here on.
+  std::map<std::string, std::unique_ptr<SourceState>> sources_;
+  std::map<std::string, std::unique_ptr<Endpoint>> endpoints_;
+  std::priority_queue<Pending> queue_;
+  uint64_t next_sequence_ = 0;
+  int next_generation_ = 0;
+  int in_flight_ = 0;
+  int64_t dispatch_retry_us_ = 0;
+  std::deque<std::string> sync_queue_;
+  std::multimap<int64_t, std::string> sync_retries_;  // Due time, source.
+  int syncs_in_flight_ = 0;
+  bool dirty_cursors_ = false;
+  bool persisting_ = false;
+  int64_t persist_us_ = 0;
+  int64_t loop_cpu_us_ = 0;
+  int64_t wakeups_ = 0;
+  std::string default_directory_;
+
+  std::atomic<FlMethodChannel*> channel_{nullptr};
+};
+
+#endif  // RUNNER_SUBSCRIPTION_HUB_H_
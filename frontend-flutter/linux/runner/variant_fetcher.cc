@@ -0,0 +1,422 @@
+#include "variant_fetcher.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <utility>
+
+#include "channel_utils.h"
+#include "image_decoder.h"
+
+namespace {
+
+const size_t kMaxVariantBytes = 512u * 1024 * 1024;
+// Room for a few hundred display-sized variants.
+const int64_t kMaxCacheBytes = int64_t(256) << 20;
+// What a photo card decodes at on a typical 2x display.
+const int kBenchmarkPreviewSize = 540;
+const int64_t kBenchmarkFirstBudgetUs = 300000;
+const int64_t kBenchmarkUpgradeBudgetUs = 8000000;
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+struct Sink {
+  std::vector<uint8_t>* data;
+  int64_t max_bytes_per_second;
+  int64_t start_us;
+};
+
+size_t AppendToSink(char* data, size_t size, size_t count, void* user_data) {
+  Sink* sink = static_cast<Sink*>(user_data);
+  size_t bytes = size * count;
+  if (sink->data->size() + bytes > kMaxVariantBytes) return 0;  // Aborts.
+  sink->data->insert(sink->data->end(), data, data + bytes);
+  if (sink->max_bytes_per_second > 0) {
+    // Reading no faster than the limit lets the TCP window close, which
+    // throttles the sender the way a slow link would.
+    int64_t due_us = sink->start_us + int64_t(sink->data->size()) * 1000000 /
+                                          sink->max_bytes_per_second;
+    int64_t now_us = NowMicros();
+    if (due_us > now_us) usleep(useconds_t(due_us - now_us));
+  }
+  return bytes;
+}
+
+// Last path segment of |url|, without query or fragment.
+std::string UrlBasename(const std::string& url) {
+  std::string path = url.substr(0, url.find_first_of("?#"));
+  size_t slash = path.rfind('/');
+  return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+// Cache file name for |candidate|: a hash of the whole URL, since variants
+// of different photos often share a basename, then the listed size so a
+// re-encoded copy at the same URL is not taken for the old one. The
+// extension is kept for anything that goes by it.
+std::string CacheName(const VariantFetcher::Candidate& candidate) {
+  gchar* hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256,
+                                              candidate.url.c_str(), -1);
+  std::string name = std::string(hash) + "-" + std::to_string(candidate.size);
+  g_free(hash);
+  std::string basename = UrlBasename(candidate.url);
+  size_t dot = basename.rfind('.');
+  if (dot != std::string::npos && dot > 0) name += basename.substr(dot);
+  return name;
+}
+
+bool ParseCandidates(FlValue* args, std::vector<VariantFetcher::Candidate>* out) {
+  FlValue* list = fl_value_lookup_string(args, "candidates");
+  if (list == nullptr || fl_value_get_type(list) != FL_VALUE_TYPE_LIST) {
+    return false;
+  }
+  for (size_t i = 0; i < fl_value_get_length(list); i++) {
+    FlValue* item = fl_value_get_list_value(list, i);
+    if (fl_value_get_type(item) != FL_VALUE_TYPE_MAP) return false;
+    VariantFetcher::Candidate candidate;
+    candidate.url = ArgString(item, "url");
+    candidate.size = ArgInt(item, "size");
+    if (candidate.url.empty()) return false;
+    out->push_back(candidate);
+  }
+  return !out->empty();
+}
+
+int64_t DisplayMicros(const std::string& path) {
+  int64_t start = NowMicros();
+  DecodedImage image;
+  std::string error;
+  DecodeScaledImage(path, kBenchmarkPreviewSize, &image, &error);
+  return NowMicros() - start;
+}
+
+}  // namespace
+
+VariantFetcher::VariantFetcher(std::string cache_dir, LinkEstimator* link)
+    : cache_dir_(std::move(cache_dir)), link_(link) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  g_mkdir_with_parents(cache_dir_.c_str(), 0700);
+}
+
+VariantFetcher::~VariantFetcher() {
+  if (benchmark_thread_.joinable()) benchmark_thread_.join();
+  if (channel_ != nullptr) g_object_unref(channel_);
+  curl_global_cleanup();
+}
+
+bool VariantFetcher::Download(const std::string& url,
+                              int64_t max_bytes_per_second,
+                              std::vector<uint8_t>* data, std::string* error) {
+  CURL* curl = curl_easy_init();
+  if (curl == nullptr) {
+    *error = "curl_easy_init failed";
+    return false;
+  }
+  curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1024L);
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, 30L);
+  Sink sink = {data, max_bytes_per_second, NowMicros()};
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, AppendToSink);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &sink);
+  if (max_bytes_per_second > 0) {
+    // Small reads keep the pacing smooth.
+    curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 4096L);
+  }
+  CURLcode code = curl_easy_perform(curl);
+  curl_easy_cleanup(curl);
+  if (code != CURLE_OK) {
+    *error = curl_easy_strerror(code);
+    return false;
+  }
+  return true;
+}
+
+bool VariantFetcher::Fetch(const std::vector<Candidate>& candidates,
+                           int64_t budget_us, int min_index, Result* result,
+                           std::string* error) {
+  std::vector<int64_t> sizes;
+  for (const Candidate& candidate : candidates) sizes.push_back(candidate.size);
+  int index = link_->Choose(sizes, budget_us, min_index);
+  if (index < 0) {
+    *error = "No candidates";
+    return false;
+  }
+  const Candidate& chosen = candidates[size_t(index)];
+  result->index = index;
+  result->path = cache_dir_ + "/" + CacheName(chosen);
+
+  // Without a listed size there is nothing to check a cached file against,
+  // so it is fetched again.
+  struct stat info;
+  if (chosen.size > 0 && stat(result->path.c_str(), &info) == 0 &&
+      info.st_size == chosen.size) {
+    result->bytes = info.st_size;
+    result->cache_hit = true;
+    Use(result->path, result->bytes);
+    return true;
+  }
+
+  std::vector<uint8_t> data;
+  int64_t start = NowMicros();
+  if (!Download(chosen.url, 0, &data, error)) return false;
+  result->micros = NowMicros() - start;
+  result->bytes = int64_t(data.size());
+  link_->RecordTransfer(result->bytes, result->micros);
+
+  GError* gerror = nullptr;
+  if (!g_file_set_contents(result->path.c_str(),
+                           reinterpret_cast<const gchar*>(data.data()),
+                           gssize(data.size()), &gerror)) {
+    *error = gerror != nullptr ? gerror->message : "Cannot write variant";
+    g_clear_error(&gerror);
+    return false;
+  }
+  Use(result->path, result->bytes);
+  return true;
+}
+
+void VariantFetcher::LoadCacheLocked() {
+  cache_loaded_ = true;
+  GDir* dir = g_dir_open(cache_dir_.c_str(), 0, nullptr);
+  if (dir == nullptr) return;
+  std::vector<std::pair<int64_t, std::string>> files;  // (mtime, path)
+  const gchar* name;
+  while ((name = g_dir_read_name(dir)) != nullptr) {
+    std::string path = cache_dir_ + "/" + name;
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) continue;
+    files.emplace_back(
+        int64_t(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec,
+        path);
+    cache_bytes_ += info.st_size;
+    cache_[path].bytes = info.st_size;
+  }
+  g_dir_close(dir);
+  std::sort(files.begin(), files.end());
+  for (const auto& file : files) {
+    lru_.push_front(file.second);
+    cache_[file.second].position = lru_.begin();
+  }
+}
+
+void VariantFetcher::Use(const std::string& path, int64_t bytes) {
+  // Hits bump the mtime so the order is still known after a restart.
+  utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  if (!cache_loaded_) LoadCacheLocked();
+  auto it = cache_.find(path);
+  if (it != cache_.end()) {
+    cache_bytes_ -= it->second.bytes;
+    lru_.erase(it->second.position);
+  }
+  lru_.push_front(path);
+  cache_[path] = CacheEntry{lru_.begin(), bytes};
+  cache_bytes_ += bytes;
+  // Unlinking under the lock keeps a fetch of the same file from racing it.
+  while (cache_bytes_ > kMaxCacheBytes && lru_.size() > 1) {
+    auto victim = cache_.find(lru_.back());
+    unlink(victim->first.c_str());
+    cache_bytes_ -= victim->second.bytes;
+    cache_.erase(victim);
+    lru_.pop_back();
+    evicted_files_++;
+  }
+}
+
+FlValue* VariantFetcher::Benchmark(const std::vector<Candidate>& candidates,
+                                   const std::vector<int64_t>& rates) {
+  std::string dir = cache_dir_ + "/benchmark";
+  g_mkdir_with_parents(dir.c_str(), 0700);
+  std::vector<int64_t> sizes;
+  for (const Candidate& candidate : candidates) sizes.push_back(candidate.size);
+  int original = int(candidates.size()) - 1;
+
+  // Downloads candidate |index| at |rate| and returns the microseconds until
+  // it is decoded for display, or -1.
+  auto visible_after = [&](int index, int64_t rate, LinkEstimator* link) {
+    std::vector<uint8_t> data;
+    std::string error;
+    int64_t start = NowMicros();
+    if (!Download(candidates[size_t(index)].url, rate, &data, &error)) {
+      return int64_t(-1);
+    }
+    int64_t download_us = NowMicros() - start;
+    if (link != nullptr) link->RecordTransfer(int64_t(data.size()), download_us);
+    std::string path = dir + "/" + UrlBasename(candidates[size_t(index)].url);
+    if (!g_file_set_contents(path.c_str(),
+                             reinterpret_cast<const gchar*>(data.data()),
+                             gssize(data.size()), nullptr)) {
+      return int64_t(-1);
+    }
+    int64_t visible_us = download_us + DisplayMicros(path);
+    unlink(path.c_str());
+    return visible_us;
+  };
+
+  FlValue* runs = fl_value_new_list();
+  for (int64_t rate : rates) {
+    // Throttled loopback says nothing about the real interface, so each run
+    // learns from its own transfers only.
+    LinkEstimator link(false);
+    int64_t original_us = visible_after(original, rate, nullptr);
+    int first = link.Choose(sizes, kBenchmarkFirstBudgetUs);
+    int64_t first_us = visible_after(first, rate, &link);
+    int upgrade = link.Choose(sizes, kBenchmarkUpgradeBudgetUs, first + 1);
+    int64_t upgrade_us = upgrade > first ? visible_after(upgrade, rate, &link)
+                                         : int64_t(0);
+    // What the next photo would start with, now that the link is known.
+    int informed = link.Choose(sizes, kBenchmarkFirstBudgetUs);
+
+    FlValue* run = fl_value_new_map();
+    fl_value_set_string_take(run, "bytesPerSecond", fl_value_new_int(rate));
+    fl_value_set_string_take(run, "originalVisibleMicros",
+                             fl_value_new_int(original_us));
+    fl_value_set_string_take(run, "firstIndex", fl_value_new_int(first));
+    fl_value_set_string_take(run, "firstVisibleMicros",
+                             fl_value_new_int(first_us));
+    fl_value_set_string_take(run, "upgradeIndex", fl_value_new_int(upgrade));
+    fl_value_set_string_take(
+        run, "upgradeVisibleMicros",
+        fl_value_new_int(upgrade_us > 0 ? first_us + upgrade_us : 0));
+    fl_value_set_string_take(run, "informedFirstIndex",
+                             fl_value_new_int(informed));
+    fl_value_set_string_take(
+        run, "estimatedBytesPerSecond",
+        fl_value_new_float(link.EstimateBytesPerSecond()));
+    fl_value_append_take(runs, run);
+  }
+  rmdir(dir.c_str());
+
+  FlValue* result = fl_value_new_map();
+  fl_value_set_string_take(result, "runs", runs);
+  return result;
+}
+
+void VariantFetcher::RegisterChannel(FlBinaryMessenger* messenger,
+                                     WorkerPool* pool) {
+  pool_ = pool;
+  g_autoptr(FlStandardMethodCodec) codec = fl_standard_method_codec_new();
+  channel_ = fl_method_channel_new(messenger, "com.rabee.omran.variants",
+                                   FL_METHOD_CODEC(codec));
+  fl_method_channel_set_method_call_handler(
+      channel_,
+      [](FlMethodChannel* channel, FlMethodCall* method_call,
+         gpointer user_data) {
+        VariantFetcher* self = static_cast<VariantFetcher*>(user_data);
+        const gchar* method = fl_method_call_get_name(method_call);
+        FlValue* args = fl_method_call_get_args(method_call);
+
+        if (strcmp(method, "fetch") == 0) {
+          std::vector<Candidate> candidates;
+          if (!ParseCandidates(args, &candidates)) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         "candidates are required", nullptr,
+                                         nullptr);
+            return;
+          }
+          int64_t budget_us = ArgInt(args, "budgetMillis", 300) * 1000;
+          int min_index = int(ArgInt(args, "minIndex"));
+          g_object_ref(method_call);
+          self->pool_->Post([self, method_call, candidates, budget_us,
+                             min_index]() {
+            Result result;
+            std::string error;
+            if (!self->Fetch(candidates, budget_us, min_index, &result,
+                             &error)) {
+              RespondErrorLater(method_call, "FETCH_FAILED", error);
+              return;
+            }
+            FlValue* value = fl_value_new_map();
+            fl_value_set_string_take(value, "path",
+                                     fl_value_new_string(result.path.c_str()));
+            fl_value_set_string_take(value, "index",
+                                     fl_value_new_int(result.index));
+            fl_value_set_string_take(value, "bytes",
+                                     fl_value_new_int(result.bytes));
+            fl_value_set_string_take(value, "micros",
+                                     fl_value_new_int(result.micros));
+            fl_value_set_string_take(value, "cacheHit",
+                                     fl_value_new_bool(result.cache_hit));
+            RespondSuccessLater(method_call, value);
+          });
+        } else if (strcmp(method, "estimate") == 0) {
+          LinkEstimator::Snapshot snapshot = self->link_->snapshot();
+          g_autoptr(FlValue) value = fl_value_new_map();
+          fl_value_set_string_take(
+              value, "interface",
+              fl_value_new_string(snapshot.interface.c_str()));
+          fl_value_set_string_take(
+              value, "transferBytesPerSecond",
+              fl_value_new_float(snapshot.transfer_bytes_per_second));
+          fl_value_set_string_take(
+              value, "counterBytesPerSecond",
+              fl_value_new_float(snapshot.counter_bytes_per_second));
+          fl_value_set_string_take(
+              value, "estimateBytesPerSecond",
+              fl_value_new_float(snapshot.estimate_bytes_per_second));
+          fl_value_set_string_take(value, "transfers",
+                                   fl_value_new_int(snapshot.transfers));
+          {
+            std::lock_guard<std::mutex> lock(self->cache_mutex_);
+            fl_value_set_string_take(value, "cacheBytes",
+                                     fl_value_new_int(self->cache_bytes_));
+            fl_value_set_string_take(
+                value, "cacheFiles",
+                fl_value_new_int(int64_t(self->cache_.size())));
+            fl_value_set_string_take(value, "cacheEvictions",
+                                     fl_value_new_int(self->evicted_files_));
+          }
+          fl_method_call_respond_success(method_call, value, nullptr);
+        } else if (strcmp(method, "benchmark") == 0) {
+          std::vector<Candidate> candidates;
+          FlValue* rate_list = fl_value_lookup_string(args, "rates");
+          if (!ParseCandidates(args, &candidates) || rate_list == nullptr ||
+              fl_value_get_type(rate_list) != FL_VALUE_TYPE_LIST) {
+            fl_method_call_respond_error(method_call, "BAD_ARGS",
+                                         "candidates and rates are required",
+                                         nullptr, nullptr);
+            return;
+          }
+          std::vector<int64_t> rates;
+          for (size_t i = 0; i < fl_value_get_length(rate_list); i++) {
+            FlValue* rate = fl_value_get_list_value(rate_list, i);
+            if (fl_value_get_type(rate) == FL_VALUE_TYPE_INT) {
+              rates.push_back(fl_value_get_int(rate));
+            }
+          }
+          // Throttled runs take minutes, so they get a thread of their own
+          // rather than holding a pool thread.
+          if (self->benchmark_running_) {
+            fl_method_call_respond_error(method_call, "BUSY",
+                                         "A benchmark is already running",
+                                         nullptr, nullptr);
+            return;
+          }
+          if (self->benchmark_thread_.joinable()) {
+            self->benchmark_thread_.join();
+          }
+          self->benchmark_running_ = true;
+          g_object_ref(method_call);
+          self->benchmark_thread_ =
+              std::thread([self, method_call, candidates, rates]() {
+                RespondSuccessLater(method_call,
+                                    self->Benchmark(candidates, rates));
+                self->benchmark_running_ = false;
+              });
+        } else {
+          fl_method_call_respond_not_implemented(method_call, nullptr);
+        }
+      },
+      this, nullptr);
+}
@@ -0,0 +1,97 @@
+#ifndef RUNNER_VARIANT_FETCHER_H_
+#define RUNNER_VARIANT_FETCHER_H_
+
+#include <curl/curl.h>
+#include <flutter_linux/flutter_linux.h>
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "link_estimator.h"
+#include "worker_pool.h"
+
+/**
+ * Picks which copy of a photo to download for display. The server lists
+ * downscaled variants next to the original; the smallest comes first when
+ * nothing is known about the link, so a photo is visible almost at once,
+ * and a larger one up to the original follows once the link estimate says
+ * it will arrive in time.
+ *
+ * Fetched files are kept in <cache_dir>, named after a hash of their URL
+ * and their listed size, so asking again for the same copy costs nothing.
+ * The directory is held to a byte budget by evicting the least recently
+ * used files; use is kept in each file's mtime so the order survives a
+ * restart.
+ */
+class VariantFetcher {
+ public:
+  struct Candidate {
+    std::string url;
+    int64_t size = 0;  // Bytes, as listed by the server.
+  };
+
+  struct Result {
+    std::string path;
+    int index = -1;  // Into the candidate list.
+    int64_t bytes = 0;
+    int64_t micros = 0;
+    bool cache_hit = false;
+  };
+
+  VariantFetcher(std::string cache_dir, LinkEstimator* link);
+  ~VariantFetcher();
+
+  VariantFetcher(const VariantFetcher&) = delete;
+  VariantFetcher& operator=(const VariantFetcher&) = delete;
+
+  // Downloads the largest of |candidates| (ascending by size) expected to
+  // arrive within |budget_us|, but at least the one at |min_index|.
+  // Blocking; call from a worker thread.
+  bool Fetch(const std::vector<Candidate>& candidates, int64_t budget_us,
+             int min_index, Result* result, std::string* error);
+
+  // Exposes the fetcher on the "com.rabee.omran.variants" channel.
+  void RegisterChannel(FlBinaryMessenger* messenger, WorkerPool* pool);
+
+ private:
+  // |max_bytes_per_second| > 0 throttles the transfer.
+  static bool Download(const std::string& url, int64_t max_bytes_per_second,
+                       std::vector<uint8_t>* data, std::string* error);
+
+  FlValue* Benchmark(const std::vector<Candidate>& candidates,
+                     const std::vector<int64_t>& rates);
+
+  // Marks the file at |path|, of |bytes|, as just used, then evicts the
+  // least recently used files until the cache fits its budget again. The
+  // file at |path| itself is never evicted.
+  void Use(const std::string& path, int64_t bytes);
+  void LoadCacheLocked();
+
+  struct CacheEntry {
+    std::list<std::string>::iterator position;
+    int64_t bytes;
+  };
+
+  std::string cache_dir_;
+  LinkEstimator* link_;
+
+  std::mutex cache_mutex_;
+  bool cache_loaded_ = false;
+  std::list<std::string> lru_;  // Paths, most recently used first.
+  std::unordered_map<std::string, CacheEntry> cache_;
+  int64_t cache_bytes_ = 0;
+  int64_t evicted_files_ = 0;
+
+  FlMethodChannel* channel_ = nullptr;
+  WorkerPool* pool_ = nullptr;
+  std::thread benchmark_thread_;
+  std::atomic<bool> benchmark_running_{false};
+};
+
+#endif  // RUNNER_VARIANT_FETCHER_H_
@@ -0,0 +1,44 @@
+#ifndef RUNNER_WORKER_POOL_H_
+#define RUNNER_WORKER_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed-size pool of background threads for blocking native work
+ * (image decoding, disk I/O) that must never run on the GTK main loop.
+ */
+class WorkerPool {
+ public:
+  explicit WorkerPool(size_t thread_count);
+  ~WorkerPool();
+
+  WorkerPool(const WorkerPool&) = delete;
+  WorkerPool& operator=(const WorkerPool&) = delete;
+
+  // Queues |task| to run on one of the pool threads.
+  void Post(std::function<void()> task);
+
+  size_t thread_count() const { return threads_.size(); }
+
+ private:
+  void Run();
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  std::vector<std::thread> threads_;
+  bool stopping_ = false;
+};
+
+/**
+ * Runs |task| on the GTK main thread. Safe to call from any thread; used to
+ * hand results from pool threads back to Flutter channels.
+ */
+void RunOnMainThread(std::function<void()> task);
+
+#endif  // RUNNER_WORKER_POOL_H_
@@ -0,0 +1,234 @@
+#include "ws_connection.h"
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include <strings.h>
+
+#include <cstring>
+
+namespace {
+
+const char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+// Nothing the backend sends comes close; anything bigger is a broken stream.
+const uint64_t kMaxMessageBytes = 16 * 1024 * 1024;
+
+std::string Base64(const unsigned char* data, size_t size) {
+  std::string out(4 * ((size + 2) / 3) + 1, '\0');
+  int written = EVP_EncodeBlock(reinterpret_cast<unsigned char*>(&out[0]),
+                                data, int(size));
+  out.resize(size_t(written));
+  return out;
+}
+
+std::string AcceptFor(const std::string& key) {
+  std::string input = key + kWebSocketGuid;
+  unsigned char digest[SHA_DIGEST_LENGTH];
+  SHA1(reinterpret_cast<const unsigned char*>(input.data()), input.size(),
+       digest);
+  return Base64(digest, sizeof(digest));
+}
+
+// Value of header |name| in the response head |head|, or empty.
+std::string HeaderValue(const std::string& head, const char* name) {
+  size_t name_length = strlen(name);
+  size_t line = head.find("\r\n");
+  while (line != std::string::npos && line + 2 < head.size()) {
+    size_t start = line + 2;
+    line = head.find("\r\n", start);
+    size_t end = line == std::string::npos ? head.size() : line;
+    if (end - start > name_length && head[start + name_length] == ':' &&
+        strncasecmp(head.data() + start, name, name_length) == 0) {
+      size_t value = start + name_length + 1;
+      while (value < end && (head[value] == ' ' || head[value] == '\t')) {
+        value++;
+      }
+      size_t value_end = end;
+      while (value_end > value && head[value_end - 1] == ' ') value_end--;
+      return head.substr(value, value_end - value);
+    }
+  }
+  return std::string();
+}
+
+}  // namespace
+
+std::string WsConnection::UpgradeRequest(const std::string& host,
+                                         const std::string& path,
+                                         const char* protocol) {
+  unsigned char nonce[16];
+  RAND_bytes(nonce, sizeof(nonce));
+  std::string key = Base64(nonce, sizeof(nonce));
+  std::string accept = AcceptFor(key);
+  memcpy(expected_accept_, accept.data(), sizeof(expected_accept_));
+  protocol_ = protocol;
+  std::string offer = protocol != nullptr
+                          ? std::string("Sec-WebSocket-Protocol: ") +
+                                protocol + "\r\n"
+                          : std::string();
+  return "GET " + path + " HTTP/1.1\r\n" + "Host: " + host +
+         "\r\n"
+         "Upgrade: websocket\r\n"
+         "Connection: Upgrade\r\n"
+         "Sec-WebSocket-Key: " +
+         key +
+         "\r\n"
+         "Sec-WebSocket-Version: 13\r\n" +
+         offer + "\r\n";
+}
+
+std::string WsConnection::Frame(uint8_t opcode, const char* data,
+                                size_t size) {
+  std::string frame;
+  frame.reserve(size + 14);
+  frame.push_back(char(0x80 | opcode));
+  if (size < 126) {
+    frame.push_back(char(0x80 | size));
+  } else if (size <= 0xffff) {
+    frame.push_back(char(0x80 | 126));
+    frame.push_back(char(size >> 8));
+    frame.push_back(char(size));
+  } else {
+    frame.push_back(char(0x80 | 127));
+    for (int shift = 56; shift >= 0; shift -= 8) {
+      frame.push_back(char(uint64_t(size) >> shift));
+    }
+  }
+  unsigned char mask[4];
+  RAND_bytes(mask, sizeof(mask));
+  frame.append(reinterpret_cast<char*>(mask), sizeof(mask));
+  for (size_t i = 0; i < size; i++) {
+    frame.push_back(char(data[i] ^ mask[i % 4]));
+  }
+  return frame;
+}
+
+bool WsConnection::ParseUpgrade(const char* data, size_t size,
+                                size_t* consumed) {
+  // The answer is tiny; collect it whole before looking at it.
+  size_t before = pending_.size();
+  pending_.append(data, size);
+  size_t end = pending_.find("\r\n\r\n");
+  if (end == std::string::npos) {
+    *consumed = size;
+    return pending_.size() < 8192;
+  }
+  std::string head = pending_.substr(0, end);
+  *consumed = end + 4 - before;
+  pending_.clear();
+  if (head.compare(0, 12, "HTTP/1.1 101") != 0) return false;
+  std::string accept = HeaderValue(head, "Sec-WebSocket-Accept");
+  if (accept.size() != sizeof(expected_accept_) ||
+      memcmp(accept.data(), expected_accept_, sizeof(expected_accept_)) != 0) {
+    return false;
+  }
+  // A server that ignores the offer speaks the default protocol; one that
+  // picks something never offered is broken.
+  std::string protocol = HeaderValue(head, "Sec-WebSocket-Protocol");
+  if (!protocol.empty() && (protocol_ == nullptr || protocol != protocol_)) {
+    return false;
+  }
+  protocol_accepted_ = !protocol.empty();
+  state_ = State::kOpen;
+  return true;
+}
+
+long WsConnection::ParseFrames(const char* data, size_t size, Sink* sink,
+                               std::string* reply) {
+  size_t offset = 0;
+  while (size - offset >= 2) {
+    const unsigned char* head =
+        reinterpret_cast<const unsigned char*>(data + offset);
+    bool fin = (head[0] & 0x80) != 0;
+    uint8_t opcode = head[0] & 0x0f;
+    bool masked = (head[1] & 0x80) != 0;
+    uint64_t length = head[1] & 0x7f;
+    size_t header = 2;
+    if (length == 126) {
+      if (size - offset < 4) break;
+      length = (uint64_t(head[2]) << 8) | head[3];
+      header = 4;
+    } else if (length == 127) {
+      if (size - offset < 10) break;
+      length = 0;
+      for (int i = 0; i < 8; i++) length = (length << 8) | head[2 + i];
+      header = 10;
+    }
+    // Servers never mask.
+    if (masked || length > kMaxMessageBytes) return -1;
+    if (size - offset - header < length) break;
+    const char* payload = data + offset + header;
+    offset += header + size_t(length);
+
+    switch (opcode) {
+      case kText:
+      case kBinary:
+        if (!message_.empty() || message_opcode_ != 0) return -1;
+        if (fin) {
+          sink->OnMessage(payload, size_t(length), opcode == kBinary);
+        } else {
+          message_opcode_ = opcode;
+          message_.assign(payload, size_t(length));
+        }
+        break;
+      case kContinuation:
+        if (message_opcode_ == 0) return -1;
+        message_.append(payload, size_t(length));
+        if (message_.size() > kMaxMessageBytes) return -1;
+        if (fin) {
+          sink->OnMessage(message_.data(), message_.size(),
+                          message_opcode_ == kBinary);
+          message_opcode_ = 0;
+          std::string().swap(message_);
+        }
+        break;
+      case kClose:
+        // Echo the status code back, as the closing handshake asks.
+        reply->append(Frame(kClose, payload, length >= 2 ? 2 : 0));
+        state_ = State::kClosed;
+        return -1;
+      case kPing:
+        reply->append(Frame(kPong, payload, size_t(length)));
+        break;
+      default:
+        // Unsolicited pongs are allowed; anything else is not.
+        if (opcode != kPong) return -1;
+    }
+  }
+  return long(offset);
+}
+
+bool WsConnection::Feed(const char* data, size_t size, Sink* sink,
+                        std::string* reply) {
+  if (state_ == State::kClosed) return false;
+  if (state_ == State::kUpgrading) {
+    size_t consumed = 0;
+    bool ok = ParseUpgrade(data, size, &consumed);
+    if (!ok) {
+      state_ = State::kClosed;
+      return false;
+    }
+    if (state_ == State::kUpgrading) return true;
+    data += consumed;
+    size -= consumed;
+  }
+
+  long consumed;
+  if (pending_.empty()) {
+    consumed = ParseFrames(data, size, sink, reply);
+    if (consumed >= 0) {
+      pending_.assign(data + consumed, size - size_t(consumed));
+    }
+  } else {
+    pending_.append(data, size);
+    consumed = ParseFrames(pending_.data(), pending_.size(), sink, reply);
+    if (consumed >= 0) pending_.erase(0, size_t(consumed));
+  }
+  if (consumed < 0) {
+    state_ = State::kClosed;
+    return false;
+  }
+  // Give the buffer back once it drains, so idle sockets stay small.
+  if (pending_.empty()) std::string().swap(pending_);
+  return true;
+}
@@ -0,0 +1,69 @@
+#ifndef RUNNER_WS_CONNECTION_H_
+#define RUNNER_WS_CONNECTION_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Client side of one WebSocket: builds the upgrade request, checks the
+ * server's answer and splits what arrives into messages, answering pings
+ * and closes. The caller owns the transport and does all I/O, so many of
+ * these can share one epoll loop; the subscription hub and ws_load both do.
+ * Kept small: a connection that is not mid-frame holds no heap memory.
+ */
+class WsConnection {
+ public:
+  enum Opcode : uint8_t {
+    kContinuation = 0x0,
+    kText = 0x1,
+    kBinary = 0x2,
+    kClose = 0x8,
+    kPing = 0x9,
+    kPong = 0xA,
+  };
+
+  class Sink {
+   public:
+    virtual ~Sink() = default;
+    // A complete text or binary message.
+    virtual void OnMessage(const char* data, size_t size, bool binary) = 0;
+  };
+
+  enum class State : uint8_t { kUpgrading, kOpen, kClosed };
+
+  // The GET that asks |host| to upgrade |path|, offering subprotocol
+  // |protocol| unless it is null; remembers the accept key the answer has to
+  // carry. |protocol| must outlive the connection.
+  std::string UpgradeRequest(const std::string& host, const std::string& path,
+                             const char* protocol = nullptr);
+
+  // Consumes |size| bytes read from the socket. Complete messages go to
+  // |sink|; frames to send back (pongs, the closing handshake) are appended
+  // to |reply|. Returns false once the connection is unusable: a refused
+  // upgrade, a protocol error or a close from the server.
+  bool Feed(const char* data, size_t size, Sink* sink, std::string* reply);
+
+  State state() const { return state_; }
+  // Whether the server took the offered subprotocol; known once open.
+  bool protocol_accepted() const { return protocol_accepted_; }
+
+  // A masked client frame carrying |size| bytes of |data|.
+  static std::string Frame(uint8_t opcode, const char* data, size_t size);
+
+ private:
+  bool ParseUpgrade(const char* data, size_t size, size_t* consumed);
+  // Parses frames from |data|; returns bytes consumed, or -1 on error.
+  long ParseFrames(const char* data, size_t size, Sink* sink,
+                   std::string* reply);
+
+  State state_ = State::kUpgrading;
+  uint8_t message_opcode_ = 0;
+  bool protocol_accepted_ = false;
+  const char* protocol_ = nullptr;
+  char expected_accept_[28] = {};
+  std::string pending_;  // Unparsed tail of the last read.
+  std::string message_;  // Fragments of a message not yet finished.
+};
+
+#endif  // RUNNER_WS_CONNECTION_H_
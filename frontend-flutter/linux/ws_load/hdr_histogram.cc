@@ -0,0 +1,90 @@
+#include "hdr_histogram.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+int Log2Ceiling(int64_t value) {
+  int magnitude = 0;
+  while ((int64_t(1) << magnitude) < value) magnitude++;
+  return magnitude;
+}
+
+}  // namespace
+
+HdrHistogram::HdrHistogram(int64_t highest, int significant_digits)
+    : highest_(std::max<int64_t>(highest, 2)) {
+  significant_digits = std::max(1, std::min(significant_digits, 5));
+  // Enough sub-buckets that neighbours differ by at most one unit in the
+  // last significant digit.
+  int64_t largest_single_unit = 2 * int64_t(std::pow(10, significant_digits));
+  int sub_bucket_count_magnitude = Log2Ceiling(largest_single_unit);
+  sub_bucket_half_count_magnitude_ =
+      std::max(sub_bucket_count_magnitude, 1) - 1;
+  int64_t sub_bucket_count = int64_t(1) << sub_bucket_count_magnitude;
+  sub_bucket_half_count_ = sub_bucket_count / 2;
+  sub_bucket_mask_ = sub_bucket_count - 1;
+
+  // Each bucket doubles the range covered by the one before it.
+  int bucket_count = 1;
+  int64_t covered = sub_bucket_count;
+  while (covered <= highest_) {
+    covered <<= 1;
+    bucket_count++;
+  }
+  counts_.assign(size_t(bucket_count + 1) * size_t(sub_bucket_half_count_), 0);
+}
+
+int HdrHistogram::CountsIndex(int64_t value) const {
+  int pow2_ceiling = 64 - __builtin_clzll(uint64_t(value | sub_bucket_mask_));
+  int bucket_index = pow2_ceiling - (sub_bucket_half_count_magnitude_ + 1);
+  int64_t sub_bucket_index = value >> bucket_index;
+  int64_t bucket_base = int64_t(bucket_index + 1)
+                        << sub_bucket_half_count_magnitude_;
+  return int(bucket_base + sub_bucket_index - sub_bucket_half_count_);
+}
+
+int64_t HdrHistogram::HighestEquivalentValue(int index) const {
+  int bucket_index = (index >> sub_bucket_half_count_magnitude_) - 1;
+  int64_t sub_bucket_index =
+      (index & (sub_bucket_half_count_ - 1)) + sub_bucket_half_count_;
+  if (bucket_index < 0) {
+    sub_bucket_index -= sub_bucket_half_count_;
+    bucket_index = 0;
+  }
+  int64_t lowest = sub_bucket_index << bucket_index;
+  return lowest + (int64_t(1) << bucket_index) - 1;
+}
+
+void HdrHistogram::Record(int64_t value) {
+  value = std::max<int64_t>(value, 1);
+  if (value > highest_) {
+    value = highest_;
+    saturated_++;
+  }
+  counts_[size_t(CountsIndex(value))]++;
+  count_++;
+  min_ = std::min(min_, value);
+  max_ = std::max(max_, value);
+  total_ += double(value);
+}
+
+double HdrHistogram::mean() const {
+  return count_ ? total_ / double(count_) : 0;
+}
+
+int64_t HdrHistogram::ValueAtPercentile(double percentile) const {
+  if (count_ == 0) return 0;
+  percentile = std::max(0.0, std::min(percentile, 100.0));
+  int64_t wanted = std::max<int64_t>(
+      1, int64_t(std::ceil(percentile / 100 * double(count_))));
+  int64_t seen = 0;
+  for (size_t i = 0; i < counts_.size(); i++) {
+    seen += counts_[i];
+    if (seen >= wanted) {
+      return std::min(HighestEquivalentValue(int(i)), max_);
+    }
+  }
+  return max_;
+}
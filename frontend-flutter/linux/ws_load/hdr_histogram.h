@@ -0,0 +1,46 @@
+#ifndef WS_LOAD_HDR_HISTOGRAM_H_
+#define WS_LOAD_HDR_HISTOGRAM_H_
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * High dynamic range histogram: records integer values from 1 to
+ * |highest| in constant time and memory, keeping |significant_digits|
+ * decimal digits of precision across the whole range, so a p99.99 of
+ * seconds is as exact as a p50 of microseconds. Values above |highest|
+ * are clamped to it and counted as saturated. Not thread-safe.
+ */
+class HdrHistogram {
+ public:
+  HdrHistogram(int64_t highest, int significant_digits);
+
+  void Record(int64_t value);
+
+  int64_t count() const { return count_; }
+  int64_t saturated() const { return saturated_; }
+  int64_t min() const { return count_ ? min_ : 0; }
+  int64_t max() const { return max_; }
+  double mean() const;
+
+  // Smallest recorded value such that |percentile| percent of all values
+  // are at or below it, to the histogram's precision.
+  int64_t ValueAtPercentile(double percentile) const;
+
+ private:
+  int CountsIndex(int64_t value) const;
+  int64_t HighestEquivalentValue(int index) const;
+
+  const int64_t highest_;
+  int sub_bucket_half_count_magnitude_ = 0;
+  int64_t sub_bucket_half_count_ = 0;
+  int64_t sub_bucket_mask_ = 0;
+  std::vector<int64_t> counts_;
+  int64_t count_ = 0;
+  int64_t saturated_ = 0;
+  int64_t min_ = INT64_MAX;
+  int64_t max_ = 0;
+  double total_ = 0;
+};
+
+#endif  // WS_LOAD_HDR_HISTOGRAM_H_
@@ -0,0 +1,571 @@
+#include "load_generator.h"
+
+#include <errno.h>
+#include <json/json.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <openssl/rand.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include "photo_batch.h"
+#include "photo_uploader.h"
+
+namespace {
+
+const int kMaxEvents = 512;
+const int kReadBufferBytes = 64 * 1024;
+const int kPollMillis = 50;
+// Lets the server finish setting up the last sockets before its memory is
+// read.
+const int64_t kSettleUs = 1000000;
+// Decoding every message of every socket would slow delivery down; one
+// socket in this many is enough to measure it.
+const uint32_t kDecodeSampleEvery = 16;
+
+int64_t NowNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// Resident set of |pid| (0 for this process) in bytes, or -1.
+int64_t ResidentBytes(int pid) {
+  char path[64];
+  if (pid == 0) {
+    snprintf(path, sizeof(path), "/proc/self/status");
+  } else {
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  }
+  FILE* file = fopen(path, "r");
+  if (file == nullptr) return -1;
+  char line[256];
+  long long kib = -1;
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    if (sscanf(line, "VmRSS: %lld kB", &kib) == 1) break;
+  }
+  fclose(file);
+  return kib < 0 ? -1 : int64_t(kib) * 1024;
+}
+
+// Pages the kernel holds in TCP socket buffers, system wide. Against a
+// local backend that covers both ends of every connection.
+int64_t TcpSocketPages() {
+  FILE* file = fopen("/proc/net/sockstat", "r");
+  if (file == nullptr) return -1;
+  char line[256];
+  long long pages = -1;
+  while (fgets(line, sizeof(line), file) != nullptr) {
+    const char* mem = strstr(line, " mem ");
+    if (strncmp(line, "TCP:", 4) == 0 && mem != nullptr) {
+      sscanf(mem, " mem %lld", &pages);
+      break;
+    }
+  }
+  fclose(file);
+  return pages;
+}
+
+int EphemeralPorts() {
+  FILE* file = fopen("/proc/sys/net/ipv4/ip_local_port_range", "r");
+  if (file == nullptr) return -1;
+  int low = 0, high = 0;
+  int read = fscanf(file, "%d %d", &low, &high);
+  fclose(file);
+  return read == 2 ? high - low + 1 : -1;
+}
+
+std::string Millis(int64_t micros) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.2f ms", double(micros) / 1000);
+  return text;
+}
+
+void PrintPercentiles(const char* label, const HdrHistogram& histogram) {
+  printf("%-12s n=%lld  p50 %s  p90 %s  p99 %s  p99.9 %s  max %s\n", label,
+         (long long)histogram.count(),
+         Millis(histogram.ValueAtPercentile(50)).c_str(),
+         Millis(histogram.ValueAtPercentile(90)).c_str(),
+         Millis(histogram.ValueAtPercentile(99)).c_str(),
+         Millis(histogram.ValueAtPercentile(99.9)).c_str(),
+         Millis(histogram.max()).c_str());
+}
+
+std::string PerConnection(int64_t before, int64_t after, int open) {
+  if (before < 0 || after < 0 || open <= 0) return "n/a";
+  char text[32];
+  snprintf(text, sizeof(text), "%.1f KiB",
+           double(after - before) / 1024 / double(open));
+  return text;
+}
+
+}  // namespace
+
+LoadGenerator::LoadGenerator(const LoadOptions& options)
+    : options_(options),
+      round_started_us_(new std::atomic<int64_t>[options.uploads]),
+      round_expected_(new std::atomic<int>[options.uploads]),
+      round_received_(size_t(options.uploads), 0),
+      round_last_us_(size_t(options.uploads), 0) {
+  for (int i = 0; i < options_.uploads; i++) {
+    round_started_us_[i] = 0;
+    round_expected_[i] = 0;
+  }
+  unsigned char tag[4];
+  RAND_bytes(tag, sizeof(tag));
+  char marker[32];
+  snprintf(marker, sizeof(marker), "ws-load-%02x%02x%02x%02x-", tag[0], tag[1],
+           tag[2], tag[3]);
+  marker_ = marker;
+}
+
+LoadGenerator::~LoadGenerator() {
+  for (Client& client : clients_) {
+    if (client.fd >= 0) close(client.fd);
+  }
+  if (epoll_fd_ >= 0) close(epoll_fd_);
+}
+
+bool LoadGenerator::Resolve() {
+  addrinfo hints = {};
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo* result = nullptr;
+  std::string port = std::to_string(options_.port);
+  int error =
+      getaddrinfo(options_.host.c_str(), port.c_str(), &hints, &result);
+  if (error != 0) {
+    fprintf(stderr, "Cannot resolve %s: %s\n", options_.host.c_str(),
+            gai_strerror(error));
+    return false;
+  }
+  memcpy(&server_, result->ai_addr, result->ai_addrlen);
+  server_length_ = result->ai_addrlen;
+  freeaddrinfo(result);
+
+  for (const std::string& source : options_.source_addresses) {
+    hints.ai_flags = AI_NUMERICHOST;
+    hints.ai_family = server_.ss_family;
+    if (getaddrinfo(source.c_str(), nullptr, &hints, &result) != 0) {
+      fprintf(stderr, "Bad source address %s\n", source.c_str());
+      return false;
+    }
+    sockaddr_storage address = {};
+    memcpy(&address, result->ai_addr, result->ai_addrlen);
+    sources_.push_back(address);
+    freeaddrinfo(result);
+  }
+  return true;
+}
+
+int LoadGenerator::RaiseFileLimit() {
+  rlimit limit;
+  if (getrlimit(RLIMIT_NOFILE, &limit) != 0) return options_.connections;
+  limit.rlim_cur = limit.rlim_max;
+  setrlimit(RLIMIT_NOFILE, &limit);
+  getrlimit(RLIMIT_NOFILE, &limit);
+  // Leave room for the epoll fd, curl and stdio.
+  int usable = limit.rlim_cur > rlim_t(INT_MAX)
+                   ? INT_MAX
+                   : std::max(0, int(limit.rlim_cur) - 64);
+  if (options_.connections > usable) {
+    fprintf(stderr,
+            "Only %d descriptors available; raise the hard limit "
+            "(ulimit -Hn) for more connections\n",
+            usable);
+  }
+  return std::min(options_.connections, usable);
+}
+
+int64_t LoadGenerator::ServerResidentBytes() {
+  int64_t total = 0;
+  for (int pid : options_.server_pids) {
+    int64_t bytes = ResidentBytes(pid);
+    if (bytes < 0) return -1;
+    total += bytes;
+  }
+  return total;
+}
+
+bool LoadGenerator::StartConnect(uint32_t index) {
+  Client& client = clients_[index];
+  client.started_us = NowMicros();
+  int fd = socket(server_.ss_family,
+                  SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) {
+    if (first_error_.empty()) first_error_ = strerror(errno);
+    connect_failures_++;
+    return false;
+  }
+  if (!sources_.empty()) {
+    const sockaddr_storage& source = sources_[index % sources_.size()];
+#ifdef IP_BIND_ADDRESS_NO_PORT
+    // Let connect() pick the port per destination, so every source address
+    // gets the whole ephemeral range.
+    int one = 1;
+    setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &one, sizeof(one));
+#endif
+    socklen_t length = source.ss_family == AF_INET6 ? sizeof(sockaddr_in6)
+                                                    : sizeof(sockaddr_in);
+    if (bind(fd, reinterpret_cast<const sockaddr*>(&source), length) != 0) {
+      if (first_error_.empty()) first_error_ = strerror(errno);
+      close(fd);
+      connect_failures_++;
+      return false;
+    }
+  }
+  if (connect(fd, reinterpret_cast<const sockaddr*>(&server_),
+              server_length_) != 0 &&
+      errno != EINPROGRESS) {
+    if (first_error_.empty()) first_error_ = strerror(errno);
+    close(fd);
+    connect_failures_++;
+    return false;
+  }
+  epoll_event event = {};
+  event.events = EPOLLOUT;
+  event.data.u32 = index;
+  epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event);
+  client.fd = fd;
+  connecting_++;
+  return true;
+}
+
+void LoadGenerator::Close(uint32_t index) {
+  Client& client = clients_[index];
+  if (client.fd < 0) return;
+  // Closing removes it from the epoll set.
+  close(client.fd);
+  client.fd = -1;
+}
+
+void LoadGenerator::OnEvent(uint32_t index, uint32_t events) {
+  Client& client = clients_[index];
+  if (client.fd < 0) return;
+
+  if (events & EPOLLOUT) {
+    // The connect finished, one way or the other.
+    int error = 0;
+    socklen_t length = sizeof(error);
+    getsockopt(client.fd, SOL_SOCKET, SO_ERROR, &error, &length);
+    std::string host = options_.host + ":" + std::to_string(options_.port);
+    std::string request = client.ws.UpgradeRequest(
+        host, options_.ws_path,
+        options_.batched ? kPhotoBatchProtocol : nullptr);
+    if (error == 0 &&
+        send(client.fd, request.data(), request.size(), MSG_NOSIGNAL) ==
+            ssize_t(request.size())) {
+      epoll_event event = {};
+      event.events = EPOLLIN;
+      event.data.u32 = index;
+      epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, client.fd, &event);
+      return;
+    }
+    if (first_error_.empty()) first_error_ = strerror(error ? error : errno);
+    connect_failures_++;
+    connecting_--;
+    Close(index);
+    return;
+  }
+
+  static char buffer[kReadBufferBytes];
+  ssize_t read = recv(client.fd, buffer, sizeof(buffer), 0);
+  if (read < 0 && (errno == EAGAIN || errno == EINTR)) return;
+
+  bool was_open = client.ws.state() == WsConnection::State::kOpen;
+  bool ok = false;
+  std::string reply;
+  if (read > 0) {
+    current_ = index;
+    ok = client.ws.Feed(buffer, size_t(read), this, &reply);
+    if (!reply.empty()) {
+      send(client.fd, reply.data(), reply.size(), MSG_NOSIGNAL);
+    }
+  }
+  bool is_open = client.ws.state() == WsConnection::State::kOpen;
+  if (!was_open && (is_open || !ok)) {
+    // The upgrade was answered, or the socket went away before it was.
+    connecting_--;
+    if (is_open) {
+      open_++;
+      if (client.ws.protocol_accepted()) batched_sockets_++;
+      handshake_us_.Record(NowMicros() - client.started_us);
+    }
+  }
+  if (ok) return;
+  if (was_open || is_open) {
+    open_--;
+    disconnects_++;
+  } else {
+    upgrade_failures_++;
+  }
+  Close(index);
+}
+
+void LoadGenerator::OnMessage(const char* data, size_t size, bool binary) {
+  wire_messages_++;
+  wire_bytes_ += int64_t(size);
+  if (current_ % kDecodeSampleEvery == 0) TimeDecode(data, size, binary);
+  if (!binary) {
+    static const char kType[] = "\"photo_update\"";
+    if (memmem(data, size, kType, sizeof(kType) - 1) != nullptr) {
+      wire_updates_++;
+    }
+    Deliver(data, size);
+    return;
+  }
+  PhotoBatchReader reader(data, size);
+  PhotoUpdateView update;
+  while (reader.Next(&update)) {
+    wire_updates_++;
+    Deliver(update.original_file_name.data, update.original_file_name.size);
+  }
+}
+
+void LoadGenerator::TimeDecode(const char* data, size_t size, bool binary) {
+  int64_t start = NowNanos();
+  size_t updates = 0;
+  if (binary) {
+    PhotoBatchReader reader(data, size);
+    PhotoUpdateView update;
+    while (reader.Next(&update)) updates++;
+  } else {
+    static std::unique_ptr<Json::CharReader> json(
+        Json::CharReaderBuilder().newCharReader());
+    Json::Value message;
+    if (json->parse(data, data + size, &message, nullptr) &&
+        message.get("type", "").asString() == "photo_update") {
+      updates = 1;
+    }
+  }
+  if (updates == 0) return;
+  decode_ns_.Record((NowNanos() - start) / int64_t(updates));
+}
+
+void LoadGenerator::Deliver(const char* data, size_t size) {
+  const char* found = static_cast<const char*>(
+      memmem(data, size, marker_.data(), marker_.size()));
+  if (found == nullptr) return;
+  int round = 0;
+  const char* digit = found + marker_.size();
+  const char* end = data + size;
+  if (digit == end || *digit < '0' || *digit > '9') return;
+  for (; digit < end && *digit >= '0' && *digit <= '9'; digit++) {
+    round = round * 10 + (*digit - '0');
+    if (round >= options_.uploads) return;
+  }
+  int64_t started_us = round_started_us_[round];
+  if (started_us == 0) return;
+
+  Client& client = clients_[current_];
+  if (round <= client.last_round) {
+    late_or_duplicate_++;
+    return;
+  }
+  client.last_round = round;
+  int64_t now_us = NowMicros();
+  delivery_us_.Record(now_us - started_us);
+  round_received_[size_t(round)]++;
+  round_last_us_[size_t(round)] = now_us;
+}
+
+void LoadGenerator::Loop(int64_t deadline_us, bool (LoadGenerator::*done)()) {
+  epoll_event events[kMaxEvents];
+  while (done == nullptr || !(this->*done)()) {
+    int64_t now_us = NowMicros();
+    if (now_us >= deadline_us) return;
+    while (connecting_ < options_.connect_concurrency &&
+           next_connect_ < clients_.size()) {
+      StartConnect(next_connect_++);
+    }
+    int timeout = int(
+        std::min<int64_t>(kPollMillis, (deadline_us - now_us + 999) / 1000));
+    int count = epoll_wait(epoll_fd_, events, kMaxEvents, timeout);
+    for (int i = 0; i < count; i++) {
+      OnEvent(events[i].data.u32, events[i].events);
+    }
+  }
+}
+
+bool LoadGenerator::RampDone() {
+  return next_connect_ == clients_.size() && connecting_ == 0;
+}
+
+bool LoadGenerator::UploadsDone() { return uploads_done_; }
+
+bool LoadGenerator::DeliveryDone() {
+  for (int i = 0; i < options_.uploads; i++) {
+    if (round_received_[size_t(i)] < round_expected_[i]) return false;
+  }
+  return true;
+}
+
+void LoadGenerator::Upload() {
+  std::string host = options_.host.find(':') != std::string::npos
+                         ? "[" + options_.host + "]"
+                         : options_.host;
+  std::string url =
+      "http://" + host + ":" + std::to_string(options_.port) +
+      (options_.stream ? options_.stream_path : options_.upload_path);
+  bool tiny = options_.image.empty();
+  PhotoUploader uploader(
+      url,
+      tiny ? std::string(reinterpret_cast<const char*>(kTinyPng), kTinyPngSize)
+           : options_.image,
+      tiny ? "image/png" : options_.image_type, options_.stream);
+  std::string extension =
+      tiny || options_.image_type == "image/png" ? ".png" : ".jpg";
+
+  int64_t next_us = NowMicros();
+  for (int round = 0; round < options_.uploads; round++) {
+    int64_t wait_us = next_us - NowMicros();
+    if (wait_us > 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+    }
+    next_us += options_.upload_interval_us;
+
+    round_expected_[round] = open_.load();
+    int64_t started_us = NowMicros();
+    round_started_us_[round] = started_us;
+    std::string error;
+    long status = uploader.Upload(marker_ + std::to_string(round) + extension,
+                                  &error);
+    upload_us_.Record(NowMicros() - started_us);
+    if (status != 201) {
+      // Nothing was announced, so nothing can be missing.
+      round_expected_[round] = 0;
+      uploads_failed_++;
+      if (upload_error_.empty()) {
+        upload_error_ = status ? "HTTP " + std::to_string(status) : error;
+      }
+    }
+  }
+  uploads_done_ = true;
+}
+
+int LoadGenerator::Run() {
+  if (!Resolve()) return 2;
+  int connections = RaiseFileLimit();
+  int ports = EphemeralPorts();
+  size_t sources = std::max<size_t>(1, sources_.size());
+  if (ports > 0 && size_t(connections) > size_t(ports) * sources) {
+    fprintf(stderr,
+            "%d connections need more than the %d ephemeral ports of one "
+            "source address; add --source addresses\n",
+            connections, ports);
+  }
+  epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+
+  // Before the client table, which is part of what a connection costs.
+  client_rss_before_ = ResidentBytes(0);
+  server_rss_before_ = ServerResidentBytes();
+  socket_pages_before_ = TcpSocketPages();
+  clients_.resize(size_t(connections));
+
+  fprintf(stderr, "Opening %d connections...\n", connections);
+  int64_t ramp_start_us = NowMicros();
+  Loop(INT64_MAX, &LoadGenerator::RampDone);
+  ramp_us_ = NowMicros() - ramp_start_us;
+  Loop(NowMicros() + kSettleUs, nullptr);
+
+  client_rss_after_ = ResidentBytes(0);
+  server_rss_after_ = ServerResidentBytes();
+  socket_pages_after_ = TcpSocketPages();
+
+  fprintf(stderr, "%d open; uploading %d photos...\n", open_.load(),
+          options_.uploads);
+  std::thread uploader(&LoadGenerator::Upload, this);
+  Loop(INT64_MAX, &LoadGenerator::UploadsDone);
+  Loop(NowMicros() + options_.delivery_timeout_us,
+       &LoadGenerator::DeliveryDone);
+  uploader.join();
+
+  Report();
+  return open_ > 0 && uploads_failed_ < options_.uploads ? 0 : 1;
+}
+
+void LoadGenerator::Report() {
+  int open = open_.load();
+  int attempted = int(clients_.size());
+  printf("connections  %d of %d open, %d connect and %d upgrade failures, "
+         "%d disconnects\n",
+         open, attempted, connect_failures_, upgrade_failures_, disconnects_);
+  if (!first_error_.empty()) {
+    printf("             first error: %s\n", first_error_.c_str());
+  }
+  int upgraded = attempted - connect_failures_ - upgrade_failures_;
+  printf("connect rate %.0f/s (%s to ramp up)\n",
+         ramp_us_ > 0 ? double(upgraded) * 1e6 / double(ramp_us_) : 0,
+         Millis(ramp_us_).c_str());
+  PrintPercentiles("handshake", handshake_us_);
+
+  long page = sysconf(_SC_PAGESIZE);
+  printf("memory/conn  client %s, server %s, kernel TCP (both ends) %s\n",
+         PerConnection(client_rss_before_, client_rss_after_, open).c_str(),
+         options_.server_pids.empty()
+             ? "n/a (pass --server-pid)"
+             : PerConnection(server_rss_before_, server_rss_after_, open)
+                   .c_str(),
+         PerConnection(socket_pages_before_ * page,
+                       socket_pages_after_ * page, open)
+             .c_str());
+
+  printf("uploads      %d sent, %d failed\n", options_.uploads,
+         uploads_failed_.load());
+  if (!upload_error_.empty()) {
+    printf("             first error: %s\n", upload_error_.c_str());
+  }
+  PrintPercentiles("upload", upload_us_);
+
+  int64_t expected = 0;
+  int64_t received = 0;
+  int64_t dropped = 0;
+  HdrHistogram fan_out_us(600000000, 3);
+  for (int i = 0; i < options_.uploads; i++) {
+    expected += round_expected_[i];
+    received += round_received_[size_t(i)];
+    dropped += std::max(0, round_expected_[i] - round_received_[size_t(i)]);
+    if (round_received_[size_t(i)] > 0) {
+      fan_out_us.Record(round_last_us_[size_t(i)] - round_started_us_[i]);
+    }
+  }
+  printf("deliveries   %lld of %lld, %lld dropped, %lld late or duplicate\n",
+         (long long)received, (long long)expected, (long long)dropped,
+         (long long)late_or_duplicate_);
+  // Per client and update: upload sent to photo_update read.
+  PrintPercentiles("latency", delivery_us_);
+  // Per upload: until the last client had it.
+  PrintPercentiles("fan-out", fan_out_us);
+
+  printf("wire         %s on %lld of %d sockets: %lld messages, %lld "
+         "updates, %.0f bytes and %.2f messages per update\n",
+         batched_sockets_ > 0 ? "photo-batch" : "JSON",
+         (long long)(batched_sockets_ > 0 ? batched_sockets_ : open), open,
+         (long long)wire_messages_, (long long)wire_updates_,
+         wire_updates_ > 0 ? double(wire_bytes_) / double(wire_updates_) : 0,
+         wire_updates_ > 0
+             ? double(wire_messages_) / double(wire_updates_)
+             : 0);
+  // Sampled on one socket in kDecodeSampleEvery.
+  printf("decode       n=%lld  p50 %.2f us  p99 %.2f us  max %.2f us per "
+         "update\n",
+         (long long)decode_ns_.count(),
+         double(decode_ns_.ValueAtPercentile(50)) / 1000,
+         double(decode_ns_.ValueAtPercentile(99)) / 1000,
+         double(decode_ns_.max()) / 1000);
+}
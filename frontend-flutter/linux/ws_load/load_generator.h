@@ -0,0 +1,133 @@
+#ifndef WS_LOAD_LOAD_GENERATOR_H_
+#define WS_LOAD_LOAD_GENERATOR_H_
+
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "hdr_histogram.h"
+#include "ws_connection.h"
+
+struct LoadOptions {
+  std::string host = "127.0.0.1";
+  int port = 8000;
+  std::string ws_path = "/ws/photo/";
+  std::string upload_path = "/api/photo/";
+  std::string stream_path = "/api/photo/stream/";
+  int connections = 10000;
+  // Connects and upgrades in flight at once while ramping up.
+  int connect_concurrency = 256;
+  // Local addresses to connect from, round robin; each gives another
+  // ~28k ephemeral ports towards the server.
+  std::vector<std::string> source_addresses;
+  int uploads = 20;
+  int64_t upload_interval_us = 1000000;
+  // How long after the last upload stragglers may still arrive.
+  int64_t delivery_timeout_us = 10000000;
+  // Offers the photo-batch subprotocol; the server then sends updates as
+  // binary batches instead of one JSON message each.
+  bool batched = false;
+  // Uploads the raw photo to |stream_path| instead of a multipart form to
+  // |upload_path|.
+  bool stream = false;
+  // With > 0, skips the WebSockets and benchmarks this many concurrent
+  // uploads to each endpoint instead; see UploadBench.
+  int upload_concurrency = 0;
+  std::string image;  // Empty for the built-in 1x1 PNG.
+  std::string image_type;
+  // Backend processes whose memory is sampled around the ramp up.
+  std::vector<int> server_pids;
+};
+
+/**
+ * Opens |connections| WebSockets to the backend from a single epoll loop,
+ * then uploads a photo every |upload_interval_us| from a second thread and
+ * times, for every socket, how long the resulting photo_update took to
+ * arrive. Uploads run open loop on a fixed schedule, so a slow fan-out
+ * shows up as latency instead of quietly slowing the test down.
+ */
+class LoadGenerator : private WsConnection::Sink {
+ public:
+  explicit LoadGenerator(const LoadOptions& options);
+  ~LoadGenerator() override;
+
+  // Runs the whole test and prints the report. Returns the exit status.
+  int Run();
+
+ private:
+  struct Client {
+    int fd = -1;
+    int32_t last_round = -1;
+    int64_t started_us = 0;
+    WsConnection ws;
+  };
+
+  bool Resolve();
+  int RaiseFileLimit();
+  int64_t ServerResidentBytes();
+  bool StartConnect(uint32_t index);
+  void OnEvent(uint32_t index, uint32_t events);
+  void Close(uint32_t index);
+  void Loop(int64_t deadline_us, bool (LoadGenerator::*done)());
+  bool RampDone();
+  bool UploadsDone();
+  bool DeliveryDone();
+  void Upload();
+  void OnMessage(const char* data, size_t size, bool binary) override;
+  // Counts the photo whose name is somewhere in |data|, if it is one of
+  // this run's.
+  void Deliver(const char* data, size_t size);
+  // Decodes |data| the way the app would and records the cost per update.
+  void TimeDecode(const char* data, size_t size, bool binary);
+  void Report();
+
+  const LoadOptions options_;
+  std::string marker_;  // Prefix of this run's upload names.
+  int epoll_fd_ = -1;
+  sockaddr_storage server_{};
+  socklen_t server_length_ = 0;
+  std::vector<sockaddr_storage> sources_;
+  std::vector<Client> clients_;
+  uint32_t current_ = 0;  // Client whose bytes OnMessage is looking at.
+  uint32_t next_connect_ = 0;
+  int connecting_ = 0;
+  std::atomic<int> open_{0};
+
+  int connect_failures_ = 0;
+  int upgrade_failures_ = 0;
+  int disconnects_ = 0;
+  std::string first_error_;
+  int64_t ramp_us_ = 0;
+  HdrHistogram handshake_us_{60000000, 3};
+
+  // Per upload round, written by the upload thread before the request
+  // goes out, so the update can never arrive ahead of them.
+  std::unique_ptr<std::atomic<int64_t>[]> round_started_us_;
+  std::unique_ptr<std::atomic<int>[]> round_expected_;
+  std::vector<int> round_received_;
+  std::vector<int64_t> round_last_us_;
+  std::atomic<bool> uploads_done_{false};
+  std::atomic<int> uploads_failed_{0};
+  HdrHistogram upload_us_{60000000, 3};
+  HdrHistogram delivery_us_{600000000, 3};
+  int64_t late_or_duplicate_ = 0;
+  int64_t batched_sockets_ = 0;  // That took the photo-batch offer.
+  int64_t wire_messages_ = 0;
+  int64_t wire_updates_ = 0;
+  int64_t wire_bytes_ = 0;  // Message payloads, without frame headers.
+  HdrHistogram decode_ns_{1000000000, 3};  // Per update, sampled.
+  std::string upload_error_;  // Written by the upload thread only.
+
+  int64_t client_rss_before_ = 0;
+  int64_t client_rss_after_ = 0;
+  int64_t server_rss_before_ = 0;
+  int64_t server_rss_after_ = 0;
+  int64_t socket_pages_before_ = 0;
+  int64_t socket_pages_after_ = 0;
+};
+
+#endif  // WS_LOAD_LOAD_GENERATOR_H_
@@ -0,0 +1,139 @@
+#include <curl/curl.h>
+#include <getopt.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "load_generator.h"
+#include "upload_bench.h"
+
+namespace {
+
+void Usage(const char* program) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "Opens WebSocket subscribers against a local backend, uploads\n"
+          "photos and reports how long each subscriber took to hear of them.\n"
+          "\n"
+          "  --host HOST             backend host (127.0.0.1)\n"
+          "  --port PORT             backend port (8000)\n"
+          "  --connections N         WebSockets to open (10000)\n"
+          "  --concurrency N         connects in flight while ramping (256)\n"
+          "  --source ADDR           local address to connect from; repeat\n"
+          "                          for more than ~28k connections\n"
+          "  --uploads N             photos to upload (20)\n"
+          "  --interval-ms MS        time between uploads (1000)\n"
+          "  --timeout-ms MS         wait for stragglers after the last\n"
+          "                          upload (10000)\n"
+          "  --image FILE            photo to upload (a built-in 1x1 PNG)\n"
+          "  --batched               ask for photo-batch frames instead of\n"
+          "                          JSON\n"
+          "  --stream                upload the raw photo to the streaming\n"
+          "                          endpoint instead of a multipart form\n"
+          "  --upload-bench N        no WebSockets: time --uploads uploads,\n"
+          "                          N at a time, to both endpoints\n"
+          "  --server-pid PID        backend process to sample memory of;\n"
+          "                          repeat for every worker\n",
+          program);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  static const option kOptions[] = {
+      {"host", required_argument, nullptr, 'h'},
+      {"port", required_argument, nullptr, 'p'},
+      {"connections", required_argument, nullptr, 'c'},
+      {"concurrency", required_argument, nullptr, 'C'},
+      {"source", required_argument, nullptr, 's'},
+      {"uploads", required_argument, nullptr, 'u'},
+      {"interval-ms", required_argument, nullptr, 'i'},
+      {"timeout-ms", required_argument, nullptr, 't'},
+      {"image", required_argument, nullptr, 'f'},
+      {"batched", no_argument, nullptr, 'b'},
+      {"stream", no_argument, nullptr, 'S'},
+      {"upload-bench", required_argument, nullptr, 'B'},
+      {"server-pid", required_argument, nullptr, 'P'},
+      {"help", no_argument, nullptr, '?'},
+      {nullptr, 0, nullptr, 0},
+  };
+
+  LoadOptions options;
+  int option;
+  while ((option = getopt_long(argc, argv, "", kOptions, nullptr)) != -1) {
+    switch (option) {
+      case 'h':
+        options.host = optarg;
+        break;
+      case 'p':
+        options.port = atoi(optarg);
+        break;
+      case 'c':
+        options.connections = atoi(optarg);
+        break;
+      case 'C':
+        options.connect_concurrency = atoi(optarg);
+        break;
+      case 's':
+        options.source_addresses.push_back(optarg);
+        break;
+      case 'u':
+        options.uploads = atoi(optarg);
+        break;
+      case 'i':
+        options.upload_interval_us = int64_t(atoll(optarg)) * 1000;
+        break;
+      case 't':
+        options.delivery_timeout_us = int64_t(atoll(optarg)) * 1000;
+        break;
+      case 'f': {
+        std::ifstream file(optarg, std::ios::binary);
+        if (!file) {
+          fprintf(stderr, "Cannot read %s\n", optarg);
+          return 2;
+        }
+        std::ostringstream bytes;
+        bytes << file.rdbuf();
+        options.image = bytes.str();
+        std::string name = optarg;
+        bool png = name.size() > 4 &&
+                   name.compare(name.size() - 4, 4, ".png") == 0;
+        options.image_type = png ? "image/png" : "image/jpeg";
+        break;
+      }
+      case 'b':
+        options.batched = true;
+        break;
+      case 'S':
+        options.stream = true;
+        break;
+      case 'B':
+        options.upload_concurrency = atoi(optarg);
+        if (options.upload_concurrency <= 0) {
+          Usage(argv[0]);
+          return 2;
+        }
+        break;
+      case 'P':
+        options.server_pids.push_back(atoi(optarg));
+        break;
+      default:
+        Usage(argv[0]);
+        return 2;
+    }
+  }
+  if (options.connections <= 0 || options.connect_concurrency <= 0 ||
+      options.uploads < 0 || options.port <= 0) {
+    Usage(argv[0]);
+    return 2;
+  }
+
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+  int status = options.upload_concurrency > 0 ? UploadBench(options).Run()
+                                              : LoadGenerator(options).Run();
+  curl_global_cleanup();
+  return status;
+}
@@ -0,0 +1,42 @@
+#ifndef WS_LOAD_PHOTO_UPLOADER_H_
+#define WS_LOAD_PHOTO_UPLOADER_H_
+
+#include <curl/curl.h>
+
+#include <string>
+
+/**
+ * Posts photos to the backend's upload endpoint the way the app does, as a
+ * multipart "image" field, or with |stream| as the raw body of the
+ * streaming endpoint, over one kept-alive connection. Not thread-safe;
+ * each thread that uploads needs its own.
+ */
+class PhotoUploader {
+ public:
+  // |image| is the file body sent every time; each upload is named after
+  // the round so the resulting photo_update can be told apart.
+  PhotoUploader(const std::string& url, std::string image,
+                std::string content_type, bool stream = false);
+  ~PhotoUploader();
+
+  PhotoUploader(const PhotoUploader&) = delete;
+  PhotoUploader& operator=(const PhotoUploader&) = delete;
+
+  // Uploads the image as |file_name|. Returns the HTTP status, or 0 when
+  // the request failed, with the reason in |error|.
+  long Upload(const std::string& file_name, std::string* error);
+
+ private:
+  const std::string url_;
+  const std::string image_;
+  const std::string content_type_;
+  const bool stream_;
+  CURL* curl_;
+  curl_slist* headers_ = nullptr;
+};
+
+// A 1x1 PNG, for runs that measure fan-out rather than image processing.
+extern const unsigned char kTinyPng[];
+extern const size_t kTinyPngSize;
+
+#endif  // WS_LOAD_PHOTO_UPLOADER_H_
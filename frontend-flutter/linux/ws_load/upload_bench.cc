@@ -0,0 +1,108 @@
+#include "upload_bench.h"
+
+#include <openssl/rand.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "hdr_histogram.h"
+#include "photo_uploader.h"
+
+namespace {
+
+int64_t NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+double Millis(int64_t micros) { return double(micros) / 1000; }
+
+}  // namespace
+
+UploadBench::UploadBench(const LoadOptions& options) : options_(options) {
+  unsigned char tag[4];
+  RAND_bytes(tag, sizeof(tag));
+  char marker[32];
+  snprintf(marker, sizeof(marker), "ws-bench-%02x%02x%02x%02x-", tag[0],
+           tag[1], tag[2], tag[3]);
+  marker_ = marker;
+}
+
+bool UploadBench::RunEndpoint(const char* label, const std::string& path,
+                              bool stream) {
+  std::string host = options_.host.find(':') != std::string::npos
+                         ? "[" + options_.host + "]"
+                         : options_.host;
+  std::string url =
+      "http://" + host + ":" + std::to_string(options_.port) + path;
+  bool tiny = options_.image.empty();
+  std::string image =
+      tiny ? std::string(reinterpret_cast<const char*>(kTinyPng), kTinyPngSize)
+           : options_.image;
+  std::string type = tiny ? "image/png" : options_.image_type;
+  std::string extension = tiny || type == "image/png" ? ".png" : ".jpg";
+
+  std::atomic<int> next{0};
+  std::mutex mutex;
+  HdrHistogram response_us(600000000, 3);
+  int failed = 0;
+  std::string first_error;
+
+  int64_t started_us = NowMicros();
+  std::vector<std::thread> threads;
+  for (int i = 0; i < options_.upload_concurrency; i++) {
+    threads.emplace_back([&] {
+      PhotoUploader uploader(url, image, type, stream);
+      for (int round = next++; round < options_.uploads; round = next++) {
+        std::string error;
+        int64_t sent_us = NowMicros();
+        long status = uploader.Upload(
+            marker_ + label + "-" + std::to_string(round) + extension, &error);
+        int64_t elapsed_us = NowMicros() - sent_us;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (status == 201) {
+          response_us.Record(elapsed_us);
+        } else {
+          failed++;
+          if (first_error.empty()) {
+            first_error = status ? "HTTP " + std::to_string(status) : error;
+          }
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) thread.join();
+  int64_t wall_us = NowMicros() - started_us;
+
+  int64_t ok = response_us.count();
+  printf("%-10s %lld of %d uploaded in %.2f s: %.1f uploads/s, %.1f MB/s\n",
+         label, (long long)ok, options_.uploads, double(wall_us) / 1e6,
+         double(ok) * 1e6 / double(wall_us),
+         double(ok) * double(image.size()) / double(wall_us));
+  printf("           response p50 %.1f ms  p90 %.1f ms  p99 %.1f ms  "
+         "max %.1f ms\n",
+         Millis(response_us.ValueAtPercentile(50)),
+         Millis(response_us.ValueAtPercentile(90)),
+         Millis(response_us.ValueAtPercentile(99)),
+         Millis(response_us.max()));
+  if (failed > 0) {
+    printf("           %d failed, first: %s\n", failed, first_error.c_str());
+  }
+  return ok > 0;
+}
+
+int UploadBench::Run() {
+  fprintf(stderr, "Uploading %d photos of %zu bytes, %d at a time...\n",
+          options_.uploads,
+          options_.image.empty() ? kTinyPngSize : options_.image.size(),
+          options_.upload_concurrency);
+  bool multipart =
+      RunEndpoint("multipart", options_.upload_path, /*stream=*/false);
+  bool stream = RunEndpoint("stream", options_.stream_path, /*stream=*/true);
+  return multipart && stream ? 0 : 1;
+}
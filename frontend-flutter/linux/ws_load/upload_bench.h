@@ -0,0 +1,29 @@
+#ifndef WS_LOAD_UPLOAD_BENCH_H_
+#define WS_LOAD_UPLOAD_BENCH_H_
+
+#include <string>
+
+#include "load_generator.h"
+
+/**
+ * Uploads |uploads| copies of the image to the multipart endpoint and then
+ * to the streaming one, |upload_concurrency| at a time, closed loop, and
+ * reports the throughput and response times of each. Without WebSockets,
+ * so the numbers are the upload path's alone.
+ */
+class UploadBench {
+ public:
+  explicit UploadBench(const LoadOptions& options);
+
+  // Runs both endpoints and prints the report. Returns the exit status.
+  int Run();
+
+ private:
+  // Returns false when every upload to |path| failed.
+  bool RunEndpoint(const char* label, const std::string& path, bool stream);
+
+  const LoadOptions options_;
+  std::string marker_;  // Prefix of this run's upload names.
+};
+
+#endif  // WS_LOAD_UPLOAD_BENCH_H_